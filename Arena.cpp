@@ -0,0 +1,79 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include "Arena.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+// a string longer than this part of a chunk gets a chunk of its own, so that
+// the rest of the current chunk is not wasted
+#define DEDICATED_CHUNK_FRACTION 4
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+StringArena::StringArena(size_t chunk_size)
+        :chunk_size(chunk_size),
+         next(nullptr),
+         available(0),
+         used(0),
+         reserved(0)
+{
+}
+
+/**
+ * Destructor. Frees all the chunks.
+ */
+StringArena::~StringArena()
+{
+    for (auto const& chunk: chunks)
+    {
+        delete[] chunk;
+    }
+}
+
+/**
+ * Space for length characters.
+ */
+char* StringArena::allocate(size_t length)
+{
+    used += length;
+
+    if (length > available)
+    {
+        if (length > chunk_size / DEDICATED_CHUNK_FRACTION)
+        {
+            char* chunk = new char[length];
+            chunks.push_back(chunk);
+            reserved += length;
+            return chunk;
+        }
+
+        next = new char[chunk_size];
+        available = chunk_size;
+        chunks.push_back(next);
+        reserved += chunk_size;
+    }
+
+    char* space = next;
+    next += length;
+    available -= length;
+    return space;
+}
+
+/**
+ * The bytes handed out.
+ */
+size_t StringArena::get_used() const
+{
+    return used;
+}
+
+/**
+ * The bytes of the chunks.
+ */
+size_t StringArena::get_reserved() const
+{
+    return reserved;
+}
@@ -0,0 +1,142 @@
+#ifndef EX5_ARENA_H
+#define EX5_ARENA_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * Allocates objects of a single type from slabs of slab_size objects, so that
+ * objects allocated one after the other lie next to each other. A released
+ * object's slot is reused by the next allocation. Slabs are only freed, all at
+ * once, with the pool. Not thread safe: the owner of the pool guards it.
+ */
+template <typename T>
+class ObjectPool
+{
+public:
+    ObjectPool(size_t slab_size)
+            :slab_size(slab_size),
+             free_slots(nullptr),
+             slab_used(slab_size),
+             live(0)
+    {
+    }
+
+    /**
+     * Destructor. Frees the slabs; objects which were not released are not
+     * destroyed.
+     */
+    ~ObjectPool()
+    {
+        for (auto const& slab: slabs)
+        {
+            delete[] slab;
+        }
+    }
+
+    /**
+     * A default constructed object.
+     */
+    T* allocate()
+    {
+        Slot* slot = free_slots;
+        if (slot != nullptr)
+        {
+            free_slots = slot->next;
+        }
+        else
+        {
+            if (slab_used == slab_size)
+            {
+                slabs.push_back(new Slot[slab_size]);
+                slab_used = 0;
+            }
+            slot = &slabs.back()[slab_used++];
+        }
+
+        live++;
+        return new (&slot->storage) T();
+    }
+
+    /**
+     * Destroy an object of the pool, and keep its slot for reuse.
+     */
+    void release(T* object)
+    {
+        object->~T();
+
+        Slot* slot = reinterpret_cast<Slot*>(object);
+        slot->next = free_slots;
+        free_slots = slot;
+        live--;
+    }
+
+    /**
+     * The number of objects allocated and not released.
+     */
+    size_t get_live() const
+    {
+        return live;
+    }
+
+private:
+    // holds an object, or links to the next free slot
+    union Slot
+    {
+        Slot* next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    std::vector<Slot*> slabs;
+    size_t slab_size;
+    Slot* free_slots;
+    // slots of the last slab which were handed out
+    size_t slab_used;
+    size_t live;
+};
+
+/**
+ * Hands out space for strings which live as long as the arena, by bumping a
+ * pointer through large chunks. Nothing is freed before the arena is. Not
+ * thread safe: the owner of the arena guards it.
+ */
+class StringArena
+{
+public:
+    StringArena(size_t chunk_size);
+
+    /**
+     * Destructor. Frees all the chunks.
+     */
+    ~StringArena();
+
+    /**
+     * Space for length characters.
+     */
+    char* allocate(size_t length);
+
+    /**
+     * The bytes handed out, and the bytes of the chunks.
+     */
+    size_t get_used() const;
+    size_t get_reserved() const;
+
+private:
+    std::vector<char*> chunks;
+    size_t chunk_size;
+    // the free space of the current chunk
+    char* next;
+    size_t available;
+    size_t used;
+    size_t reserved;
+};
+
+#endif //EX5_ARENA_H
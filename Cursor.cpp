@@ -0,0 +1,116 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include "Cursor.h"
+#include "WriteAheadLog.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+// kind (1) | event id (4) | date key (4) | name | CRC-32 of the rest (4),
+// integers in little endian
+#define UINT32_SIZE 4
+#define CURSOR_FIELDS_SIZE (1 + 2 * UINT32_SIZE)
+#define CURSOR_CRC_SIZE UINT32_SIZE
+#define BYTE_BITS 8
+#define BYTE_MASK 0xFF
+#define NIBBLE_BITS 4
+#define NIBBLE_MASK 0xF
+#define HEX_DIGITS "0123456789abcdef"
+
+static void put_uint32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < UINT32_SIZE; i++)
+    {
+        out += (char) ((value >> (i * BYTE_BITS)) & BYTE_MASK);
+    }
+}
+
+static uint32_t get_uint32(const std::string& in, size_t position)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < UINT32_SIZE; i++)
+    {
+        value |= (uint32_t) (uint8_t) in[position + i] << (i * BYTE_BITS);
+    }
+    return value;
+}
+
+static int hex_value(char digit)
+{
+    if (digit >= '0' && digit <= '9')
+    {
+        return digit - '0';
+    }
+    if (digit >= 'a' && digit <= 'f')
+    {
+        return digit - 'a' + 10;
+    }
+    return -1;
+}
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+/**
+ * The continuation token of a cursor: its fields and their CRC-32, in hex.
+ */
+std::string encode_cursor(const Cursor& cursor)
+{
+    std::string bytes;
+    bytes += (char) cursor.kind;
+    put_uint32(bytes, (uint32_t) cursor.event_id);
+    put_uint32(bytes, cursor.date_key);
+    bytes += cursor.name;
+    put_uint32(bytes, crc32(bytes.data(), bytes.length()));
+
+    std::string token;
+    token.reserve(bytes.length() * 2);
+    for (auto const& byte: bytes)
+    {
+        token += HEX_DIGITS[((uint8_t) byte >> NIBBLE_BITS) & NIBBLE_MASK];
+        token += HEX_DIGITS[(uint8_t) byte & NIBBLE_MASK];
+    }
+    return token;
+}
+
+/**
+ * Parse a continuation token. Returns false if it is not one encode_cursor
+ * made, or its event id is not positive (no event has such an id, and the
+ * listings step from it).
+ */
+bool decode_cursor(const char* token, size_t length, Cursor& cursor)
+{
+    if (length % 2 != 0 ||
+        length < 2 * (CURSOR_FIELDS_SIZE + CURSOR_CRC_SIZE))
+    {
+        return false;
+    }
+
+    std::string bytes;
+    bytes.reserve(length / 2);
+    for (size_t i = 0; i < length; i += 2)
+    {
+        int high = hex_value(token[i]);
+        int low = hex_value(token[i + 1]);
+        if (high < 0 || low < 0)
+        {
+            return false;
+        }
+        bytes += (char) ((high << NIBBLE_BITS) | low);
+    }
+
+    size_t crc_position = bytes.length() - CURSOR_CRC_SIZE;
+    if (crc32(bytes.data(), crc_position) != get_uint32(bytes, crc_position))
+    {
+        return false;
+    }
+
+    cursor.kind = (uint8_t) bytes[0];
+    cursor.event_id = (int) get_uint32(bytes, 1);
+    cursor.date_key = get_uint32(bytes, 1 + UINT32_SIZE);
+    cursor.name.assign(bytes, CURSOR_FIELDS_SIZE,
+                       crc_position - CURSOR_FIELDS_SIZE);
+    return cursor.kind >= CURSOR_RSVPS && cursor.kind <= CURSOR_RANGE &&
+           cursor.event_id > 0;
+}
@@ -0,0 +1,55 @@
+#ifndef EX5_CURSOR_H
+#define EX5_CURSOR_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <stdint.h>
+#include <string>
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+// What a cursor pages through.
+typedef enum
+{
+    // the RSVPs of an event, by name
+    CURSOR_RSVPS = 1,
+    // the events, by id from the newest
+    CURSOR_EVENTS,
+    // the events of a range of dates, by date and then by id
+    CURSOR_RANGE
+} CursorKind;
+
+// Where the next page of a listing starts: right after the last item of the
+// previous page. A cursor names that item rather than counting the items
+// before it, so items added or removed meanwhile shift no page.
+typedef struct
+{
+    uint8_t kind;
+    // CURSOR_RSVPS: the event whose RSVPs are listed. CURSOR_EVENTS,
+    // CURSOR_RANGE: the last event listed.
+    int event_id;
+    // CURSOR_RANGE: the date key of the last event listed
+    uint32_t date_key;
+    // CURSOR_RSVPS: the last name listed
+    std::string name;
+} Cursor;
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+/**
+ * The continuation token of a cursor: its fields and their CRC-32, in hex, so
+ * that it is a single word of a request. Clients pass it back as it is.
+ */
+std::string encode_cursor(const Cursor& cursor);
+
+/**
+ * Parse a continuation token. Returns false if it is not one encode_cursor
+ * made (e.g. it was mistyped), or its event id is not positive. A token is not
+ * signed: one which is made up only moves a listing to another position.
+ */
+bool decode_cursor(const char* token, size_t length, Cursor& cursor);
+
+#endif //EX5_CURSOR_H
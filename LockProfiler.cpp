@@ -0,0 +1,418 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <algorithm>
+#include <map>
+#include "LockProfiler.h"
+#include "Metrics.h"
+#include "Utils.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+#define NO_PROFILE -1
+#define UNREGISTERED_PROFILE -2
+#define PERCENT 100.0
+#define PERCENT_SIZE 16
+
+// The waits of the acquisitions of a lock by one call site.
+typedef struct
+{
+    std::atomic<const char*> site;
+    Counter contended;
+    Counter wait_ns;
+} LockSite;
+
+// What one thread recorded of a lock.
+typedef struct
+{
+    Counter acquisitions;
+    // acquisitions which had to wait
+    Counter contended;
+    // the waits of those acquisitions, and how long the lock was held
+    Histogram waits;
+    Histogram holds;
+    LockSite sites[LOCK_SITES];
+    // the waits of the sites past LOCK_SITES
+    LockSite other_sites;
+} LockStats;
+
+// The contended acquisitions and the total wait of call sites, by name.
+typedef std::map<std::string, std::pair<uint64_t, uint64_t>> SiteWaits;
+
+// A lock the calling thread holds, and since when.
+typedef struct
+{
+    const ProfiledLock* lock;
+    int profile;
+    uint64_t acquired_ns;
+} HeldLock;
+
+std::atomic<bool> is_profiling_locks(false);
+
+// the names of the profiles, and the blocks of the threads, each with an entry
+// for every profile; guarded by profiles_mutex
+static pthread_mutex_t profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const char* profile_names[MAX_LOCK_PROFILES];
+static int profiles_num = 0;
+static std::vector<LockStats*> thread_blocks;
+
+// the calling thread's block, and the locks it holds, the last taken last
+static thread_local LockStats* thread_block = nullptr;
+static thread_local HeldLock held_locks[MAX_HELD_LOCKS];
+static thread_local int held_num = 0;
+
+/**
+ * The calling thread's entry of a profile, its block registered on its first
+ * call.
+ */
+static LockStats& get_stats(int profile)
+{
+    if (thread_block == nullptr)
+    {
+        thread_block = new LockStats[MAX_LOCK_PROFILES];
+        for (int i = 0; i < MAX_LOCK_PROFILES; i++)
+        {
+            for (auto& site: thread_block[i].sites)
+            {
+                site.site = nullptr;
+            }
+            thread_block[i].other_sites.site = LOCK_OTHER_SITE;
+        }
+
+        pthread_mutex_lock(&profiles_mutex);
+        thread_blocks.push_back(thread_block);
+        pthread_mutex_unlock(&profiles_mutex);
+    }
+    return thread_block[profile];
+}
+
+/**
+ * The entry of a call site in a thread's entry of a profile, added if there is
+ * room.
+ */
+static LockSite& get_site(LockStats& stats, const char* site)
+{
+    for (auto& entry: stats.sites)
+    {
+        const char* entry_site = entry.site.load(std::memory_order_relaxed);
+        if (entry_site == site)
+        {
+            return entry;
+        }
+        if (entry_site == nullptr)
+        {
+            entry.site.store(site, std::memory_order_release);
+            return entry;
+        }
+    }
+    return stats.other_sites;
+}
+
+/**
+ * Sum the waits of a thread's call site into sites, by their name (the same
+ * name may be at different addresses).
+ */
+static void add_site(const LockSite& site, SiteWaits& sites)
+{
+    const char* name = site.site.load(std::memory_order_acquire);
+    if (name == nullptr || site.contended.get() == 0)
+    {
+        return;
+    }
+    std::pair<uint64_t, uint64_t>& sum = sites[name];
+    sum.first += site.contended.get();
+    sum.second += site.wait_ns.get();
+}
+
+/**
+ * The profile of a lock, summed over the threads, as a JSON object.
+ */
+static std::string profile_json(int profile)
+{
+    uint64_t acquisitions = 0, contended = 0;
+    Histogram waits, holds;
+    SiteWaits sites;
+    for (auto const& block: thread_blocks)
+    {
+        const LockStats& stats = block[profile];
+        acquisitions += stats.acquisitions.get();
+        contended += stats.contended.get();
+        waits.add(stats.waits);
+        holds.add(stats.holds);
+        for (auto const& site: stats.sites)
+        {
+            add_site(site, sites);
+        }
+        add_site(stats.other_sites, sites);
+    }
+
+    // the sites which waited the longest in total first
+    std::vector<std::pair<uint64_t, std::string>> by_wait;
+    for (auto const& site: sites)
+    {
+        by_wait.push_back(std::make_pair(site.second.second, site.first));
+    }
+    std::sort(by_wait.rbegin(), by_wait.rend());
+
+    std::string sites_json;
+    for (size_t i = 0; i < by_wait.size() && i < LOCK_REPORT_SITES; i++)
+    {
+        const std::string& site = by_wait[i].second;
+        sites_json += std::string(i == 0 ? "" : ",") + "{\"site\":\"" + site +
+                      "\",\"contended\":" +
+                      std::to_string(sites[site].first) + ",\"wait_ns\":" +
+                      std::to_string(sites[site].second) + "}";
+    }
+
+    char percent[PERCENT_SIZE];
+    snprintf(percent, sizeof(percent), "%.2f", acquisitions == 0 ? 0 :
+             PERCENT * contended / acquisitions);
+    return "{\"acquisitions\":" + std::to_string(acquisitions) +
+           ",\"contended\":" + std::to_string(contended) +
+           ",\"contended_percent\":" + percent +
+           ",\"wait\":" + waits.to_json() +
+           ",\"hold\":" + holds.to_json() +
+           ",\"top_sites\":[" + sites_json + "]}";
+}
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+/**
+ * Start profiling the locks.
+ */
+void start_lock_profiling()
+{
+    is_profiling_locks = true;
+}
+
+/**
+ * The profile of every lock which was taken since profiling started, as a
+ * JSON object by lock name.
+ */
+std::string lock_profile_json()
+{
+    std::string json = "{";
+    pthread_mutex_lock(&profiles_mutex);
+    for (int profile = 0; profile < profiles_num; profile++)
+    {
+        json += std::string(profile == 0 ? "" : ",") + "\"" +
+                profile_names[profile] + "\":" + profile_json(profile);
+    }
+    pthread_mutex_unlock(&profiles_mutex);
+    return json + "}";
+}
+
+/**
+ * Free the blocks of all the threads; none may still take a profiled lock.
+ */
+void free_lock_profiles()
+{
+    is_profiling_locks = false;
+    pthread_mutex_lock(&profiles_mutex);
+    for (auto const& block: thread_blocks)
+    {
+        delete[] block;
+    }
+    thread_blocks.clear();
+    pthread_mutex_unlock(&profiles_mutex);
+    thread_block = nullptr;
+}
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+ProfiledLock::ProfiledLock(const char* name, const char* wait_span)
+        :name(name),
+         wait_span(wait_span != nullptr ? wait_span : name),
+         profile(UNREGISTERED_PROFILE)
+{
+}
+
+/**
+ * The index of the lock's profile, registered on the first call. Locks of the
+ * same name share it.
+ */
+int ProfiledLock::get_profile()
+{
+    int index = profile.load(std::memory_order_acquire);
+    if (index != UNREGISTERED_PROFILE)
+    {
+        return index;
+    }
+
+    pthread_mutex_lock(&profiles_mutex);
+    index = NO_PROFILE;
+    for (int i = 0; i < profiles_num; i++)
+    {
+        if (strcmp(profile_names[i], name) == EQUAL)
+        {
+            index = i;
+        }
+    }
+    if (index == NO_PROFILE && profiles_num < MAX_LOCK_PROFILES)
+    {
+        index = profiles_num++;
+        profile_names[index] = name;
+    }
+    pthread_mutex_unlock(&profiles_mutex);
+
+    profile.store(index, std::memory_order_release);
+    return index;
+}
+
+/**
+ * Record an acquisition by a call site, which waited since wait_start_ns (0
+ * if it did not wait), and start timing the hold.
+ */
+void ProfiledLock::acquired(const char* site, uint64_t wait_start_ns)
+{
+    int index = get_profile();
+    if (index == NO_PROFILE)
+    {
+        return;
+    }
+
+    uint64_t now_ns = monotonic_ns();
+    LockStats& stats = get_stats(index);
+    stats.acquisitions.add(1);
+    if (wait_start_ns != 0)
+    {
+        uint64_t wait_ns = now_ns - wait_start_ns;
+        stats.contended.add(1);
+        stats.waits.record(wait_ns);
+        LockSite& site_stats = get_site(stats, site);
+        site_stats.contended.add(1);
+        site_stats.wait_ns.add(wait_ns);
+    }
+
+    if (held_num < MAX_HELD_LOCKS)
+    {
+        held_locks[held_num++] = {this, index, now_ns};
+    }
+}
+
+/**
+ * Record the release of the lock by the calling thread: the time it was held
+ * for, if its acquisition was recorded.
+ */
+void ProfiledLock::released()
+{
+    for (int i = held_num - 1; i >= 0; i--)
+    {
+        if (held_locks[i].lock != this)
+        {
+            continue;
+        }
+
+        get_stats(held_locks[i].profile).holds.record(
+                monotonic_ns() - held_locks[i].acquired_ns);
+        held_locks[i] = held_locks[--held_num];
+        return;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ProfiledMutex::ProfiledMutex(const char* name, const char* wait_span)
+        :ProfiledLock(name, wait_span)
+{
+    pthread_mutex_init(&mutex, NULL);
+}
+
+ProfiledMutex::~ProfiledMutex()
+{
+    pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * Take the mutex, timing the wait (if it has to) as a span of the traced
+ * request, and for the profile.
+ */
+void ProfiledMutex::lock_observed(const char* site)
+{
+    TraceScope wait(wait_span);
+    if (!is_profiling_locks.load(std::memory_order_relaxed))
+    {
+        pthread_mutex_lock(&mutex);
+        return;
+    }
+
+    if (pthread_mutex_trylock(&mutex) == SUCCESS)
+    {
+        acquired(site, 0);
+        return;
+    }
+    uint64_t wait_start_ns = monotonic_ns();
+    pthread_mutex_lock(&mutex);
+    acquired(site, wait_start_ns);
+}
+
+/**
+ * Wait on a condition until deadline, with the mutex held. The hold ends
+ * while waiting, and a new one starts once the wait is over.
+ */
+int ProfiledMutex::timed_wait(pthread_cond_t& cond,
+                              const struct timespec& deadline,
+                              const char* site)
+{
+    bool is_profiled = is_profiling_locks.load(std::memory_order_relaxed);
+    if (is_profiled)
+    {
+        released();
+    }
+    int result = pthread_cond_timedwait(&cond, &mutex, &deadline);
+    if (is_profiled)
+    {
+        // counted as an acquisition, which did not wait for another holder
+        acquired(site, 0);
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ProfiledRWLock::ProfiledRWLock(const char* name, const char* wait_span,
+                               bool prefer_writers)
+        :ProfiledLock(name, wait_span)
+{
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    if (prefer_writers)
+    {
+        pthread_rwlockattr_setkind_np(
+                &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    }
+    pthread_rwlock_init(&lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+ProfiledRWLock::~ProfiledRWLock()
+{
+    pthread_rwlock_destroy(&lock);
+}
+
+/**
+ * Take the lock for reading or writing, timing the wait (if it has to) as a
+ * span of the traced request, and for the profile.
+ */
+void ProfiledRWLock::lock_observed(const char* site, bool for_write)
+{
+    TraceScope wait(wait_span);
+    if (!is_profiling_locks.load(std::memory_order_relaxed))
+    {
+        for_write ? pthread_rwlock_wrlock(&lock) : pthread_rwlock_rdlock(&lock);
+        return;
+    }
+
+    if ((for_write ? pthread_rwlock_trywrlock(&lock) :
+                     pthread_rwlock_tryrdlock(&lock)) == SUCCESS)
+    {
+        acquired(site, 0);
+        return;
+    }
+    uint64_t wait_start_ns = monotonic_ns();
+    for_write ? pthread_rwlock_wrlock(&lock) : pthread_rwlock_rdlock(&lock);
+    acquired(site, wait_start_ns);
+}
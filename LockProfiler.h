@@ -0,0 +1,195 @@
+#ifndef EX5_LOCKPROFILER_H
+#define EX5_LOCKPROFILER_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <atomic>
+#include "Trace.h"
+
+//==============================================================================
+//=============================== DEFINES ======================================
+//==============================================================================
+// locks of different names which are profiled at most; locks of the same name
+// (e.g. the shards of a store) share a profile
+#define MAX_LOCK_PROFILES 16
+// call sites a thread tells apart for each profile; the waits of the sites
+// past them are counted as LOCK_OTHER_SITE
+#define LOCK_SITES 16
+#define LOCK_OTHER_SITE "other"
+// call sites a report lists for each lock, the longest waiting first
+#define LOCK_REPORT_SITES 5
+// locks a thread holds at once whose hold time is measured
+#define MAX_HELD_LOCKS 64
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+// Locks are profiled once profiling starts: each acquisition is counted, and
+// when it has to wait (it would block), the wait is timed and charged to the
+// call site. How long the lock is then held is timed as well. Each thread
+// records to a block of its own, without a lock, and a report sums the
+// blocks.
+
+// set once profiling starts; while it is not (and requests are not traced),
+// taking a lock costs a load of it besides the lock
+extern std::atomic<bool> is_profiling_locks;
+
+/**
+ * Start profiling the locks.
+ */
+void start_lock_profiling();
+
+/**
+ * The profile of every lock which was taken since profiling started, as a
+ * JSON object by lock name: its acquisitions, those which waited, histograms
+ * of the waits and of the hold times, and the call sites which waited the
+ * longest.
+ */
+std::string lock_profile_json();
+
+/**
+ * Free the blocks of all the threads; none may still take a profiled lock.
+ */
+void free_lock_profiles();
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * What a profiled lock of any kind has: its name, which its profile is kept
+ * by, and the name of the span its waits are traced as.
+ */
+class ProfiledLock
+{
+protected:
+    ProfiledLock(const char* name, const char* wait_span);
+
+    /**
+     * Record an acquisition by a call site, which waited since wait_start_ns
+     * (0 if it did not wait).
+     */
+    void acquired(const char* site, uint64_t wait_start_ns);
+
+    /**
+     * Record the release of the lock by the calling thread.
+     */
+    void released();
+
+    /**
+     * Whether the acquisitions of the lock are profiled or traced.
+     */
+    static bool is_observed()
+    {
+        return is_profiling_locks.load(std::memory_order_relaxed) ||
+               is_tracing.load(std::memory_order_relaxed);
+    }
+
+    const char* name;
+    const char* wait_span;
+
+private:
+    /**
+     * The index of the lock's profile, registered on the first call. -1 if
+     * there are MAX_LOCK_PROFILES profiles already.
+     */
+    int get_profile();
+
+    std::atomic<int> profile;
+};
+
+/**
+ * A mutex whose acquisitions are profiled. site names the caller (e.g.
+ * __func__), and must outlive the profile.
+ */
+class ProfiledMutex : public ProfiledLock
+{
+public:
+    explicit ProfiledMutex(const char* name, const char* wait_span = nullptr);
+
+    ~ProfiledMutex();
+
+    void lock(const char* site)
+    {
+        if (!is_observed())
+        {
+            pthread_mutex_lock(&mutex);
+            return;
+        }
+        lock_observed(site);
+    }
+
+    void unlock()
+    {
+        if (is_profiling_locks.load(std::memory_order_relaxed))
+        {
+            released();
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    /**
+     * Wait on a condition until deadline, with the mutex held. The time
+     * spent waiting is not counted as holding it.
+     */
+    int timed_wait(pthread_cond_t& cond, const struct timespec& deadline,
+                   const char* site);
+
+private:
+    void lock_observed(const char* site);
+
+    pthread_mutex_t mutex;
+};
+
+/**
+ * A reader-writer lock whose acquisitions are profiled, for reading and for
+ * writing alike.
+ */
+class ProfiledRWLock : public ProfiledLock
+{
+public:
+    ProfiledRWLock(const char* name, const char* wait_span = nullptr,
+                   bool prefer_writers = false);
+
+    ~ProfiledRWLock();
+
+    void read_lock(const char* site)
+    {
+        if (!is_observed())
+        {
+            pthread_rwlock_rdlock(&lock);
+            return;
+        }
+        lock_observed(site, false);
+    }
+
+    void write_lock(const char* site)
+    {
+        if (!is_observed())
+        {
+            pthread_rwlock_wrlock(&lock);
+            return;
+        }
+        lock_observed(site, true);
+    }
+
+    void unlock()
+    {
+        if (is_profiling_locks.load(std::memory_order_relaxed))
+        {
+            released();
+        }
+        pthread_rwlock_unlock(&lock);
+    }
+
+private:
+    void lock_observed(const char* site, bool for_write);
+
+    pthread_rwlock_t lock;
+};
+
+#endif //EX5_LOCKPROFILER_H
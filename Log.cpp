@@ -1,71 +1,402 @@
-//==============================================================================
-//=============================== INCLUDES  ====================================
-//==============================================================================
-
-#include "Log.h"
-
-
-//==============================================================================
-//================================== CLASS =====================================
-//==============================================================================
-
-/**
- * Destructor.
- */
-Log::~Log()
-{
-    close_log_file();
-	pthread_mutex_destroy(&log_mutex);
-}
-
-/*
- * Open the file stream.
- */
-int Log::open_log_file()
-{
-    logFile.open(log_path, std::fstream::out | std::fstream::in | \
-                 std::fstream::trunc);
-
-    if(!logFile.is_open())
-    {
-        return FAILURE;
-    }
-
-    return SUCCESS;
-}
-
-/*
- * Open the file stream.
- */
-void Log::close_log_file()
-{
-    logFile.close();
-}
-
-/**
- * This method writes a given string to the log.
- */
-int Log::write_to_log(std::string text) {
-    if (!logFile) {
-        return FAILURE;
-    }
-
-    pthread_mutex_lock(&log_mutex);
-
-    now = time(INIT);
-    ltm = localtime(&now);
-
-    logFile << std::setw(TWO_DIG) << std::setfill(FILL) << ltm->tm_hour << ':'
-            << std::setw(TWO_DIG) << std::setfill(FILL) << ltm->tm_min  << ':'
-            << std::setw(TWO_DIG) << std::setfill(FILL) << ltm->tm_sec  << " \t"
-            << text;
-
-    pthread_mutex_unlock(&log_mutex);
-
-
-    if (logFile.bad()) {
-        return FAILURE;
-    }
-
-    return SUCCESS;
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+
+#include "Log.h"
+#include "Trace.h"
+
+// the span of a traced request writing a record
+#define TRACE_WRITE_SPAN "log_write"
+// the low bits of a packed time stamp, which hold its local second of the day
+#define STAMP_DAY_BITS 17
+#define STAMP_DAY_MASK ((1ULL << STAMP_DAY_BITS) - 1)
+#define SECONDS_IN_MINUTE 60
+#define SECONDS_IN_HOUR 3600
+
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+
+/**
+ * Append a number below 100 to a string as two digits.
+ */
+static void append_two_digits(std::string& out, unsigned number)
+{
+    out += (char) ('0' + number / 10);
+    out += (char) ('0' + number % 10);
+}
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+
+/**
+ * Destructor.
+ */
+Log::~Log()
+{
+    close_log_file();
+    delete[] ring;
+}
+
+/*
+ * Open the file stream.
+ */
+int Log::open_log_file()
+{
+    logFile.open(log_path, std::fstream::out | std::fstream::in | \
+                 std::fstream::trunc);
+
+    if(!logFile.is_open())
+    {
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Write the log from a flusher thread from now on.
+ */
+int Log::start_async(size_t capacity, LogFullPolicy policy)
+{
+    if (!logFile || is_async)
+    {
+        return FAILURE;
+    }
+
+    // a power of two, so that a position is mapped to a slot with a mask
+    size_t ring_size = 1;
+    while (ring_size < capacity)
+    {
+        ring_size <<= 1;
+    }
+
+    ring = new(std::nothrow) LogSlot[ring_size];
+    if (ring == nullptr)
+    {
+        return FAILURE;
+    }
+    for (size_t i = 0; i < ring_size; i++)
+    {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ring_mask = ring_size - 1;
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos = 0;
+    full_policy = policy;
+    pthread_mutex_init(&flusher_mutex, nullptr);
+    pthread_cond_init(&flusher_cond, nullptr);
+    pthread_cond_init(&room_cond, nullptr);
+
+    if (pthread_create(&flusher, nullptr, flusher_func, this) != 0)
+    {
+        return FAILURE;
+    }
+    is_async = true;
+
+    return SUCCESS;
+}
+
+/*
+ * Close the file stream, once the queued records were written.
+ */
+void Log::close_log_file()
+{
+    if (is_async)
+    {
+        stop_flusher = true;
+        wake_flusher();
+        pthread_join(flusher, nullptr);
+        is_async = false;
+        pthread_cond_destroy(&flusher_cond);
+        pthread_cond_destroy(&room_cond);
+        pthread_mutex_destroy(&flusher_mutex);
+    }
+
+    logFile.close();
+}
+
+/**
+ * This method writes a given string to the log.
+ */
+int Log::write_to_log(std::string text) {
+    TraceScope writing(TRACE_WRITE_SPAN);
+    if (!is_async)
+    {
+        if (!logFile) {
+            return FAILURE;
+        }
+
+        std::string record;
+        record.reserve(STAMP_SIZE + sizeof(STAMP_SEPARATOR) + text.length());
+        append_time_stamp(record);
+        record += text;
+
+        log_mutex.lock(__func__);
+        logFile << record;
+        log_mutex.unlock();
+
+        if (logFile.bad()) {
+            return FAILURE;
+        }
+
+        return SUCCESS;
+    }
+
+    if (write_failed.load(std::memory_order_relaxed))
+    {
+        return FAILURE;
+    }
+
+    std::string record;
+    record.reserve(STAMP_SIZE + sizeof(STAMP_SEPARATOR) + text.length());
+    append_time_stamp(record);
+    record += text;
+
+    if (try_enqueue(record))
+    {
+        return SUCCESS;
+    }
+
+    wake_flusher();
+    if (full_policy == LOG_FULL_DROP)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return FAILURE;
+    }
+
+    enqueue_blocking(record);
+    return SUCCESS;
+}
+
+/**
+ * Push a record to the full ring, once the flusher makes room for it. The
+ * producer sleeps meanwhile; the flusher wakes it after each batch it pops.
+ */
+void Log::enqueue_blocking(std::string& record)
+{
+    pthread_mutex_lock(&flusher_mutex);
+    blocked_producers.fetch_add(1);
+    // retried once counted, so that a batch popped before the flusher could
+    // see the count is not waited for
+    while (!try_enqueue(record))
+    {
+        // flusher_mutex is held, so the flusher is woken here rather than
+        // by wake_flusher
+        if (flusher_idle.load(std::memory_order_acquire))
+        {
+            pthread_cond_signal(&flusher_cond);
+        }
+
+        // the interval bounds the wait if the flusher popped a batch
+        // without seeing the count
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&room_cond, &flusher_mutex, &deadline);
+    }
+    blocked_producers.fetch_sub(1);
+    pthread_mutex_unlock(&flusher_mutex);
+}
+
+/**
+ * Wake the producers which wait for room in the ring, if any.
+ */
+void Log::wake_producers()
+{
+    if (blocked_producers.load() > 0)
+    {
+        pthread_mutex_lock(&flusher_mutex);
+        pthread_cond_broadcast(&room_cond);
+        pthread_mutex_unlock(&flusher_mutex);
+    }
+}
+
+/**
+ * The number of records dropped since the ring was full.
+ */
+uint64_t Log::dropped_records() const
+{
+    return dropped.load(std::memory_order_relaxed);
+}
+
+/**
+ * Append the time stamp of the current second to a record. localtime is only
+ * called once a second; other records reuse the second of the day it gave,
+ * which is published along with the second it is of in a single word, so a
+ * record never gets the stamp of another second.
+ */
+void Log::append_time_stamp(std::string& record)
+{
+    time_t now = time(INIT);
+    uint64_t packed = stamp.load(std::memory_order_acquire);
+
+    if ((time_t) (packed >> STAMP_DAY_BITS) != now)
+    {
+        tm ltm;
+        localtime_r(&now, &ltm);
+        packed = ((uint64_t) now << STAMP_DAY_BITS) |
+                 (uint64_t) (ltm.tm_hour * SECONDS_IN_HOUR +
+                             ltm.tm_min * SECONDS_IN_MINUTE + ltm.tm_sec);
+        stamp.store(packed, std::memory_order_release);
+    }
+
+    // "HH:MM:SS"
+    unsigned second = (unsigned) (packed & STAMP_DAY_MASK);
+    append_two_digits(record, second / SECONDS_IN_HOUR);
+    record += ':';
+    append_two_digits(record, second / SECONDS_IN_MINUTE % SECONDS_IN_MINUTE);
+    record += ':';
+    append_two_digits(record, second % SECONDS_IN_MINUTE);
+    record += STAMP_SEPARATOR;
+}
+
+/**
+ * Push a record to the ring, without blocking. false if it is full.
+ * The record is moved to the ring (record is left with unspecified content).
+ */
+bool Log::try_enqueue(std::string& record)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        LogSlot& slot = ring[pos & ring_mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+        if (diff == 0)
+        {
+            // the slot is free, claim its position
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed))
+            {
+                slot.record.swap(record);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // the record pushed a lap ago was not popped yet
+            return false;
+        }
+        else
+        {
+            // another producer claimed the position first
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Move the queued records to batch, until it holds LOG_BATCH_SIZE bytes.
+ */
+void Log::dequeue_batch(std::string& batch)
+{
+    while (batch.length() < LOG_BATCH_SIZE)
+    {
+        LogSlot& slot = ring[dequeue_pos & ring_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+        {
+            return;
+        }
+
+        batch += slot.record;
+        slot.record.clear();
+        // free the slot for the record pushed a lap later
+        slot.sequence.store(dequeue_pos + ring_mask + 1,
+                            std::memory_order_release);
+        dequeue_pos++;
+    }
+}
+
+/**
+ * Wake the flusher if it waits for records.
+ */
+void Log::wake_flusher()
+{
+    if (flusher_idle.load(std::memory_order_acquire))
+    {
+        pthread_mutex_lock(&flusher_mutex);
+        pthread_cond_signal(&flusher_cond);
+        pthread_mutex_unlock(&flusher_mutex);
+    }
+}
+
+/**
+ * Write the queued records in batches, until the log is closed and they were
+ * all written.
+ */
+void* Log::flusher_func(void* log)
+{
+    Log* self = (Log*) log;
+    std::string batch;
+    uint64_t reported_dropped = 0;
+
+    while (true)
+    {
+        // checked before draining, so that no record pushed before the log
+        // was closed is left behind
+        bool stopping = self->stop_flusher.load(std::memory_order_acquire);
+
+        batch.clear();
+        self->dequeue_batch(batch);
+        self->wake_producers();
+
+        uint64_t dropped = self->dropped_records();
+        if (dropped != reported_dropped)
+        {
+            self->append_time_stamp(batch);
+            batch += std::to_string(dropped - reported_dropped) + \
+                     " log records were dropped, the log was full.\n";
+            reported_dropped = dropped;
+        }
+
+        if (!batch.empty())
+        {
+            self->logFile.write(batch.data(), batch.length());
+            self->logFile.flush();
+            if (self->logFile.bad())
+            {
+                self->write_failed.store(true, std::memory_order_relaxed);
+            }
+        }
+        else if (stopping)
+        {
+            break;
+        }
+        else
+        {
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            // a record pushed meanwhile is written at the next interval at
+            // the latest
+            pthread_mutex_lock(&self->flusher_mutex);
+            self->flusher_idle.store(true, std::memory_order_release);
+            if (!self->stop_flusher.load(std::memory_order_acquire))
+            {
+                pthread_cond_timedwait(&self->flusher_cond,
+                                       &self->flusher_mutex, &deadline);
+            }
+            self->flusher_idle.store(false, std::memory_order_relaxed);
+            pthread_mutex_unlock(&self->flusher_mutex);
+        }
+    }
+
+    return nullptr;
 }
\ No newline at end of file
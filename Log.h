@@ -1,65 +1,162 @@
-#ifndef EX5_LOG_H
-#define EX5_LOG_H
-
-//==============================================================================
-//=============================== INCLUDES  ====================================
-//==============================================================================
-#define FAILURE -1
-#define SUCCESS 0
-
-// value to initialize timer funtion
-#define INIT 0
-// two digit number. (will be filled with 0 if its single digit number)
-#define TWO_DIG 2
-// If number is not 2-digit number, the gap filled with 0
-#define FILL  '0'
-
-//==============================================================================
-//=============================== INCLUDES  ====================================
-//==============================================================================
-#include <fstream>
-#include <iostream>
-#include <stdlib.h>
-#include <string.h>
-#include <iomanip>
-
-//==============================================================================
-//================================== CLASS =====================================
-//==============================================================================
-class Log
-{
-public:
-    Log(std::string path,  pthread_mutex_t& log_mutex)
-            :log_path(path),
-			 log_mutex(log_mutex){}
-
-    /**
-     * Destructor.
-     */
-    ~Log();
-
-    /*
-     * Open the file stream.
-     */
-    int open_log_file();
-
-    /*
-     * Open the file stream.
-     */
-    void close_log_file();
-
-    /**
-    * This method writes a given string to the log.
-    */
-    int write_to_log(std::string text);
-
-    std::string log_path;
-    std::fstream logFile;
-    pthread_mutex_t& log_mutex;
-    // Variables with which time stamp is measured.
-    time_t now;
-    tm *ltm;
-
-};
-
+#ifndef EX5_LOG_H
+#define EX5_LOG_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#define FAILURE -1
+#define SUCCESS 0
+
+// value to initialize timer funtion
+#define INIT 0
+// length of the "HH:MM:SS" time stamp which opens a record
+#define STAMP_SIZE 8
+#define STAMP_SEPARATOR " \t"
+// the flusher writes once it gathered this many bytes, or ran out of records
+#define LOG_BATCH_SIZE 65536
+// ms the flusher waits for records when there are none to write, unless a
+// producer finds the ring full and wakes it
+#define LOG_FLUSH_INTERVAL_MS 10
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include "LockProfiler.h"
+
+// What an asynchronous log does with a record when its ring is full.
+typedef enum {LOG_FULL_DROP, LOG_FULL_BLOCK} LogFullPolicy;
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+// A log is synchronous by default: each record is written under log_mutex.
+// Once start_async is called, records are queued to a lock-free ring instead,
+// which any thread may push to, and a flusher thread writes them in batches.
+class Log
+{
+public:
+    Log(std::string path,  ProfiledMutex& log_mutex)
+            :log_path(path),
+			 log_mutex(log_mutex),
+             is_async(false),
+             write_failed(false),
+             stop_flusher(false),
+             dropped(0),
+             flusher_idle(false),
+             blocked_producers(0),
+             ring(nullptr),
+             stamp(0){}
+
+    /**
+     * Destructor.
+     */
+    ~Log();
+
+    /*
+     * Open the file stream.
+     */
+    int open_log_file();
+
+    /**
+     * Write the log from a flusher thread from now on. Records wait in a ring
+     * of (at least) capacity records; policy tells what write_to_log does
+     * when it is full. Called once, after open_log_file.
+     */
+    int start_async(size_t capacity, LogFullPolicy policy);
+
+    /*
+     * Close the file stream, once the queued records were written.
+     */
+    void close_log_file();
+
+    /**
+    * This method writes a given string to the log.
+    */
+    int write_to_log(std::string text);
+
+    /**
+     * The number of records dropped since the ring was full.
+     */
+    uint64_t dropped_records() const;
+
+    std::string log_path;
+    std::fstream logFile;
+    ProfiledMutex& log_mutex;
+
+private:
+    // A record in the ring. sequence tells whose turn it is to use the slot:
+    // it equals the position of the record to push when the slot is free, and
+    // that position + 1 once the record was pushed.
+    struct LogSlot
+    {
+        std::atomic<size_t> sequence;
+        std::string record;
+    };
+
+    /**
+     * Append the time stamp of the current second to a record.
+     */
+    void append_time_stamp(std::string& record);
+
+    /**
+     * Push a record to the ring, without blocking. false if it is full.
+     */
+    bool try_enqueue(std::string& record);
+
+    /**
+     * Move the queued records to batch, until it holds LOG_BATCH_SIZE bytes.
+     */
+    void dequeue_batch(std::string& batch);
+
+    /**
+     * Wake the flusher if it waits for records.
+     */
+    void wake_flusher();
+
+    /**
+     * Push a record to the full ring, once the flusher makes room for it.
+     */
+    void enqueue_blocking(std::string& record);
+
+    /**
+     * Wake the producers which wait for room in the ring, if any.
+     */
+    void wake_producers();
+
+    static void* flusher_func(void* log);
+
+    std::atomic<bool> is_async;
+    std::atomic<bool> write_failed;
+    std::atomic<bool> stop_flusher;
+    std::atomic<uint64_t> dropped;
+    LogFullPolicy full_policy;
+    pthread_t flusher;
+    // the flusher waits on flusher_cond while flusher_idle
+    pthread_mutex_t flusher_mutex;
+    pthread_cond_t flusher_cond;
+    std::atomic<bool> flusher_idle;
+    // producers of a LOG_FULL_BLOCK log wait on room_cond (with
+    // flusher_mutex) while the ring is full
+    pthread_cond_t room_cond;
+    std::atomic<int> blocked_producers;
+
+    LogSlot* ring;
+    size_t ring_mask;
+    std::atomic<size_t> enqueue_pos;
+    // only the flusher pops records
+    size_t dequeue_pos;
+
+    // The last second a record was written in, shifted left by
+    // STAMP_DAY_BITS, and its local second of the day in the low bits: both
+    // change with a single store, so they always match.
+    std::atomic<uint64_t> stamp;
+};
+
 #endif //EX5_LOG_H
\ No newline at end of file
@@ -0,0 +1,291 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <math.h>
+#include <algorithm>
+#include "Metrics.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+// the buckets of each power of two past the first ones
+#define HALF_SUB_BUCKETS (1 << (HISTOGRAM_SUB_BUCKET_BITS - 1))
+#define SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define UINT64_BITS 64
+#define PERCENT 100.0
+
+// the block of the calling thread
+static thread_local void* current_thread_metrics = nullptr;
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+Counter::Counter()
+        :value(0)
+{
+}
+
+/**
+ * Add to the counter. Only its thread calls it.
+ */
+void Counter::add(uint64_t delta)
+{
+    value.store(value.load(std::memory_order_relaxed) + delta,
+                std::memory_order_relaxed);
+}
+
+uint64_t Counter::get() const
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Histogram::Histogram()
+        :max(0)
+{
+}
+
+/**
+ * Count a value. Only the histogram's thread calls it.
+ */
+void Histogram::record(uint64_t value)
+{
+    counts[bucket_of(value)].add(1);
+    count.add(1);
+    total.add(value);
+    if (value > max.load(std::memory_order_relaxed))
+    {
+        max.store(value, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Add the counts of another histogram to this one, which no other thread
+ * writes.
+ */
+void Histogram::add(const Histogram& other)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        counts[i].add(other.counts[i].get());
+    }
+    count.add(other.count.get());
+    total.add(other.total.get());
+    max.store(std::max(get_max(), other.get_max()),
+              std::memory_order_relaxed);
+}
+
+uint64_t Histogram::get_count() const
+{
+    return count.get();
+}
+
+uint64_t Histogram::get_total() const
+{
+    return total.get();
+}
+
+uint64_t Histogram::get_max() const
+{
+    return max.load(std::memory_order_relaxed);
+}
+
+/**
+ * The value percentile percents of the values are at most (up to the width
+ * of its bucket). 0 if there are none.
+ */
+uint64_t Histogram::get_percentile(double percentile) const
+{
+    // the buckets are summed as they are read, so they may count values
+    // recorded after count was read
+    uint64_t values_num = get_count();
+    if (values_num == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) ceil(percentile / PERCENT * values_num);
+    rank = std::max(rank, (uint64_t) 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += counts[i].get();
+        if (seen >= rank)
+        {
+            return std::min(bucket_top(i), get_max());
+        }
+    }
+    return get_max();
+}
+
+/**
+ * The count, mean, median, 90th, 99th and 99.9th percentiles and max, as a
+ * JSON object.
+ */
+std::string Histogram::to_json() const
+{
+    uint64_t values_num = get_count();
+    uint64_t mean = values_num == 0 ? 0 : get_total() / values_num;
+
+    return "{\"count\":" + std::to_string(values_num) +
+           ",\"mean_ns\":" + std::to_string(mean) +
+           ",\"p50_ns\":" + std::to_string(get_percentile(50)) +
+           ",\"p90_ns\":" + std::to_string(get_percentile(90)) +
+           ",\"p99_ns\":" + std::to_string(get_percentile(99)) +
+           ",\"p999_ns\":" + std::to_string(get_percentile(99.9)) +
+           ",\"max_ns\":" + std::to_string(get_max()) + "}";
+}
+
+/**
+ * Values below SUB_BUCKETS have a bucket each. A larger value whose highest
+ * bit is b is shifted right by b - HISTOGRAM_SUB_BUCKET_BITS + 1, leaving
+ * HALF_SUB_BUCKETS possible values, each a bucket.
+ */
+size_t Histogram::bucket_of(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return (size_t) value;
+    }
+
+    int shift = UINT64_BITS - 1 - __builtin_clzll(value) -
+                HISTOGRAM_SUB_BUCKET_BITS + 1;
+    if (shift > HISTOGRAM_MAX_SHIFT)
+    {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    return (size_t) shift * HALF_SUB_BUCKETS + (size_t) (value >> shift);
+}
+
+/**
+ * The largest value a bucket counts.
+ */
+uint64_t Histogram::bucket_top(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    if (bucket == HISTOGRAM_BUCKETS - 1)
+    {
+        return UINT64_MAX;
+    }
+
+    int shift = (int) (bucket / HALF_SUB_BUCKETS) - 1;
+    uint64_t low = (uint64_t) (bucket - shift * HALF_SUB_BUCKETS) << shift;
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Metrics::Metrics(size_t kinds_num, size_t counters_num)
+        :kinds_num(kinds_num),
+         counters_num(counters_num)
+{
+    pthread_mutex_init(&threads_mutex, NULL);
+}
+
+/**
+ * Destructor. Frees the blocks of all the threads; none may still record.
+ */
+Metrics::~Metrics()
+{
+    for (auto const& thread: threads)
+    {
+        delete[] thread->requests;
+        delete[] thread->counters;
+        delete thread;
+    }
+    pthread_mutex_destroy(&threads_mutex);
+}
+
+/**
+ * Record a request of a kind, which was parsed and executed in the given
+ * times, and whether its reply was an error.
+ */
+void Metrics::record_request(size_t kind, uint64_t parse_ns,
+                             uint64_t execute_ns, bool is_error)
+{
+    RequestMetrics& request = get_thread_metrics()->requests[kind];
+    request.phases[PHASE_PARSE].record(parse_ns);
+    request.phases[PHASE_EXECUTE].record(execute_ns);
+    if (is_error)
+    {
+        request.errors.add(1);
+    }
+}
+
+/**
+ * Record the time the reply of a request of a kind took to be sent.
+ */
+void Metrics::record_send(size_t kind, uint64_t send_ns)
+{
+    get_thread_metrics()->requests[kind].phases[PHASE_SEND].record(send_ns);
+}
+
+/**
+ * Add to a counter.
+ */
+void Metrics::add_to_counter(size_t counter, uint64_t delta)
+{
+    get_thread_metrics()->counters[counter].add(delta);
+}
+
+/**
+ * Sum the metrics of a kind of request over all the threads into sum.
+ */
+void Metrics::get_requests(size_t kind, RequestMetrics& sum)
+{
+    pthread_mutex_lock(&threads_mutex);
+    for (auto const& thread: threads)
+    {
+        const RequestMetrics& request = thread->requests[kind];
+        for (int phase = 0; phase < PHASES_NUM; phase++)
+        {
+            sum.phases[phase].add(request.phases[phase]);
+        }
+        sum.errors.add(request.errors.get());
+    }
+    pthread_mutex_unlock(&threads_mutex);
+}
+
+/**
+ * A counter, summed over all the threads.
+ */
+uint64_t Metrics::get_counter(size_t counter)
+{
+    uint64_t sum = 0;
+    pthread_mutex_lock(&threads_mutex);
+    for (auto const& thread: threads)
+    {
+        sum += thread->counters[counter].get();
+    }
+    pthread_mutex_unlock(&threads_mutex);
+    return sum;
+}
+
+/**
+ * The calling thread's block, registered on its first call. A thread's block
+ * outlives it, so that what it recorded is still counted.
+ */
+Metrics::ThreadMetrics* Metrics::get_thread_metrics()
+{
+    ThreadMetrics* thread = (ThreadMetrics*) current_thread_metrics;
+    if (thread != nullptr && thread->owner == this)
+    {
+        return thread;
+    }
+
+    thread = new ThreadMetrics;
+    thread->owner = this;
+    thread->requests = new RequestMetrics[kinds_num];
+    thread->counters = new Counter[counters_num];
+
+    pthread_mutex_lock(&threads_mutex);
+    threads.push_back(thread);
+    pthread_mutex_unlock(&threads_mutex);
+
+    current_thread_metrics = thread;
+    return thread;
+}
@@ -0,0 +1,191 @@
+#ifndef EX5_METRICS_H
+#define EX5_METRICS_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+
+//==============================================================================
+//=============================== DEFINES ======================================
+//==============================================================================
+// A histogram counts values below 2^HISTOGRAM_SUB_BUCKET_BITS exactly, and
+// splits each larger power of two into half as many buckets, so a value is
+// known to within 1/16 of it. Values from 2^(HISTOGRAM_MAX_SHIFT +
+// HISTOGRAM_SUB_BUCKET_BITS) ns (over two minutes) on share the last bucket.
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_MAX_SHIFT 32
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_SHIFT + 2) << \
+                           (HISTOGRAM_SUB_BUCKET_BITS - 1))
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+// The phases a request is timed in.
+typedef enum
+{
+    // splitting the request into its tokens
+    PHASE_PARSE,
+    // executing the command, and building its reply
+    PHASE_EXECUTE,
+    // from the reply being built to its being written to the socket
+    PHASE_SEND,
+    PHASES_NUM
+} RequestPhase;
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * A counter written by a single thread, and read by any. Adding is a plain
+ * load and store, without a locked instruction.
+ */
+class Counter
+{
+public:
+    Counter();
+
+    /**
+     * Add to the counter. Only its thread calls it.
+     */
+    void add(uint64_t delta);
+
+    uint64_t get() const;
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+/**
+ * A histogram of latencies, in nanoseconds, in the manner of HdrHistogram:
+ * buckets are linear within each power of two, so that percentiles have a
+ * bounded relative error whatever their magnitude. Written by a single
+ * thread, and read by any.
+ */
+class Histogram
+{
+public:
+    Histogram();
+
+    /**
+     * Count a value. Only the histogram's thread calls it.
+     */
+    void record(uint64_t value);
+
+    /**
+     * Add the counts of another histogram (e.g. of another thread) to this
+     * one, which no other thread writes.
+     */
+    void add(const Histogram& other);
+
+    /**
+     * The number of values, their sum and the largest of them.
+     */
+    uint64_t get_count() const;
+    uint64_t get_total() const;
+    uint64_t get_max() const;
+
+    /**
+     * The value percentile percents of the values are at most (up to the
+     * width of its bucket). 0 if there are none.
+     */
+    uint64_t get_percentile(double percentile) const;
+
+    /**
+     * The count, mean, median, 90th, 99th and 99.9th percentiles and max, as
+     * a JSON object.
+     */
+    std::string to_json() const;
+
+private:
+    static size_t bucket_of(uint64_t value);
+
+    /**
+     * The largest value a bucket counts.
+     */
+    static uint64_t bucket_top(size_t bucket);
+
+    Counter counts[HISTOGRAM_BUCKETS];
+    Counter count;
+    Counter total;
+    std::atomic<uint64_t> max;
+};
+
+// The metrics of the requests of one kind (e.g. of one command).
+typedef struct
+{
+    Histogram phases[PHASES_NUM];
+    // requests whose reply was an error
+    Counter errors;
+} RequestMetrics;
+
+/**
+ * Counters and latency histograms of requests by kind, and counters of
+ * anything else, which each thread keeps on its own: a thread records to its
+ * own block of metrics, without a lock, and readers sum the blocks. A thread
+ * takes the mutex only to register its block, the first time it records.
+ */
+class Metrics
+{
+public:
+    Metrics(size_t kinds_num, size_t counters_num);
+
+    /**
+     * Destructor. Frees the blocks of all the threads; none may still record.
+     */
+    ~Metrics();
+
+    /**
+     * Record a request of a kind, which was parsed and executed in the given
+     * times, and whether its reply was an error.
+     */
+    void record_request(size_t kind, uint64_t parse_ns, uint64_t execute_ns,
+                        bool is_error);
+
+    /**
+     * Record the time the reply of a request of a kind took to be sent.
+     */
+    void record_send(size_t kind, uint64_t send_ns);
+
+    /**
+     * Add to a counter.
+     */
+    void add_to_counter(size_t counter, uint64_t delta);
+
+    /**
+     * Sum the metrics of a kind of request over all the threads into sum.
+     */
+    void get_requests(size_t kind, RequestMetrics& sum);
+
+    /**
+     * A counter, summed over all the threads.
+     */
+    uint64_t get_counter(size_t counter);
+
+private:
+    // the metrics one thread records
+    typedef struct
+    {
+        const Metrics* owner;
+        RequestMetrics* requests;
+        Counter* counters;
+    } ThreadMetrics;
+
+    /**
+     * The calling thread's block, registered on its first call.
+     */
+    ThreadMetrics* get_thread_metrics();
+
+    size_t kinds_num;
+    size_t counters_num;
+
+    // guards threads
+    pthread_mutex_t threads_mutex;
+    std::vector<ThreadMetrics*> threads;
+};
+
+#endif //EX5_METRICS_H
@@ -0,0 +1,355 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <algorithm>
+#include "NameTree.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+// names of a leaf, and children of an inner node, at most (a node which
+// outgrows it splits in two; nodes which shrink are not merged, so a tree is
+// as deep as the most names it had)
+#define NAME_TREE_FANOUT 32
+
+/**
+ * Whether a key sorts before a name, by bytes.
+ */
+static bool key_less(const std::string& key, StrRef name)
+{
+    return NameLess()(make_ref(key), name);
+}
+
+/**
+ * Whether a name sorts before a key, by bytes.
+ */
+static bool name_less(StrRef name, const std::string& key)
+{
+    return NameLess()(name, make_ref(key));
+}
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * Build a version of names, which are sorted by bytes and distinct: full
+ * leaves, and the levels above them, from the bottom up.
+ */
+NameTree::Ptr NameTree::build(const std::vector<StrRef>& names)
+{
+    if (names.empty())
+    {
+        return nullptr;
+    }
+
+    std::vector<Ptr> level;
+    for (size_t first = 0; first < names.size(); first += NAME_TREE_FANOUT)
+    {
+        std::shared_ptr<NameTree> leaf(new NameTree());
+        size_t end = std::min(first + NAME_TREE_FANOUT, names.size());
+        for (size_t i = first; i < end; i++)
+        {
+            leaf->keys.push_back(ref_to_string(names[i]));
+        }
+        leaf->join_keys();
+        level.push_back(leaf);
+    }
+
+    while (level.size() > 1)
+    {
+        std::vector<Ptr> upper;
+        for (size_t first = 0; first < level.size(); first += NAME_TREE_FANOUT)
+        {
+            std::shared_ptr<NameTree> node(new NameTree());
+            size_t end = std::min(first + NAME_TREE_FANOUT, level.size());
+            for (size_t i = first; i < end; i++)
+            {
+                node->keys.push_back(level[i]->keys.front());
+                node->children.push_back(level[i]);
+            }
+            upper.push_back(node);
+        }
+        level.swap(upper);
+    }
+    return level.front();
+}
+
+/**
+ * The version of a set with a name added (the set itself if it has it). A
+ * root which splits gets a new root above it.
+ */
+NameTree::Ptr NameTree::insert(const Ptr& tree, const std::string& name)
+{
+    if (tree == nullptr)
+    {
+        std::shared_ptr<NameTree> leaf(new NameTree());
+        leaf->keys.push_back(name);
+        leaf->join_keys();
+        return leaf;
+    }
+
+    Ptr left, right;
+    if (!insert_into(tree, name, left, right))
+    {
+        return tree;
+    }
+    if (right == nullptr)
+    {
+        return left;
+    }
+
+    std::shared_ptr<NameTree> root(new NameTree());
+    root->keys.push_back(left->keys.front());
+    root->keys.push_back(right->keys.front());
+    root->children.push_back(left);
+    root->children.push_back(right);
+    return root;
+}
+
+/**
+ * The version of a set with a name removed (the set itself if it does not
+ * have it). A root left with a single child is replaced by it.
+ */
+NameTree::Ptr NameTree::erase(const Ptr& tree, const std::string& name)
+{
+    if (tree == nullptr)
+    {
+        return tree;
+    }
+
+    Ptr erased = erase_from(tree, name);
+    while (erased != nullptr && erased->children.size() == 1)
+    {
+        erased = erased->children.front();
+    }
+    return erased;
+}
+
+/**
+ * Append the names which sort after after to out, separated by spaces, up to
+ * limit of them and within max_length bytes. Returns true if names were left
+ * out.
+ */
+bool NameTree::list_after(StrRef after, size_t limit, size_t max_length,
+                          std::string& out, std::string& last) const
+{
+    size_t listed = 0;
+    const std::string* last_listed = nullptr;
+    bool has_more = list_from(after, limit, max_length, out, listed,
+                              last_listed);
+    if (last_listed != nullptr)
+    {
+        last = *last_listed;
+    }
+    return has_more;
+}
+
+/**
+ * The index of the child whose names a name sorts among: the last one whose
+ * first name is not after it (or the first one).
+ */
+size_t NameTree::child_index(StrRef name) const
+{
+    size_t index = (size_t) (std::upper_bound(keys.begin(), keys.end(), name,
+                                              name_less) - keys.begin());
+    return index > 0 ? index - 1 : 0;
+}
+
+/**
+ * Add a name under a node: its leaf is copied with the name, and so is each
+ * node on the path to it, with its new child. A node past NAME_TREE_FANOUT
+ * entries gives its second half to a new node, right.
+ */
+bool NameTree::insert_into(const Ptr& node, const std::string& name,
+                           Ptr& left, Ptr& right)
+{
+    std::shared_ptr<NameTree> copy;
+    if (node->children.empty())
+    {
+        std::vector<std::string>::const_iterator position =
+                std::lower_bound(node->keys.begin(), node->keys.end(),
+                                 make_ref(name), key_less);
+        if (position != node->keys.end() && *position == name)
+        {
+            return false;
+        }
+
+        copy.reset(new NameTree(*node));
+        copy->keys.insert(copy->keys.begin() +
+                          (position - node->keys.begin()), name);
+    }
+    else
+    {
+        size_t index = node->child_index(make_ref(name));
+        Ptr child_left, child_right;
+        if (!insert_into(node->children[index], name, child_left,
+                         child_right))
+        {
+            return false;
+        }
+
+        copy.reset(new NameTree(*node));
+        copy->keys[index] = child_left->keys.front();
+        copy->children[index] = child_left;
+        if (child_right != nullptr)
+        {
+            copy->keys.insert(copy->keys.begin() + index + 1,
+                              child_right->keys.front());
+            copy->children.insert(copy->children.begin() + index + 1,
+                                  child_right);
+        }
+    }
+
+    right = nullptr;
+    if (copy->keys.size() > NAME_TREE_FANOUT)
+    {
+        size_t half = copy->keys.size() / 2;
+        std::shared_ptr<NameTree> split(new NameTree());
+        split->keys.assign(copy->keys.begin() + half, copy->keys.end());
+        copy->keys.resize(half);
+        if (!copy->children.empty())
+        {
+            split->children.assign(copy->children.begin() + half,
+                                   copy->children.end());
+            copy->children.resize(half);
+        }
+        else
+        {
+            split->join_keys();
+        }
+        right = split;
+    }
+    if (copy->children.empty())
+    {
+        copy->join_keys();
+    }
+    left = copy;
+    return true;
+}
+
+/**
+ * The version of a node without a name: its leaf is copied without the name,
+ * and so is each node on the path to it. A node left without entries is
+ * dropped from its parent.
+ */
+NameTree::Ptr NameTree::erase_from(const Ptr& node, const std::string& name)
+{
+    if (node->children.empty())
+    {
+        std::vector<std::string>::const_iterator position =
+                std::lower_bound(node->keys.begin(), node->keys.end(),
+                                 make_ref(name), key_less);
+        if (position == node->keys.end() || *position != name)
+        {
+            return node;
+        }
+        if (node->keys.size() == 1)
+        {
+            return nullptr;
+        }
+
+        std::shared_ptr<NameTree> copy(new NameTree(*node));
+        copy->keys.erase(copy->keys.begin() +
+                         (position - node->keys.begin()));
+        copy->join_keys();
+        return copy;
+    }
+
+    size_t index = node->child_index(make_ref(name));
+    Ptr child = erase_from(node->children[index], name);
+    if (child == node->children[index])
+    {
+        return node;
+    }
+    if (child == nullptr && node->children.size() == 1)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<NameTree> copy(new NameTree(*node));
+    if (child == nullptr)
+    {
+        copy->keys.erase(copy->keys.begin() + index);
+        copy->children.erase(copy->children.begin() + index);
+    }
+    else
+    {
+        copy->keys[index] = child->keys.front();
+        copy->children[index] = child;
+    }
+    return copy;
+}
+
+/**
+ * Append the names of a node after after: of a leaf from the first one after
+ * it, of an inner node from the child it sorts among on.
+ */
+bool NameTree::list_from(StrRef after, size_t limit, size_t max_length,
+                         std::string& out, size_t& listed,
+                         const std::string*& last) const
+{
+    if (!children.empty())
+    {
+        for (size_t index = child_index(after); index < children.size();
+             index++)
+        {
+            if (children[index]->list_from(after, limit, max_length, out,
+                                           listed, last))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::string>::const_iterator it =
+            std::upper_bound(keys.begin(), keys.end(), after, name_less);
+
+    // a leaf listed whole is appended at once
+    size_t delimiter = listed > 0 ? 1 : 0;
+    if (it == keys.begin() && listed + keys.size() <= limit &&
+        out.length() + delimiter + text.length() <= max_length)
+    {
+        if (listed > 0)
+        {
+            out += STRING_DELIMITER;
+        }
+        out += text;
+        last = &keys.back();
+        listed += keys.size();
+        return false;
+    }
+
+    for (; it != keys.end(); ++it)
+    {
+        if (listed == limit ||
+            (listed > 0 && out.length() + 1 + it->length() > max_length))
+        {
+            return true;
+        }
+        if (listed > 0)
+        {
+            out += STRING_DELIMITER;
+        }
+        out += *it;
+        last = &*it;
+        listed++;
+    }
+    return false;
+}
+
+/**
+ * Join the names of a leaf into its text.
+ */
+void NameTree::join_keys()
+{
+    text.clear();
+    for (auto const& key: keys)
+    {
+        if (!text.empty())
+        {
+            text += STRING_DELIMITER;
+        }
+        text += key;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef EX5_NAMETREE_H
+#define EX5_NAMETREE_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <memory>
+#include <string>
+#include <vector>
+#include "Utils.h"
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * A version of a set of names, sorted by bytes, which is never modified once
+ * it is built: adding or removing a name makes a new version, which copies
+ * only the nodes on the path to the name and shares the others with the
+ * previous version (a persistent B+ tree). So a writer publishes the next
+ * version in logarithmic time, and readers read whichever version they hold
+ * without any lock, while the versions they hold are kept alive by their
+ * references. A null version is the empty set.
+ */
+class NameTree
+{
+public:
+    typedef std::shared_ptr<const NameTree> Ptr;
+
+    /**
+     * Build a version of names, which are sorted by bytes and distinct.
+     */
+    static Ptr build(const std::vector<StrRef>& names);
+
+    /**
+     * The version of a set with a name added (the set itself if it has it).
+     */
+    static Ptr insert(const Ptr& tree, const std::string& name);
+
+    /**
+     * The version of a set with a name removed (the set itself if it does not
+     * have it).
+     */
+    static Ptr erase(const Ptr& tree, const std::string& name);
+
+    /**
+     * Append the names which sort after after to out, separated by spaces:
+     * up to limit of them, and only as many as keep out within max_length
+     * bytes (but at least one). last is set to the last name appended.
+     * Returns true if names were left out.
+     */
+    bool list_after(StrRef after, size_t limit, size_t max_length,
+                    std::string& out, std::string& last) const;
+
+private:
+    NameTree() = default;
+
+    /**
+     * The index of the child whose names a name sorts among.
+     */
+    size_t child_index(StrRef name) const;
+
+    /**
+     * Add a name under a node, making its new version, and the new node which
+     * split from it if it outgrew NAME_TREE_FANOUT (nullptr if none). Returns
+     * false if the node has the name.
+     */
+    static bool insert_into(const Ptr& node, const std::string& name,
+                            Ptr& left, Ptr& right);
+
+    /**
+     * The version of a node without a name: the node itself if it does not
+     * have it, nullptr if the name was its last.
+     */
+    static Ptr erase_from(const Ptr& node, const std::string& name);
+
+    /**
+     * Append the names of a node after after, as list_after does, counting
+     * the names appended in listed. Returns true once a name is left out.
+     */
+    bool list_from(StrRef after, size_t limit, size_t max_length,
+                   std::string& out, size_t& listed,
+                   const std::string*& last) const;
+
+    /**
+     * Join the names of a leaf into its text.
+     */
+    void join_keys();
+
+    // A leaf's names; for an inner node, the first name under each child.
+    std::vector<std::string> keys;
+    // a leaf's names separated by spaces, so that a whole leaf is listed at
+    // once
+    std::string text;
+    // empty for a leaf
+    std::vector<Ptr> children;
+};
+
+#endif //EX5_NAMETREE_H
@@ -0,0 +1,432 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <ctype.h>
+#include <algorithm>
+#include "SearchIndex.h"
+#include "Utils.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+// longer terms are cut to this many characters
+#define MAX_TERM_LENGTH 32
+// ends a word of a query which is a prefix
+#define PREFIX_WILDCARD '*'
+// a prefix stands for at most this many terms, and has at least this length
+#define MAX_PREFIX_TERMS 256
+#define MIN_PREFIX_LENGTH 2
+// ids of a block of a posting list
+#define POSTING_BLOCK_SIZE 128
+#define VARINT_DATA_BITS 7
+#define VARINT_MORE 0x80
+
+static void put_varint(std::string& out, uint32_t value)
+{
+    while (value >= VARINT_MORE)
+    {
+        out += (char) (value | VARINT_MORE);
+        value >>= VARINT_DATA_BITS;
+    }
+    out += (char) value;
+}
+
+static uint32_t get_varint(const std::string& in, size_t& position)
+{
+    uint32_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do
+    {
+        byte = (uint8_t) in[position++];
+        value |= (uint32_t) (byte & ~VARINT_MORE) << shift;
+        shift += VARINT_DATA_BITS;
+    } while (byte & VARINT_MORE);
+    return value;
+}
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+SearchIndex::SearchIndex()
+        :postings_size(0)
+{
+}
+
+/**
+ * Split text into terms: runs of ASCII letters and digits, lower cased, and
+ * cut to MAX_TERM_LENGTH characters.
+ */
+void SearchIndex::tokenize(const char* text, size_t length,
+                           std::vector<std::string>& terms)
+{
+    std::string term;
+    for (size_t i = 0; i <= length; i++)
+    {
+        unsigned char c = i < length ? (unsigned char) text[i] : ' ';
+        if (c < 0x80 && isalnum(c))
+        {
+            if (term.length() < MAX_TERM_LENGTH)
+            {
+                term += (char) tolower(c);
+            }
+        }
+        else if (!term.empty())
+        {
+            terms.push_back(term);
+            term.clear();
+        }
+    }
+}
+
+/**
+ * Split a query into its terms, as tokenize does. A word of the query which
+ * ends with PREFIX_WILDCARD makes its last term a prefix, which keeps the
+ * wildcard.
+ */
+void SearchIndex::parse_query(const char* query, size_t length,
+                              std::vector<std::string>& terms)
+{
+    size_t start = 0;
+    while (start < length)
+    {
+        const char* found = (const char*) memchr(query + start,
+                                                 STRING_DELIMITER,
+                                                 length - start);
+        size_t end = found == nullptr ? length : (size_t) (found - query);
+
+        size_t word_length = end - start;
+        bool is_prefix = word_length > 0 &&
+                         query[end - 1] == PREFIX_WILDCARD;
+        size_t terms_num = terms.size();
+        tokenize(query + start, word_length - (is_prefix ? 1 : 0), terms);
+        if (is_prefix && terms.size() > terms_num)
+        {
+            terms.back() += PREFIX_WILDCARD;
+        }
+        start = end + 1;
+    }
+}
+
+/**
+ * Add the terms of an event, whose id is larger than any added before. A term
+ * repeated in them is added once.
+ */
+void SearchIndex::add(int event_id, const std::vector<std::string>& terms)
+{
+    for (auto const& term: terms)
+    {
+        PostingList& list = postings[term];
+        if (list.ids_num > 0 && list.last_id == event_id)
+        {
+            continue;
+        }
+
+        size_t size = list.bytes.size();
+        if (list.ids_num == 0 || list.last_block_ids == POSTING_BLOCK_SIZE)
+        {
+            PostingBlock block;
+            block.first_id = event_id;
+            block.offset = (uint32_t) list.bytes.size();
+            list.blocks.push_back(block);
+            list.last_block_ids = 1;
+            postings_size += sizeof(block);
+        }
+        else
+        {
+            put_varint(list.bytes, (uint32_t) (event_id - list.last_id));
+            list.last_block_ids++;
+        }
+        list.last_id = event_id;
+        list.ids_num++;
+        postings_size += list.bytes.size() - size;
+    }
+}
+
+/**
+ * Put the posting lists of an index of older events (whose ids are all smaller
+ * than the ones of this index) before this index's. older is emptied.
+ */
+void SearchIndex::prepend(SearchIndex& older)
+{
+    for (auto& older_entry: older.postings)
+    {
+        PostingList& older_list = older_entry.second;
+        std::map<std::string, PostingList>::iterator newer =
+                postings.find(older_entry.first);
+        if (newer == postings.end())
+        {
+            postings[older_entry.first] = std::move(older_list);
+            continue;
+        }
+
+        // the newer blocks follow the older ones, each keeping its own size
+        PostingList& list = newer->second;
+        uint32_t shift = (uint32_t) older_list.bytes.size();
+        for (auto const& block: list.blocks)
+        {
+            PostingBlock shifted = block;
+            shifted.offset += shift;
+            older_list.blocks.push_back(shifted);
+        }
+        older_list.bytes += list.bytes;
+        list.bytes.swap(older_list.bytes);
+        list.blocks.swap(older_list.blocks);
+        list.ids_num += older_list.ids_num;
+    }
+
+    postings_size += older.postings_size;
+    older.postings.clear();
+    older.postings_size = 0;
+}
+
+/**
+ * The ids of up to limit events which have every term of a query, newest
+ * first. Returns FAILURE if a prefix is shorter than MIN_PREFIX_LENGTH or
+ * starts more than MAX_PREFIX_TERMS terms.
+ */
+int SearchIndex::search(const std::vector<std::string>& query, size_t limit,
+                        std::vector<int>& event_ids) const
+{
+    event_ids.clear();
+    if (query.empty() || limit == 0)
+    {
+        return SUCCESS;
+    }
+
+    // the lists of each term, and the term with the fewest ids, whose ids are
+    // the candidates
+    std::vector<std::vector<const PostingList*> > terms_lists(query.size());
+    size_t driver = 0;
+    uint64_t driver_ids = UINT64_MAX;
+    for (size_t i = 0; i < query.size(); i++)
+    {
+        if (!find_lists(query[i], terms_lists[i]))
+        {
+            return FAILURE;
+        }
+
+        uint64_t ids_num = 0;
+        for (auto const& list: terms_lists[i])
+        {
+            ids_num += list->ids_num;
+        }
+        if (ids_num == 0)
+        {
+            return SUCCESS;
+        }
+        if (ids_num < driver_ids)
+        {
+            driver = i;
+            driver_ids = ids_num;
+        }
+    }
+
+    // The candidates are the ids of the driver's lists (several for a
+    // prefix), merged newest first: each list is read from its newest block
+    // back, and the heap has the next id of each list, so the search decodes
+    // the blocks it needs and stops once it found enough.
+    std::vector<ListReader> readers(terms_lists[driver].size());
+    std::vector<std::pair<int, size_t> > heads;
+    heads.reserve(readers.size());
+    for (size_t i = 0; i < readers.size(); i++)
+    {
+        readers[i].list = terms_lists[driver][i];
+        readers[i].block = readers[i].list->blocks.size();
+        readers[i].left = 0;
+        int event_id;
+        if (read_back(readers[i], event_id))
+        {
+            heads.push_back(std::make_pair(event_id, i));
+        }
+    }
+    std::make_heap(heads.begin(), heads.end());
+
+    std::vector<int> scratch;
+    bool has_previous = false;
+    int previous_id = 0;
+    while (!heads.empty() && event_ids.size() < limit)
+    {
+        std::pop_heap(heads.begin(), heads.end());
+        int event_id = heads.back().first;
+        if (read_back(readers[heads.back().second], heads.back().first))
+        {
+            std::push_heap(heads.begin(), heads.end());
+        }
+        else
+        {
+            heads.pop_back();
+        }
+
+        // an event may have several of the terms of a prefix
+        if (has_previous && event_id == previous_id)
+        {
+            continue;
+        }
+        has_previous = true;
+        previous_id = event_id;
+
+        if (matches_others(terms_lists, driver, event_id, scratch))
+        {
+            event_ids.push_back(event_id);
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * The number of terms.
+ */
+size_t SearchIndex::get_terms_num() const
+{
+    return postings.size();
+}
+
+/**
+ * The bytes of the posting lists.
+ */
+uint64_t SearchIndex::get_postings_size() const
+{
+    return postings_size;
+}
+
+/**
+ * Decode the ids of a block of a list, in increasing order.
+ */
+void SearchIndex::decode_block(const PostingList& list, size_t block,
+                               std::vector<int>& ids)
+{
+    size_t position = list.blocks[block].offset;
+    size_t end = block + 1 < list.blocks.size() ?
+                 list.blocks[block + 1].offset : list.bytes.size();
+
+    int event_id = list.blocks[block].first_id;
+    ids.clear();
+    ids.push_back(event_id);
+    while (position < end)
+    {
+        event_id += (int) get_varint(list.bytes, position);
+        ids.push_back(event_id);
+    }
+}
+
+/**
+ * Read the next id of a list, going back. A block is decoded once the reader
+ * gets to it. Returns false once the oldest id was read.
+ */
+bool SearchIndex::read_back(ListReader& reader, int& event_id)
+{
+    if (reader.left == 0)
+    {
+        if (reader.block == 0)
+        {
+            return false;
+        }
+        reader.block--;
+        decode_block(*reader.list, reader.block, reader.ids);
+        reader.left = reader.ids.size();
+    }
+
+    event_id = reader.ids[--reader.left];
+    return true;
+}
+
+/**
+ * Whether an event has every term of a query but the driver's: for each term,
+ * one of its lists has the event.
+ */
+bool SearchIndex::matches_others(
+        const std::vector<std::vector<const PostingList*> >& terms_lists,
+        size_t driver, int event_id, std::vector<int>& scratch)
+{
+    for (size_t term = 0; term < terms_lists.size(); term++)
+    {
+        if (term == driver)
+        {
+            continue;
+        }
+
+        bool is_match = false;
+        for (auto const& list: terms_lists[term])
+        {
+            if (contains(*list, event_id, scratch))
+            {
+                is_match = true;
+                break;
+            }
+        }
+        if (!is_match)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Whether a list has an id. Only the block which may have it is decoded.
+ */
+bool SearchIndex::contains(const PostingList& list, int event_id,
+                           std::vector<int>& scratch)
+{
+    if (list.ids_num == 0 || event_id < list.blocks[0].first_id ||
+        event_id > list.last_id)
+    {
+        return false;
+    }
+
+    // the last block starting at or before the id
+    size_t low = 0, high = list.blocks.size();
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+        if (list.blocks[middle].first_id <= event_id)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    decode_block(list, low, scratch);
+    return std::binary_search(scratch.begin(), scratch.end(), event_id);
+}
+
+/**
+ * The lists a query term stands for: its own, or for a prefix, the lists of
+ * the terms it starts. Returns false if the prefix is too broad.
+ */
+bool SearchIndex::find_lists(const std::string& term,
+                             std::vector<const PostingList*>& lists) const
+{
+    if (term.empty() || term[term.length() - 1] != PREFIX_WILDCARD)
+    {
+        std::map<std::string, PostingList>::const_iterator it =
+                postings.find(term);
+        if (it != postings.end())
+        {
+            lists.push_back(&it->second);
+        }
+        return true;
+    }
+
+    std::string prefix = term.substr(0, term.length() - 1);
+    if (prefix.length() < MIN_PREFIX_LENGTH)
+    {
+        return false;
+    }
+    for (std::map<std::string, PostingList>::const_iterator it =
+                 postings.lower_bound(prefix);
+         it != postings.end() && it->first.compare(0, prefix.length(),
+                                                   prefix) == 0; ++it)
+    {
+        if (lists.size() == MAX_PREFIX_TERMS)
+        {
+            return false;
+        }
+        lists.push_back(&it->second);
+    }
+    return true;
+}
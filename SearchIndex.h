@@ -0,0 +1,135 @@
+#ifndef EX5_SEARCHINDEX_H
+#define EX5_SEARCHINDEX_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * An inverted index of the words of events: for each term, the ids of the
+ * events it appears in. Ids are added in increasing order, so a posting list
+ * is stored as the deltas between consecutive ids, each a varint (7 bits a
+ * byte), in blocks whose first id and offset are kept aside: a list is
+ * searched by block, and read from its newest block back. Not thread safe:
+ * the owner of the index guards it.
+ */
+class SearchIndex
+{
+public:
+    SearchIndex();
+
+    /**
+     * Split text into terms: runs of ASCII letters and digits, lower cased,
+     * and cut to MAX_TERM_LENGTH characters.
+     */
+    static void tokenize(const char* text, size_t length,
+                         std::vector<std::string>& terms);
+
+    /**
+     * Split a query into its terms, as tokenize does. A word of the query
+     * which ends with PREFIX_WILDCARD makes its last term a prefix, which
+     * keeps the wildcard.
+     */
+    static void parse_query(const char* query, size_t length,
+                            std::vector<std::string>& terms);
+
+    /**
+     * Add the terms of an event, whose id is larger than any added before.
+     * A term repeated in them is added once.
+     */
+    void add(int event_id, const std::vector<std::string>& terms);
+
+    /**
+     * Put the posting lists of an index of older events (whose ids are all
+     * smaller than the ones of this index) before this index's. older is
+     * emptied.
+     */
+    void prepend(SearchIndex& older);
+
+    /**
+     * The ids of up to limit events which have every term of a query, newest
+     * first. Returns FAILURE if a prefix is shorter than MIN_PREFIX_LENGTH or
+     * starts more than MAX_PREFIX_TERMS terms.
+     */
+    int search(const std::vector<std::string>& query, size_t limit,
+               std::vector<int>& event_ids) const;
+
+    /**
+     * The number of terms, and the bytes of their posting lists.
+     */
+    size_t get_terms_num() const;
+    uint64_t get_postings_size() const;
+
+private:
+    typedef struct
+    {
+        int first_id;
+        uint32_t offset;
+    } PostingBlock;
+
+    // The ids of the events a term appears in. A block's first id is kept in
+    // blocks, and the rest of its ids as deltas in bytes.
+    typedef struct
+    {
+        std::string bytes;
+        std::vector<PostingBlock> blocks;
+        int last_id;
+        uint32_t last_block_ids;
+        uint32_t ids_num;
+    } PostingList;
+
+    // A list read from its newest id back: the block read last, its ids,
+    // and how many of them are left to read.
+    typedef struct
+    {
+        const PostingList* list;
+        size_t block;
+        std::vector<int> ids;
+        size_t left;
+    } ListReader;
+
+    /**
+     * Decode the ids of a block of a list, in increasing order.
+     */
+    static void decode_block(const PostingList& list, size_t block,
+                             std::vector<int>& ids);
+
+    /**
+     * Read the next id of a list, going back. A block is decoded once the
+     * reader gets to it. Returns false once the oldest id was read.
+     */
+    static bool read_back(ListReader& reader, int& event_id);
+
+    /**
+     * Whether an event has every term of a query but the driver's (whose
+     * lists it was read from).
+     */
+    static bool matches_others(
+            const std::vector<std::vector<const PostingList*> >& terms_lists,
+            size_t driver, int event_id, std::vector<int>& scratch);
+
+    /**
+     * Whether a list has an id. Only the block which may have it is decoded.
+     */
+    static bool contains(const PostingList& list, int event_id,
+                         std::vector<int>& scratch);
+
+    /**
+     * The lists a query term stands for: its own, or for a prefix, the lists
+     * of the terms it starts. Returns false if the prefix is too broad.
+     */
+    bool find_lists(const std::string& term,
+                    std::vector<const PostingList*>& lists) const;
+
+    std::map<std::string, PostingList> postings;
+    uint64_t postings_size;
+};
+
+#endif //EX5_SEARCHINDEX_H
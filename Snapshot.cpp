@@ -0,0 +1,478 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Snapshot.h"
+#include "WriteAheadLog.h"
+#include "Utils.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+#define SNAPSHOT_MAGIC "EMSNAP\0\0"
+#define SNAPSHOT_VERSION 1
+// each section is written once it buffered this many bytes
+#define SNAPSHOT_BUFFER_SIZE (1 << 20)
+#define SECTION_ALIGNMENT 8
+
+static uint64_t align_section(uint64_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) &
+           ~(uint64_t) (SECTION_ALIGNMENT - 1);
+}
+
+/**
+ * The size of each section of a snapshot.
+ */
+static void get_section_sizes(const SnapshotHeader& header,
+                              uint64_t sizes[SNAPSHOT_SECTIONS])
+{
+    sizes[SECTION_CLIENTS] = header.clients_num * sizeof(SnapshotClient);
+    sizes[SECTION_EVENTS] = header.events_num * sizeof(SnapshotEvent);
+    sizes[SECTION_EVENT_RSVPS] = header.rsvps_num * sizeof(uint32_t);
+    sizes[SECTION_CLIENT_RSVPS] = header.rsvps_num * sizeof(uint32_t);
+    sizes[SECTION_HEAP] = header.heap_size;
+}
+
+/**
+ * Whether [offset, offset + length) is within [0, limit).
+ */
+static bool is_within(uint64_t offset, uint64_t length, uint64_t limit)
+{
+    return offset <= limit && length <= limit - offset;
+}
+
+/**
+ * Write all of data to a file, at offset.
+ */
+static int pwrite_all(int fd, const char* data, size_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t written = pwrite(fd, data, length, (off_t) offset);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return FAILURE;
+        }
+        data += written;
+        length -= (size_t) written;
+        offset += (uint64_t) written;
+    }
+    return SUCCESS;
+}
+
+//==============================================================================
+//============================= SNAPSHOT WRITER ================================
+//==============================================================================
+SnapshotWriter::SnapshotWriter(const std::string& dir)
+        :dir(dir),
+         temp_path(WriteAheadLog::snapshot_path(dir) + SNAPSHOT_TEMP_SUFFIX),
+         fd(FAILURE),
+         is_failed(false),
+         next_client_rsvp(0),
+         next_event_rsvp(0),
+         next_text(0)
+{
+    memset(&header, 0, sizeof(header));
+    memset(section_positions, 0, sizeof(section_positions));
+    memset(section_ends, 0, sizeof(section_ends));
+}
+
+/**
+ * Destructor. Removes the temporary file if the snapshot was not committed.
+ */
+SnapshotWriter::~SnapshotWriter()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        unlink(temp_path.c_str());
+    }
+}
+
+/*
+ * Create the temporary file, for a snapshot of the given size.
+ */
+int SnapshotWriter::open(uint64_t generation, uint32_t clients_num,
+                         uint32_t events_num, uint64_t rsvps_num,
+                         uint64_t heap_size)
+{
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.generation = generation;
+    header.clients_num = clients_num;
+    header.events_num = events_num;
+    header.rsvps_num = rsvps_num;
+    header.heap_size = heap_size;
+
+    uint64_t sizes[SNAPSHOT_SECTIONS];
+    get_section_sizes(header, sizes);
+
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (int section = 0; section < SNAPSHOT_SECTIONS; section++)
+    {
+        offset = align_section(offset);
+        header.section_offsets[section] = offset;
+        section_positions[section] = offset;
+        section_ends[section] = offset + sizes[section];
+        section_buffers[section].reserve(SNAPSHOT_BUFFER_SIZE);
+        offset += sizes[section];
+    }
+
+    fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return FAILURE;
+    }
+
+    // the padding between the sections is left as a hole
+    return ftruncate(fd, (off_t) offset) < 0 ? FAILURE : SUCCESS;
+}
+
+/**
+ * Add a client, followed by rsvps_num calls to add_client_rsvp.
+ */
+void SnapshotWriter::add_client(const char* name, uint32_t name_length,
+                                uint32_t rsvps_num)
+{
+    SnapshotClient client;
+    client.name_offset = next_text;
+    client.rsvps_begin = next_client_rsvp;
+    client.name_length = name_length;
+    client.rsvps_num = rsvps_num;
+
+    append(SECTION_CLIENTS, &client, sizeof(client));
+    append(SECTION_HEAP, name, name_length);
+    next_text += name_length;
+    next_client_rsvp += rsvps_num;
+}
+
+void SnapshotWriter::add_client_rsvp(uint32_t event_index)
+{
+    append(SECTION_CLIENT_RSVPS, &event_index, sizeof(event_index));
+}
+
+/**
+ * Add an event, followed by rsvps_num calls to add_event_rsvp.
+ */
+void SnapshotWriter::add_event(const char* title, uint32_t title_length,
+                               const char* date, uint32_t date_length,
+                               const char* description,
+                               uint32_t description_length, uint32_t rsvps_num)
+{
+    SnapshotEvent event;
+    event.text_offset = next_text;
+    event.rsvps_begin = next_event_rsvp;
+    event.title_length = title_length;
+    event.date_length = date_length;
+    event.description_length = description_length;
+    event.rsvps_num = rsvps_num;
+
+    append(SECTION_EVENTS, &event, sizeof(event));
+    append(SECTION_HEAP, title, title_length);
+    append(SECTION_HEAP, date, date_length);
+    append(SECTION_HEAP, description, description_length);
+    next_text += (uint64_t) title_length + date_length + description_length;
+    next_event_rsvp += rsvps_num;
+}
+
+void SnapshotWriter::add_event_rsvp(uint32_t client_index)
+{
+    append(SECTION_EVENT_RSVPS, &client_index, sizeof(client_index));
+}
+
+/**
+ * Sync the snapshot and put it in place of the previous one.
+ */
+int SnapshotWriter::commit()
+{
+    for (int section = 0; section < SNAPSHOT_SECTIONS; section++)
+    {
+        flush(section);
+        if (section_positions[section] != section_ends[section])
+        {
+            is_failed = true;
+        }
+    }
+    if (is_failed)
+    {
+        return FAILURE;
+    }
+
+    header.header_crc = crc32(&header, sizeof(header));
+    if (pwrite_all(fd, (const char*) &header, sizeof(header), 0) == FAILURE ||
+        fsync(fd) < 0 || ::close(fd) < 0)
+    {
+        return FAILURE;
+    }
+    fd = FAILURE;
+
+    if (rename(temp_path.c_str(),
+               WriteAheadLog::snapshot_path(dir).c_str()) < 0)
+    {
+        unlink(temp_path.c_str());
+        return FAILURE;
+    }
+
+    // make the rename itself durable
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Append bytes to a section, writing its buffer once it is full.
+ */
+void SnapshotWriter::append(int section, const void* data, size_t length)
+{
+    std::string& buffer = section_buffers[section];
+    if (!is_within(section_positions[section], buffer.length() + length,
+                   section_ends[section]))
+    {
+        // more records than open was told of
+        is_failed = true;
+        return;
+    }
+
+    header.section_crcs[section] = crc32(data, length,
+                                         header.section_crcs[section]);
+    buffer.append((const char*) data, length);
+    if (buffer.length() >= SNAPSHOT_BUFFER_SIZE)
+    {
+        flush(section);
+    }
+}
+
+/**
+ * Write the buffered bytes of a section at its offset.
+ */
+void SnapshotWriter::flush(int section)
+{
+    std::string& buffer = section_buffers[section];
+    if (!is_failed && pwrite_all(fd, buffer.data(), buffer.length(),
+                                 section_positions[section]) == FAILURE)
+    {
+        is_failed = true;
+    }
+    section_positions[section] += buffer.length();
+    buffer.clear();
+}
+
+//==============================================================================
+//============================= SNAPSHOT READER ================================
+//==============================================================================
+SnapshotReader::SnapshotReader()
+        :data(nullptr),
+         size(0),
+         header(nullptr),
+         clients(nullptr),
+         events(nullptr),
+         event_rsvps(nullptr),
+         client_rsvps(nullptr),
+         heap(nullptr)
+{
+}
+
+/**
+ * Destructor. Unmaps the snapshot.
+ */
+SnapshotReader::~SnapshotReader()
+{
+    if (data != nullptr)
+    {
+        munmap((void*) data, size);
+    }
+}
+
+/*
+ * Map and validate a snapshot.
+ */
+int SnapshotReader::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return FAILURE;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0)
+    {
+        ::close(fd);
+        return FAILURE;
+    }
+    size = (size_t) file_stat.st_size;
+    if (size < sizeof(SnapshotHeader))
+    {
+        ::close(fd);
+        errno = (size < sizeof(header->magic)) ? EINVAL : EBADMSG;
+        return FAILURE;
+    }
+
+    data = (const char*) mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        data = nullptr;
+        return FAILURE;
+    }
+
+    header = (const SnapshotHeader*) data;
+    int error = 0;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION)
+    {
+        error = EINVAL;
+    }
+    else if (!is_valid())
+    {
+        error = EBADMSG;
+    }
+    if (error != 0)
+    {
+        munmap((void*) data, size);
+        data = nullptr;
+        errno = error;
+        return FAILURE;
+    }
+
+    const uint64_t* offsets = header->section_offsets;
+    clients = (const SnapshotClient*) (data + offsets[SECTION_CLIENTS]);
+    events = (const SnapshotEvent*) (data + offsets[SECTION_EVENTS]);
+    event_rsvps = (const uint32_t*) (data + offsets[SECTION_EVENT_RSVPS]);
+    client_rsvps = (const uint32_t*) (data + offsets[SECTION_CLIENT_RSVPS]);
+    heap = data + offsets[SECTION_HEAP];
+    return SUCCESS;
+}
+
+uint64_t SnapshotReader::get_generation() const
+{
+    return header->generation;
+}
+
+uint32_t SnapshotReader::get_clients_num() const
+{
+    return header->clients_num;
+}
+
+uint32_t SnapshotReader::get_events_num() const
+{
+    return header->events_num;
+}
+
+/**
+ * The records of the snapshot, their RSVPs, and their strings.
+ */
+const SnapshotClient& SnapshotReader::get_client(uint32_t index) const
+{
+    return clients[index];
+}
+
+const SnapshotEvent& SnapshotReader::get_event(uint32_t index) const
+{
+    return events[index];
+}
+
+const uint32_t* SnapshotReader::get_client_rsvps(
+        const SnapshotClient& client) const
+{
+    return client_rsvps + client.rsvps_begin;
+}
+
+const uint32_t* SnapshotReader::get_event_rsvps(
+        const SnapshotEvent& event) const
+{
+    return event_rsvps + event.rsvps_begin;
+}
+
+const char* SnapshotReader::get_text(uint64_t offset) const
+{
+    return heap + offset;
+}
+
+/**
+ * Whether the header, the checksums and every offset and index of the records
+ * are consistent with the file's size.
+ */
+bool SnapshotReader::is_valid() const
+{
+    SnapshotHeader unchecked = *header;
+    unchecked.header_crc = 0;
+    if (crc32(&unchecked, sizeof(unchecked)) != header->header_crc ||
+        header->rsvps_num > size / sizeof(uint32_t) || header->heap_size > size)
+    {
+        return false;
+    }
+
+    uint64_t sizes[SNAPSHOT_SECTIONS];
+    get_section_sizes(*header, sizes);
+
+    // the sections follow each other, aligned, within the file
+    uint64_t end = sizeof(SnapshotHeader);
+    for (int section = 0; section < SNAPSHOT_SECTIONS; section++)
+    {
+        uint64_t offset = header->section_offsets[section];
+        if (offset < end || offset % SECTION_ALIGNMENT != 0 ||
+            !is_within(offset, sizes[section], size) ||
+            crc32(data + offset, sizes[section]) !=
+            header->section_crcs[section])
+        {
+            return false;
+        }
+        end = offset + sizes[section];
+    }
+
+    const uint64_t* offsets = header->section_offsets;
+    const SnapshotClient* stored_clients =
+            (const SnapshotClient*) (data + offsets[SECTION_CLIENTS]);
+    const SnapshotEvent* stored_events =
+            (const SnapshotEvent*) (data + offsets[SECTION_EVENTS]);
+    const uint32_t* stored_event_rsvps =
+            (const uint32_t*) (data + offsets[SECTION_EVENT_RSVPS]);
+    const uint32_t* stored_client_rsvps =
+            (const uint32_t*) (data + offsets[SECTION_CLIENT_RSVPS]);
+
+    for (uint32_t i = 0; i < header->clients_num; i++)
+    {
+        const SnapshotClient& client = stored_clients[i];
+        if (!is_within(client.name_offset, client.name_length,
+                       header->heap_size) ||
+            !is_within(client.rsvps_begin, client.rsvps_num,
+                       header->rsvps_num))
+        {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->events_num; i++)
+    {
+        const SnapshotEvent& event = stored_events[i];
+        uint64_t text_length = (uint64_t) event.title_length +
+                               event.date_length + event.description_length;
+        if (!is_within(event.text_offset, text_length, header->heap_size) ||
+            !is_within(event.rsvps_begin, event.rsvps_num, header->rsvps_num))
+        {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->rsvps_num; i++)
+    {
+        if (stored_event_rsvps[i] >= header->clients_num ||
+            stored_client_rsvps[i] >= header->events_num)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
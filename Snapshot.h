@@ -0,0 +1,201 @@
+#ifndef EX5_SNAPSHOT_H
+#define EX5_SNAPSHOT_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <stdint.h>
+#include <string>
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+// A snapshot is a header followed by sections of fixed width records, which
+// are used in place once the file is mapped. Integers are in the byte order of
+// the host (so a snapshot of another order has an unknown version). Each
+// section starts at a multiple of 8 bytes.
+typedef enum
+{
+    // SnapshotClient[clients_num]
+    SECTION_CLIENTS,
+    // SnapshotEvent[events_num]
+    SECTION_EVENTS,
+    // uint32_t[rsvps_num]: indices of the clients which RSVP'ed to each
+    // event, the event's entries being contiguous
+    SECTION_EVENT_RSVPS,
+    // uint32_t[rsvps_num]: indices of the events each client RSVP'ed to
+    SECTION_CLIENT_RSVPS,
+    // the characters of the names, titles, dates and descriptions
+    SECTION_HEAP,
+    SNAPSHOT_SECTIONS
+} SnapshotSection;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    // CRC-32 of the header, with this field set to 0
+    uint32_t header_crc;
+    // the last generation of the write-ahead log the snapshot covers
+    uint64_t generation;
+    uint32_t clients_num;
+    // the event at index i has the id FIRST_EVENT_ID + i
+    uint32_t events_num;
+    uint64_t rsvps_num;
+    uint64_t heap_size;
+    uint64_t section_offsets[SNAPSHOT_SECTIONS];
+    uint32_t section_crcs[SNAPSHOT_SECTIONS];
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct
+{
+    uint64_t name_offset;
+    uint64_t rsvps_begin;
+    uint32_t name_length;
+    uint32_t rsvps_num;
+} SnapshotClient;
+
+typedef struct
+{
+    // the title, date and description follow each other in the heap
+    uint64_t text_offset;
+    uint64_t rsvps_begin;
+    uint32_t title_length;
+    uint32_t date_length;
+    uint32_t description_length;
+    uint32_t rsvps_num;
+} SnapshotEvent;
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * Writes a snapshot to a temporary file, which replaces the previous snapshot
+ * only once it is complete and synced to the disk. The size of each section is
+ * given up front, and the records are added in order: the clients with the
+ * events they RSVP'ed to, and the events with the clients which RSVP'ed to
+ * them. Each section is buffered and written at its own offset, so the
+ * records of different sections may be added in any order.
+ */
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(const std::string& dir);
+
+    /**
+     * Destructor. Removes the temporary file if the snapshot was not
+     * committed.
+     */
+    ~SnapshotWriter();
+
+    /*
+     * Create the temporary file, for a snapshot of the given size.
+     */
+    int open(uint64_t generation, uint32_t clients_num, uint32_t events_num,
+             uint64_t rsvps_num, uint64_t heap_size);
+
+    /**
+     * Add a client, followed by rsvps_num calls to add_client_rsvp.
+     */
+    void add_client(const char* name, uint32_t name_length,
+                    uint32_t rsvps_num);
+    void add_client_rsvp(uint32_t event_index);
+
+    /**
+     * Add an event, followed by rsvps_num calls to add_event_rsvp.
+     */
+    void add_event(const char* title, uint32_t title_length,
+                   const char* date, uint32_t date_length,
+                   const char* description, uint32_t description_length,
+                   uint32_t rsvps_num);
+    void add_event_rsvp(uint32_t client_index);
+
+    /**
+     * Sync the snapshot and put it in place of the previous one. Fails if
+     * anything was not written, or if the records added do not fill the
+     * sizes given to open.
+     */
+    int commit();
+
+private:
+    /**
+     * Append bytes to a section, writing its buffer once it is full.
+     */
+    void append(int section, const void* data, size_t length);
+
+    /**
+     * Write the buffered bytes of a section at its offset.
+     */
+    void flush(int section);
+
+    std::string dir;
+    std::string temp_path;
+    int fd;
+    // a write failed
+    bool is_failed;
+
+    SnapshotHeader header;
+    // where the next records of each section go, and their buffers
+    uint64_t section_positions[SNAPSHOT_SECTIONS];
+    uint64_t section_ends[SNAPSHOT_SECTIONS];
+    std::string section_buffers[SNAPSHOT_SECTIONS];
+    // where the RSVPs of the next client and event, and the next string, go
+    uint64_t next_client_rsvp;
+    uint64_t next_event_rsvp;
+    uint64_t next_text;
+};
+
+/**
+ * A snapshot mapped to memory. Its records are validated when it is opened,
+ * and then read in place, without being parsed or copied. The mapping is kept
+ * until the reader is destroyed, even if the file is replaced meanwhile.
+ */
+class SnapshotReader
+{
+public:
+    SnapshotReader();
+
+    /**
+     * Destructor. Unmaps the snapshot.
+     */
+    ~SnapshotReader();
+
+    /*
+     * Map and validate a snapshot. Returns FAILURE, with errno set to ENOENT
+     * if there is none, EINVAL if it is not in this format (e.g. it was
+     * written by an older version) and EBADMSG if it is corrupt.
+     */
+    int open(const std::string& path);
+
+    uint64_t get_generation() const;
+    uint32_t get_clients_num() const;
+    uint32_t get_events_num() const;
+
+    /**
+     * The records of the snapshot, their RSVPs, and their strings.
+     */
+    const SnapshotClient& get_client(uint32_t index) const;
+    const SnapshotEvent& get_event(uint32_t index) const;
+    const uint32_t* get_client_rsvps(const SnapshotClient& client) const;
+    const uint32_t* get_event_rsvps(const SnapshotEvent& event) const;
+    const char* get_text(uint64_t offset) const;
+
+private:
+    /**
+     * Whether the header, the checksums and every offset and index of the
+     * records are consistent with the file's size.
+     */
+    bool is_valid() const;
+
+    const char* data;
+    size_t size;
+    const SnapshotHeader* header;
+    const SnapshotClient* clients;
+    const SnapshotEvent* events;
+    const uint32_t* event_rsvps;
+    const uint32_t* client_rsvps;
+    const char* heap;
+};
+
+#endif //EX5_SNAPSHOT_H
@@ -0,0 +1,342 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <sys/syscall.h>
+#include <fstream>
+#include "Trace.h"
+#include "Utils.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+#define TRACE_TEMP_SUFFIX ".tmp"
+#define DEFAULT_THREAD_NAME "thread"
+// Chrome trace events count microseconds
+#define NS_IN_TRACE_UNIT 1000.0
+#define TRACE_TIME_SIZE 32
+
+// A span, as a thread recorded it.
+typedef struct
+{
+    const char* name;
+    uint64_t trace_id;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    // shown on a track of the request rather than of the thread
+    bool is_async;
+} TraceRecord;
+
+// A slot of a thread's ring, which holds the span recorded n-th while its
+// sequence is 2n + 2 (0 while it holds none). The thread makes the sequence
+// odd before it overwrites the slot, and its fields are stored and loaded in
+// release and acquire order, so a reader which finds the same even sequence
+// before and after loading them loaded a whole span.
+typedef struct
+{
+    std::atomic<uint64_t> sequence;
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> trace_id;
+    std::atomic<uint64_t> start_ns;
+    std::atomic<uint64_t> end_ns;
+    std::atomic<bool> is_async;
+} TraceSlot;
+
+// The spans of a thread: a ring of the newest TRACE_BUFFER_SPANS of them,
+// which only the thread writes to, and the number of spans it recorded. A
+// reader may read the ring at any time.
+typedef struct
+{
+    long tid;
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> count;
+    TraceSlot* slots;
+} TraceBuffer;
+
+std::atomic<bool> is_tracing(false);
+
+static std::atomic<uint32_t> sample_every(0);
+static std::atomic<uint64_t> next_trace_id(1);
+
+// guards buffers
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TraceBuffer*> buffers;
+
+// the buffer of the calling thread, its name, the requests it sampled from,
+// and the traced request it works on (0 if none)
+static thread_local TraceBuffer* thread_buffer = nullptr;
+static thread_local const char* thread_name = DEFAULT_THREAD_NAME;
+static thread_local uint32_t thread_requests = 0;
+static thread_local uint64_t thread_trace_id = 0;
+
+/**
+ * The calling thread's buffer, registered on its first call.
+ */
+static TraceBuffer* get_thread_buffer()
+{
+    if (thread_buffer != nullptr)
+    {
+        return thread_buffer;
+    }
+
+    TraceBuffer* buffer = new TraceBuffer;
+    buffer->tid = syscall(SYS_gettid);
+    buffer->name = thread_name;
+    buffer->count = 0;
+    buffer->slots = new TraceSlot[TRACE_BUFFER_SPANS]();
+
+    pthread_mutex_lock(&buffers_mutex);
+    buffers.push_back(buffer);
+    pthread_mutex_unlock(&buffers_mutex);
+
+    thread_buffer = buffer;
+    return buffer;
+}
+
+/**
+ * Append a span to the calling thread's ring, over its oldest span once the
+ * ring is full.
+ */
+static void record_span(const char* name, uint64_t trace_id, uint64_t start_ns,
+                        uint64_t end_ns, bool is_async)
+{
+    TraceBuffer* buffer = get_thread_buffer();
+    uint64_t count = buffer->count.load(std::memory_order_relaxed);
+    TraceSlot& slot = buffer->slots[count % TRACE_BUFFER_SPANS];
+
+    slot.sequence.store(2 * count + 1, std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_release);
+    slot.trace_id.store(trace_id, std::memory_order_release);
+    slot.start_ns.store(start_ns, std::memory_order_release);
+    slot.end_ns.store(end_ns, std::memory_order_release);
+    slot.is_async.store(is_async, std::memory_order_release);
+    slot.sequence.store(2 * count + 2, std::memory_order_release);
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+/**
+ * Read the span recorded n-th from a slot. Returns false if the slot does not
+ * hold it (anymore), e.g. since the thread overwrote it meanwhile.
+ */
+static bool read_span(const TraceSlot& slot, uint64_t n, TraceRecord& record)
+{
+    uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != 2 * n + 2)
+    {
+        return false;
+    }
+
+    record.name = slot.name.load(std::memory_order_acquire);
+    record.trace_id = slot.trace_id.load(std::memory_order_acquire);
+    record.start_ns = slot.start_ns.load(std::memory_order_acquire);
+    record.end_ns = slot.end_ns.load(std::memory_order_acquire);
+    record.is_async = slot.is_async.load(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+/**
+ * A time of the monotonic clock, in the unit of Chrome trace events.
+ */
+static std::string trace_time(uint64_t ns)
+{
+    char text[TRACE_TIME_SIZE];
+    snprintf(text, sizeof(text), "%.3f", ns / NS_IN_TRACE_UNIT);
+    return text;
+}
+
+/**
+ * Append the events of a span to out, as Chrome trace events of process pid
+ * and thread tid: a complete event for a thread's span, or a begin and an end
+ * event for a request's.
+ */
+static void append_span_events(const TraceRecord& record, int pid, long tid,
+                               std::string& out)
+{
+    std::string common = "\"name\":\"" + std::string(record.name) +
+                         "\",\"pid\":" + std::to_string(pid) + ",\"tid\":" +
+                         std::to_string(tid);
+    std::string args = ",\"args\":{\"request\":" +
+                       std::to_string(record.trace_id) + "}},\n";
+
+    if (!record.is_async)
+    {
+        out += "{" + common + ",\"cat\":\"server\",\"ph\":\"X\",\"ts\":" +
+               trace_time(record.start_ns) + ",\"dur\":" +
+               trace_time(record.end_ns - record.start_ns) + args;
+        return;
+    }
+
+    std::string id = ",\"cat\":\"request\",\"id\":" +
+                     std::to_string(record.trace_id);
+    out += "{" + common + id + ",\"ph\":\"b\",\"ts\":" +
+           trace_time(record.start_ns) + args;
+    out += "{" + common + id + ",\"ph\":\"e\",\"ts\":" +
+           trace_time(record.end_ns) + args;
+}
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+/**
+ * Start tracing one of every sample_every requests.
+ */
+void start_tracing(uint32_t sample_every_num)
+{
+    sample_every = std::max(sample_every_num, (uint32_t) 1);
+    is_tracing = true;
+}
+
+/**
+ * Whether the calling thread's next request is traced: its trace id if it
+ * is, 0 if it is not (or tracing is off).
+ */
+uint64_t trace_sample()
+{
+    if (!is_tracing.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    if (++thread_requests < sample_every.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    thread_requests = 0;
+    return next_trace_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * The current time, if the calling thread works on a traced request, and 0
+ * otherwise.
+ */
+uint64_t trace_span_start()
+{
+    return thread_trace_id == 0 ? 0 : monotonic_ns();
+}
+
+/**
+ * Record a span of the calling thread's traced request, which started at
+ * start_ns and ends now.
+ */
+void trace_span_end(const char* name, uint64_t start_ns)
+{
+    trace_span(name, start_ns, monotonic_ns());
+}
+
+/**
+ * Record a span of the calling thread's traced request, if any.
+ */
+void trace_span(const char* name, uint64_t start_ns, uint64_t end_ns)
+{
+    if (thread_trace_id != 0)
+    {
+        record_span(name, thread_trace_id, start_ns, end_ns, false);
+    }
+}
+
+/**
+ * Record a span of a traced request which no single thread spent.
+ */
+void trace_async_span(const char* name, uint64_t trace_id, uint64_t start_ns,
+                      uint64_t end_ns)
+{
+    if (trace_id != 0)
+    {
+        record_span(name, trace_id, start_ns, end_ns, true);
+    }
+}
+
+/**
+ * Name the calling thread's track.
+ */
+void trace_name_thread(const char* name)
+{
+    thread_name = name;
+    if (thread_buffer != nullptr)
+    {
+        thread_buffer->name = name;
+    }
+}
+
+/**
+ * Write the spans the rings hold to path, as a JSON object of Chrome trace
+ * events. It is written to a temporary file, which is renamed over path. The
+ * spans which newer ones overwrote are counted as dropped.
+ */
+int write_trace(const std::string& path)
+{
+    int pid = getpid();
+    std::string temp_path = path + TRACE_TEMP_SUFFIX;
+    std::ofstream out(temp_path, std::ios::trunc);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+    uint64_t dropped_spans = 0;
+    pthread_mutex_lock(&buffers_mutex);
+    for (auto const& buffer: buffers)
+    {
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid <<
+               ",\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"" <<
+               buffer->name.load() << "\"}},\n";
+
+        // the newest spans, up to the ring's size
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t first = count > TRACE_BUFFER_SPANS ?
+                         count - TRACE_BUFFER_SPANS : 0;
+        std::string events;
+        for (uint64_t n = first; n < count; n++)
+        {
+            TraceRecord record;
+            if (read_span(buffer->slots[n % TRACE_BUFFER_SPANS], n, record))
+            {
+                append_span_events(record, pid, buffer->tid, events);
+            }
+            else
+            {
+                dropped_spans++;
+            }
+        }
+        dropped_spans += first;
+        out << events;
+    }
+    pthread_mutex_unlock(&buffers_mutex);
+
+    // the metadata event closes the list, which may not end with a comma
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid <<
+           ",\"args\":{\"name\":\"emServer\"}}\n],\"droppedSpans\":" <<
+           dropped_spans << "}\n";
+    out.close();
+
+    if (!out || rename(temp_path.c_str(), path.c_str()) != SUCCESS)
+    {
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Free the buffers of all the threads; none may still record.
+ */
+void free_trace_buffers()
+{
+    is_tracing = false;
+    pthread_mutex_lock(&buffers_mutex);
+    for (auto const& buffer: buffers)
+    {
+        delete[] buffer->slots;
+        delete buffer;
+    }
+    buffers.clear();
+    pthread_mutex_unlock(&buffers_mutex);
+}
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+TracedRequest::TracedRequest(uint64_t trace_id)
+        :previous_id(thread_trace_id)
+{
+    thread_trace_id = trace_id;
+}
+
+TracedRequest::~TracedRequest()
+{
+    thread_trace_id = previous_id;
+}
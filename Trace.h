@@ -0,0 +1,127 @@
+#ifndef EX5_TRACE_H
+#define EX5_TRACE_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+//==============================================================================
+//=============================== DEFINES ======================================
+//==============================================================================
+// spans a thread keeps: its buffer is a ring, whose newest spans overwrite
+// its oldest ones (and an export counts those as dropped)
+#define TRACE_BUFFER_SPANS 65536
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+// Requests are traced by sampling: one of every few requests a thread
+// handles gets a trace id, and while a thread works on a traced request, the
+// spans it records (parsing, executing, waiting for a lock, writing to the
+// log...) are tagged with the id. Each thread records to a ring of its own,
+// without a lock. The buffers are exported in the Chrome trace event format,
+// which Perfetto and chrome://tracing open.
+
+// set once tracing starts; while it is not, recording a span costs a load of
+// it
+extern std::atomic<bool> is_tracing;
+
+/**
+ * Start tracing one of every sample_every requests.
+ */
+void start_tracing(uint32_t sample_every);
+
+/**
+ * Whether the calling thread's next request is traced: its trace id if it
+ * is, 0 if it is not (or tracing is off).
+ */
+uint64_t trace_sample();
+
+/**
+ * The current time, if the calling thread works on a traced request, and 0
+ * otherwise.
+ */
+uint64_t trace_span_start();
+
+/**
+ * Record a span of the calling thread's traced request, which started at
+ * start_ns (as trace_span_start returned it) and ends now.
+ */
+void trace_span_end(const char* name, uint64_t start_ns);
+
+/**
+ * Record a span of the calling thread's traced request, if any.
+ */
+void trace_span(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Record a span of a traced request which no single thread spent (e.g. the
+ * time it waited for a worker). It is shown on a track of the request.
+ */
+void trace_async_span(const char* name, uint64_t trace_id, uint64_t start_ns,
+                      uint64_t end_ns);
+
+/**
+ * Name the calling thread's track.
+ */
+void trace_name_thread(const char* name);
+
+/**
+ * Write the newest spans of each thread to path, as a JSON object of Chrome
+ * trace events. The file is replaced at once.
+ */
+int write_trace(const std::string& path);
+
+/**
+ * Free the buffers of all the threads; none may still record.
+ */
+void free_trace_buffers();
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * A span of the calling thread's traced request, from its construction to
+ * its destruction. name must outlive the trace (e.g. a string literal).
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+            :name(name),
+             start_ns(is_tracing.load(std::memory_order_relaxed) ?
+                      trace_span_start() : 0){}
+
+    ~TraceScope()
+    {
+        if (start_ns != 0)
+        {
+            trace_span_end(name, start_ns);
+        }
+    }
+
+private:
+    const char* name;
+    uint64_t start_ns;
+};
+
+/**
+ * The calling thread works on a request (traced if trace_id is not 0) from
+ * its construction to its destruction.
+ */
+class TracedRequest
+{
+public:
+    explicit TracedRequest(uint64_t trace_id);
+
+    ~TracedRequest();
+
+private:
+    // the request the thread worked on before
+    uint64_t previous_id;
+};
+
+#endif //EX5_TRACE_H
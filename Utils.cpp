@@ -1,191 +1,654 @@
-#ifndef EX5_UTILS_CPP
-#define EX5_UTILS_CPP
-
-//==============================================================================
-//=============================== INCLUDES  ====================================
-//==============================================================================
-#include "Utils.h"
-
-using namespace std;
-
-//==============================================================================
-//================================ UTILS =======================================
-//==============================================================================
-/**
- * Check if given string is an integer.
- */
-bool isInteger(const std::string & s)
-{
-    if(s.empty() || ((!isdigit(s[0])) && \
-    (s[0] != '-') && (s[0] != '+'))) return false ;
-
-    char * p ;
-    strtol(s.c_str(), &p, 10) ;
-
-    return (*p == 0) ;
-}
-
-/**
- * Read data from a socket. how_much bytes will be read before return.
- */
-int read_data(int *sock, char *write_to_me, int how_much)
-{
-    int b_count = 0;
-    int bytes_read = 0;
-
-    // loop until full buffer
-    while (b_count < how_much)
-    {
-        bytes_read = (int) read(*sock, write_to_me, \
-                                (size_t) how_much - b_count);
-
-        // if there is more to read, read
-        if (bytes_read > 0)
-        {
-            b_count += bytes_read;
-            write_to_me += bytes_read;
-            continue;
-        }
-
-        // if read was failed, fail as well
-        if (bytes_read == FAILURE)
-        {
-            return FAILURE;
-        }
-    }
-
-    return b_count;
-}
-
-/**
- * Write data to socket.
- */
-int write_data(int *sock, char* read_from_me, int how_much) {
-    int bytes_written = 0;  /* counts bytes written returned */
-    int b_count = 0;    /* count how much written */
-
-    /* loop until full buffer */
-    while (b_count < how_much) {
-        bytes_written = (int) write(*sock, \
-                                    read_from_me, (size_t) how_much - b_count);
-
-        // if there is more to write, write
-        if (bytes_written > 0) {
-
-            b_count += bytes_written;
-            read_from_me += bytes_written;
-        }
-
-        // if write was failed, fail as well
-        if (bytes_written < 0) {
-            return FAILURE;
-        }
-
-        // stop writing
-        break;
-    }
-    return b_count;
-}
-////////////////////////////////////////////////////////////////////////////////
-// TCP utils
-/**
- * Initialize a sockaddr_in struct
- */
-sockaddr_in init_sockaddr(int port, in_addr_t addr)
-{
-    struct sockaddr_in server_sock;
-
-    server_sock.sin_family = AF_INET;
-    server_sock.sin_port = htons((uint16_t) port);
-    server_sock.sin_addr.s_addr = addr;
-
-    return server_sock;
-}
-
-
-////////////////////////////////////////////////////////////////////////////////
-// General utils
-/**
- * Get te current time in HH:MM:SS format
- */
-string get_current_time()
-{
-    time_t current_time;
-    struct tm * time_info;
-    char timeString[TIME_STRING];  // space for "HH:MM:SS\0"
-
-    time(&current_time);
-    time_info = localtime(&current_time);
-
-    strftime(timeString, sizeof(timeString), "%H:%M:%S", time_info);
-    return string(timeString);
-}
-
-/**
- * Get the relevant error text. On client, also print error to stdout
- */
-string sys_call_error(string function)
-{
-    string error_text = "ERROR\t" + function + "\t" + to_string(errno) + ".\n";
-    return error_text;
-}
-
-/**
- * Simple method that allows, in case of an error, to write message to the log
- * file and close it.
- */
-void exit_write_close(Log* logfile, string message, int EXIT_CODE)
-{
-    logfile->write_to_log(message);
-    delete logfile;
-    exit(EXIT_CODE);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-// Parser utils
-/**
- * convert a string to its upper case string
- */
-string to_upper(string data){
-    transform(data.begin(), data.end(), data.begin(), ::toupper);
-    return data;
-}
-
-/**
- * Split a string into vector of strings using a delimiter
- */
-vector<string> split(string str, char delimiter) {
-	vector<string> internal;
-	stringstream ss(str); // Turn the string into a stream.
-	string tok;
-
-	while (getline(ss, tok, delimiter)) {
-		internal.push_back(tok);
-	}
-
-	return internal;
-}
-
-/**
- * Given a starting index (3 for client, 4 for server), the event description
- * will be processed from split_msg.
- */
-string get_event_description(int start_index, vector<string> split_msg)
-{
-    string event_desc = "";
-
-    // CLIENT SIDE 0 - function, 1 - title, 2 - date, 3 till end - desc
-    // SERVER SIDE 0 name , 1 - function, 2 - title, 3 - date, 4 till end - desc
-    for (int i = start_index ; i < (int)split_msg.size() ; i++) {
-        if ((unsigned)i == (split_msg.size() - 1 )) {
-            event_desc += split_msg[i];
-        } else {
-            event_desc += split_msg[i] + STRING_DELIMITER;
-        }
-    }
-
-    return event_desc;
-}
-
+#ifndef EX5_UTILS_CPP
+#define EX5_UTILS_CPP
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include "Utils.h"
+
+using namespace std;
+
+//==============================================================================
+//================================ UTILS =======================================
+//==============================================================================
+/**
+ * Check if given string is an integer.
+ */
+bool isInteger(const std::string & s)
+{
+    if(s.empty() || ((!isdigit(s[0])) && \
+    (s[0] != '-') && (s[0] != '+'))) return false ;
+
+    char * p ;
+    strtol(s.c_str(), &p, 10) ;
+
+    return (*p == 0) ;
+}
+
+/**
+ * Read data from a socket. how_much bytes will be read before return.
+ */
+int read_data(int *sock, char *write_to_me, int how_much)
+{
+    int b_count = 0;
+    int bytes_read = 0;
+
+    // loop until full buffer
+    while (b_count < how_much)
+    {
+        bytes_read = (int) read(*sock, write_to_me, \
+                                (size_t) how_much - b_count);
+
+        // if there is more to read, read
+        if (bytes_read > 0)
+        {
+            b_count += bytes_read;
+            write_to_me += bytes_read;
+            continue;
+        }
+
+        // if read was failed, fail as well
+        if (bytes_read == FAILURE)
+        {
+            return FAILURE;
+        }
+
+        // peer closed the connection, return what was read so far
+        break;
+    }
+
+    return b_count;
+}
+
+/**
+ * Write data to socket.
+ */
+int write_data(int *sock, char* read_from_me, int how_much) {
+    int bytes_written = 0;  /* counts bytes written returned */
+    int b_count = 0;    /* count how much written */
+
+    /* loop until full buffer */
+    while (b_count < how_much) {
+        bytes_written = (int) write(*sock, \
+                                    read_from_me, (size_t) how_much - b_count);
+
+        // if there is more to write, write
+        if (bytes_written > 0) {
+
+            b_count += bytes_written;
+            read_from_me += bytes_written;
+        }
+
+        // if write was failed, fail as well
+        if (bytes_written < 0) {
+            return FAILURE;
+        }
+    }
+    return b_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Protocol utils
+// The commands of the protocol. sizeof counts the terminating null character
+// of the text.
+static const struct
+{
+    const char* text;
+    size_t length;
+    Opcode opcode;
+} commands[] = {
+    {REGISTER_TEXT, sizeof(REGISTER_TEXT) - 1, OP_REGISTER},
+    {UNREGISTER_TEXT, sizeof(UNREGISTER_TEXT) - 1, OP_UNREGISTER},
+    {CREATE_TEXT, sizeof(CREATE_TEXT) - 1, OP_CREATE},
+    {GET_TOP_5_TEXT, sizeof(GET_TOP_5_TEXT) - 1, OP_GET_TOP_5},
+    {SEND_RSVP_TEXT, sizeof(SEND_RSVP_TEXT) - 1, OP_SEND_RSVP},
+    {GET_RSVPS_LIST_TEXT, sizeof(GET_RSVPS_LIST_TEXT) - 1,
+     OP_GET_RSVPS_LIST},
+    {GET_TOP_N_TEXT, sizeof(GET_TOP_N_TEXT) - 1, OP_GET_TOP_N},
+    {GET_EVENTS_RANGE_TEXT, sizeof(GET_EVENTS_RANGE_TEXT) - 1,
+     OP_GET_EVENTS_RANGE},
+    {SEARCH_TEXT, sizeof(SEARCH_TEXT) - 1, OP_SEARCH},
+    {GET_EVENTS_TEXT, sizeof(GET_EVENTS_TEXT) - 1, OP_GET_EVENTS},
+    {SUBSCRIBE_TEXT, sizeof(SUBSCRIBE_TEXT) - 1, OP_SUBSCRIBE},
+    {UNSUBSCRIBE_TEXT, sizeof(UNSUBSCRIBE_TEXT) - 1, OP_UNSUBSCRIBE},
+    {STATS_TEXT, sizeof(STATS_TEXT) - 1, OP_STATS}
+};
+
+#define COMMANDS_NUM (sizeof(commands) / sizeof(commands[0]))
+#define NO_COMMAND_TEXT "NONE"
+
+/**
+ * Get the opcode of a (upper case) command text. OP_NONE if there is none.
+ */
+Opcode opcode_from_text(const string& command)
+{
+    return opcode_from_ref(make_ref(command));
+}
+
+/**
+ * Get the opcode of a (upper case) command, without allocating. OP_NONE if
+ * there is none.
+ */
+Opcode opcode_from_ref(const StrRef& command)
+{
+    for (size_t i = 0; i < COMMANDS_NUM; i++)
+    {
+        if (command.length == commands[i].length &&
+            memcmp(command.data, commands[i].text, command.length) == 0)
+        {
+            return commands[i].opcode;
+        }
+    }
+
+    return OP_NONE;
+}
+
+/**
+ * Get the command text of an opcode. "NONE" for OP_NONE.
+ */
+const char* text_from_opcode(Opcode opcode)
+{
+    for (size_t i = 0; i < COMMANDS_NUM; i++)
+    {
+        if (commands[i].opcode == opcode)
+        {
+            return commands[i].text;
+        }
+    }
+
+    return NO_COMMAND_TEXT;
+}
+
+/**
+ * Serialize a frame header into FRAME_HEADER_SIZE bytes.
+ */
+void encode_frame_header(const FrameHeader& header, unsigned char* out)
+{
+    uint16_t flags = htons(header.flags);
+    uint32_t request_id = htonl(header.request_id);
+    uint32_t length = htonl(header.length);
+
+    out[0] = header.magic;
+    out[1] = header.opcode;
+    memcpy(out + 2, &flags, sizeof(flags));
+    memcpy(out + 4, &request_id, sizeof(request_id));
+    memcpy(out + 8, &length, sizeof(length));
+}
+
+/**
+ * Deserialize FRAME_HEADER_SIZE bytes into a frame header.
+ */
+FrameHeader decode_frame_header(const unsigned char* in)
+{
+    FrameHeader header;
+    uint16_t flags;
+    uint32_t request_id;
+    uint32_t length;
+
+    memcpy(&flags, in + 2, sizeof(flags));
+    memcpy(&request_id, in + 4, sizeof(request_id));
+    memcpy(&length, in + 8, sizeof(length));
+
+    header.magic = in[0];
+    header.opcode = in[1];
+    header.flags = ntohs(flags);
+    header.request_id = ntohl(request_id);
+    header.length = ntohl(length);
+
+    return header;
+}
+
+/**
+ * Write a single frame (header and payload) to a socket. Header and payload
+ * are sent with a single write.
+ */
+int write_frame(int* sock, uint8_t opcode, uint32_t request_id, \
+                const string& payload)
+{
+    if (payload.length() > MAX_FRAME_PAYLOAD)
+    {
+        errno = EMSGSIZE;
+        return FAILURE;
+    }
+
+    FrameHeader header;
+    header.magic = FRAME_MAGIC;
+    header.opcode = opcode;
+    header.flags = NO_FLAGS;
+    header.request_id = request_id;
+    header.length = (uint32_t) payload.length();
+
+    string frame(FRAME_HEADER_SIZE, END_STR);
+    encode_frame_header(header, (unsigned char*) &frame[0]);
+    frame += payload;
+
+    if (write_data(sock, &frame[0], (int) frame.length()) != \
+        (int) frame.length())
+    {
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Read the payload of a frame whose header was already read and decoded.
+ */
+int read_frame_payload(int* sock, const FrameHeader& header, string& payload)
+{
+    if (header.magic != FRAME_MAGIC || header.length > MAX_FRAME_PAYLOAD)
+    {
+        errno = EPROTO;
+        return FAILURE;
+    }
+
+    payload.assign(header.length, END_STR);
+    if (header.length > 0 && \
+        read_data(sock, &payload[0], (int) header.length) != \
+        (int) header.length)
+    {
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Read a single frame from a socket.
+ */
+int read_frame(int* sock, FrameHeader& header, string& payload)
+{
+    unsigned char raw_header[FRAME_HEADER_SIZE];
+
+    if (read_data(sock, (char*) raw_header, FRAME_HEADER_SIZE) != \
+        FRAME_HEADER_SIZE)
+    {
+        return FAILURE;
+    }
+
+    header = decode_frame_header(raw_header);
+    return read_frame_payload(sock, header, payload);
+}
+
+/**
+ * Write a message in the legacy fixed size (PROTOCOL_MESSAGE_SIZE) format.
+ * Messages which are too long are truncated, as they always were.
+ */
+int write_legacy_message(int* sock, const string& message)
+{
+    vector<char> buffer(PROTOCOL_MESSAGE_SIZE, END_STR);
+    message.copy(buffer.data(), min(message.length(), \
+                                    (size_t) PROTOCOL_MESSAGE_SIZE - 1));
+
+    if (write_data(sock, buffer.data(), PROTOCOL_MESSAGE_SIZE) != \
+        PROTOCOL_MESSAGE_SIZE)
+    {
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+////////////////////////////////////////////////////////////////////////////////
+// TCP utils
+/**
+ * Initialize a sockaddr_in struct
+ */
+sockaddr_in init_sockaddr(int port, in_addr_t addr)
+{
+    struct sockaddr_in server_sock;
+
+    server_sock.sin_family = AF_INET;
+    server_sock.sin_port = htons((uint16_t) port);
+    server_sock.sin_addr.s_addr = addr;
+
+    return server_sock;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// General utils
+/**
+ * Get te current time in HH:MM:SS format
+ */
+string get_current_time()
+{
+    time_t current_time;
+    struct tm * time_info;
+    char timeString[TIME_STRING];  // space for "HH:MM:SS\0"
+
+    time(&current_time);
+    time_info = localtime(&current_time);
+
+    strftime(timeString, sizeof(timeString), "%H:%M:%S", time_info);
+    return string(timeString);
+}
+
+/**
+ * Current time of the monotonic clock, in nanoseconds.
+ */
+uint64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Get the relevant error text. On client, also print error to stdout
+ */
+string sys_call_error(string function)
+{
+    string error_text = "ERROR\t" + function + "\t" + to_string(errno) + ".\n";
+    return error_text;
+}
+
+/**
+ * Simple method that allows, in case of an error, to write message to the log
+ * file and close it.
+ */
+void exit_write_close(Log* logfile, string message, int EXIT_CODE)
+{
+    logfile->write_to_log(message);
+    delete logfile;
+    exit(EXIT_CODE);
+}
+
+/**
+ * Split a "key=value" command line option. Returns false if arg is not one.
+ */
+bool parse_option(const string& arg, string& key, string& value)
+{
+    size_t separator = arg.find('=');
+    if (separator == string::npos || separator == 0)
+    {
+        return false;
+    }
+
+    key = arg.substr(0, separator);
+    value = arg.substr(separator + 1);
+    return true;
+}
+
+/**
+ * Parse the integer value of a command line option. Returns false, and leaves
+ * number as it is, if it is not an int (e.g. it is too large for one), rather
+ * than throwing as stoi does.
+ */
+bool parse_int_option(const string& value, int& number)
+{
+    if (!isInteger(value))
+    {
+        return false;
+    }
+
+    errno = 0;
+    long parsed = strtol(value.c_str(), nullptr, 10);
+    if (errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+    {
+        return false;
+    }
+    number = (int) parsed;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// Parser utils
+/**
+ * convert a string to its upper case string
+ */
+string to_upper(string data){
+    transform(data.begin(), data.end(), data.begin(), ::toupper);
+    return data;
+}
+
+/**
+ * A view of a string's characters, valid while the string is not modified.
+ */
+StrRef make_ref(const string& str)
+{
+    return make_ref(str.data(), str.length());
+}
+
+/**
+ * A view of length characters starting at data.
+ */
+StrRef make_ref(const char* data, size_t length)
+{
+    StrRef ref;
+    ref.data = data;
+    ref.length = length;
+    return ref;
+}
+
+/**
+ * The characters of a view, as a string.
+ */
+string ref_to_string(const StrRef& ref)
+{
+    return string(ref.data, ref.length);
+}
+
+/**
+ * Lower case of an ASCII letter, other characters are kept as is.
+ */
+static inline unsigned char fold_case(char c)
+{
+    return (unsigned char) ((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+}
+
+/**
+ * FNV-1a hash of the case folded characters.
+ */
+size_t CaseInsensitiveHash::operator()(const StrRef& key) const
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.length; i++)
+    {
+        hash = (hash ^ fold_case(key.data[i])) * 1099511628211ULL;
+    }
+    return (size_t) hash;
+}
+
+/**
+ * Compare the case folded characters.
+ */
+bool CaseInsensitiveEqual::operator()(const StrRef& first,
+                                      const StrRef& second) const
+{
+    if (first.length != second.length)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < first.length; i++)
+    {
+        if (fold_case(first.data[i]) != fold_case(second.data[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Compare the common prefix, and then the lengths.
+ */
+bool NameLess::operator()(const StrRef& first, const StrRef& second) const
+{
+    int order = memcmp(first.data, second.data,
+                       min(first.length, second.length));
+    return order < 0 || (order == 0 && first.length < second.length);
+}
+
+/**
+ * Split a string into vector of strings using a delimiter
+ */
+vector<string> split(string str, char delimiter) {
+	vector<string> internal;
+	stringstream ss(str); // Turn the string into a stream.
+	string tok;
+
+	while (getline(ss, tok, delimiter)) {
+		internal.push_back(tok);
+	}
+
+	return internal;
+}
+
+/**
+ * Split message on delimiter into at most max_tokens views of it, without
+ * allocating. The last token holds the rest of the message.
+ */
+size_t tokenize(const StrRef& message, char delimiter, StrRef* tokens,
+                size_t max_tokens)
+{
+    size_t tokens_num = 0;
+    size_t start = 0;
+
+    while (start < message.length && tokens_num < max_tokens)
+    {
+        const char* found = nullptr;
+        if (tokens_num < max_tokens - 1)
+        {
+            found = (const char*) memchr(message.data + start, delimiter,
+                                         message.length - start);
+        }
+
+        size_t end = found == nullptr ? message.length :
+                                        (size_t) (found - message.data);
+        tokens[tokens_num++] = make_ref(message.data + start, end - start);
+        start = end + 1;
+    }
+
+    return tokens_num;
+}
+
+/**
+ * Parse a (signed) decimal integer, clamped to the range of long. Returns false
+ * if ref is not an integer.
+ */
+bool ref_to_long(const StrRef& ref, long& value)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (ref.length > 0 && (ref.data[0] == '-' || ref.data[0] == '+'))
+    {
+        negative = ref.data[0] == '-';
+        i++;
+    }
+    if (i == ref.length)
+    {
+        return false;
+    }
+
+    // the magnitude of LONG_MIN, larger ones are clamped to it
+    const unsigned long limit = (unsigned long) LONG_MAX + 1;
+    unsigned long magnitude = 0;
+    for (; i < ref.length; i++)
+    {
+        if (!isdigit((unsigned char) ref.data[i]))
+        {
+            return false;
+        }
+        unsigned long digit = ref.data[i] - '0';
+        magnitude = magnitude > (limit - digit) / 10 ? limit :
+                                                       magnitude * 10 + digit;
+    }
+
+    if (negative)
+    {
+        value = magnitude > (unsigned long) LONG_MAX ? LONG_MIN :
+                                                       -(long) magnitude;
+    }
+    else
+    {
+        value = (long) min(magnitude, (unsigned long) LONG_MAX);
+    }
+    return true;
+}
+
+/**
+ * Parse the digits of ref from position begin to end. Returns false if any of
+ * them is not a digit.
+ */
+static bool parse_digits(const StrRef& ref, size_t begin, size_t end,
+                         uint32_t& value)
+{
+    value = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        if (!isdigit((unsigned char) ref.data[i]))
+        {
+            return false;
+        }
+        value = value * 10 + (uint32_t) (ref.data[i] - '0');
+    }
+    return true;
+}
+
+/**
+ * Parse a date given as DD/MM/YYYY or YYYY-MM-DD into its key, YYYYMMDD, which
+ * orders dates as integers do. Returns false if date is in neither format.
+ */
+bool parse_date_key(const StrRef& date, uint32_t& key)
+{
+    uint32_t year, month, day;
+    if (date.length != DATE_LENGTH)
+    {
+        return false;
+    }
+
+    if (date.data[2] == '/' && date.data[5] == '/')
+    {
+        if (!parse_digits(date, 0, 2, day) ||
+            !parse_digits(date, 3, 5, month) ||
+            !parse_digits(date, 6, 10, year))
+        {
+            return false;
+        }
+    }
+    else if (date.data[4] == '-' && date.data[7] == '-')
+    {
+        if (!parse_digits(date, 0, 4, year) ||
+            !parse_digits(date, 5, 7, month) ||
+            !parse_digits(date, 8, 10, day))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    if (month < 1 || month > 12 || day < 1 || day > 31)
+    {
+        return false;
+    }
+    key = year * 10000 + month * 100 + day;
+    return true;
+}
+
+/**
+ * Given a starting index (3 for client, 4 for server), the event description
+ * will be processed from split_msg.
+ */
+string get_event_description(int start_index, vector<string> split_msg)
+{
+    string event_desc = "";
+
+    // CLIENT SIDE 0 - function, 1 - title, 2 - date, 3 till end - desc
+    // SERVER SIDE 0 name , 1 - function, 2 - title, 3 - date, 4 till end - desc
+    for (int i = start_index ; i < (int)split_msg.size() ; i++) {
+        if ((unsigned)i == (split_msg.size() - 1 )) {
+            event_desc += split_msg[i];
+        } else {
+            event_desc += split_msg[i] + STRING_DELIMITER;
+        }
+    }
+
+    return event_desc;
+}
+
 #endif //EX5_UTILS_CPP
\ No newline at end of file
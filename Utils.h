@@ -1,147 +1,596 @@
-#ifndef EX5_UTILS_H
-#define EX5_UTILS_H
-
-//==============================================================================
-//=============================== INCLUDES  ====================================
-//==============================================================================
-#include <unistd.h>
-#include <string>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <string.h>
-#include <iostream>
-#include <vector>
-#include <algorithm>
-#include <sstream>
-#include "Log.h"
-
-using namespace std;
-
-//==============================================================================
-//=============================== DEFINES ======================================
-//==============================================================================
-#define FAILURE -1
-#define ERROR 1
-#define SUCCESS 0
-#define ERROR_IN_REQUEST 'e'
-#define REQUEST_OK 'k'
-#define REQUEST_OK_BUT_PLUS 'w'
-#define END_STR '\0'
-
-#define STRING_DELIMITER ' '
-// ASCII representation
-#define EVENT_DELIMITER 167
-#define PROTOCOL_MESSAGE_SIZE 99999
-
-// Protocol text
-#define EXIT_TEXT "EXIT"
-#define REGISTER_TEXT "REGISTER"
-#define UNREGISTER_TEXT "UNREGISTER"
-#define CREATE_TEXT "CREATE"
-#define GET_TOP_5_TEXT "GET_TOP_5"
-#define SEND_RSVP_TEXT "SEND_RSVP"
-#define GET_RSVPS_LIST_TEXT "GET_RSVPS_LIST"
-#define EMPTY_STR ""
-
-#define EVENT_TITLE_ARG 1
-#define EVENT_DATE_ARG 2
-#define TIME_STRING 9
-#define GET_RSVP_ID 1
-
-#define REQUEST_STATUS 0
-
-
-//////////////////////////////// enServer //////////////////////////////////////
-
-#define SERVER_ARG_NUM 2
-#define SERVER_ARG_PORT 1
-#define SERVER_USAGE "Usage: emServer portNum"
-#define SERVER_LOG_FILE "emServer.log"
-#define MAX_PENDING_CONNECTIONS 10
-#define CLIENT_NAME_SPLIT_MSG_INDEX 0
-#define COMMAND_SPLIT_MSG_INDEX_SERVER 1
-#define ARG_OFFSET 1
-#define DEFAULT_ID 0
-#define DESC_IDX 4
-#define FIVE_CLIENTS 5
-#define EQUAL 0
-
-/////////////////////////////// emClient ///////////////////////////////////////
-
-#define CLIENT_ARG_NUM 4
-#define CLIENT_ARG_NAME 1
-#define CLIENT_ARG_IP 2
-#define CLIENT_ARG_PORT 3
-#define CLIENT_USAGE "Usage: emClient clientName serverAddress serverPort"
-#define ILLEGAL_COMMAND "ERROR: illegal command.\n"
-#define NOT_REGISTERED "ERROR: first command must be REGISTER.\n"
-#define COMMAND_SPLIT_MSG_INDEX_CLIENT 0
-#define DESC_STR_SIZE 256
-#define TITLE_DATE_STR_SIZE 30
-#define CREATE_VALID_WORD_NUM 4
-#define CREATE_DESC_IDX 3
-#define SEND__GET_RSVP_ONLY_COMMAND 1
-
-
-//==============================================================================
-//=============================== TYPEDEF ======================================
-//==============================================================================
-typedef enum {CLIENT, SERVER} Mode;
-
-
-//==============================================================================
-//================================ UTILS =======================================
-//==============================================================================
-
-/**
- * Check if given string is an integer.
- */
-bool isInteger(const std::string & s);
-/**
- * Read data from a socket. how_much bytes will be read before return.
- */
-int read_data(int* sock, char *write_to_me, int how_much);
-
-/**
- * Write data to socket.
- */
-int write_data(int* sock, char* read_from_me, int how_much);
-////////////////////////////////////////////////////////////////////////////////
-// TCP utils
-
-/**
- * Initialize a sockaddr_in struct
- */
-sockaddr_in init_sockaddr(int port, in_addr_t addr);
-
-////////////////////////////////////////////////////////////////////////////////
-// General utils
-
-/**
- * Get te current time in HH:MM:SS format
- */
-string get_current_time();
-
-/**
- * Get the relevant error text
- */
-string sys_call_error(string function);
-/**
- * A helping method that writes, in case of failures, message and exits.
- */
-void exit_write_close(Log* logfile, string message, int EXIT_CODE);
-
-////////////////////////////////////////////////////////////////////////////////
-// Parser utils
-/**
- * convert a string to its upper case string
- */
-string to_upper(string data);
-/**
- * Split a string into vector of strings using a delimiter
- */
-vector<string> split(string str, char delimiter);
-
-string get_event_description(int start_index, vector<string> split_msg);
-
-#endif //EX5_UTILS_H
+#ifndef EX5_UTILS_H
+#define EX5_UTILS_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <unistd.h>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include "Log.h"
+
+using namespace std;
+
+//==============================================================================
+//=============================== DEFINES ======================================
+//==============================================================================
+#define FAILURE -1
+#define ERROR 1
+#define SUCCESS 0
+#define ERROR_IN_REQUEST 'e'
+#define REQUEST_OK 'k'
+#define REQUEST_OK_BUT_PLUS 'w'
+#define END_STR '\0'
+
+#define STRING_DELIMITER ' '
+// ASCII representation
+#define EVENT_DELIMITER 167
+#define PROTOCOL_MESSAGE_SIZE 99999
+
+// Framed protocol. Every message is a FRAME_HEADER_SIZE bytes header followed
+// by a payload of exactly header.length bytes. The header layout (network byte
+// order) is: magic (1) | opcode (1) | flags (2) | request id (4) | length (4).
+// The magic byte is never a printable character, which lets the server tell
+// framed messages apart from legacy fixed size (PROTOCOL_MESSAGE_SIZE) ones.
+#define FRAME_MAGIC 0xEB
+#define FRAME_HEADER_SIZE 12
+// A request is at most as long as a legacy one; a reply may list many events
+// or names, up to MAX_FRAME_PAYLOAD bytes. A longer reply is answered with
+// ERROR_IN_REQUEST rather than cut.
+#define MAX_REQUEST_PAYLOAD PROTOCOL_MESSAGE_SIZE
+#define MAX_FRAME_PAYLOAD (64 * 1024 * 1024)
+#define NO_FLAGS 0
+// set on the reply to a request the server refused since it is overloaded
+#define FLAG_OVERLOADED 0x1
+#define OVERLOADED_TEXT "server is overloaded"
+// set on a frame the server pushes to a subscriber (SUBSCRIBE), which answers
+// no request: its request id is the one of the SUBSCRIBE request
+#define FLAG_PUSH 0x2
+
+// Protocol text
+#define EXIT_TEXT "EXIT"
+#define REGISTER_TEXT "REGISTER"
+#define UNREGISTER_TEXT "UNREGISTER"
+#define CREATE_TEXT "CREATE"
+#define GET_TOP_5_TEXT "GET_TOP_5"
+#define GET_TOP_N_TEXT "GET_TOP_N"
+#define SEND_RSVP_TEXT "SEND_RSVP"
+#define GET_RSVPS_LIST_TEXT "GET_RSVPS_LIST"
+#define GET_EVENTS_RANGE_TEXT "GET_EVENTS_RANGE"
+#define SEARCH_TEXT "SEARCH"
+#define GET_EVENTS_TEXT "GET_EVENTS"
+#define SUBSCRIBE_TEXT "SUBSCRIBE"
+#define UNSUBSCRIBE_TEXT "UNSUBSCRIBE"
+// the texts pushed to subscribers: an event, as GET_TOP_N lists it, or a
+// range of ids of events which were created faster than they were read
+#define NEW_EVENT_TEXT "New event: "
+#define NEW_EVENTS_TEXT "New events "
+#define COALESCED_TEXT ", coalesced since the subscriber is slow"
+// precedes the continuation token of a page which is not the last
+#define NEXT_PAGE_TEXT "next page"
+#define EMPTY_STR ""
+
+#define EVENT_TITLE_ARG 1
+#define EVENT_DATE_ARG 2
+#define TIME_STRING 9
+#define GET_RSVP_ID 1
+#define GET_TOP_N_ARG 1
+// GET_RSVPS_LIST id [page_size] [token]
+#define RSVPS_PAGE_ARG 2
+#define RSVPS_TOKEN_ARG 3
+// GET_EVENTS [page_size] [token]
+#define EVENTS_PAGE_ARG 1
+#define EVENTS_TOKEN_ARG 2
+// GET_EVENTS_RANGE from to [limit] [token]
+#define RANGE_FROM_ARG 1
+#define RANGE_TO_ARG 2
+#define RANGE_LIMIT_ARG 3
+#define RANGE_TOKEN_ARG 4
+// DD/MM/YYYY or YYYY-MM-DD
+#define DATE_LENGTH 10
+
+#define REQUEST_STATUS 0
+
+
+//////////////////////////////// enServer //////////////////////////////////////
+
+#define SERVER_ARG_NUM 2
+#define SERVER_ARG_PORT 1
+#define SERVER_FIRST_OPTION_ARG 2
+#define SERVER_USAGE "Usage: emServer portNum [legacy=on|off] " \
+                     "[idle_timeout=seconds] [reactors=num] [backlog=num] " \
+                     "[workers=num] [queue=num] [top_n_cap=num] " \
+                     "[log=sync|async] [log_buffer=records] " \
+                     "[log_full=block|drop] [data_dir=path] " \
+                     "[snapshot_interval=seconds] " \
+                     "[durability=none|batched|strict] [commit_delay=us] " \
+                     "[stats_file=path] [stats_interval=seconds] " \
+                     "[trace_file=path] [trace_sample=num] " \
+                     "[lock_profile=on|off]"
+#define LEGACY_OPTION "legacy"
+#define IDLE_TIMEOUT_OPTION "idle_timeout"
+#define REACTORS_OPTION "reactors"
+#define BACKLOG_OPTION "backlog"
+#define WORKERS_OPTION "workers"
+#define QUEUE_OPTION "queue"
+#define TOP_N_CAP_OPTION "top_n_cap"
+#define DATA_DIR_OPTION "data_dir"
+#define SNAPSHOT_INTERVAL_OPTION "snapshot_interval"
+#define DURABILITY_OPTION "durability"
+#define DURABILITY_NONE_TEXT "none"
+#define DURABILITY_BATCHED_TEXT "batched"
+#define DURABILITY_STRICT_TEXT "strict"
+#define COMMIT_DELAY_OPTION "commit_delay"
+#define LOG_OPTION "log"
+#define LOG_SYNC "sync"
+#define LOG_ASYNC "async"
+#define LOG_BUFFER_OPTION "log_buffer"
+#define LOG_FULL_OPTION "log_full"
+#define LOG_FULL_DROP_TEXT "drop"
+#define LOG_FULL_BLOCK_TEXT "block"
+#define STATS_TEXT "STATS"
+#define STATS_FILE_OPTION "stats_file"
+#define STATS_INTERVAL_OPTION "stats_interval"
+// seconds between two dumps of the stats to stats_file
+#define DEFAULT_STATS_INTERVAL 10
+#define STATS_TICK_SECONDS 1
+// a dump is written to this temporary file, then renamed over stats_file
+#define STATS_TEMP_SUFFIX ".tmp"
+// the line of the process status which tells its number of threads
+#define PROC_STATUS_FILE "/proc/self/status"
+#define THREADS_FIELD "Threads:"
+#define TRACE_TEXT "TRACE"
+#define TRACE_FILE_OPTION "trace_file"
+#define TRACE_SAMPLE_OPTION "trace_sample"
+// one of every this many requests is traced, once tracing is on
+#define DEFAULT_TRACE_SAMPLE 100
+// the spans of a traced request, besides its command's (named as the command)
+#define TRACE_ACCEPT_SPAN "accept"
+#define TRACE_QUEUED_SPAN "queued"
+#define TRACE_PARSE_SPAN "parse"
+#define TRACE_CLIENT_SHARD_SPAN "client_shard_wait"
+#define TRACE_EVENT_SHARD_SPAN "event_shard_wait"
+#define TRACE_EVENTS_MUTEX_SPAN "events_mutex_wait"
+#define TRACE_DATE_INDEX_SPAN "date_index_wait"
+#define TRACE_SEARCH_INDEX_SPAN "search_index_wait"
+#define TRACE_LOG_MUTEX_SPAN "log_mutex_wait"
+#define TRACE_SOCKET_WRITE_SPAN "socket_write"
+// the names of the threads' tracks
+#define ACCEPT_THREAD_NAME "acceptor"
+#define REACTOR_THREAD_NAME "reactor"
+#define WORKER_THREAD_NAME "worker"
+#define LOCK_PROFILE_OPTION "lock_profile"
+#define LOCKS_TEXT "LOCKS"
+// the names of the profiled locks; the shards of a store share a profile
+#define SERVER_LOG_LOCK "server_log_mutex"
+#define EVENTS_LOCK "events_mutex"
+#define CLIENT_SHARDS_LOCK "client_shards"
+#define EVENT_SHARDS_LOCK "event_shards"
+#define DATE_INDEX_LOCK "date_index_lock"
+#define SEARCH_INDEX_LOCK "search_index_lock"
+#define THREADS_NUM_LOCK "threads_num_mutex"
+#define DEFERRED_REPLIES_LOCK "deferred_replies_mutex"
+#define SUBSCRIBERS_LOCK "subscribers_mutex"
+#define DEFAULT_IDLE_TIMEOUT 60
+#define MAX_EPOLL_EVENTS 256
+// ms a reactor waits for events before checking for exit and idle sessions
+#define REACTOR_TICK_MS 500
+#define READ_CHUNK_SIZE 65536
+// a connection stops being read while more replies wait to be written
+#define MAX_PENDING_OUTPUT (4 * PROTOCOL_MESSAGE_SIZE)
+// requests of a connection waiting for a worker before reading pauses
+#define MAX_QUEUED_REQUESTS 64
+// events a subscriber's queue holds before they are coalesced into a range
+#define SUBSCRIBER_QUEUE_SIZE 64
+// requests a worker executes for a connection before others get their turn
+#define WORKER_BATCH_SIZE 16
+#define DEFAULT_WORK_QUEUE_CAPACITY 1024
+// the longest line of an event: its fields come from a single request, and
+// its id and separators add less than 16 bytes
+#define MAX_EVENT_LINE (MAX_REQUEST_PAYLOAD + 16)
+// the most events a GET_TOP_N reply lists by default, and the highest cap,
+// with which the longest reply (with a line's room left for its heading) still
+// fits in a frame
+#define DEFAULT_TOP_N_CAP 100
+#define MAX_TOP_N_CAP (MAX_FRAME_PAYLOAD / (MAX_EVENT_LINE + 1) - 1)
+// events a GET_EVENTS_RANGE reply lists if no limit is given, and at most
+#define DEFAULT_RANGE_LIMIT 10
+#define MAX_RANGE_LIMIT 100
+// events a GET_EVENTS page lists if no size is given, and at most
+#define DEFAULT_EVENTS_PAGE 10
+#define MAX_EVENTS_PAGE 100
+// names a GET_RSVPS_LIST page lists at most; the client asks for full pages
+#define MAX_RSVPS_PAGE 1000
+// bytes of names a GET_RSVPS_LIST page lists at most (though at least one
+// name), leaving room in a frame for the next page line, whose token spells a
+// name in hex
+#define MAX_RSVPS_PAGE_LENGTH (MAX_FRAME_PAYLOAD - 4 * MAX_REQUEST_PAYLOAD)
+// events a SEARCH reply lists, the newest first
+#define SEARCH_RESULTS 10
+// the client's SEARCH command: SEARCH word [word...]
+#define SEARCH_QUERY_ARG 1
+// records an asynchronous log queues before the log_full policy applies
+#define DEFAULT_LOG_BUFFER 8192
+#define NS_IN_US 1000
+#define NS_IN_SECOND 1000000000ULL
+// shards of the registered clients (by name) and of the events (by id); each
+// a power of 2, EVENT_SHARDS at most 64
+#define CLIENT_SHARDS 16
+#define EVENT_SHARDS 16
+// the event table grows by chunks of slots, up to its directory of chunks
+#define EVENT_CHUNK_SIZE 4096
+#define MAX_EVENT_CHUNKS 65536
+#define CACHE_LINE_SIZE 64
+// clients and events allocated at once, and the characters of event texts
+#define CLIENT_SLAB_SIZE 1024
+#define EVENT_SLAB_SIZE 1024
+#define EVENT_TEXT_CHUNK_SIZE (256 << 10)
+#define SERVER_LOG_FILE "emServer.log"
+// files of the persisted store, in its data_dir
+#define SNAPSHOT_FILE "emServer.snapshot"
+#define SNAPSHOT_TEMP_SUFFIX ".tmp"
+#define WAL_FILE_PREFIX "emServer.wal."
+#define DEFAULT_SNAPSHOT_INTERVAL 300
+// a snapshot is taken early once the current generation of the log is this big
+#define SNAPSHOT_WAL_SIZE (64 << 20)
+#define SNAPSHOT_TICK_SECONDS 1
+// us the committer waits for more records after the first of a batch
+#define DEFAULT_COMMIT_DELAY 2000
+// a batch is committed without waiting once its records take this many bytes
+#define WAL_BATCH_SIZE (1 << 20)
+#define MAX_PENDING_CONNECTIONS 10
+#define CLIENT_NAME_SPLIT_MSG_INDEX 0
+#define COMMAND_SPLIT_MSG_INDEX_SERVER 1
+#define ARG_OFFSET 1
+#define DEFAULT_ID 0
+#define FIRST_EVENT_ID 1
+#define DESC_IDX 4
+// a request is split to name, command, and up to the description
+#define MAX_REQUEST_TOKENS (DESC_IDX + 1)
+#define FIVE_CLIENTS 5
+#define EQUAL 0
+
+/////////////////////////////// emClient ///////////////////////////////////////
+
+#define CLIENT_ARG_NUM 4
+#define CLIENT_ARG_NAME 1
+#define CLIENT_ARG_IP 2
+#define CLIENT_ARG_PORT 3
+#define CLIENT_FIRST_OPTION_ARG 4
+#define CLIENT_USAGE "Usage: emClient clientName serverAddress serverPort " \
+                     "[protocol=framed|legacy]"
+#define PROTOCOL_OPTION "protocol"
+#define PROTOCOL_LEGACY "legacy"
+#define PROTOCOL_FRAMED "framed"
+#define CLIENT_LOG_LOCK "client_log_mutex"
+#define ILLEGAL_COMMAND "ERROR: illegal command.\n"
+#define NOT_REGISTERED "ERROR: first command must be REGISTER.\n"
+#define COMMAND_SPLIT_MSG_INDEX_CLIENT 0
+#define DESC_STR_SIZE 256
+#define TITLE_DATE_STR_SIZE 30
+#define CREATE_VALID_WORD_NUM 4
+#define CREATE_DESC_IDX 3
+#define SEND__GET_RSVP_ONLY_COMMAND 1
+
+///////////////////////////// emReadBench //////////////////////////////////////
+
+#define READ_BENCH_ARG_NUM 3
+#define READ_BENCH_ARG_IP 1
+#define READ_BENCH_ARG_PORT 2
+#define READ_BENCH_FIRST_OPTION_ARG 3
+#define READ_BENCH_USAGE "Usage: emReadBench serverAddress serverPort " \
+                         "[readers=num] [seconds=num]"
+#define READERS_OPTION "readers"
+#define SECONDS_OPTION "seconds"
+#define DEFAULT_BENCH_READERS 4
+#define DEFAULT_BENCH_SECONDS 3
+// requests a reader sends before it waits for their replies
+#define BENCH_PIPELINE_DEPTH 16
+// clients RSVP'ed to the event the readers list
+#define BENCH_RSVPS 32
+
+/////////////////////////////// emBench ////////////////////////////////////////
+
+#define MICRO_BENCH_USAGE "Usage: emBench [max_size=num] [max_threads=num] " \
+                          "[only=benchmark] [out=path] [baseline=path]"
+#define MAX_SIZE_OPTION "max_size"
+#define MAX_THREADS_OPTION "max_threads"
+#define ONLY_OPTION "only"
+#define OUT_OPTION "out"
+#define BASELINE_OPTION "baseline"
+// datasets have 1K, 10K... events and clients, up to the max size
+#define MIN_BENCH_SIZE 1000
+#define DEFAULT_MAX_BENCH_SIZE 1000000
+#define MAX_BENCH_SIZE 10000000
+#define BENCH_SIZE_FACTOR 10
+// benchmarks run on 1, 2, 4... threads, up to the max
+#define DEFAULT_MAX_BENCH_THREADS 8
+#define DEFAULT_BENCH_RESULTS "emBench.json"
+// the server's log is thrown away, and the log benchmarks write to files of
+// their own, removed once they are done
+#define BENCH_SERVER_LOG "/dev/null"
+#define BENCH_LOG_FILE "emBench.log"
+#define BENCH_ASYNC_LOG_FILE "emBench.async.log"
+#define BENCH_SYNC_LOG_LOCK "bench_sync_log_mutex"
+#define BENCH_ASYNC_LOG_LOCK "bench_async_log_mutex"
+// A measurement runs about this long: it is calibrated on a single thread,
+// with twice as many operations each time, until a run takes a tenth of it.
+#define BENCH_TARGET_NS (200 * 1000 * 1000ULL)
+#define BENCH_CALIBRATION_OPS 16
+// names a thread looks up, drawn at random before it is timed
+#define BENCH_NAMES_NUM 4096
+// a change from the baseline smaller than this is reported as noise
+#define BENCH_NOISE_PERCENT 5.0
+// what the benchmarks parse, create and log
+#define BENCH_REQUEST "bench_client CREATE party 2016-01-01 a party on the " \
+                      "roof, bring some drinks and friends"
+#define BENCH_OWNER "bench_owner"
+#define BENCH_TITLE "party"
+#define BENCH_DATE "2016-01-01"
+#define BENCH_DESCRIPTION "a party on the roof, bring some drinks and friends"
+#define BENCH_LOG_RECORD "bench_owner\tevent id 1000 was assigned to the " \
+                         "event with title party.\n"
+#define BENCH_LINE_SIZE 256
+
+/////////////////////////////// emLoad /////////////////////////////////////////
+
+#define LOAD_ARG_NUM 3
+#define LOAD_ARG_IP 1
+#define LOAD_ARG_PORT 2
+#define LOAD_FIRST_OPTION_ARG 3
+#define LOAD_USAGE "Usage: emLoad serverAddress serverPort [clients=num] " \
+                   "[threads=num] [rate=requests_per_second] " \
+                   "[seconds=num] [warmup=seconds] " \
+                   "[mix=COMMAND:weight,...]"
+#define CLIENTS_OPTION "clients"
+#define THREADS_OPTION "threads"
+// requests per second sent whether or not earlier ones were answered (an open
+// loop); without it each client waits for its reply (a closed loop)
+#define RATE_OPTION "rate"
+#define WARMUP_OPTION "warmup"
+#define MIX_OPTION "mix"
+#define MIX_DELIMITER ','
+#define MIX_WEIGHT_DELIMITER ':'
+#define DEFAULT_LOAD_CLIENTS 100
+#define DEFAULT_LOAD_THREADS 1
+#define DEFAULT_LOAD_SECONDS 10
+#define DEFAULT_LOAD_WARMUP 1
+#define DEFAULT_LOAD_MIX "REGISTER:5,CREATE:10,SEND_RSVP:25,GET_TOP_5:40," \
+                         "GET_RSVPS_LIST:20"
+// events created before the load starts, which SEND_RSVP and GET_RSVPS_LIST
+// pick from at random
+#define LOAD_EVENTS 64
+// requests of a client waiting for replies in an open loop, past which
+// requests are queued (and counted as delayed) until replies make room
+#define LOAD_MAX_PENDING 64
+#define LOAD_MAX_EPOLL_EVENTS 256
+// ms a thread waits for replies before checking whether the load is over
+#define LOAD_TICK_MS 100
+#define LOAD_READ_CHUNK_SIZE 65536
+#define LOAD_EVENT_TEXT "load_event 2016-01-01 created by the load generator"
+
+
+//==============================================================================
+//=============================== TYPEDEF ======================================
+//==============================================================================
+typedef enum {CLIENT, SERVER} Mode;
+
+// A view of characters owned by someone else (e.g. a client's name, or a
+// received request). Cheap to copy, never allocates.
+typedef struct
+{
+    const char* data;
+    size_t length;
+} StrRef;
+
+// Hash of a name, ignoring the case of its (ASCII) letters.
+struct CaseInsensitiveHash
+{
+    size_t operator()(const StrRef& key) const;
+};
+
+// Equality of names, ignoring the case of their (ASCII) letters.
+struct CaseInsensitiveEqual
+{
+    bool operator()(const StrRef& first, const StrRef& second) const;
+};
+
+// Order of names by their bytes.
+struct NameLess
+{
+    bool operator()(const StrRef& first, const StrRef& second) const;
+};
+
+// Commands of the protocol, as carried by the opcode field of a frame header.
+typedef enum
+{
+    OP_NONE = 0,
+    OP_REGISTER,
+    OP_UNREGISTER,
+    OP_CREATE,
+    OP_GET_TOP_5,
+    OP_SEND_RSVP,
+    OP_GET_RSVPS_LIST,
+    OP_GET_TOP_N,
+    OP_GET_EVENTS_RANGE,
+    OP_SEARCH,
+    OP_GET_EVENTS,
+    OP_SUBSCRIBE,
+    OP_UNSUBSCRIBE,
+    OP_STATS
+} Opcode;
+
+// the number of opcodes, OP_NONE included
+#define OPCODES_NUM (OP_STATS + 1)
+
+// Decoded frame header.
+typedef struct
+{
+    uint8_t magic;
+    uint8_t opcode;
+    uint16_t flags;
+    uint32_t request_id;
+    uint32_t length;
+} FrameHeader;
+
+
+//==============================================================================
+//================================ UTILS =======================================
+//==============================================================================
+
+/**
+ * Check if given string is an integer.
+ */
+bool isInteger(const std::string & s);
+/**
+ * Read data from a socket. how_much bytes will be read before return.
+ */
+int read_data(int* sock, char *write_to_me, int how_much);
+
+/**
+ * Write data to socket.
+ */
+int write_data(int* sock, char* read_from_me, int how_much);
+
+////////////////////////////////////////////////////////////////////////////////
+// Protocol utils
+
+/**
+ * Get the opcode of a (upper case) command text. OP_NONE if there is none.
+ */
+Opcode opcode_from_text(const string& command);
+/**
+ * Get the opcode of a (upper case) command, without allocating. OP_NONE if
+ * there is none.
+ */
+Opcode opcode_from_ref(const StrRef& command);
+
+/**
+ * Get the command text of an opcode. "NONE" for OP_NONE.
+ */
+const char* text_from_opcode(Opcode opcode);
+
+/**
+ * Serialize a frame header into FRAME_HEADER_SIZE bytes.
+ */
+void encode_frame_header(const FrameHeader& header, unsigned char* out);
+
+/**
+ * Deserialize FRAME_HEADER_SIZE bytes into a frame header.
+ */
+FrameHeader decode_frame_header(const unsigned char* in);
+
+/**
+ * Write a single frame (header and payload) to a socket.
+ */
+int write_frame(int* sock, uint8_t opcode, uint32_t request_id, \
+                const string& payload);
+
+/**
+ * Read the payload of a frame whose header was already read and decoded.
+ */
+int read_frame_payload(int* sock, const FrameHeader& header, string& payload);
+
+/**
+ * Read a single frame from a socket.
+ */
+int read_frame(int* sock, FrameHeader& header, string& payload);
+
+/**
+ * Write a message in the legacy fixed size (PROTOCOL_MESSAGE_SIZE) format.
+ */
+int write_legacy_message(int* sock, const string& message);
+////////////////////////////////////////////////////////////////////////////////
+// TCP utils
+
+/**
+ * Initialize a sockaddr_in struct
+ */
+sockaddr_in init_sockaddr(int port, in_addr_t addr);
+
+////////////////////////////////////////////////////////////////////////////////
+// General utils
+
+/**
+ * Get te current time in HH:MM:SS format
+ */
+string get_current_time();
+
+/**
+ * Current time of the monotonic clock, in nanoseconds.
+ */
+uint64_t monotonic_ns();
+
+/**
+ * Get the relevant error text
+ */
+string sys_call_error(string function);
+/**
+ * A helping method that writes, in case of failures, message and exits.
+ */
+void exit_write_close(Log* logfile, string message, int EXIT_CODE);
+
+/**
+ * Split a "key=value" command line option. Returns false if arg is not one.
+ */
+bool parse_option(const string& arg, string& key, string& value);
+
+/**
+ * Parse the integer value of a command line option. Returns false, and leaves
+ * number as it is, if it is not an int (e.g. it is too large for one).
+ */
+bool parse_int_option(const string& value, int& number);
+
+////////////////////////////////////////////////////////////////////////////////
+// Parser utils
+/**
+ * convert a string to its upper case string
+ */
+string to_upper(string data);
+/**
+ * A view of a string's characters, valid while the string is not modified.
+ */
+StrRef make_ref(const string& str);
+/**
+ * A view of length characters starting at data.
+ */
+StrRef make_ref(const char* data, size_t length);
+/**
+ * The characters of a view, as a string.
+ */
+string ref_to_string(const StrRef& ref);
+/**
+ * Split a string into vector of strings using a delimiter
+ */
+vector<string> split(string str, char delimiter);
+/**
+ * Split message on delimiter into at most max_tokens views of it, without
+ * allocating. The last token holds the rest of the message, delimiters
+ * included. As with split, a trailing delimiter does not start a token.
+ * Returns the number of tokens.
+ */
+size_t tokenize(const StrRef& message, char delimiter, StrRef* tokens,
+                size_t max_tokens);
+/**
+ * Parse a (signed) decimal integer, clamped to the range of long. Returns false
+ * if ref is not an integer.
+ */
+bool ref_to_long(const StrRef& ref, long& value);
+/**
+ * Parse a date given as DD/MM/YYYY or YYYY-MM-DD into its key, YYYYMMDD, which
+ * orders dates as integers do. Returns false if date is in neither format.
+ */
+bool parse_date_key(const StrRef& date, uint32_t& key);
+
+string get_event_description(int start_index, vector<string> split_msg);
+
+#endif //EX5_UTILS_H
@@ -0,0 +1,162 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <time.h>
+#include "WorkerPool.h"
+#include "Utils.h"
+#include "Trace.h"
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+WorkerPool::WorkerPool(int workers_num, int queue_capacity)
+        :workers_num(workers_num),
+         is_running(false),
+         is_stopping(false),
+         queue((size_t) queue_capacity),
+         head(0),
+         size(0)
+{
+    pthread_mutex_init(&queue_mutex, NULL);
+    pthread_cond_init(&not_empty, NULL);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.workers_num = workers_num;
+    stats.queue_capacity = queue_capacity;
+}
+
+/**
+ * Destructor. Stops the workers if they are still running.
+ */
+WorkerPool::~WorkerPool()
+{
+    stop();
+    pthread_cond_destroy(&not_empty);
+    pthread_mutex_destroy(&queue_mutex);
+}
+
+/*
+ * Spawn the workers.
+ */
+int WorkerPool::start()
+{
+    is_running = true;
+
+    for (int i = 0; i < workers_num; i++)
+    {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, worker_thread_func, this) != SUCCESS)
+        {
+            stop();
+            return FAILURE;
+        }
+        workers.push_back(worker);
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Execute the tasks left in the queue, and wait for the workers to exit.
+ */
+void WorkerPool::stop()
+{
+    if (!is_running)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&queue_mutex);
+    is_stopping = true;
+    pthread_cond_broadcast(&not_empty);
+    pthread_mutex_unlock(&queue_mutex);
+
+    for (auto const& worker: workers)
+    {
+        pthread_join(worker, NULL);
+    }
+
+    workers.clear();
+    is_running = false;
+}
+
+/**
+ * Queue a task. Returns false, without queuing it, if the queue is full.
+ */
+bool WorkerPool::try_submit(void (*function)(void*), void* arg)
+{
+    pthread_mutex_lock(&queue_mutex);
+
+    if (size == (int) queue.size() || is_stopping)
+    {
+        stats.rejected++;
+        pthread_mutex_unlock(&queue_mutex);
+        return false;
+    }
+
+    Task& task = queue[(head + size) % queue.size()];
+    task.function = function;
+    task.arg = arg;
+    task.queued_at_ns = monotonic_ns();
+    size++;
+
+    stats.submitted++;
+    stats.max_queue_depth = std::max(stats.max_queue_depth, size);
+
+    pthread_cond_signal(&not_empty);
+    pthread_mutex_unlock(&queue_mutex);
+
+    return true;
+}
+
+/**
+ * A snapshot of the pool's counters.
+ */
+WorkerPoolStats WorkerPool::get_stats()
+{
+    pthread_mutex_lock(&queue_mutex);
+    WorkerPoolStats current = stats;
+    current.queue_depth = size;
+    pthread_mutex_unlock(&queue_mutex);
+
+    return current;
+}
+
+/**
+ * Each worker takes tasks from the queue and executes them, until the pool
+ * is stopped and the queue is empty.
+ */
+void* WorkerPool::worker_thread_func(void* args)
+{
+    WorkerPool* pool = (WorkerPool*) args;
+    trace_name_thread(WORKER_THREAD_NAME);
+
+    while (true)
+    {
+        pthread_mutex_lock(&pool->queue_mutex);
+        while (pool->size == 0 && !pool->is_stopping)
+        {
+            pthread_cond_wait(&pool->not_empty, &pool->queue_mutex);
+        }
+
+        if (pool->size == 0)
+        {
+            pthread_mutex_unlock(&pool->queue_mutex);
+            break;
+        }
+
+        Task task = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % (int) pool->queue.size();
+        pool->size--;
+
+        uint64_t wait_ns = monotonic_ns() - task.queued_at_ns;
+        pool->stats.total_wait_ns += wait_ns;
+        pool->stats.max_wait_ns = std::max(pool->stats.max_wait_ns, wait_ns);
+        pool->stats.executed++;
+        pthread_mutex_unlock(&pool->queue_mutex);
+
+        task.function(task.arg);
+    }
+
+    return NULL;
+}
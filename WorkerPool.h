@@ -0,0 +1,97 @@
+#ifndef EX5_WORKERPOOL_H
+#define EX5_WORKERPOOL_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+// A task handed to the pool, with the time it was queued at.
+typedef struct
+{
+    void (*function)(void*);
+    void* arg;
+    uint64_t queued_at_ns;
+} Task;
+
+// Counters of a worker pool, for tuning its size and queue depth.
+typedef struct
+{
+    int workers_num;
+    int queue_capacity;
+    // tasks currently queued, and the most that were ever queued at once
+    int queue_depth;
+    int max_queue_depth;
+    uint64_t submitted;
+    // tasks refused since the queue was full
+    uint64_t rejected;
+    // time tasks waited in the queue before a worker took them
+    uint64_t total_wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t executed;
+} WorkerPoolStats;
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * A fixed number of worker threads, which execute tasks taken from a bounded
+ * queue (many producers, many consumers). When the queue is full, tasks are
+ * refused rather than queued, so the caller can report an overload.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool(int workers_num, int queue_capacity);
+
+    /**
+     * Destructor. Stops the workers if they are still running.
+     */
+    ~WorkerPool();
+
+    /*
+     * Spawn the workers.
+     */
+    int start();
+
+    /*
+     * Execute the tasks left in the queue, and wait for the workers to exit.
+     */
+    void stop();
+
+    /**
+     * Queue a task. Returns false, without queuing it, if the queue is full.
+     */
+    bool try_submit(void (*function)(void*), void* arg);
+
+    /**
+     * A snapshot of the pool's counters.
+     */
+    WorkerPoolStats get_stats();
+
+private:
+    static void* worker_thread_func(void* args);
+
+    int workers_num;
+    std::vector<pthread_t> workers;
+    bool is_running;
+    bool is_stopping;
+
+    // circular buffer of queue_capacity tasks, from head on
+    std::vector<Task> queue;
+    int head;
+    int size;
+
+    // guards the queue and the counters
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t not_empty;
+
+    WorkerPoolStats stats;
+};
+
+#endif //EX5_WORKERPOOL_H
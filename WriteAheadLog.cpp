@@ -0,0 +1,773 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "WriteAheadLog.h"
+#include "Utils.h"
+#include "Trace.h"
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+// A record is framed as: body length (4) | CRC-32 of the body (4) | body. The
+// body is the record's type (1) followed by its fields, integers in network
+// byte order and strings prefixed by their length (4).
+#define RECORD_HEADER_SIZE 8
+
+// the spans of a traced request appending a record, and waiting for the mutex
+#define TRACE_APPEND_SPAN "wal_append"
+#define TRACE_MUTEX_WAIT_SPAN "wal_mutex_wait"
+
+static void put_u32(std::string& out, uint32_t value)
+{
+    value = htonl(value);
+    out.append((const char*) &value, sizeof(value));
+}
+
+static void put_u64(std::string& out, uint64_t value)
+{
+    put_u32(out, (uint32_t) (value >> 32));
+    put_u32(out, (uint32_t) value);
+}
+
+static void put_string(std::string& out, const std::string& value)
+{
+    put_u32(out, (uint32_t) value.length());
+    out += value;
+}
+
+// Reads the fields of a record's body, failing once they run past its end.
+typedef struct
+{
+    const char* data;
+    size_t length;
+    size_t offset;
+} BodyReader;
+
+static bool get_u32(BodyReader& reader, uint32_t& value)
+{
+    if (reader.length - reader.offset < sizeof(value))
+    {
+        return false;
+    }
+    memcpy(&value, reader.data + reader.offset, sizeof(value));
+    value = ntohl(value);
+    reader.offset += sizeof(value);
+    return true;
+}
+
+static bool get_u64(BodyReader& reader, uint64_t& value)
+{
+    uint32_t high, low;
+    if (!get_u32(reader, high) || !get_u32(reader, low))
+    {
+        return false;
+    }
+    value = ((uint64_t) high << 32) | low;
+    return true;
+}
+
+static bool get_string(BodyReader& reader, std::string& value)
+{
+    uint32_t length;
+    if (!get_u32(reader, length) || reader.length - reader.offset < length)
+    {
+        return false;
+    }
+    value.assign(reader.data + reader.offset, length);
+    reader.offset += length;
+    return true;
+}
+
+/**
+ * Decode the body of a record. false if it is malformed.
+ */
+static bool decode_record(const char* body, size_t length, StoreRecord& record)
+{
+    BodyReader reader = {body, length, 0};
+    if (length == 0)
+    {
+        return false;
+    }
+    record.type = (uint8_t) body[0];
+    reader.offset = 1;
+
+    switch (record.type)
+    {
+    case RECORD_SNAPSHOT:
+        return get_u64(reader, record.generation);
+    case RECORD_REGISTER:
+    case RECORD_UNREGISTER:
+        return get_string(reader, record.name);
+    case RECORD_CREATE:
+        return get_u32(reader, record.event_id) &&
+               get_string(reader, record.title) &&
+               get_string(reader, record.date) &&
+               get_string(reader, record.description);
+    case RECORD_RSVP:
+        return get_u32(reader, record.event_id) &&
+               get_string(reader, record.name);
+    default:
+        return false;
+    }
+}
+
+// CRC-32 of each byte value (crc_tables[0]), and of each byte value followed
+// by 1 to 7 zero bytes, so that 8 bytes are folded in at once. Built on first
+// use.
+#define CRC_SLICES 8
+static uint32_t crc_tables[CRC_SLICES][256];
+static pthread_once_t crc_tables_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_tables()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t value = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+        }
+        crc_tables[0][i] = value;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (int slice = 1; slice < CRC_SLICES; slice++)
+        {
+            uint32_t previous = crc_tables[slice - 1][i];
+            crc_tables[slice][i] = (previous >> 8) ^
+                                   crc_tables[0][previous & 0xFF];
+        }
+    }
+}
+
+/**
+ * Write all of data to a file.
+ */
+static int write_all(int fd, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return FAILURE;
+        }
+        data += written;
+        length -= (size_t) written;
+    }
+    return SUCCESS;
+}
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+/**
+ * CRC-32 (IEEE) of length bytes, continuing crc.
+ */
+uint32_t crc32(const void* data, size_t length, uint32_t crc)
+{
+    pthread_once(&crc_tables_once, build_crc_tables);
+
+    const unsigned char* bytes = (const unsigned char*) data;
+    crc ^= 0xFFFFFFFF;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (length >= CRC_SLICES)
+    {
+        uint32_t low, high;
+        memcpy(&low, bytes, sizeof(low));
+        memcpy(&high, bytes + sizeof(low), sizeof(high));
+        low ^= crc;
+        crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF] ^
+              crc_tables[5][(low >> 16) & 0xFF] ^ crc_tables[4][low >> 24] ^
+              crc_tables[3][high & 0xFF] ^ crc_tables[2][(high >> 8) & 0xFF] ^
+              crc_tables[1][(high >> 16) & 0xFF] ^ crc_tables[0][high >> 24];
+        bytes += CRC_SLICES;
+        length -= CRC_SLICES;
+    }
+#endif
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = crc_tables[0][(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * Append a record to out, framed by its length and checksum.
+ */
+void encode_record(const StoreRecord& record, std::string& out)
+{
+    size_t header_offset = out.length();
+    out.append(RECORD_HEADER_SIZE, '\0');
+
+    out += (char) record.type;
+    switch (record.type)
+    {
+    case RECORD_SNAPSHOT:
+        put_u64(out, record.generation);
+        break;
+    case RECORD_REGISTER:
+    case RECORD_UNREGISTER:
+        put_string(out, record.name);
+        break;
+    case RECORD_CREATE:
+        put_u32(out, record.event_id);
+        put_string(out, record.title);
+        put_string(out, record.date);
+        put_string(out, record.description);
+        break;
+    case RECORD_RSVP:
+        put_u32(out, record.event_id);
+        put_string(out, record.name);
+        break;
+    }
+
+    size_t body_offset = header_offset + RECORD_HEADER_SIZE;
+    uint32_t length = htonl((uint32_t) (out.length() - body_offset));
+    uint32_t checksum = htonl(crc32(out.data() + body_offset,
+                                    out.length() - body_offset));
+    memcpy(&out[header_offset], &length, sizeof(length));
+    memcpy(&out[header_offset + sizeof(length)], &checksum, sizeof(checksum));
+}
+
+/**
+ * Call apply on each record of a log or snapshot file, in order, until the
+ * first torn or corrupt record.
+ */
+int read_records(const std::string& path,
+                 void (*apply)(const StoreRecord&, void*), void* arg,
+                 uint64_t& records_num, uint64_t& valid_length, bool& is_torn)
+{
+    records_num = 0;
+    valid_length = 0;
+    is_torn = false;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return FAILURE;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0)
+    {
+        ::close(fd);
+        return FAILURE;
+    }
+    size_t file_size = (size_t) file_stat.st_size;
+    if (file_size == 0)
+    {
+        ::close(fd);
+        return SUCCESS;
+    }
+
+    const char* data = (const char*) mmap(nullptr, file_size, PROT_READ,
+                                          MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        return FAILURE;
+    }
+
+    StoreRecord record;
+    size_t offset = 0;
+    while (offset < file_size)
+    {
+        uint32_t length, checksum;
+        if (file_size - offset < RECORD_HEADER_SIZE)
+        {
+            is_torn = true;
+            break;
+        }
+        memcpy(&length, data + offset, sizeof(length));
+        memcpy(&checksum, data + offset + sizeof(length), sizeof(checksum));
+        length = ntohl(length);
+        checksum = ntohl(checksum);
+
+        const char* body = data + offset + RECORD_HEADER_SIZE;
+        if (file_size - offset - RECORD_HEADER_SIZE < length ||
+            crc32(body, length) != checksum ||
+            !decode_record(body, length, record))
+        {
+            is_torn = true;
+            break;
+        }
+
+        apply(record, arg);
+        records_num++;
+        offset += RECORD_HEADER_SIZE + length;
+    }
+    valid_length = offset;
+
+    munmap((void*) data, file_size);
+    return SUCCESS;
+}
+
+//==============================================================================
+//============================= WRITE AHEAD LOG ================================
+//==============================================================================
+WriteAheadLog::WriteAheadLog(const std::string& dir, Durability durability,
+                             int commit_delay_us, void (*on_commit)(uint64_t))
+        :dir(dir),
+         durability(durability),
+         commit_delay_ns((uint64_t) commit_delay_us * NS_IN_US),
+         on_commit(on_commit),
+         fd(FAILURE),
+         generation(0),
+         size(0),
+         buffered_records(0),
+         appended_lsn(0),
+         first_buffered_ns(0),
+         durable_lsn(0),
+         failed_from_lsn(0),
+         reported_lsn(0),
+         has_committer(false),
+         is_stopping(false),
+         is_committing(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+
+    // the committer waits for its delay on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&to_commit, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&committed, NULL);
+
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * Destructor. Commits the records left and closes the current generation.
+ */
+WriteAheadLog::~WriteAheadLog()
+{
+    close();
+    pthread_cond_destroy(&committed);
+    pthread_cond_destroy(&to_commit);
+    pthread_mutex_destroy(&mutex);
+}
+
+/*
+ * Start writing a new (empty) generation, and the committer if needed.
+ */
+int WriteAheadLog::open(uint64_t generation)
+{
+    int new_fd = ::open(generation_path(dir, generation).c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (new_fd < 0)
+    {
+        return FAILURE;
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    fd = new_fd;
+    this->generation = generation;
+    size = 0;
+    close_failed_range();
+    pthread_mutex_unlock(&mutex);
+
+    if (durability == DURABILITY_BATCHED && !has_committer)
+    {
+        if (pthread_create(&committer, NULL, committer_thread_func, this) !=
+            SUCCESS)
+        {
+            return FAILURE;
+        }
+        has_committer = true;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Commit the records left, and close the current generation.
+ */
+void WriteAheadLog::close()
+{
+    if (has_committer)
+    {
+        pthread_mutex_lock(&mutex);
+        is_stopping = true;
+        pthread_cond_signal(&to_commit);
+        pthread_mutex_unlock(&mutex);
+
+        pthread_join(committer, nullptr);
+        has_committer = false;
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (fd >= 0)
+    {
+        commit_buffer();
+        ::close(fd);
+        fd = FAILURE;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Append a record to the current generation; lsn is set to its number.
+ */
+int WriteAheadLog::append(const StoreRecord& record, uint64_t& lsn)
+{
+    TraceScope appending(TRACE_APPEND_SPAN);
+    std::string encoded;
+    encode_record(record, encoded);
+
+    {
+        TraceScope wait(TRACE_MUTEX_WAIT_SPAN);
+        pthread_mutex_lock(&mutex);
+    }
+    if (fd < 0)
+    {
+        pthread_mutex_unlock(&mutex);
+        return FAILURE;
+    }
+
+    // a record which follows a failed one fails at once; so do the records
+    // still buffered, which all follow it too, and no batch is written
+    if (failed_from_lsn != 0)
+    {
+        lsn = ++appended_lsn;
+        durable_lsn.store(appended_lsn);
+        pthread_cond_signal(&to_commit);
+        pthread_mutex_unlock(&mutex);
+        return FAILURE;
+    }
+
+    int result = SUCCESS;
+    if (durability == DURABILITY_BATCHED)
+    {
+        if (buffered_records == 0)
+        {
+            first_buffered_ns = monotonic_ns();
+        }
+        buffer += encoded;
+        buffered_records++;
+
+        // the committer waits for the first record, or for a full batch
+        if (buffered_records == 1 || buffer.length() >= WAL_BATCH_SIZE)
+        {
+            pthread_cond_signal(&to_commit);
+        }
+    }
+    else
+    {
+        uint64_t start_ns = monotonic_ns();
+        result = write_all(fd, encoded.data(), encoded.length());
+        if (result == SUCCESS && durability == DURABILITY_STRICT)
+        {
+            result = fdatasync(fd) == 0 ? SUCCESS : FAILURE;
+
+            uint64_t commit_ns = monotonic_ns() - start_ns;
+            stats.commits++;
+            stats.committed_records++;
+            stats.max_batch_records = 1;
+            stats.total_commit_ns += commit_ns;
+            stats.max_commit_ns = std::max(stats.max_commit_ns, commit_ns);
+        }
+    }
+
+    if (result == SUCCESS)
+    {
+        size += encoded.length();
+    }
+    lsn = ++appended_lsn;
+    if (result == FAILURE)
+    {
+        fail_from(lsn);
+    }
+    if (durability != DURABILITY_BATCHED)
+    {
+        durable_lsn.store(appended_lsn);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return result;
+}
+
+/**
+ * Commit the current generation and start the next one.
+ */
+int WriteAheadLog::rotate()
+{
+    int new_fd = ::open(generation_path(dir, get_generation() + 1).c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (new_fd < 0)
+    {
+        return FAILURE;
+    }
+
+    pthread_mutex_lock(&mutex);
+    // the batch the committer writes belongs to the current generation
+    while (is_committing)
+    {
+        pthread_cond_wait(&committed, &mutex);
+    }
+    int result = commit_buffer();
+
+    ::close(fd);
+    fd = new_fd;
+    generation++;
+    size = 0;
+    close_failed_range();
+
+    // let the committer report the records committed here
+    pthread_cond_signal(&to_commit);
+    pthread_mutex_unlock(&mutex);
+
+    return result;
+}
+
+/**
+ * The LSN up to which records are durable.
+ */
+uint64_t WriteAheadLog::get_durable_lsn() const
+{
+    return durable_lsn.load();
+}
+
+/**
+ * Whether a settled record failed to be written or synced.
+ */
+bool WriteAheadLog::is_failed(uint64_t lsn)
+{
+    pthread_mutex_lock(&mutex);
+    bool failed = failed_from_lsn != 0 && lsn >= failed_from_lsn;
+    for (size_t i = 0; i < failed_ranges.size() && !failed; i++)
+    {
+        failed = lsn >= failed_ranges[i].first &&
+                 lsn <= failed_ranges[i].second;
+    }
+    pthread_mutex_unlock(&mutex);
+    return failed;
+}
+
+/**
+ * The current generation.
+ */
+uint64_t WriteAheadLog::get_generation()
+{
+    pthread_mutex_lock(&mutex);
+    uint64_t current = generation;
+    pthread_mutex_unlock(&mutex);
+    return current;
+}
+
+/**
+ * The bytes appended to the current generation.
+ */
+uint64_t WriteAheadLog::get_size()
+{
+    pthread_mutex_lock(&mutex);
+    uint64_t current = size;
+    pthread_mutex_unlock(&mutex);
+    return current;
+}
+
+/**
+ * A snapshot of the commit counters.
+ */
+WalStats WriteAheadLog::get_stats()
+{
+    pthread_mutex_lock(&mutex);
+    WalStats current = stats;
+    pthread_mutex_unlock(&mutex);
+    return current;
+}
+
+/**
+ * Write the buffered records to the current generation, and sync it.
+ * The mutex is held.
+ */
+int WriteAheadLog::commit_buffer()
+{
+    if (buffered_records == 0)
+    {
+        return SUCCESS;
+    }
+
+    int result = FAILURE;
+    if (failed_from_lsn == 0)
+    {
+        uint64_t start_ns = monotonic_ns();
+        result = write_all(fd, buffer.data(), buffer.length());
+        if (result == SUCCESS)
+        {
+            result = fdatasync(fd) == 0 ? SUCCESS : FAILURE;
+        }
+
+        uint64_t commit_ns = monotonic_ns() - start_ns;
+        stats.commits++;
+        stats.committed_records += buffered_records;
+        stats.max_batch_records = std::max(stats.max_batch_records,
+                                           buffered_records);
+        stats.total_commit_ns += commit_ns;
+        stats.max_commit_ns = std::max(stats.max_commit_ns, commit_ns);
+        if (result == FAILURE)
+        {
+            stats.failed_commits++;
+        }
+    }
+    if (result == FAILURE)
+    {
+        fail_from(appended_lsn - buffered_records + 1);
+    }
+
+    buffer.clear();
+    buffered_records = 0;
+    durable_lsn.store(appended_lsn);
+    return result;
+}
+
+/**
+ * Fail the records of the current generation from first_lsn on: a record
+ * appended after one which is missing (or torn) is not replayed.
+ */
+void WriteAheadLog::fail_from(uint64_t first_lsn)
+{
+    if (failed_from_lsn == 0)
+    {
+        failed_from_lsn = first_lsn;
+    }
+}
+
+/**
+ * Keep the failed records of the current generation, if any, before a new
+ * one starts.
+ */
+void WriteAheadLog::close_failed_range()
+{
+    if (failed_from_lsn != 0)
+    {
+        failed_ranges.push_back(std::make_pair(failed_from_lsn,
+                                               appended_lsn));
+        failed_from_lsn = 0;
+    }
+}
+
+/**
+ * The committer: waits for records, gives the records appended after the
+ * first one commit_delay to join the batch (unless it is full), then writes
+ * and syncs the batch with the mutex released, and reports it to on_commit.
+ */
+void* WriteAheadLog::committer_thread_func(void* args)
+{
+    WriteAheadLog* wal = (WriteAheadLog*) args;
+    // swapped with the buffer, so that both keep their capacity
+    std::string batch;
+
+    pthread_mutex_lock(&wal->mutex);
+    while (true)
+    {
+        uint64_t durable = wal->durable_lsn.load();
+        if (wal->reported_lsn < durable)
+        {
+            wal->reported_lsn = durable;
+            pthread_mutex_unlock(&wal->mutex);
+            wal->on_commit(durable);
+            pthread_mutex_lock(&wal->mutex);
+            continue;
+        }
+
+        if (wal->buffered_records == 0)
+        {
+            if (wal->is_stopping)
+            {
+                break;
+            }
+            pthread_cond_wait(&wal->to_commit, &wal->mutex);
+            continue;
+        }
+
+        uint64_t deadline_ns = wal->first_buffered_ns + wal->commit_delay_ns;
+        if (!wal->is_stopping && wal->buffer.length() < WAL_BATCH_SIZE &&
+            monotonic_ns() < deadline_ns)
+        {
+            struct timespec deadline;
+            deadline.tv_sec = (time_t) (deadline_ns / 1000000000ULL);
+            deadline.tv_nsec = (long) (deadline_ns % 1000000000ULL);
+            pthread_cond_timedwait(&wal->to_commit, &wal->mutex, &deadline);
+            continue;
+        }
+
+        batch.swap(wal->buffer);
+        uint64_t batch_records = wal->buffered_records;
+        uint64_t batch_lsn = wal->appended_lsn;
+        wal->buffered_records = 0;
+        // a batch which follows a failed record is failed without writing it
+        if (wal->failed_from_lsn != 0)
+        {
+            batch.clear();
+            wal->durable_lsn.store(batch_lsn);
+            continue;
+        }
+        wal->is_committing = true;
+        pthread_mutex_unlock(&wal->mutex);
+
+        uint64_t start_ns = monotonic_ns();
+        int result = write_all(wal->fd, batch.data(), batch.length());
+        if (result == SUCCESS)
+        {
+            result = fdatasync(wal->fd) == 0 ? SUCCESS : FAILURE;
+        }
+        uint64_t commit_ns = monotonic_ns() - start_ns;
+        batch.clear();
+
+        pthread_mutex_lock(&wal->mutex);
+        wal->is_committing = false;
+        pthread_cond_broadcast(&wal->committed);
+
+        wal->stats.commits++;
+        wal->stats.committed_records += batch_records;
+        wal->stats.max_batch_records = std::max(wal->stats.max_batch_records,
+                                                batch_records);
+        wal->stats.total_commit_ns += commit_ns;
+        wal->stats.max_commit_ns = std::max(wal->stats.max_commit_ns,
+                                            commit_ns);
+
+        // the replies are released either way, failed ones as errors (the
+        // records may not survive a crash, or be replayed after the torn one)
+        if (result == FAILURE)
+        {
+            wal->stats.failed_commits++;
+            wal->fail_from(batch_lsn - batch_records + 1);
+        }
+        wal->durable_lsn.store(batch_lsn);
+    }
+    pthread_mutex_unlock(&wal->mutex);
+
+    return nullptr;
+}
+
+/**
+ * The path of a generation's file in dir.
+ */
+std::string WriteAheadLog::generation_path(const std::string& dir,
+                                           uint64_t generation)
+{
+    return dir + "/" WAL_FILE_PREFIX + std::to_string(generation);
+}
+
+/**
+ * The path of the snapshot in dir.
+ */
+std::string WriteAheadLog::snapshot_path(const std::string& dir)
+{
+    return dir + "/" SNAPSHOT_FILE;
+}
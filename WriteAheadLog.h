@@ -0,0 +1,232 @@
+#ifndef EX5_WRITEAHEADLOG_H
+#define EX5_WRITEAHEADLOG_H
+
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+// Kinds of records. A snapshot of an older version is a RECORD_SNAPSHOT
+// record, followed by the records which rebuild the store it was taken of.
+typedef enum
+{
+    RECORD_SNAPSHOT = 1,
+    RECORD_REGISTER,
+    RECORD_UNREGISTER,
+    RECORD_CREATE,
+    RECORD_RSVP
+} RecordType;
+
+// A mutation of the store, as written to a write-ahead log (or an older
+// snapshot).
+typedef struct
+{
+    uint8_t type;
+    // RECORD_SNAPSHOT: the last log generation the snapshot covers
+    uint64_t generation;
+    // RECORD_CREATE, RECORD_RSVP
+    uint32_t event_id;
+    // RECORD_REGISTER, RECORD_UNREGISTER, RECORD_RSVP
+    std::string name;
+    // RECORD_CREATE
+    std::string title;
+    std::string date;
+    std::string description;
+} StoreRecord;
+
+//==============================================================================
+//=============================== FUNCTIONS ====================================
+//==============================================================================
+/**
+ * CRC-32 (IEEE) of length bytes. crc is the CRC-32 of the bytes preceding
+ * them, if the checksum is computed in parts.
+ */
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0);
+
+/**
+ * Append a record to out, framed by its length and checksum.
+ */
+void encode_record(const StoreRecord& record, std::string& out);
+
+/**
+ * Call apply on each record of a log or snapshot file, in order. Reading stops
+ * at the first torn or corrupt record; valid_length is then the length of the
+ * records before it, and is_torn is set. Returns FAILURE if the file could not
+ * be read (errno tells why).
+ */
+int read_records(const std::string& path,
+                 void (*apply)(const StoreRecord&, void*), void* arg,
+                 uint64_t& records_num, uint64_t& valid_length, bool& is_torn);
+
+// How durable the record of a mutation is once the mutation is answered.
+typedef enum
+{
+    // written to the file; the system syncs it to the disk when it sees fit
+    DURABILITY_NONE,
+    // synced by the committer, together with the records appended meanwhile
+    // (for up to a delay after the first of them); the replies to the
+    // mutations wait for the sync
+    DURABILITY_BATCHED,
+    // synced on its own, before the next record is appended
+    DURABILITY_STRICT
+} Durability;
+
+// Counters of a write-ahead log's syncs (commits), for tuning the delay.
+typedef struct
+{
+    uint64_t commits;
+    uint64_t committed_records;
+    // records synced by a single commit
+    uint64_t max_batch_records;
+    // time commits took to write and sync their records
+    uint64_t total_commit_ns;
+    uint64_t max_commit_ns;
+    // commits whose write or sync failed
+    uint64_t failed_commits;
+} WalStats;
+
+//==============================================================================
+//================================== CLASS =====================================
+//==============================================================================
+/**
+ * An append only log of the store's mutations, split into generations: each
+ * generation is a file of its own, and a snapshot covers all the generations
+ * up to the one that was current when it was taken.
+ * Records are numbered in the order they are appended (their LSN). How they
+ * are written depends on the durability: with DURABILITY_BATCHED they are
+ * buffered, and a committer thread writes and syncs them in batches, then
+ * reports the LSN up to which records are settled to on_commit.
+ * Once a record could not be written or synced, the records after it in its
+ * generation could not be replayed either, so they all fail, up to the next
+ * generation; is_failed tells whether a settled record did.
+ */
+class WriteAheadLog
+{
+public:
+    WriteAheadLog(const std::string& dir, Durability durability,
+                  int commit_delay_us, void (*on_commit)(uint64_t));
+
+    /**
+     * Destructor. Commits the records left and closes the current generation.
+     */
+    ~WriteAheadLog();
+
+    /*
+     * Start writing a new (empty) generation, and the committer if needed.
+     */
+    int open(uint64_t generation);
+
+    /*
+     * Commit the records left, and close the current generation.
+     */
+    void close();
+
+    /**
+     * Append a record to the current generation; lsn is set to its number.
+     * Returns FAILURE if the record was not written (lsn is still set, unless
+     * the log is closed).
+     */
+    int append(const StoreRecord& record, uint64_t& lsn);
+
+    /**
+     * Commit the current generation and start the next one.
+     */
+    int rotate();
+
+    /**
+     * The LSN up to which records are settled: durable, or failed.
+     */
+    uint64_t get_durable_lsn() const;
+
+    /**
+     * Whether a settled record failed to be written or synced.
+     */
+    bool is_failed(uint64_t lsn);
+
+    /**
+     * The current generation, and the bytes appended to it.
+     */
+    uint64_t get_generation();
+    uint64_t get_size();
+
+    /**
+     * A snapshot of the commit counters.
+     */
+    WalStats get_stats();
+
+    /**
+     * The path of a generation's file, and of the snapshot, in dir.
+     */
+    static std::string generation_path(const std::string& dir,
+                                       uint64_t generation);
+    static std::string snapshot_path(const std::string& dir);
+
+private:
+    /**
+     * Write the buffered records to the current generation, and sync it.
+     * The mutex is held.
+     */
+    int commit_buffer();
+
+    /**
+     * Fail the records of the current generation from first_lsn on. The mutex
+     * is held.
+     */
+    void fail_from(uint64_t first_lsn);
+
+    /**
+     * Keep the failed records of the current generation, if any, before a new
+     * one starts. The mutex is held.
+     */
+    void close_failed_range();
+
+    static void* committer_thread_func(void* args);
+
+    std::string dir;
+    Durability durability;
+    uint64_t commit_delay_ns;
+    void (*on_commit)(uint64_t);
+
+    int fd;
+    uint64_t generation;
+    uint64_t size;
+
+    // records appended and not written yet (DURABILITY_BATCHED), the number
+    // of the last one, and when the first of them was appended
+    std::string buffer;
+    uint64_t buffered_records;
+    uint64_t appended_lsn;
+    uint64_t first_buffered_ns;
+
+    std::atomic<uint64_t> durable_lsn;
+    // the first failed record of the current generation (0 if none), and the
+    // failed records of the previous generations, as ranges of LSNs
+    uint64_t failed_from_lsn;
+    std::vector<std::pair<uint64_t, uint64_t>> failed_ranges;
+    // the durable LSN which was last reported to on_commit
+    uint64_t reported_lsn;
+
+    pthread_t committer;
+    bool has_committer;
+    bool is_stopping;
+    // the committer writes a batch, with the mutex released
+    bool is_committing;
+
+    // guards the fields above
+    pthread_mutex_t mutex;
+    // signaled when records are appended, or when the durable LSN moved
+    pthread_cond_t to_commit;
+    // signaled when the committer completed a batch
+    pthread_cond_t committed;
+
+    WalStats stats;
+};
+
+#endif //EX5_WRITEAHEADLOG_H
@@ -0,0 +1,619 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <math.h>
+#include <new>
+#include <map>
+#include <random>
+#include "Utils.h"
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+struct Benchmark;
+
+// A thread of a measurement.
+typedef struct
+{
+	pthread_t thread;
+	int index;
+	const Benchmark* benchmark;
+	// operations to run, and the allocations they made
+	uint64_t ops;
+	uint64_t allocations;
+	// what the benchmark reads (e.g. names to look up), prepared before the
+	// thread is timed
+	vector<string> names;
+	vector<string> split_msg;
+	string frame;
+	// sums what the operations returned, so that none is optimized away
+	size_t checksum;
+} BenchThread;
+
+// A hot path of the server, run in isolation.
+struct Benchmark
+{
+	const char* name;
+	// whether it is measured at each dataset size, or only once per number
+	// of threads (with size 0)
+	bool is_sized;
+	// grow the dataset to size clients and events, if it reads them
+	void (*prepare)(size_t size);
+	// prepare a thread, before it is timed
+	void (*setup)(BenchThread& thread, size_t size);
+	// run ops operations
+	void (*run)(BenchThread& thread, uint64_t ops);
+};
+
+// A measurement of a benchmark.
+typedef struct
+{
+	string name;
+	size_t size;
+	int threads_num;
+	uint64_t ops;
+	// the time an operation took on a thread, the operations of all the
+	// threads per second, and the allocations an operation made
+	double ns_per_op;
+	double ops_per_second;
+	double allocations_per_op;
+} BenchResult;
+
+//==============================================================================
+//================================= GLOBALS ====================================
+//==============================================================================
+// Defined by emServer.cpp, which is linked without its main.
+extern Log* server_log;
+extern ProfiledMutex server_log_mutex;
+extern atomic<size_t> events_num;
+void init_store();
+bool create_client(StrRef client_name);
+bool is_client_registered(StrRef client_name, bool to_del);
+int create_event(StrRef client_name, StrRef title, StrRef date,
+                 StrRef description);
+string top_events_reply(size_t top_n);
+
+// the calls to operator new the calling thread made
+thread_local uint64_t thread_allocations = 0;
+
+// the clients registered so far
+size_t bench_clients = 0;
+
+// the logs the log benchmarks write to
+Log* bench_sync_log = nullptr;
+Log* bench_async_log = nullptr;
+ProfiledMutex bench_sync_log_mutex(BENCH_SYNC_LOG_LOCK);
+ProfiledMutex bench_async_log_mutex(BENCH_ASYNC_LOG_LOCK);
+
+// the threads of a measurement start together
+pthread_barrier_t start_barrier;
+
+//==============================================================================
+//============================= ALLOCATIONS ====================================
+//==============================================================================
+// Every allocation of the program is counted by the thread making it. The
+// operators are not inlined, so that the compiler does not see a pointer from
+// operator new being freed.
+
+__attribute__((noinline))
+void* operator new(size_t size)
+{
+	thread_allocations++;
+	void* allocated = malloc(size == 0 ? 1 : size);
+	if (allocated == nullptr)
+	{
+		throw bad_alloc();
+	}
+	return allocated;
+}
+
+__attribute__((noinline))
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	thread_allocations++;
+	return malloc(size == 0 ? 1 : size);
+}
+
+__attribute__((noinline))
+void operator delete(void* allocated) noexcept
+{
+	free(allocated);
+}
+
+__attribute__((noinline))
+void operator delete(void* allocated, size_t) noexcept
+{
+	free(allocated);
+}
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+/**
+ * Report a failed system call and exit.
+ */
+void exit_with_error(const string& function)
+{
+	cerr << sys_call_error(function);
+	exit(ERROR);
+}
+
+/**
+ * The name of the i'th client the benchmarks register.
+ */
+string bench_client_name(size_t i)
+{
+	return "bench_client" + to_string(i);
+}
+
+/**
+ * Register clients until there are size of them.
+ */
+void prepare_clients(size_t size)
+{
+	for (; bench_clients < size; bench_clients++)
+	{
+		create_client(make_ref(bench_client_name(bench_clients)));
+	}
+}
+
+/**
+ * Create events until there are size of them.
+ */
+void prepare_events(size_t size)
+{
+	while (events_num.load() < size)
+	{
+		create_event(make_ref(BENCH_OWNER), make_ref(BENCH_TITLE),
+		             make_ref(BENCH_DATE), make_ref(BENCH_DESCRIPTION));
+	}
+}
+
+void prepare_nothing(size_t /*size*/)
+{
+}
+
+void setup_nothing(BenchThread& /*thread*/, size_t /*size*/)
+{
+}
+
+//==============================================================================
+//============================== BENCHMARKS ====================================
+//==============================================================================
+/**
+ * split: a CREATE request, into its words.
+ */
+void run_split(BenchThread& thread, uint64_t ops)
+{
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		thread.checksum += split(BENCH_REQUEST, STRING_DELIMITER).size();
+	}
+}
+
+/**
+ * get_event_description: the description of a split CREATE request.
+ */
+void setup_description(BenchThread& thread, size_t /*size*/)
+{
+	thread.split_msg = split(BENCH_REQUEST, STRING_DELIMITER);
+}
+
+void run_description(BenchThread& thread, uint64_t ops)
+{
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		thread.checksum += get_event_description(DESC_IDX,
+		                                         thread.split_msg).length();
+	}
+}
+
+/**
+ * parse_request: a CREATE frame, as the server parses it: its header is
+ * decoded, its payload tokenized in place, and the command dispatched on its
+ * opcode.
+ */
+void setup_parse(BenchThread& thread, size_t /*size*/)
+{
+	FrameHeader header;
+	header.magic = FRAME_MAGIC;
+	header.opcode = OP_CREATE;
+	header.flags = 0;
+	header.request_id = 0;
+	header.length = sizeof(BENCH_REQUEST) - 1;
+	unsigned char header_bytes[FRAME_HEADER_SIZE];
+	encode_frame_header(header, header_bytes);
+	thread.frame.assign((const char*) header_bytes, FRAME_HEADER_SIZE);
+	thread.frame += BENCH_REQUEST;
+}
+
+void run_parse(BenchThread& thread, uint64_t ops)
+{
+	StrRef split_msg[MAX_REQUEST_TOKENS];
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		FrameHeader header = decode_frame_header(
+				(const unsigned char*) thread.frame.data());
+		size_t tokens_num = tokenize(make_ref(thread.frame.data() +
+		                                      FRAME_HEADER_SIZE,
+		                                      header.length),
+		                             STRING_DELIMITER, split_msg,
+		                             MAX_REQUEST_TOKENS);
+		switch (opcode_from_ref(split_msg[COMMAND_SPLIT_MSG_INDEX_SERVER]))
+		{
+		case OP_CREATE:
+			thread.checksum += split_msg[DESC_IDX].length;
+			break;
+		default:
+			thread.checksum += tokens_num;
+			break;
+		}
+	}
+}
+
+/**
+ * is_client_registered: registered names, drawn at random.
+ */
+void setup_lookup(BenchThread& thread, size_t size)
+{
+	mt19937 random((uint32_t) (thread.index + size));
+	uniform_int_distribution<size_t> client(0, size - 1);
+	thread.names.clear();
+	for (int i = 0; i < BENCH_NAMES_NUM; i++)
+	{
+		thread.names.push_back(bench_client_name(client(random)));
+	}
+}
+
+void run_lookup(BenchThread& thread, uint64_t ops)
+{
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		thread.checksum += is_client_registered(
+				make_ref(thread.names[i % BENCH_NAMES_NUM]), false);
+	}
+}
+
+/**
+ * create_event: new events, added to the size the dataset has.
+ */
+void run_create(BenchThread& thread, uint64_t ops)
+{
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		thread.checksum += (size_t) create_event(make_ref(BENCH_OWNER),
+		                                         make_ref(BENCH_TITLE),
+		                                         make_ref(BENCH_DATE),
+		                                         make_ref(BENCH_DESCRIPTION));
+	}
+}
+
+/**
+ * GET_TOP_5: the serialized lines of the five newest events.
+ */
+void run_top_5(BenchThread& thread, uint64_t ops)
+{
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		thread.checksum += top_events_reply(FIVE_CLIENTS).length();
+	}
+}
+
+/**
+ * Log::write_to_log: a record of a created event, written under the log's
+ * mutex, or queued to the flusher of an asynchronous log.
+ */
+void run_log_write_sync(BenchThread& thread, uint64_t ops)
+{
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		thread.checksum +=
+			(size_t) bench_sync_log->write_to_log(BENCH_LOG_RECORD);
+	}
+}
+
+void run_log_write_async(BenchThread& thread, uint64_t ops)
+{
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		thread.checksum +=
+			(size_t) bench_async_log->write_to_log(BENCH_LOG_RECORD);
+	}
+}
+
+// Run in this order at each size. create_event grows the events past the
+// size, so it runs after the benchmarks which read them.
+const Benchmark benchmarks[] = {
+	{"split", false, prepare_nothing, setup_nothing, run_split},
+	{"get_event_description", false, prepare_nothing, setup_description,
+	 run_description},
+	{"parse_request", false, prepare_nothing, setup_parse, run_parse},
+	{"log_write_sync", false, prepare_nothing, setup_nothing,
+	 run_log_write_sync},
+	{"log_write_async", false, prepare_nothing, setup_nothing,
+	 run_log_write_async},
+	{"is_client_registered", true, prepare_clients, setup_lookup, run_lookup},
+	{"get_top_5", true, prepare_events, setup_nothing, run_top_5},
+	{"create_event", true, prepare_events, setup_nothing, run_create}
+};
+#define BENCHMARKS_NUM (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+//==============================================================================
+//=============================== MEASURING ====================================
+//==============================================================================
+void* bench_thread_func(void* args)
+{
+	BenchThread* thread = (BenchThread*) args;
+	pthread_barrier_wait(&start_barrier);
+
+	uint64_t allocations = thread_allocations;
+	thread->benchmark->run(*thread, thread->ops);
+	thread->allocations = thread_allocations - allocations;
+	return nullptr;
+}
+
+/**
+ * The operations a thread runs in about BENCH_TARGET_NS. Run on the calling
+ * thread, twice as many each time, until a run takes a tenth of it.
+ */
+uint64_t calibrate(const Benchmark& benchmark, size_t size)
+{
+	BenchThread thread;
+	thread.index = 0;
+	thread.checksum = 0;
+	benchmark.setup(thread, size);
+
+	uint64_t ops = BENCH_CALIBRATION_OPS;
+	while (true)
+	{
+		uint64_t start_ns = monotonic_ns();
+		benchmark.run(thread, ops);
+		uint64_t elapsed_ns = max(monotonic_ns() - start_ns, (uint64_t) 1);
+		if (elapsed_ns >= BENCH_TARGET_NS / 10)
+		{
+			return max((uint64_t) (ops * BENCH_TARGET_NS / elapsed_ns),
+			           (uint64_t) 1);
+		}
+		ops *= 2;
+	}
+}
+
+/**
+ * Measure a benchmark on a number of threads, which share the operations of
+ * about BENCH_TARGET_NS on a single thread.
+ */
+BenchResult measure(const Benchmark& benchmark, size_t size, int threads_num)
+{
+	uint64_t thread_ops = max(calibrate(benchmark, size) / threads_num,
+	                          (uint64_t) 1);
+
+	vector<BenchThread> threads((size_t) threads_num);
+	pthread_barrier_init(&start_barrier, NULL, (unsigned) threads_num + 1);
+	for (int i = 0; i < threads_num; i++)
+	{
+		threads[i].index = i;
+		threads[i].benchmark = &benchmark;
+		threads[i].ops = thread_ops;
+		threads[i].checksum = 0;
+		benchmark.setup(threads[i], size);
+		if (pthread_create(&threads[i].thread, NULL, bench_thread_func,
+		                   &threads[i]) != SUCCESS)
+		{
+			exit_with_error("pthread_create");
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	uint64_t start_ns = monotonic_ns();
+	uint64_t allocations = 0;
+	for (auto& thread: threads)
+	{
+		pthread_join(thread.thread, NULL);
+		allocations += thread.allocations;
+	}
+	uint64_t elapsed_ns = max(monotonic_ns() - start_ns, (uint64_t) 1);
+	pthread_barrier_destroy(&start_barrier);
+
+	BenchResult result;
+	result.name = benchmark.name;
+	result.size = size;
+	result.threads_num = threads_num;
+	result.ops = thread_ops * threads_num;
+	result.ns_per_op = (double) elapsed_ns * threads_num / result.ops;
+	result.ops_per_second = (double) result.ops * NS_IN_SECOND / elapsed_ns;
+	result.allocations_per_op = (double) allocations / result.ops;
+	return result;
+}
+
+/**
+ * A result as a line of the JSON results file.
+ */
+string result_json(const BenchResult& result)
+{
+	char line[BENCH_LINE_SIZE];
+	snprintf(line, sizeof(line), "{\"name\": \"%s\", \"size\": %zu, "
+	         "\"threads\": %d, \"ops\": %llu, \"ns_per_op\": %.1f, "
+	         "\"ops_per_sec\": %.0f, \"allocs_per_op\": %.2f}",
+	         result.name.c_str(), result.size, result.threads_num,
+	         (unsigned long long) result.ops, result.ns_per_op,
+	         result.ops_per_second, result.allocations_per_op);
+	return line;
+}
+
+/**
+ * Read the ns per op of the results of a previous run, by benchmark, size
+ * and number of threads.
+ */
+map<string, double> read_baseline(const string& path)
+{
+	map<string, double> baseline;
+	ifstream in(path);
+	if (!in)
+	{
+		exit_with_error("open");
+	}
+
+	string line;
+	while (getline(in, line))
+	{
+		char name[BENCH_LINE_SIZE];
+		size_t size;
+		int threads_num;
+		unsigned long long ops;
+		double ns_per_op;
+		if (sscanf(line.c_str(), " {\"name\": \"%255[^\"]\", \"size\": %zu, "
+		           "\"threads\": %d, \"ops\": %llu, \"ns_per_op\": %lf",
+		           name, &size, &threads_num, &ops, &ns_per_op) == 5)
+		{
+			baseline[string(name) + "/" + to_string(size) + "/" +
+			         to_string(threads_num)] = ns_per_op;
+		}
+	}
+	return baseline;
+}
+
+/**
+ * Print a result, and how it changed from the baseline if it has it.
+ */
+void print_result(const BenchResult& result,
+                  const map<string, double>& baseline)
+{
+	char line[BENCH_LINE_SIZE];
+	snprintf(line, sizeof(line), "%-22s size %8zu threads %2d: %10.1f ns/op "
+	         "%12.0f ops/s %7.2f allocs/op", result.name.c_str(), result.size,
+	         result.threads_num, result.ns_per_op, result.ops_per_second,
+	         result.allocations_per_op);
+	cout << line;
+
+	map<string, double>::const_iterator old = baseline.find(
+			result.name + "/" + to_string(result.size) + "/" +
+			to_string(result.threads_num));
+	if (old != baseline.end() && old->second > 0)
+	{
+		double change = 100 * (result.ns_per_op - old->second) / old->second;
+		snprintf(line, sizeof(line), "  %+6.1f%%%s", change,
+		         fabs(change) < BENCH_NOISE_PERCENT ? "" :
+		         change > 0 ? " slower" : " faster");
+		cout << line;
+	}
+	cout << endl;
+}
+
+//==============================================================================
+//================================= MAIN =======================================
+//==============================================================================
+/**
+ * Measure the server's hot paths in isolation: at each dataset size from
+ * MIN_BENCH_SIZE clients and events up to max_size, and on 1, 2, 4...
+ * threads up to max_threads. The results are written to a JSON file, a result
+ * a line, so that the files of two commits can be diffed, or one passed as
+ * the baseline of the next run.
+ */
+int main(int argc, char *argv[])
+{
+	size_t max_size = DEFAULT_MAX_BENCH_SIZE;
+	int max_threads = DEFAULT_MAX_BENCH_THREADS;
+	string only = EMPTY_STR;
+	string out_path = DEFAULT_BENCH_RESULTS;
+	string baseline_path = EMPTY_STR;
+	for (int i = 1; i < argc; i++)
+	{
+		string key, value;
+		bool valid = parse_option(argv[i], key, value);
+		if (valid && key == MAX_SIZE_OPTION && isInteger(value) &&
+		    atol(value.c_str()) >= MIN_BENCH_SIZE &&
+		    atol(value.c_str()) <= MAX_BENCH_SIZE)
+		{
+			max_size = (size_t) atol(value.c_str());
+		}
+		else if (valid && key == MAX_THREADS_OPTION && isInteger(value) &&
+		         atoi(value.c_str()) > 0)
+		{
+			max_threads = atoi(value.c_str());
+		}
+		else if (valid && key == ONLY_OPTION && !value.empty())
+		{
+			only = value;
+		}
+		else if (valid && key == OUT_OPTION && !value.empty())
+		{
+			out_path = value;
+		}
+		else if (valid && key == BASELINE_OPTION && !value.empty())
+		{
+			baseline_path = value;
+		}
+		else
+		{
+			cout << MICRO_BENCH_USAGE << endl;
+			exit(SUCCESS);
+		}
+	}
+
+	map<string, double> baseline;
+	if (!baseline_path.empty())
+	{
+		baseline = read_baseline(baseline_path);
+	}
+
+	// the server's own log is thrown away, the log benchmarks write to files
+	server_log = new Log(BENCH_SERVER_LOG, server_log_mutex);
+	bench_sync_log = new Log(BENCH_LOG_FILE, bench_sync_log_mutex);
+	bench_async_log = new Log(BENCH_ASYNC_LOG_FILE, bench_async_log_mutex);
+	if (server_log->open_log_file() == FAILURE ||
+	    bench_sync_log->open_log_file() == FAILURE ||
+	    bench_async_log->open_log_file() == FAILURE ||
+	    bench_async_log->start_async(DEFAULT_LOG_BUFFER,
+	                                 LOG_FULL_BLOCK) == FAILURE)
+	{
+		exit_with_error("open_log_file");
+	}
+	init_store();
+
+	vector<BenchResult> results;
+	for (size_t size = MIN_BENCH_SIZE; size <= max_size;
+	     size *= BENCH_SIZE_FACTOR)
+	{
+		for (size_t i = 0; i < BENCHMARKS_NUM; i++)
+		{
+			const Benchmark& benchmark = benchmarks[i];
+			// the benchmarks without a dataset run along the first size
+			if ((!only.empty() && only != benchmark.name) ||
+			    (!benchmark.is_sized && size != MIN_BENCH_SIZE))
+			{
+				continue;
+			}
+
+			size_t bench_size = benchmark.is_sized ? size : 0;
+			benchmark.prepare(bench_size);
+			for (int threads_num = 1; threads_num <= max_threads;
+			     threads_num *= 2)
+			{
+				results.push_back(measure(benchmark, bench_size,
+				                          threads_num));
+				print_result(results.back(), baseline);
+			}
+		}
+	}
+
+	ofstream out(out_path, ios::trunc);
+	out << "{\"benchmarks\": [" << endl;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		out << result_json(results[i]) <<
+		       (i + 1 < results.size() ? "," : "") << endl;
+	}
+	out << "]}" << endl;
+	out.close();
+	if (!out)
+	{
+		exit_with_error("write");
+	}
+	cout << "results written to " << out_path << endl;
+
+	bench_async_log->close_log_file();
+	bench_sync_log->close_log_file();
+	unlink(BENCH_LOG_FILE);
+	unlink(BENCH_ASYNC_LOG_FILE);
+	return SUCCESS;
+}
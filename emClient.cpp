@@ -1,471 +1,1047 @@
-//==============================================================================
-//=============================== INCLUDES  ====================================
-//==============================================================================
-#include "Utils.h"
-
-//==============================================================================
-//================================= GLOBALS ====================================
-//==============================================================================
-// The log file
-Log * client_log;
-
-// Will be used to guard the log file
-pthread_mutex_t client_log_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Socket to server
-int sock_to_server;
-
-// Address to server
-struct sockaddr_in server;
-
-// client name
-string client_name;
-
-// indicated whether the client is registered or not
-bool is_registered = false;
-
-char sent_message[PROTOCOL_MESSAGE_SIZE];
-char received_message[PROTOCOL_MESSAGE_SIZE];
-
-//==============================================================================
-//=============================== HELPERS ======================================
-//==============================================================================
-/**
- * This method allows the user to send message to the server and receive its
- * response. A connection is established beforehand.
- */
-void send_receive_server_comunication(char* sent_message, \
-                                      char* received_message)
-{
-	// Create socket
-	sock_to_server = socket(AF_INET, SOCK_STREAM, 0);
-
-	int * con = new int(sock_to_server);
-
-	if (sock_to_server < SUCCESS) {
-		exit_write_close(client_log, sys_call_error("socket"), ERROR);
-	}
-
-	// Connect to server
-	if (connect(*con, (struct sockaddr *) &server, sizeof(server)) < SUCCESS)
-	{
-		close(sock_to_server);
-		exit_write_close(client_log, sys_call_error("connect"), ERROR);
-	}
-
-	// send data
-	if (write_data(con, sent_message, PROTOCOL_MESSAGE_SIZE) == FAILURE)
-	{
-		exit_write_close(client_log, sys_call_error("write"), ERROR);
-	}
-
-	//get response
-	if (read_data(con, received_message, \
-	              PROTOCOL_MESSAGE_SIZE) == FAILURE)
-	{
-		exit_write_close(client_log, sys_call_error("read"), ERROR);
-	}
-
-	delete con;
-
-	// close connection to server
-	close(sock_to_server);
-}
-
-/**
- * Chcecks if command is legal command
- */
-int is_legal_command(string command)
-{
-	if (command == string(REGISTER_TEXT) ||
-		command == string(UNREGISTER_TEXT) ||
-		command == string(CREATE_TEXT) ||
-		command == string(GET_TOP_5_TEXT) ||
-		command == string(SEND_RSVP_TEXT) ||
-		command == string(GET_RSVPS_LIST_TEXT))
-	{
-		return 1;
-	}
-
-	return 0;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////Client functions///////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-
-/**
- * Method that used to register a client.
- */
-void client_register()
-{
-	// create a string out of the request
-	string string_to_send = client_name + STRING_DELIMITER + REGISTER_TEXT;
-
-	// copy the string into the cahr buffer
-	string_to_send.copy(sent_message, string_to_send.length());
-
-	send_receive_server_comunication(sent_message, received_message);
-
-	if (received_message[REQUEST_STATUS] == REQUEST_OK)
-	{
-		client_log->write_to_log("Client " + client_name +
-								 " was registered successfully.\n");
-		is_registered = true;
-	}
-	else
-	{
-		exit_write_close(client_log, "ERROR: the client " + client_name +
-                         " was already registered.\n", EXIT_SUCCESS);
-	}
-}
-
-/**
- * Method that used to uregister a client.
- */
-void client_unregister()
-{
-	// create a string out of the request
-	string string_to_send = client_name + STRING_DELIMITER +  UNREGISTER_TEXT;
-
-	// copy the string into the char buffer
-	string_to_send.copy(sent_message, string_to_send.length());
-
-	send_receive_server_comunication(sent_message, received_message);
-
-	if (received_message[REQUEST_STATUS] == REQUEST_OK)
-	{
-		exit_write_close(client_log, "Client " + client_name + \
-                             " was unregistered successfully.\n", SUCCESS);
-	}
-	else
-	{
-		client_log->write_to_log(NOT_REGISTERED);
-		is_registered = false;
-	}
-}
-
-/**
- * Method that used to create an event.
- */
-int client_create(vector<string> split_msg)
-{
-	string string_to_send;
-
-	if (split_msg.size() < CREATE_VALID_WORD_NUM)
-	{
-		client_log->write_to_log("ERROR: missing arguments "
-										 "in command CREATE.\n");
-		return FAILURE;
-	}
-	else
-	{
-		string event_desc = get_event_description(CREATE_DESC_IDX, split_msg);
-
-		// Check sizes of the various event attributes.
-		if (split_msg[EVENT_DATE_ARG].size() > TITLE_DATE_STR_SIZE ||
-			split_msg[EVENT_TITLE_ARG].size() > TITLE_DATE_STR_SIZE ||
-			event_desc.size() > DESC_STR_SIZE)
-		{
-			client_log->write_to_log("ERROR: invalid argument "
-											 "in command CREATE.\n");
-			return FAILURE;
-		}
-
-		string_to_send =
-				client_name + STRING_DELIMITER + CREATE_TEXT + \
-                              STRING_DELIMITER + split_msg[EVENT_TITLE_ARG] + \
-                              STRING_DELIMITER + split_msg[EVENT_DATE_ARG] + \
-                              STRING_DELIMITER + event_desc;
-
-	}
-
-	string_to_send.copy(sent_message, string_to_send.length());
-	send_receive_server_comunication(sent_message,
-									 received_message);
-
-	client_log->write_to_log("Event id " + \
-                                 to_string(atoi(received_message)) + \
-                                 " was created successfully.\n");
-
-	return SUCCESS;
-}
-
-/**
- * Method that get the top 5.
- */
-int client_get_top_5()
-{
-	// create a string out of the request
-	string string_to_send = client_name + STRING_DELIMITER + GET_TOP_5_TEXT;
-
-	// copy the string into the char buffer
-	string_to_send.copy(sent_message, string_to_send.length());
-
-	send_receive_server_comunication(sent_message, received_message);
-
-	vector <string> split_events = split(received_message, \
-	                                     (char) EVENT_DELIMITER);
-
-	string events_string = EMPTY_STR;
-	for (auto const &event: split_events)
-	{
-		events_string += event;
-	}
-
-	// incase there are no events at the moment
-	events_string += ".\n";
-
-	client_log->write_to_log(events_string);
-
-	return SUCCESS;
-}
-
-/**
- * Method that is used to send rsvp.
- */
-int client_send_rsvp(vector<string> split_msg)
-{
-	if(split_msg.size() == SEND__GET_RSVP_ONLY_COMMAND)
-	{
-		client_log->write_to_log("ERROR: missing arguments in command "
-										 "SEND_RSVP_TEXT\n");
-		return FAILURE;
-	}
-
-	if(!isInteger(split_msg[GET_RSVP_ID]))
-	{
-		client_log->write_to_log("ERROR\tclient_send_rsvp_list\t"
-										 "given id is not an integer.\n");
-		return FAILURE;
-	}
-
-	string string_to_send = client_name + STRING_DELIMITER + SEND_RSVP_TEXT +
-							STRING_DELIMITER + split_msg[GET_RSVP_ID];
-
-	// copy the string into the char buffer
-	string_to_send.copy(sent_message, string_to_send.length());
-
-	send_receive_server_comunication(sent_message, received_message);
-
-	if (received_message[REQUEST_STATUS] == REQUEST_OK)
-	{
-		client_log->write_to_log("RSVP to event id " + split_msg[GET_RSVP_ID] +
-								 " was received successfully.\n");
-	}
-	else if (received_message[REQUEST_STATUS] == REQUEST_OK_BUT_PLUS)
-	{
-		client_log->write_to_log("RSVP to event id " + split_msg[GET_RSVP_ID] +
-								 " was already sent.\n");
-	}
-	else if (received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
-	{
-		client_log->write_to_log("ERROR: faild to send RSVP to event id " +
-										 split_msg[GET_RSVP_ID] +
-										 ": event was not found.\n");
-		return FAILURE;
-	}
-
-	return SUCCESS;
-}
-
-/**
- * Method that is used to retrieve rsvp list for a given id.
- */
-int client_get_rsvp_list(vector<string> split_msg)
-{
-	if (split_msg.size() == SEND__GET_RSVP_ONLY_COMMAND)
-	{
-		client_log->write_to_log("ERROR: missing arguments "
-								 "in command GET_RSVPS_LIST\n");
-		return FAILURE;
-	}
-
-	if(!isInteger(split_msg[GET_RSVP_ID]))
-	{
-		client_log->write_to_log("ERROR\tclient_get_rsvp_list\t"
-										 "given id is not an integer.\n");
-		return FAILURE;
-	}
-
-	// create a string out of the request
-	string string_to_send = client_name + STRING_DELIMITER + \
-                                GET_RSVPS_LIST_TEXT + STRING_DELIMITER + \
-                                split_msg[GET_RSVP_ID];
-
-	// copy the string into the char buffer
-	string_to_send.copy(sent_message, string_to_send.length());
-	send_receive_server_comunication(sent_message, received_message);
-
-	string sorted_users = EMPTY_STR;
-
-	vector <string> client_name_list =
-			split(received_message, STRING_DELIMITER);
-
-	std::sort(client_name_list.begin(), client_name_list.end());
-	for (auto const &name: client_name_list)
-		sorted_users += name + ',';
-
-
-	// Event with given id doesn't exist.
-	if (received_message[REQUEST_STATUS] == ERROR_IN_REQUEST) {
-		client_log->write_to_log("ERROR\tclient_get_rsvp_list\tevent "
-								 "with given id does not exist.\n");
-		return FAILURE;
-	}
-
-	client_log->write_to_log("The RSVP's list for event id " + \
-                             split_msg[GET_RSVP_ID] + " is: " + \
-                             sorted_users.substr(0,sorted_users.length()-1) \
-                             + ".\n");
-
-	return SUCCESS;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-
-/**
-* Parse a command and execute it
-*/
-int parse_command_and_execute(string msg_to_parse)
-{
-	// reset in_message and out_message
-	memset(sent_message, END_STR, PROTOCOL_MESSAGE_SIZE);
-	memset(received_message, END_STR, PROTOCOL_MESSAGE_SIZE);
-
-	// split msg
-	vector <string> split_msg = split(msg_to_parse, STRING_DELIMITER);
-
-	// check if msg is not empty
-	if (split_msg.size() > 0 &&
-		is_legal_command(to_upper(split_msg[COMMAND_SPLIT_MSG_INDEX_CLIENT])))
-	{
-		// extract command
-		string command = to_upper(split_msg[COMMAND_SPLIT_MSG_INDEX_CLIENT]);
-
-		////////////////////////////////////////////////////////////////////////
-		// REGISTER
-		////////////////////////////////////////////////////////////////////////
-
-		if (command == string(REGISTER_TEXT) && !is_registered)
-		{
-			client_register();
-		}
-		else if (command == string(REGISTER_TEXT) && is_registered)
-		{
-			client_log->write_to_log(ILLEGAL_COMMAND);
-		}
-
-		// check any other command, only if user is registered
-		if (is_registered)
-		{
-			////////////////////////////////////////////////////////////////////
-			// UNREGISTER
-			////////////////////////////////////////////////////////////////////
-			if (command == string(UNREGISTER_TEXT))
-			{
-				client_unregister();
-			}
-
-			////////////////////////////////////////////////////////////////////
-			// CREATE
-			////////////////////////////////////////////////////////////////////
-			if (command == string(CREATE_TEXT))
-			{
-				if(client_create(split_msg) == FAILURE)
-					return FAILURE;
-			}
-
-			////////////////////////////////////////////////////////////////////
-			// GET_TOP_5
-			////////////////////////////////////////////////////////////////////
-			if (command == string(GET_TOP_5_TEXT))
-			{
-				if(client_get_top_5() == FAILURE)
-					return FAILURE;
-			}
-
-			////////////////////////////////////////////////////////////////////
-			// SEND_RSVP
-			////////////////////////////////////////////////////////////////////
-			if (command == string(SEND_RSVP_TEXT))
-			{
-				if(client_send_rsvp(split_msg) == FAILURE)
-					return FAILURE;
-			}
-
-			////////////////////////////////////////////////////////////////////
-			// GET_RSVPS_LIST
-			////////////////////////////////////////////////////////////////////
-			if (command == string(GET_RSVPS_LIST_TEXT))
-			{
-				if(client_get_rsvp_list(split_msg) == FAILURE)
-					return FAILURE;
-			}
-		}
-		else
-		{
-			client_log->write_to_log(NOT_REGISTERED);
-		}
-	}
-	else
-	{
-		client_log->write_to_log(ILLEGAL_COMMAND);
-	}
-
-	return SUCCESS;
-}
-
-//==============================================================================
-//================================= MAIN =======================================
-//==============================================================================
-
-int main(int argc , char *argv[])
-{
-	// Check usage
-	if (argc != CLIENT_ARG_NUM) {
-		cout << CLIENT_USAGE << endl;
-		exit(SUCCESS);
-	}
-
-	// Get client name
-	client_name = argv[CLIENT_ARG_NAME];
-
-	// Create log file named <client_name>_HHMMSS.log
-	client_log = new(nothrow) Log(client_name + "_" + get_current_time()+".log",
-								  client_log_mutex);
-	if (client_log == nullptr)
-	{
-		exit(ERROR);
-	}
-
-	// Open log file
-	if (client_log->open_log_file() == FAILURE)
-	{
-		client_log->write_to_log(sys_call_error("open"));
-		delete client_log;
-		exit(ERROR);
-	}
-
-	// init sockaddr_in
-	server = init_sockaddr(atoi(argv[CLIENT_ARG_PORT]), \
-	                       inet_addr(argv[CLIENT_ARG_IP]));
-
-	while (true)
-	{
-		// get user input
-		string user_input;
-		getline(cin, user_input);
-
-		// parse command and execute
-		if (parse_command_and_execute(user_input) == ERROR)
-		{
-			delete client_log;
-			exit(ERROR);
-		}
-	}
-
-	delete client_log;
-	return SUCCESS;
-}
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <map>
+#include <signal.h>
+#include "Utils.h"
+
+//==============================================================================
+//================================= GLOBALS ====================================
+//==============================================================================
+// The log file
+Log * client_log;
+
+// Will be used to guard the log file
+ProfiledMutex client_log_mutex(CLIENT_LOG_LOCK);
+
+// Socket to server, kept open between requests (FAILURE when there is none)
+int sock_to_server = FAILURE;
+
+// Address to server
+struct sockaddr_in server;
+
+// client name
+string client_name;
+
+// indicated whether the client is registered or not
+bool is_registered = false;
+
+// whether to talk to the server with the legacy fixed size messages
+bool use_legacy_protocol = false;
+
+// id of the next request sent to the server
+uint32_t next_request_id = 1;
+
+// replies which arrived before they were waited for, by request id
+map<uint32_t, pair<uint16_t, string> > pending_replies;
+
+// Once the client subscribed to new events, this thread reads the session: it
+// logs the events the server pushes, and hands the replies to wait_for_reply.
+pthread_t receiver_thread;
+bool has_receiver = false;
+// guard pending_replies and session_closed while the receiver runs
+pthread_mutex_t replies_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reply_arrived = PTHREAD_COND_INITIALIZER;
+// the receiver read the end of the session
+bool session_closed = false;
+
+string sent_message;
+string received_message;
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+/**
+ * Open a connection to the server.
+ */
+int connect_to_server()
+{
+	// Create socket
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < SUCCESS) {
+		exit_write_close(client_log, sys_call_error("socket"), ERROR);
+	}
+
+	// Connect to server
+	if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < SUCCESS)
+	{
+		close(sock);
+		exit_write_close(client_log, sys_call_error("connect"), ERROR);
+	}
+
+	return sock;
+}
+
+/**
+ * Make sure the session with the server is open. A session which the server
+ * closed (e.g. after it was idle for too long) is opened again.
+ */
+void ensure_session()
+{
+	// the receiver reads the session, and tells when it is closed
+	if (has_receiver)
+	{
+		pthread_mutex_lock(&replies_mutex);
+		bool is_closed = session_closed;
+		pthread_mutex_unlock(&replies_mutex);
+		if (!is_closed)
+		{
+			return;
+		}
+
+		pthread_join(receiver_thread, nullptr);
+		has_receiver = false;
+		session_closed = false;
+		close(sock_to_server);
+		pending_replies.clear();
+		sock_to_server = connect_to_server();
+		return;
+	}
+
+	if (sock_to_server != FAILURE)
+	{
+		// a session closed by the server reads as end of file
+		char probe;
+		ssize_t peeked = recv(sock_to_server, &probe, sizeof(probe), \
+		                      MSG_PEEK | MSG_DONTWAIT);
+		if (peeked > 0 || (peeked == FAILURE && \
+		    (errno == EAGAIN || errno == EWOULDBLOCK)))
+		{
+			return;
+		}
+
+		close(sock_to_server);
+		pending_replies.clear();
+	}
+
+	sock_to_server = connect_to_server();
+}
+
+/**
+ * Send a request on the session without waiting for its reply, so several
+ * requests can be pipelined. Returns the id the reply will carry.
+ */
+uint32_t send_request(Opcode opcode, const string& message)
+{
+	uint32_t request_id = next_request_id++;
+
+	if (write_frame(&sock_to_server, (uint8_t) opcode, request_id, \
+	                message) == FAILURE)
+	{
+		exit_write_close(client_log, sys_call_error("write"), ERROR);
+	}
+
+	return request_id;
+}
+
+/**
+ * Take the reply of a request out of the replies which arrived first. Returns
+ * false if it did not arrive yet.
+ */
+bool take_pending_reply(uint32_t request_id, string& reply, uint16_t& flags)
+{
+	map<uint32_t, pair<uint16_t, string> >::iterator pending =
+			pending_replies.find(request_id);
+	if (pending == pending_replies.end())
+	{
+		return false;
+	}
+
+	flags = pending->second.first;
+	reply.swap(pending->second.second);
+	pending_replies.erase(pending);
+	return true;
+}
+
+/**
+ * Wait for the reply of a request sent on the session. Replies to other
+ * requests which arrive first are kept until they are waited for, and events
+ * pushed meanwhile are logged. Returns the flags of the reply.
+ */
+uint16_t wait_for_reply(uint32_t request_id, string& reply)
+{
+	uint16_t flags = NO_FLAGS;
+	if (has_receiver)
+	{
+		pthread_mutex_lock(&replies_mutex);
+		bool is_found;
+		while (!(is_found = take_pending_reply(request_id, reply, flags)) &&
+		       !session_closed)
+		{
+			pthread_cond_wait(&reply_arrived, &replies_mutex);
+		}
+		pthread_mutex_unlock(&replies_mutex);
+
+		if (!is_found)
+		{
+			exit_write_close(client_log, sys_call_error("read"), ERROR);
+		}
+		return flags;
+	}
+
+	if (take_pending_reply(request_id, reply, flags))
+	{
+		return flags;
+	}
+
+	FrameHeader header;
+	while (read_frame(&sock_to_server, header, reply) == SUCCESS)
+	{
+		if (header.flags & FLAG_PUSH)
+		{
+			client_log->write_to_log(reply);
+		}
+		else if (header.request_id == request_id)
+		{
+			return header.flags;
+		}
+		else
+		{
+			pending_replies[header.request_id].first = header.flags;
+			pending_replies[header.request_id].second.swap(reply);
+		}
+	}
+
+	exit_write_close(client_log, sys_call_error("read"), ERROR);
+	return NO_FLAGS;
+}
+
+/**
+ * This function reads the session once the client subscribed: it logs the
+ * events pushed, and keeps the replies for wait_for_reply, until the session
+ * is closed.
+ */
+void* receiver_thread_func(void* /*args*/)
+{
+	FrameHeader header;
+	string frame;
+	while (read_frame(&sock_to_server, header, frame) == SUCCESS)
+	{
+		if (header.flags & FLAG_PUSH)
+		{
+			client_log->write_to_log(frame);
+			continue;
+		}
+
+		pthread_mutex_lock(&replies_mutex);
+		pending_replies[header.request_id].first = header.flags;
+		pending_replies[header.request_id].second.swap(frame);
+		pthread_cond_broadcast(&reply_arrived);
+		pthread_mutex_unlock(&replies_mutex);
+	}
+
+	client_log->write_to_log("The session was closed, the subscription to new "
+	                         "events ended.\n");
+	pthread_mutex_lock(&replies_mutex);
+	session_closed = true;
+	pthread_cond_broadcast(&reply_arrived);
+	pthread_mutex_unlock(&replies_mutex);
+	return nullptr;
+}
+
+/**
+ * This method allows the user to send message to the server and receive its
+ * response. Framed requests share a single session with the server, legacy
+ * ones open a connection of their own. Returns FAILURE if the server refused
+ * the request since it is overloaded.
+ */
+int send_receive_server_comunication(Opcode opcode, string& sent_message, \
+                                     string& received_message)
+{
+	if (!use_legacy_protocol)
+	{
+		ensure_session();
+		if (wait_for_reply(send_request(opcode, sent_message),
+		                   received_message) & FLAG_OVERLOADED)
+		{
+			client_log->write_to_log("ERROR: " OVERLOADED_TEXT ", the "
+			                         "command was not executed.\n");
+			return FAILURE;
+		}
+		return SUCCESS;
+	}
+
+	int * con = new int(connect_to_server());
+
+	// send data
+	if (write_legacy_message(con, sent_message) == FAILURE)
+	{
+		exit_write_close(client_log, sys_call_error("write"), ERROR);
+	}
+
+	//get response
+	vector<char> legacy_message(PROTOCOL_MESSAGE_SIZE + 1, END_STR);
+	if (read_data(con, legacy_message.data(), \
+	              PROTOCOL_MESSAGE_SIZE) != PROTOCOL_MESSAGE_SIZE)
+	{
+		exit_write_close(client_log, sys_call_error("read"), ERROR);
+	}
+	received_message = legacy_message.data();
+
+	// close connection to server
+	close(*con);
+	delete con;
+
+	return SUCCESS;
+}
+
+/**
+ * Chcecks if command is legal command
+ */
+int is_legal_command(string command)
+{
+	return opcode_from_text(command) != OP_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////Client functions///////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Method that used to register a client.
+ */
+int client_register()
+{
+	// create a string out of the request
+	string string_to_send = client_name + STRING_DELIMITER + REGISTER_TEXT;
+
+	// the request to send
+	sent_message = string_to_send;
+
+	if (send_receive_server_comunication(OP_REGISTER, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message[REQUEST_STATUS] == REQUEST_OK)
+	{
+		client_log->write_to_log("Client " + client_name +
+								 " was registered successfully.\n");
+		is_registered = true;
+	}
+	else
+	{
+		exit_write_close(client_log, "ERROR: the client " + client_name +
+                         " was already registered.\n", EXIT_SUCCESS);
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * Method that used to uregister a client.
+ */
+int client_unregister()
+{
+	// create a string out of the request
+	string string_to_send = client_name + STRING_DELIMITER +  UNREGISTER_TEXT;
+
+	// the request to send
+	sent_message = string_to_send;
+
+	if (send_receive_server_comunication(OP_UNREGISTER, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message[REQUEST_STATUS] == REQUEST_OK)
+	{
+		exit_write_close(client_log, "Client " + client_name + \
+                             " was unregistered successfully.\n", SUCCESS);
+	}
+	else
+	{
+		client_log->write_to_log(NOT_REGISTERED);
+		is_registered = false;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * Method that used to create an event.
+ */
+int client_create(vector<string> split_msg)
+{
+	string string_to_send;
+
+	if (split_msg.size() < CREATE_VALID_WORD_NUM)
+	{
+		client_log->write_to_log("ERROR: missing arguments "
+										 "in command CREATE.\n");
+		return FAILURE;
+	}
+	else
+	{
+		string event_desc = get_event_description(CREATE_DESC_IDX, split_msg);
+
+		// Check sizes of the various event attributes.
+		if (split_msg[EVENT_DATE_ARG].size() > TITLE_DATE_STR_SIZE ||
+			split_msg[EVENT_TITLE_ARG].size() > TITLE_DATE_STR_SIZE ||
+			event_desc.size() > DESC_STR_SIZE)
+		{
+			client_log->write_to_log("ERROR: invalid argument "
+											 "in command CREATE.\n");
+			return FAILURE;
+		}
+
+		string_to_send =
+				client_name + STRING_DELIMITER + CREATE_TEXT + \
+                              STRING_DELIMITER + split_msg[EVENT_TITLE_ARG] + \
+                              STRING_DELIMITER + split_msg[EVENT_DATE_ARG] + \
+                              STRING_DELIMITER + event_desc;
+
+	}
+
+	sent_message = string_to_send;
+	if (send_receive_server_comunication(OP_CREATE, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	client_log->write_to_log("Event id " + \
+                                 to_string(atoi(received_message.c_str())) + \
+                                 " was created successfully.\n");
+
+	return SUCCESS;
+}
+
+/**
+ * Write the events a reply lists to the log.
+ */
+void log_events(const string& reply)
+{
+	vector <string> split_events = split(reply, (char) EVENT_DELIMITER);
+
+	string events_string = EMPTY_STR;
+	for (auto const &event: split_events)
+	{
+		events_string += event;
+	}
+
+	// incase there are no events at the moment
+	events_string += ".\n";
+
+	client_log->write_to_log(events_string);
+}
+
+/**
+ * Send a request for the newest events and write the events listed in the
+ * reply to the log.
+ */
+int client_get_top_events(Opcode opcode, const string& string_to_send)
+{
+	// the request to send
+	sent_message = string_to_send;
+
+	if (send_receive_server_comunication(opcode, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message.length() == 1 &&
+	    received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
+	{
+		client_log->write_to_log("ERROR: failed to get the newest events.\n");
+		return FAILURE;
+	}
+
+	log_events(received_message);
+
+	return SUCCESS;
+}
+
+/**
+ * Method that get the top 5.
+ */
+int client_get_top_5()
+{
+	return client_get_top_events(OP_GET_TOP_5, client_name + \
+	                             STRING_DELIMITER + GET_TOP_5_TEXT);
+}
+
+/**
+ * Method that get the top N, N is the command's argument.
+ */
+int client_get_top_n(vector<string> split_msg)
+{
+	if (split_msg.size() <= GET_TOP_N_ARG)
+	{
+		client_log->write_to_log("ERROR: missing arguments "
+		                         "in command GET_TOP_N\n");
+		return FAILURE;
+	}
+
+	if (!isInteger(split_msg[GET_TOP_N_ARG]) ||
+	    strtol(split_msg[GET_TOP_N_ARG].c_str(), nullptr, 10) <= 0)
+	{
+		client_log->write_to_log("ERROR\tclient_get_top_n\t"
+		                         "given N is not a positive integer.\n");
+		return FAILURE;
+	}
+
+	// create a string out of the request
+	return client_get_top_events(OP_GET_TOP_N, client_name + \
+	                             STRING_DELIMITER + GET_TOP_N_TEXT + \
+	                             STRING_DELIMITER + split_msg[GET_TOP_N_ARG]);
+}
+
+/**
+ * Method that gets the events dated from one date to another, up to a limit
+ * and after an event of a previous reply if they are given.
+ */
+int client_get_events_range(vector<string> split_msg)
+{
+	if (split_msg.size() <= RANGE_TO_ARG)
+	{
+		client_log->write_to_log("ERROR: missing arguments "
+		                         "in command GET_EVENTS_RANGE\n");
+		return FAILURE;
+	}
+
+	uint32_t date_key;
+	if (!parse_date_key(make_ref(split_msg[RANGE_FROM_ARG]), date_key) ||
+	    !parse_date_key(make_ref(split_msg[RANGE_TO_ARG]), date_key))
+	{
+		client_log->write_to_log("ERROR\tclient_get_events_range\t"
+		                         "dates are DD/MM/YYYY or YYYY-MM-DD.\n");
+		return FAILURE;
+	}
+
+	if (split_msg.size() > RANGE_LIMIT_ARG &&
+	    (!isInteger(split_msg[RANGE_LIMIT_ARG]) ||
+	     strtol(split_msg[RANGE_LIMIT_ARG].c_str(), nullptr, 10) <= 0))
+	{
+		client_log->write_to_log("ERROR\tclient_get_events_range\t"
+		                         "the limit is a positive integer.\n");
+		return FAILURE;
+	}
+
+	// the continuation token is passed as it is
+	string string_to_send = client_name + STRING_DELIMITER + \
+	                        GET_EVENTS_RANGE_TEXT + STRING_DELIMITER + \
+	                        split_msg[RANGE_FROM_ARG] + STRING_DELIMITER + \
+	                        split_msg[RANGE_TO_ARG];
+	for (size_t i = RANGE_LIMIT_ARG;
+	     i <= RANGE_TOKEN_ARG && i < split_msg.size(); i++)
+	{
+		string_to_send += STRING_DELIMITER + split_msg[i];
+	}
+
+	// the request to send
+	sent_message = string_to_send;
+
+	if (send_receive_server_comunication(OP_GET_EVENTS_RANGE, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message.length() == 1 &&
+	    received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
+	{
+		client_log->write_to_log("ERROR: failed to get the events of the "
+		                         "range.\n");
+		return FAILURE;
+	}
+
+	log_events(received_message);
+
+	return SUCCESS;
+}
+
+/**
+ * Method that is used to list a page of the events, from the newest.
+ */
+int client_get_events(vector<string> split_msg)
+{
+	if (split_msg.size() > EVENTS_PAGE_ARG &&
+	    (!isInteger(split_msg[EVENTS_PAGE_ARG]) ||
+	     strtol(split_msg[EVENTS_PAGE_ARG].c_str(), nullptr, 10) <= 0))
+	{
+		client_log->write_to_log("ERROR\tclient_get_events\t"
+		                         "the page size is a positive integer.\n");
+		return FAILURE;
+	}
+
+	// the continuation token is passed as it is
+	sent_message = client_name + STRING_DELIMITER + GET_EVENTS_TEXT;
+	for (size_t i = EVENTS_PAGE_ARG;
+	     i <= EVENTS_TOKEN_ARG && i < split_msg.size(); i++)
+	{
+		sent_message += STRING_DELIMITER + split_msg[i];
+	}
+
+	if (send_receive_server_comunication(OP_GET_EVENTS, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message.length() == 1 &&
+	    received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
+	{
+		client_log->write_to_log("ERROR\tclient_get_events\t"
+		                         "the continuation token is not valid.\n");
+		return FAILURE;
+	}
+
+	log_events(received_message);
+
+	return SUCCESS;
+}
+
+/**
+ * Method that is used to subscribe to new events, or to end the subscription.
+ * The events are pushed on the session, and logged as they arrive.
+ */
+int client_subscribe(Opcode opcode)
+{
+	string command = opcode == OP_SUBSCRIBE ? SUBSCRIBE_TEXT :
+	                                          UNSUBSCRIBE_TEXT;
+	if (use_legacy_protocol)
+	{
+		client_log->write_to_log("ERROR\tclient_subscribe\t" + command +
+		                         " needs the framed protocol.\n");
+		return FAILURE;
+	}
+
+	sent_message = client_name + STRING_DELIMITER + command;
+	if (send_receive_server_comunication(opcode, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
+	{
+		client_log->write_to_log("ERROR\tclient_subscribe\t" + command +
+		                         " failed.\n");
+		return FAILURE;
+	}
+
+	// from now on the session is read by the receiver
+	if (opcode == OP_SUBSCRIBE && !has_receiver)
+	{
+		if (pthread_create(&receiver_thread, NULL, receiver_thread_func,
+		                   NULL) != SUCCESS)
+		{
+			exit_write_close(client_log, sys_call_error("pthread_create"),
+			                 ERROR);
+		}
+		has_receiver = true;
+	}
+
+	client_log->write_to_log(opcode == OP_SUBSCRIBE ?
+	                         "Subscribed to new events.\n" :
+	                         "Unsubscribed from new events.\n");
+	return SUCCESS;
+}
+
+/**
+ * Method that is used to search the titles and descriptions of the events.
+ */
+int client_search(vector<string> split_msg)
+{
+	if (split_msg.size() <= SEARCH_QUERY_ARG)
+	{
+		client_log->write_to_log("ERROR: missing arguments "
+		                         "in command SEARCH\n");
+		return FAILURE;
+	}
+
+	// the query is the rest of the command
+	string query = split_msg[SEARCH_QUERY_ARG];
+	for (size_t i = SEARCH_QUERY_ARG + 1; i < split_msg.size(); i++)
+	{
+		query += STRING_DELIMITER + split_msg[i];
+	}
+
+	// the request to send
+	sent_message = client_name + STRING_DELIMITER + SEARCH_TEXT + \
+	               STRING_DELIMITER + query;
+
+	if (send_receive_server_comunication(OP_SEARCH, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message.length() == 1 &&
+	    received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
+	{
+		client_log->write_to_log("ERROR\tclient_search\ta prefix is too "
+		                         "short or starts too many words.\n");
+		return FAILURE;
+	}
+
+	log_events(received_message);
+
+	return SUCCESS;
+}
+
+/**
+ * Method that is used to get the stats of the server, as JSON.
+ */
+int client_stats()
+{
+	// the request to send
+	sent_message = client_name + STRING_DELIMITER + STATS_TEXT;
+
+	if (send_receive_server_comunication(OP_STATS, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	client_log->write_to_log("Server stats: " + received_message + "\n");
+
+	return SUCCESS;
+}
+
+/**
+ * Method that is used to send rsvp.
+ */
+int client_send_rsvp(vector<string> split_msg)
+{
+	if(split_msg.size() == SEND__GET_RSVP_ONLY_COMMAND)
+	{
+		client_log->write_to_log("ERROR: missing arguments in command "
+										 "SEND_RSVP_TEXT\n");
+		return FAILURE;
+	}
+
+	if(!isInteger(split_msg[GET_RSVP_ID]))
+	{
+		client_log->write_to_log("ERROR\tclient_send_rsvp_list\t"
+										 "given id is not an integer.\n");
+		return FAILURE;
+	}
+
+	string string_to_send = client_name + STRING_DELIMITER + SEND_RSVP_TEXT +
+							STRING_DELIMITER + split_msg[GET_RSVP_ID];
+
+	// the request to send
+	sent_message = string_to_send;
+
+	if (send_receive_server_comunication(OP_SEND_RSVP, sent_message,
+	                                     received_message) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	if (received_message[REQUEST_STATUS] == REQUEST_OK)
+	{
+		client_log->write_to_log("RSVP to event id " + split_msg[GET_RSVP_ID] +
+								 " was received successfully.\n");
+	}
+	else if (received_message[REQUEST_STATUS] == REQUEST_OK_BUT_PLUS)
+	{
+		client_log->write_to_log("RSVP to event id " + split_msg[GET_RSVP_ID] +
+								 " was already sent.\n");
+	}
+	else if (received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
+	{
+		client_log->write_to_log("ERROR: faild to send RSVP to event id " +
+										 split_msg[GET_RSVP_ID] +
+										 ": event was not found.\n");
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * Method that is used to retrieve rsvp list for a given id.
+ */
+int client_get_rsvp_list(vector<string> split_msg)
+{
+	if (split_msg.size() == SEND__GET_RSVP_ONLY_COMMAND)
+	{
+		client_log->write_to_log("ERROR: missing arguments "
+								 "in command GET_RSVPS_LIST\n");
+		return FAILURE;
+	}
+
+	if(!isInteger(split_msg[GET_RSVP_ID]))
+	{
+		client_log->write_to_log("ERROR\tclient_get_rsvp_list\t"
+										 "given id is not an integer.\n");
+		return FAILURE;
+	}
+
+	// The list is read a page at a time, each page ending with the token of
+	// the next one, so that it is not cut however long it is. The pages are
+	// sorted by name, and follow each other.
+	string sorted_users = EMPTY_STR;
+	string token = EMPTY_STR;
+	do
+	{
+		sent_message = client_name + STRING_DELIMITER + \
+		               GET_RSVPS_LIST_TEXT + STRING_DELIMITER + \
+		               split_msg[GET_RSVP_ID] + STRING_DELIMITER + \
+		               to_string(MAX_RSVPS_PAGE);
+		if (!token.empty())
+		{
+			sent_message += STRING_DELIMITER + token;
+		}
+		if (send_receive_server_comunication(OP_GET_RSVPS_LIST, sent_message,
+		                                     received_message) == FAILURE)
+		{
+			return FAILURE;
+		}
+
+		// Event with given id doesn't exist.
+		if (received_message.length() == 1 &&
+		    received_message[REQUEST_STATUS] == ERROR_IN_REQUEST)
+		{
+			client_log->write_to_log("ERROR\tclient_get_rsvp_list\tevent "
+			                         "with given id does not exist.\n");
+			return FAILURE;
+		}
+
+		token.clear();
+		size_t next_page = received_message.find("\n" NEXT_PAGE_TEXT " ");
+		if (next_page != string::npos)
+		{
+			token = received_message.substr(next_page +
+			                                sizeof(NEXT_PAGE_TEXT) + 1);
+			received_message.resize(next_page);
+		}
+
+		for (auto const &name: split(received_message, STRING_DELIMITER))
+			sorted_users += name + ',';
+	} while (!token.empty());
+
+	client_log->write_to_log("The RSVP's list for event id " + \
+                             split_msg[GET_RSVP_ID] + " is: " + \
+                             sorted_users.substr(0,sorted_users.length()-1) \
+                             + ".\n");
+
+	return SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+* Parse a command and execute it
+*/
+int parse_command_and_execute(string msg_to_parse)
+{
+	// reset in_message and out_message
+	sent_message.clear();
+	received_message.clear();
+
+	// split msg
+	vector <string> split_msg = split(msg_to_parse, STRING_DELIMITER);
+
+	// check if msg is not empty
+	if (split_msg.size() > 0 &&
+		is_legal_command(to_upper(split_msg[COMMAND_SPLIT_MSG_INDEX_CLIENT])))
+	{
+		// extract command
+		string command = to_upper(split_msg[COMMAND_SPLIT_MSG_INDEX_CLIENT]);
+
+		////////////////////////////////////////////////////////////////////////
+		// REGISTER
+		////////////////////////////////////////////////////////////////////////
+
+		if (command == string(REGISTER_TEXT) && !is_registered)
+		{
+			if(client_register() == FAILURE)
+				return FAILURE;
+		}
+		else if (command == string(REGISTER_TEXT) && is_registered)
+		{
+			client_log->write_to_log(ILLEGAL_COMMAND);
+		}
+
+		// check any other command, only if user is registered
+		if (is_registered)
+		{
+			////////////////////////////////////////////////////////////////////
+			// UNREGISTER
+			////////////////////////////////////////////////////////////////////
+			if (command == string(UNREGISTER_TEXT))
+			{
+				if(client_unregister() == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// CREATE
+			////////////////////////////////////////////////////////////////////
+			if (command == string(CREATE_TEXT))
+			{
+				if(client_create(split_msg) == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// GET_TOP_5
+			////////////////////////////////////////////////////////////////////
+			if (command == string(GET_TOP_5_TEXT))
+			{
+				if(client_get_top_5() == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// GET_TOP_N
+			////////////////////////////////////////////////////////////////////
+			if (command == string(GET_TOP_N_TEXT))
+			{
+				if(client_get_top_n(split_msg) == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// GET_EVENTS_RANGE
+			////////////////////////////////////////////////////////////////////
+			if (command == string(GET_EVENTS_RANGE_TEXT))
+			{
+				if(client_get_events_range(split_msg) == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// GET_EVENTS
+			////////////////////////////////////////////////////////////////////
+			if (command == string(GET_EVENTS_TEXT))
+			{
+				if(client_get_events(split_msg) == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// SUBSCRIBE, UNSUBSCRIBE
+			////////////////////////////////////////////////////////////////////
+			if (command == string(SUBSCRIBE_TEXT) ||
+			    command == string(UNSUBSCRIBE_TEXT))
+			{
+				if(client_subscribe(opcode_from_text(command)) == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// SEARCH
+			////////////////////////////////////////////////////////////////////
+			if (command == string(SEARCH_TEXT))
+			{
+				if(client_search(split_msg) == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// STATS
+			////////////////////////////////////////////////////////////////////
+			if (command == string(STATS_TEXT))
+			{
+				if(client_stats() == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// SEND_RSVP
+			////////////////////////////////////////////////////////////////////
+			if (command == string(SEND_RSVP_TEXT))
+			{
+				if(client_send_rsvp(split_msg) == FAILURE)
+					return FAILURE;
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// GET_RSVPS_LIST
+			////////////////////////////////////////////////////////////////////
+			if (command == string(GET_RSVPS_LIST_TEXT))
+			{
+				if(client_get_rsvp_list(split_msg) == FAILURE)
+					return FAILURE;
+			}
+		}
+		else
+		{
+			client_log->write_to_log(NOT_REGISTERED);
+		}
+	}
+	else
+	{
+		client_log->write_to_log(ILLEGAL_COMMAND);
+	}
+
+	return SUCCESS;
+}
+
+//==============================================================================
+//================================= MAIN =======================================
+//==============================================================================
+
+int main(int argc , char *argv[])
+{
+	// Check usage
+	if (argc < CLIENT_ARG_NUM) {
+		cout << CLIENT_USAGE << endl;
+		exit(SUCCESS);
+	}
+
+	// Parse options
+	for (int i = CLIENT_FIRST_OPTION_ARG; i < argc; i++)
+	{
+		string key, value;
+		if (!parse_option(argv[i], key, value) || key != PROTOCOL_OPTION ||
+		    (value != PROTOCOL_LEGACY && value != PROTOCOL_FRAMED))
+		{
+			cout << CLIENT_USAGE << endl;
+			exit(SUCCESS);
+		}
+		use_legacy_protocol = (value == PROTOCOL_LEGACY);
+	}
+
+	// Get client name
+	client_name = argv[CLIENT_ARG_NAME];
+
+	// Create log file named <client_name>_HHMMSS.log
+	client_log = new(nothrow) Log(client_name + "_" + get_current_time()+".log",
+								  client_log_mutex);
+	if (client_log == nullptr)
+	{
+		exit(ERROR);
+	}
+
+	// Open log file
+	if (client_log->open_log_file() == FAILURE)
+	{
+		client_log->write_to_log(sys_call_error("open"));
+		delete client_log;
+		exit(ERROR);
+	}
+
+	// a session closed by the server must not kill the client
+	signal(SIGPIPE, SIG_IGN);
+
+	// init sockaddr_in
+	server = init_sockaddr(atoi(argv[CLIENT_ARG_PORT]), \
+	                       inet_addr(argv[CLIENT_ARG_IP]));
+
+	while (true)
+	{
+		// get user input
+		string user_input;
+		getline(cin, user_input);
+
+		// parse command and execute
+		if (parse_command_and_execute(user_input) == ERROR)
+		{
+			delete client_log;
+			exit(ERROR);
+		}
+	}
+
+	delete client_log;
+	return SUCCESS;
+}
@@ -0,0 +1,719 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <signal.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/tcp.h>
+#include <deque>
+#include <random>
+#include "Utils.h"
+#include "Metrics.h"
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+// A request waiting for its reply.
+typedef struct
+{
+	Opcode opcode;
+	uint32_t request_id;
+	// when it was sent (closed loop), or meant to be sent (open loop), so
+	// that the time it waited behind earlier requests is counted as well
+	uint64_t start_ns;
+} PendingRequest;
+
+// A virtual client: a registered name with a session of its own.
+typedef struct
+{
+	int sock;
+	string name;
+	// the names the client registered with REGISTER requests
+	uint64_t registered_num;
+	uint32_t next_request_id;
+	// requests answered in order, as the server answers a session's requests
+	deque<PendingRequest> pending;
+	// requests of an open loop which were due while LOAD_MAX_PENDING were
+	// pending: each is sent once a reply makes room, and its latency still
+	// counts from when it was due (its request_id is assigned then)
+	deque<PendingRequest> backlog;
+	// frames not written yet, and bytes not decoded yet
+	string output;
+	string input;
+} VirtualClient;
+
+// A thread of the load generator, driving its share of the clients.
+typedef struct
+{
+	pthread_t thread;
+	int index;
+	int epoll_fd;
+	// fires when the next request of an open loop is due
+	int timer_fd;
+	vector<VirtualClient> clients;
+	// the client the next request of an open loop goes to
+	size_t next_client;
+	mt19937 random;
+	// latencies of the replies of each command, within the measured window,
+	// and of the requests still unanswered when the load stopped (up to then)
+	Histogram latencies[OPCODES_NUM];
+	uint64_t unanswered[OPCODES_NUM];
+	uint64_t errors;
+	uint64_t overloaded;
+	// requests of an open loop which were due while their client waited for
+	// LOAD_MAX_PENDING replies, and were queued to its backlog
+	uint64_t delayed;
+} LoadThread;
+
+//==============================================================================
+//================================= GLOBALS ====================================
+//==============================================================================
+// Address to server
+struct sockaddr_in server;
+
+// requests per second of an open loop, 0 for a closed loop, and each
+// thread's share of them
+double rate = 0;
+double thread_rate = 0;
+
+// the commands of the mix, and their cumulative weights
+vector<Opcode> mix_commands;
+vector<uint32_t> mix_weights;
+
+// the events SEND_RSVP and GET_RSVPS_LIST pick from
+vector<int> event_ids;
+
+// replies to requests started from measure_start_ns are measured; the load
+// stops at end_ns
+uint64_t measure_start_ns = 0;
+uint64_t end_ns = 0;
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+/**
+ * Report a failed system call and exit.
+ */
+void exit_with_error(const string& function)
+{
+	cerr << sys_call_error(function);
+	exit(ERROR);
+}
+
+/**
+ * Open a session with the server.
+ */
+int connect_to_server()
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < SUCCESS)
+	{
+		exit_with_error("socket");
+	}
+	if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < SUCCESS)
+	{
+		exit_with_error("connect");
+	}
+	int no_delay = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	return sock;
+}
+
+/**
+ * Send a request and wait for its reply.
+ */
+string request(int sock, Opcode opcode, const string& message)
+{
+	FrameHeader header;
+	string reply;
+	if (write_frame(&sock, (uint8_t) opcode, 0, message) == FAILURE)
+	{
+		exit_with_error("write");
+	}
+	if (read_frame(&sock, header, reply) == FAILURE)
+	{
+		exit_with_error("read");
+	}
+	return reply;
+}
+
+/**
+ * Parse a mix, e.g. "GET_TOP_5:80,CREATE:20", into the commands and their
+ * cumulative weights. Returns false if it is not one.
+ */
+bool parse_mix(const string& mix)
+{
+	mix_commands.clear();
+	mix_weights.clear();
+	uint32_t total = 0;
+	for (auto const& entry: split(mix, MIX_DELIMITER))
+	{
+		vector<string> parts = split(entry, MIX_WEIGHT_DELIMITER);
+		if (parts.size() != 2 || !isInteger(parts[1]))
+		{
+			return false;
+		}
+		Opcode command = opcode_from_text(to_upper(parts[0]));
+		if (command != OP_REGISTER && command != OP_CREATE &&
+		    command != OP_SEND_RSVP && command != OP_GET_TOP_5 &&
+		    command != OP_GET_RSVPS_LIST)
+		{
+			return false;
+		}
+		int weight = atoi(parts[1].c_str());
+		if (weight < 0)
+		{
+			return false;
+		}
+		total += (uint32_t) weight;
+		mix_commands.push_back(command);
+		mix_weights.push_back(total);
+	}
+	return total > 0;
+}
+
+/**
+ * Create the events the clients RSVP to and list.
+ */
+void create_load_events()
+{
+	int sock = connect_to_server();
+	string owner = "load_owner" + to_string(getpid());
+	request(sock, OP_REGISTER, owner + " " REGISTER_TEXT);
+	for (int i = 0; i < LOAD_EVENTS; i++)
+	{
+		string reply = request(sock, OP_CREATE, owner + " " CREATE_TEXT " "
+		                       LOAD_EVENT_TEXT);
+		if (!isInteger(reply))
+		{
+			cerr << "ERROR\tcreate_load_events\tthe server refused to create "
+			        "an event." << endl;
+			exit(ERROR);
+		}
+		event_ids.push_back(atoi(reply.c_str()));
+	}
+	close(sock);
+}
+
+/**
+ * Connect and register a thread's clients, and watch their sessions.
+ */
+void start_clients(LoadThread& thread, int clients_num)
+{
+	thread.epoll_fd = epoll_create1(0);
+	thread.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (thread.epoll_fd < SUCCESS || thread.timer_fd < SUCCESS)
+	{
+		exit_with_error("epoll_create1");
+	}
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = nullptr;
+	epoll_ctl(thread.epoll_fd, EPOLL_CTL_ADD, thread.timer_fd, &event);
+
+	thread.clients.resize((size_t) clients_num);
+	for (int i = 0; i < clients_num; i++)
+	{
+		VirtualClient& client = thread.clients[i];
+		client.sock = connect_to_server();
+		client.name = "load" + to_string(getpid()) + "_" +
+		              to_string(thread.index) + "_" + to_string(i);
+		client.registered_num = 0;
+		client.next_request_id = 0;
+		if (request(client.sock, OP_REGISTER,
+		            client.name + " " REGISTER_TEXT) != string(1, REQUEST_OK))
+		{
+			cerr << "ERROR\tstart_clients\t" << client.name << \
+			        " could not register." << endl;
+			exit(ERROR);
+		}
+
+		fcntl(client.sock, F_SETFL, fcntl(client.sock, F_GETFL) | O_NONBLOCK);
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = &client;
+		if (epoll_ctl(thread.epoll_fd, EPOLL_CTL_ADD, client.sock,
+		              &event) < SUCCESS)
+		{
+			exit_with_error("epoll_ctl");
+		}
+	}
+	thread.next_client = 0;
+}
+
+/**
+ * Write as much of a client's output as the socket takes.
+ */
+void flush_client(VirtualClient& client)
+{
+	size_t written = 0;
+	while (written < client.output.size())
+	{
+		ssize_t bytes = write(client.sock, client.output.data() + written,
+		                      client.output.size() - written);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			break;
+		}
+		if (bytes <= 0)
+		{
+			exit_with_error("write");
+		}
+		written += (size_t) bytes;
+	}
+	client.output.erase(0, written);
+}
+
+/**
+ * Draw a command from the mix.
+ */
+Opcode draw_command(LoadThread& thread)
+{
+	uniform_int_distribution<uint32_t> draw(0, mix_weights.back() - 1);
+	uint32_t drawn = draw(thread.random);
+	size_t command_index = 0;
+	while (mix_weights[command_index] <= drawn)
+	{
+		command_index++;
+	}
+	return mix_commands[command_index];
+}
+
+/**
+ * Queue a request of a command, and write it.
+ */
+void send_request(LoadThread& thread, VirtualClient& client, Opcode command,
+                  uint64_t start_ns)
+{
+	uniform_int_distribution<size_t> pick(0, event_ids.size() - 1);
+	string message;
+	switch (command)
+	{
+	case OP_REGISTER:
+		// a new name each time; the client's own name stays registered
+		message = client.name + "_" + to_string(++client.registered_num) + \
+		          " " REGISTER_TEXT;
+		break;
+	case OP_CREATE:
+		message = client.name + " " CREATE_TEXT " " LOAD_EVENT_TEXT;
+		break;
+	case OP_SEND_RSVP:
+		message = client.name + " " SEND_RSVP_TEXT " " + \
+		          to_string(event_ids[pick(thread.random)]);
+		break;
+	case OP_GET_RSVPS_LIST:
+		message = client.name + " " GET_RSVPS_LIST_TEXT " " + \
+		          to_string(event_ids[pick(thread.random)]);
+		break;
+	default:
+		message = client.name + " " GET_TOP_5_TEXT;
+		break;
+	}
+
+	FrameHeader header;
+	header.magic = FRAME_MAGIC;
+	header.opcode = (uint8_t) command;
+	header.flags = NO_FLAGS;
+	header.request_id = client.next_request_id++;
+	header.length = (uint32_t) message.length();
+	unsigned char encoded[FRAME_HEADER_SIZE];
+	encode_frame_header(header, encoded);
+	client.output.append((const char*) encoded, FRAME_HEADER_SIZE);
+	client.output += message;
+
+	client.pending.push_back({command, header.request_id, start_ns});
+	flush_client(client);
+}
+
+/**
+ * Read the replies which arrived on a client's session, and measure them. In
+ * a closed loop, each reply is followed by the client's next request.
+ */
+void read_replies(LoadThread& thread, VirtualClient& client)
+{
+	char chunk[LOAD_READ_CHUNK_SIZE];
+	while (true)
+	{
+		ssize_t bytes = read(client.sock, chunk, sizeof(chunk));
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			break;
+		}
+		if (bytes == 0)
+		{
+			cerr << "ERROR\tread_replies\tthe server closed the session of " \
+			     << client.name << " (raise its idle_timeout?)." << endl;
+			exit(ERROR);
+		}
+		if (bytes < 0)
+		{
+			exit_with_error("read");
+		}
+		client.input.append(chunk, (size_t) bytes);
+	}
+
+	size_t offset = 0;
+	uint64_t now_ns = monotonic_ns();
+	while (client.input.size() - offset >= FRAME_HEADER_SIZE)
+	{
+		FrameHeader header = decode_frame_header(
+			(const unsigned char*) client.input.data() + offset);
+		if (client.input.size() - offset - FRAME_HEADER_SIZE < header.length)
+		{
+			break;
+		}
+		const char* payload = client.input.data() + offset + FRAME_HEADER_SIZE;
+		offset += FRAME_HEADER_SIZE + header.length;
+		if (header.flags & FLAG_PUSH)
+		{
+			continue;
+		}
+
+		if (client.pending.empty() ||
+		    client.pending.front().request_id != header.request_id)
+		{
+			cerr << "ERROR\tread_replies\tunexpected reply to " << \
+			        client.name << "." << endl;
+			exit(ERROR);
+		}
+		PendingRequest answered = client.pending.front();
+		client.pending.pop_front();
+
+		if (answered.start_ns >= measure_start_ns && now_ns <= end_ns)
+		{
+			thread.latencies[answered.opcode].record(now_ns -
+			                                         answered.start_ns);
+			if (header.flags & FLAG_OVERLOADED)
+			{
+				thread.overloaded++;
+			}
+			else if (header.length == 1 && payload[0] == ERROR_IN_REQUEST)
+			{
+				thread.errors++;
+			}
+		}
+		if (rate == 0 && now_ns < end_ns)
+		{
+			send_request(thread, client, draw_command(thread), now_ns);
+		}
+		else if (!client.backlog.empty() && now_ns < end_ns)
+		{
+			PendingRequest due = client.backlog.front();
+			client.backlog.pop_front();
+			send_request(thread, client, due.opcode, due.start_ns);
+		}
+	}
+	client.input.erase(0, offset);
+}
+
+/**
+ * Send the requests of an open loop which are due, each to the next client,
+ * and arm the timer for the first one which is not. Arrivals are a Poisson
+ * process of the thread's share of the rate. A client which waits for
+ * LOAD_MAX_PENDING replies queues the request instead, so a stalled server
+ * shows in the latencies rather than lowering the load (coordinated omission).
+ */
+void send_due_requests(LoadThread& thread, uint64_t& next_send_ns,
+                       exponential_distribution<double>& interval)
+{
+	uint64_t now_ns = monotonic_ns();
+	while (next_send_ns <= now_ns && next_send_ns < end_ns)
+	{
+		VirtualClient& client = thread.clients[thread.next_client];
+		thread.next_client = (thread.next_client + 1) % thread.clients.size();
+		Opcode command = draw_command(thread);
+		if (client.pending.size() >= LOAD_MAX_PENDING ||
+		    !client.backlog.empty())
+		{
+			client.backlog.push_back({command, 0, next_send_ns});
+			if (next_send_ns >= measure_start_ns)
+			{
+				thread.delayed++;
+			}
+		}
+		else
+		{
+			send_request(thread, client, command, next_send_ns);
+		}
+		next_send_ns += (uint64_t) interval(thread.random) + 1;
+	}
+
+	struct itimerspec due;
+	memset(&due, 0, sizeof(due));
+	due.it_value.tv_sec = (time_t) (next_send_ns / NS_IN_SECOND);
+	due.it_value.tv_nsec = (long) (next_send_ns % NS_IN_SECOND);
+	if (timerfd_settime(thread.timer_fd, TFD_TIMER_ABSTIME, &due,
+	                    NULL) < SUCCESS)
+	{
+		exit_with_error("timerfd_settime");
+	}
+}
+
+//==============================================================================
+//=============================== THREADS ======================================
+//==============================================================================
+/**
+ * Count the measured requests of a thread which were not answered when the
+ * load stopped, sent or still queued: each is recorded with the time it
+ * waited until then, which its latency is at least, so that replies which
+ * never came are not left out of the percentiles.
+ */
+void count_unanswered(LoadThread& thread)
+{
+	for (auto const& client: thread.clients)
+	{
+		for (auto const* requests: {&client.pending, &client.backlog})
+		{
+			for (auto const& waiting: *requests)
+			{
+				if (waiting.start_ns >= measure_start_ns &&
+				    waiting.start_ns < end_ns)
+				{
+					thread.latencies[waiting.opcode].record(end_ns -
+					                                        waiting.start_ns);
+					thread.unanswered[waiting.opcode]++;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Drive a thread's clients until the load is over: in a closed loop each
+ * client sends a request, and the next once it is answered; in an open loop
+ * requests are sent as they are due, whether or not earlier ones were
+ * answered.
+ */
+void* load_thread_func(void* args)
+{
+	LoadThread* thread = (LoadThread*) args;
+
+	uint64_t next_send_ns = monotonic_ns();
+	exponential_distribution<double> interval(1);
+	if (rate > 0)
+	{
+		interval = exponential_distribution<double>(thread_rate /
+		                                            NS_IN_SECOND);
+		send_due_requests(*thread, next_send_ns, interval);
+	}
+	else
+	{
+		for (auto& client: thread->clients)
+		{
+			send_request(*thread, client, draw_command(*thread), next_send_ns);
+		}
+	}
+
+	struct epoll_event events[LOAD_MAX_EPOLL_EVENTS];
+	while (monotonic_ns() < end_ns)
+	{
+		int events_num = epoll_wait(thread->epoll_fd, events,
+		                            LOAD_MAX_EPOLL_EVENTS, LOAD_TICK_MS);
+		for (int i = 0; i < events_num; i++)
+		{
+			if (events[i].data.ptr == nullptr)
+			{
+				uint64_t expirations;
+				(void) !read(thread->timer_fd, &expirations,
+				             sizeof(expirations));
+				send_due_requests(*thread, next_send_ns, interval);
+				continue;
+			}
+
+			VirtualClient& client = *(VirtualClient*) events[i].data.ptr;
+			if (events[i].events & EPOLLOUT)
+			{
+				flush_client(client);
+			}
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+			{
+				read_replies(*thread, client);
+			}
+		}
+	}
+
+	count_unanswered(*thread);
+	return nullptr;
+}
+
+//==============================================================================
+//================================= MAIN =======================================
+//==============================================================================
+/**
+ * Print the throughput and the latency percentiles of the measured window,
+ * for each command of the mix and for all of them. The percentiles include
+ * the requests left unanswered, the throughput only the replies.
+ */
+void print_report(vector<LoadThread>& threads, int seconds)
+{
+	Histogram all;
+	Histogram by_command[OPCODES_NUM];
+	uint64_t unanswered[OPCODES_NUM] = {0};
+	uint64_t all_unanswered = 0;
+	uint64_t errors = 0, overloaded = 0, delayed = 0;
+	for (auto const& thread: threads)
+	{
+		for (int command = 0; command < OPCODES_NUM; command++)
+		{
+			by_command[command].add(thread.latencies[command]);
+			all.add(thread.latencies[command]);
+			unanswered[command] += thread.unanswered[command];
+			all_unanswered += thread.unanswered[command];
+		}
+		errors += thread.errors;
+		overloaded += thread.overloaded;
+		delayed += thread.delayed;
+	}
+
+	printf("throughput: %.0f replies/s (errors %lu, overloaded %lu, "
+	       "delayed %lu, unanswered %lu)\n",
+	       (double) (all.get_count() - all_unanswered) / seconds,
+	       (unsigned long) errors, (unsigned long) overloaded,
+	       (unsigned long) delayed, (unsigned long) all_unanswered);
+	printf("%-16s %10s %10s %10s %10s %10s %10s\n", "command", "replies/s",
+	       "p50 us", "p99 us", "p99.9 us", "max us", "mean us");
+
+	// each row's latencies, and how many of them were left unanswered
+	vector<pair<string, pair<const Histogram*, uint64_t>>> rows;
+	for (auto const& command: mix_commands)
+	{
+		rows.push_back({text_from_opcode(command),
+		                {&by_command[command], unanswered[command]}});
+	}
+	rows.push_back({"all", {&all, all_unanswered}});
+	for (auto const& row: rows)
+	{
+		const Histogram& latencies = *row.second.first;
+		uint64_t count = latencies.get_count();
+		printf("%-16s %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       row.first.c_str(), (double) (count - row.second.second) /
+		                          seconds,
+		       latencies.get_percentile(50) / (double) NS_IN_US,
+		       latencies.get_percentile(99) / (double) NS_IN_US,
+		       latencies.get_percentile(99.9) / (double) NS_IN_US,
+		       latencies.get_max() / (double) NS_IN_US,
+		       count == 0 ? 0 : latencies.get_total() / (double) count /
+		                        NS_IN_US);
+	}
+}
+
+/**
+ * Load a server with many clients, each with a session of its own, sending a
+ * mix of commands in a closed loop (each client waits for its reply) or an
+ * open loop (at a rate, whatever the replies), and report the throughput and
+ * the latencies.
+ */
+int main(int argc, char *argv[])
+{
+	if (argc < LOAD_ARG_NUM)
+	{
+		cout << LOAD_USAGE << endl;
+		exit(SUCCESS);
+	}
+
+	int clients_num = DEFAULT_LOAD_CLIENTS;
+	int threads_num = DEFAULT_LOAD_THREADS;
+	int seconds = DEFAULT_LOAD_SECONDS;
+	int warmup = DEFAULT_LOAD_WARMUP;
+	bool valid = parse_mix(DEFAULT_LOAD_MIX);
+	for (int i = LOAD_FIRST_OPTION_ARG; i < argc && valid; i++)
+	{
+		string key, value;
+		valid = parse_option(argv[i], key, value);
+		if (valid && key == MIX_OPTION)
+		{
+			valid = parse_mix(value);
+			continue;
+		}
+		valid = valid && isInteger(value) && atoi(value.c_str()) >= 0;
+		int number = valid ? atoi(value.c_str()) : 0;
+		if (valid && key == CLIENTS_OPTION && number > 0)
+		{
+			clients_num = number;
+		}
+		else if (valid && key == THREADS_OPTION && number > 0)
+		{
+			threads_num = number;
+		}
+		else if (valid && key == RATE_OPTION)
+		{
+			rate = number;
+		}
+		else if (valid && key == SECONDS_OPTION && number > 0)
+		{
+			seconds = number;
+		}
+		else if (valid && key == WARMUP_OPTION)
+		{
+			warmup = number;
+		}
+		else
+		{
+			valid = false;
+		}
+	}
+	if (!valid || threads_num > clients_num)
+	{
+		cout << LOAD_USAGE << endl;
+		exit(SUCCESS);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	server = init_sockaddr(atoi(argv[LOAD_ARG_PORT]),
+	                       inet_addr(argv[LOAD_ARG_IP]));
+
+	thread_rate = rate / threads_num;
+	create_load_events();
+	vector<LoadThread> threads((size_t) threads_num);
+	for (int i = 0; i < threads_num; i++)
+	{
+		threads[i].index = i;
+		threads[i].random.seed((unsigned) (getpid() + i));
+		threads[i].errors = threads[i].overloaded = threads[i].delayed = 0;
+		memset(threads[i].unanswered, 0, sizeof(threads[i].unanswered));
+		// the clients are spread as evenly as they divide
+		start_clients(threads[i], clients_num / threads_num +
+		                          (i < clients_num % threads_num ? 1 : 0));
+	}
+
+	if (rate > 0)
+	{
+		printf("open loop: %.0f requests/s", rate);
+	}
+	else
+	{
+		printf("closed loop");
+	}
+	printf(" from %d clients on %d threads, for %d s after %d s of warmup\n",
+	       clients_num, threads_num, seconds, warmup);
+
+	measure_start_ns = monotonic_ns() + (uint64_t) warmup * NS_IN_SECOND;
+	end_ns = measure_start_ns + (uint64_t) seconds * NS_IN_SECOND;
+	for (auto& thread: threads)
+	{
+		if (pthread_create(&thread.thread, NULL, load_thread_func,
+		                   &thread) != SUCCESS)
+		{
+			exit_with_error("pthread_create");
+		}
+	}
+	for (auto& thread: threads)
+	{
+		pthread_join(thread.thread, NULL);
+	}
+
+	print_report(threads, seconds);
+
+	for (auto& thread: threads)
+	{
+		for (auto& client: thread.clients)
+		{
+			close(client.sock);
+		}
+		close(thread.timer_fd);
+		close(thread.epoll_fd);
+	}
+	return SUCCESS;
+}
@@ -0,0 +1,269 @@
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <signal.h>
+#include <atomic>
+#include "Utils.h"
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+// A thread of the benchmark, with a session of its own.
+typedef struct
+{
+	pthread_t thread;
+	int sock;
+	// requests answered during the phase
+	uint64_t replies;
+} BenchThread;
+
+//==============================================================================
+//================================= GLOBALS ====================================
+//==============================================================================
+// Address to server
+struct sockaddr_in server;
+
+// the event the readers list the RSVPs of
+int event_id;
+
+// the threads run while this is set
+atomic<bool> is_running(false);
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+/**
+ * Report a failed system call and exit.
+ */
+void exit_with_error(const string& function)
+{
+	cerr << sys_call_error(function);
+	exit(ERROR);
+}
+
+/**
+ * Open a session with the server.
+ */
+int connect_to_server()
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < SUCCESS)
+	{
+		exit_with_error("socket");
+	}
+	if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < SUCCESS)
+	{
+		exit_with_error("connect");
+	}
+	return sock;
+}
+
+/**
+ * Send a request and wait for its reply.
+ */
+string request(int sock, Opcode opcode, const string& message)
+{
+	FrameHeader header;
+	string reply;
+	if (write_frame(&sock, (uint8_t) opcode, 0, message) == FAILURE)
+	{
+		exit_with_error("write");
+	}
+	if (read_frame(&sock, header, reply) == FAILURE)
+	{
+		exit_with_error("read");
+	}
+	return reply;
+}
+
+/**
+ * Create the event the readers list, with BENCH_RSVPS clients RSVP'ed to it.
+ */
+void create_bench_event(int sock)
+{
+	string owner = "bench_owner" + to_string(getpid());
+	request(sock, OP_REGISTER, owner + " " REGISTER_TEXT);
+	event_id = atoi(request(sock, OP_CREATE, owner + " " CREATE_TEXT
+	                        " bench 01/01/2016 read benchmark").c_str());
+
+	for (int i = 0; i < BENCH_RSVPS; i++)
+	{
+		string name = owner + "_" + to_string(i);
+		request(sock, OP_REGISTER, name + " " REGISTER_TEXT);
+		request(sock, OP_SEND_RSVP, name + " " SEND_RSVP_TEXT " " + \
+		        to_string(event_id));
+	}
+}
+
+//==============================================================================
+//=============================== THREADS ======================================
+//==============================================================================
+/**
+ * Read the event's RSVPs and the newest events, BENCH_PIPELINE_DEPTH requests
+ * at a time, until the phase ends.
+ */
+void* reader_thread_func(void* args)
+{
+	BenchThread* reader = (BenchThread*) args;
+	string rsvps = "bench_reader " GET_RSVPS_LIST_TEXT " " + \
+	               to_string(event_id);
+	string top = "bench_reader " GET_TOP_5_TEXT;
+
+	FrameHeader header;
+	string reply;
+	while (is_running)
+	{
+		for (int i = 0; i < BENCH_PIPELINE_DEPTH; i++)
+		{
+			bool is_rsvps = i % 2 == 0;
+			if (write_frame(&reader->sock, (uint8_t) (is_rsvps ?
+			                OP_GET_RSVPS_LIST : OP_GET_TOP_5), (uint32_t) i,
+			                is_rsvps ? rsvps : top) == FAILURE)
+			{
+				exit_with_error("write");
+			}
+		}
+		for (int i = 0; i < BENCH_PIPELINE_DEPTH; i++)
+		{
+			if (read_frame(&reader->sock, header, reply) == FAILURE)
+			{
+				exit_with_error("read");
+			}
+		}
+		reader->replies += BENCH_PIPELINE_DEPTH;
+	}
+	return nullptr;
+}
+
+/**
+ * Create events, and RSVP a client to the readers' event and unregister it
+ * (so that its list keeps its size), until the phase ends.
+ */
+void* writer_thread_func(void* args)
+{
+	BenchThread* writer = (BenchThread*) args;
+	string name = "bench_writer" + to_string(getpid());
+
+	while (is_running)
+	{
+		request(writer->sock, OP_REGISTER, name + " " REGISTER_TEXT);
+		request(writer->sock, OP_SEND_RSVP, name + " " SEND_RSVP_TEXT " " + \
+		        to_string(event_id));
+		request(writer->sock, OP_CREATE, name + " " CREATE_TEXT
+		        " written 01/01/2016 by the writer");
+		request(writer->sock, OP_UNREGISTER, name + " " UNREGISTER_TEXT);
+		writer->replies += 4;
+	}
+	return nullptr;
+}
+
+/**
+ * Run the readers, and the writer if there is one, for a number of seconds.
+ * Returns the replies the readers got per second.
+ */
+double run_phase(vector<BenchThread>& readers, BenchThread* writer,
+                 int seconds)
+{
+	is_running = true;
+	for (auto& reader: readers)
+	{
+		reader.replies = 0;
+		if (pthread_create(&reader.thread, NULL, reader_thread_func,
+		                   &reader) != SUCCESS)
+		{
+			exit_with_error("pthread_create");
+		}
+	}
+	if (writer != nullptr)
+	{
+		writer->replies = 0;
+		if (pthread_create(&writer->thread, NULL, writer_thread_func,
+		                   writer) != SUCCESS)
+		{
+			exit_with_error("pthread_create");
+		}
+	}
+
+	uint64_t start_ns = monotonic_ns();
+	sleep((unsigned) seconds);
+	is_running = false;
+
+	uint64_t replies = 0;
+	for (auto& reader: readers)
+	{
+		pthread_join(reader.thread, NULL);
+		replies += reader.replies;
+	}
+	if (writer != nullptr)
+	{
+		pthread_join(writer->thread, NULL);
+	}
+	double elapsed = (double) (monotonic_ns() - start_ns) / NS_IN_SECOND;
+
+	if (writer != nullptr)
+	{
+		cout << "writer: " << (uint64_t) (writer->replies / elapsed) << \
+		        " writes/s" << endl;
+	}
+	return replies / elapsed;
+}
+
+//==============================================================================
+//================================= MAIN =======================================
+//==============================================================================
+/**
+ * Measure the read throughput of a server, first on its own and then while a
+ * writer creates events and RSVPs to the event being read. Reads which do not
+ * wait for writers keep the same throughput in both phases.
+ */
+int main(int argc, char *argv[])
+{
+	if (argc < READ_BENCH_ARG_NUM)
+	{
+		cout << READ_BENCH_USAGE << endl;
+		exit(SUCCESS);
+	}
+
+	int readers_num = DEFAULT_BENCH_READERS;
+	int seconds = DEFAULT_BENCH_SECONDS;
+	for (int i = READ_BENCH_FIRST_OPTION_ARG; i < argc; i++)
+	{
+		string key, value;
+		if (!parse_option(argv[i], key, value) || !isInteger(value) ||
+		    atoi(value.c_str()) <= 0 ||
+		    (key != READERS_OPTION && key != SECONDS_OPTION))
+		{
+			cout << READ_BENCH_USAGE << endl;
+			exit(SUCCESS);
+		}
+		(key == READERS_OPTION ? readers_num : seconds) = atoi(value.c_str());
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	server = init_sockaddr(atoi(argv[READ_BENCH_ARG_PORT]),
+	                       inet_addr(argv[READ_BENCH_ARG_IP]));
+
+	BenchThread writer;
+	writer.sock = connect_to_server();
+	create_bench_event(writer.sock);
+
+	vector<BenchThread> readers(readers_num);
+	for (auto& reader: readers)
+	{
+		reader.sock = connect_to_server();
+	}
+
+	double alone = run_phase(readers, nullptr, seconds);
+	cout << "reads alone: " << (uint64_t) alone << " replies/s" << endl;
+	double with_writer = run_phase(readers, &writer, seconds);
+	cout << "reads with a writer: " << (uint64_t) with_writer << \
+	        " replies/s (" << (uint64_t) (100 * with_writer / alone) << \
+	        "% of alone)" << endl;
+
+	for (auto& reader: readers)
+	{
+		close(reader.sock);
+	}
+	close(writer.sock);
+	return SUCCESS;
+}
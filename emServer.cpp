@@ -1,701 +1,3933 @@
-//==============================================================================
-//=============================== INCLUDES  ====================================
-//==============================================================================
-#include <thread_db.h>
-#include "Utils.h"
-
-//==============================================================================
-//=============================== STRUCTS ======================================
-//==============================================================================
-typedef struct
-{
-	string name;
-	int event_id_RSVP;
-} Client;
-
-typedef struct
-{
-	string event_title;
-	string event_date;
-	string event_description;
-	int event_id;
-	vector<Client*> RSVP_list;
-} Event;
-
-//==============================================================================
-//=============================== TYPEDEG ======================================
-//==============================================================================
-typedef std::vector<Client*>::iterator ClientsIter;
-
-//==============================================================================
-//============================ DATA STRUCTURES =================================
-//==============================================================================
-vector<Event*> events;
-vector<Client*> registered_clients;
-
-//==============================================================================
-//================================= GLOBALS ====================================
-//==============================================================================
-// The log file
-Log * server_log;
-
-// Will be used to guard the log file
-pthread_mutex_t server_log_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Will be used to guard the log file
-pthread_mutex_t avaliable_id_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-pthread_mutex_t events_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-pthread_mutex_t threads_num_mutex = PTHREAD_MUTEX_INITIALIZER;
-int threads_num = 0;
-
-// this thread listens to the stdin
-pthread_t stdin_thread;
-
-// this thread listens to the clients sockets
-pthread_t clients_thread;
-
-// the server socket
-int server_sock;
-
-// the last used id
-int avaliable_id = 1;
-
-bool toExit = false;
-
-//==============================================================================
-//=============================== HELPERS ======================================
-//==============================================================================
-
-/**
- * free allocated memory to all dynamiclly allocated memories.
- * */
-void free_allocated_memory()
-{
-	for(auto& client : registered_clients)
-	{
-		delete client;
-	}
-
-	for(auto& event : events)
-	{
-		delete event;
-	}
-}
-
-/**
- * This function establishes a connection for a given sockaddr_in
- */
-int establish_connection(sockaddr_in& connection_info)
-{
-    int client;
-
-    // Create socket
-    if ((client = socket(AF_INET, SOCK_STREAM, 0)) < SUCCESS)
-	{
-        server_log->write_to_log(sys_call_error("socket"));
-        return FAILURE;
-    }
-
-    // Bind `sock` with given addresses
-    if (bind(client, (struct sockaddr *) &connection_info, \
-             sizeof(struct sockaddr_in)) < SUCCESS)
-	{
-        close(client);
-        server_log->write_to_log(sys_call_error("bind"));
-        return FAILURE;
-    }
-
-    // Max # of queued connects
-    if (listen(client, MAX_PENDING_CONNECTIONS) < SUCCESS)
-	{
-        server_log->write_to_log(sys_call_error("listen"));
-        return FAILURE;
-    }
-
-    return client;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-/**
- * Get the first connection request on the queue of pending connections for the
- * listening socket
- */
-int get_ready_connection(int s)
-{
-    /* socket of connection */
-    int caller;
-    if ((caller = accept(s,NULL,NULL)) < SUCCESS)
-	{
-        server_log->write_to_log(sys_call_error("accept"));
-        return FAILURE;
-    }
-
-    return caller;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-/**
- * Given client is deleted, and if neccessary, removed from an event he's
- * RSVP.
- */
-void delete_client(string client_name, std::vector<Client*>::iterator it)
-{
-	// Remove from RSVP if needed.
-	if((*it)->event_id_RSVP != SUCCESS)
-	{
-		pthread_mutex_lock(&events_mutex);
-
-		for(auto const& event: events)
-		{
-			if(event->event_id == (*it)->event_id_RSVP)
-			{
-				for(ClientsIter rsvp_client = event->RSVP_list.begin(); \
-					rsvp_client != event->RSVP_list.end(); ++rsvp_client)
-				{
-					if ((*it)->name == (*rsvp_client)->name)
-					{
-						event->RSVP_list.erase(rsvp_client);
-						break;
-					}
-				}
-
-				break;
-			}
-		}
-		pthread_mutex_unlock(&events_mutex);
-	}
-
-	delete *it; // Deallocate resources for client
-	registered_clients.erase(it);
-
-	server_log->write_to_log(
-			client_name + "\twas unregistered successfully.\n");
-}
-
-/**
- * Checks is client_name is already registered. if to_del is true, client is
- * also deleted (default is false)
- */
-bool is_client_registered(string client_name, bool to_del = false)
-{
-	// Search among registered clients.
-	pthread_mutex_lock(&clients_mutex);
-	for(std::vector<Client*>::iterator it = registered_clients.begin(); \
-	    it != registered_clients.end(); ++it)
-	{
-		if (to_upper((*it)->name) == to_upper(client_name))
-		{
-			// delete it if needed
-			if (to_del)
-			{
-				delete_client(client_name, it);
-			}
-			pthread_mutex_unlock(&clients_mutex);
-			return true;
-		}
-	}
-	pthread_mutex_unlock(&clients_mutex);
-	return false;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-/**
- * Initialize resources for a new client.
- */
-void create_client(string client_name)
-{
-	Client* new_client = new Client;
-	new_client->name = client_name;
-	new_client->event_id_RSVP = DEFAULT_ID;
-
-	pthread_mutex_lock(&clients_mutex);
-	registered_clients.push_back(new_client);
-	pthread_mutex_unlock(&clients_mutex);
-
-	server_log->write_to_log(new_client->name + \
-	                         "\twas registered successfully.\n");
-}
-
-/**
- * Initialize resources for a new event.
- * return the newly created event's id.
- */
-int create_event(string client_name, vector<string> split_msg)
-{
-	Event* new_event = new Event;
-
-	// Offset of one since we've sent, in addition, client's name.
-	new_event->event_title = split_msg[EVENT_TITLE_ARG + ARG_OFFSET];
-	new_event->event_date = split_msg[EVENT_DATE_ARG + ARG_OFFSET];
-	new_event->event_description = get_event_description(DESC_IDX, split_msg);
-
-	// Get unique id
-	pthread_mutex_lock(&avaliable_id_mutex);
-	new_event->event_id = avaliable_id;
-	avaliable_id++;
-	pthread_mutex_unlock(&avaliable_id_mutex);
-
-	pthread_mutex_lock(&events_mutex);
-	events.push_back(new_event);
-	pthread_mutex_unlock(&events_mutex);
-
-
-	server_log->write_to_log(client_name + "\tevent id " + \
-	                         to_string(new_event->event_id) + \
-							 " was assigned to the event with title " + \
-							 new_event->event_title + ".\n");
-
-	return new_event->event_id;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-/**
- * Assuming given client is registered, his name will be search across all over
- * registered clients list, and when found, pointer to this clients instance
- * will be returned.
- */
-Client* retrieve_client_by_name(string client_name)
-{
-	Client* found_client = nullptr;
-
-	pthread_mutex_lock(&clients_mutex);
-	for(auto const& client: registered_clients)
-	{
-		if(client->name == client_name)
-		{
-			found_client = client;
-		}
-	}
-	pthread_mutex_unlock(&clients_mutex);
-
-	return found_client;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-/**
- * Parse a command and execute it.
- */
-int parse_command_and_execute(int *current_connection, string msg_to_parse)
-{
-	// reset out_message
-	char out_message[PROTOCOL_MESSAGE_SIZE];
-	memset(out_message, '\0', PROTOCOL_MESSAGE_SIZE);
-
-	// split msg
-	vector<string> split_msg = split(msg_to_parse, STRING_DELIMITER);
-
-	// extract name and command
-	string client_name = split_msg[CLIENT_NAME_SPLIT_MSG_INDEX];
-	string command = split_msg[COMMAND_SPLIT_MSG_INDEX_SERVER];
-
-	////////////////////////////////////////////////////////////////////////////
-	// REGISTER
-	////////////////////////////////////////////////////////////////////////////
-	if (command == string(REGISTER_TEXT))
-	{
-		if (is_client_registered(client_name))
-		{
-			// client already registered
-			out_message[REQUEST_STATUS] = ERROR_IN_REQUEST;
-			server_log->write_to_log(
-					"ERROR: " + client_name + "\tis already exists.\n");
-		}
-		else
-		{
-			// registered successfully
-			out_message[REQUEST_STATUS] = REQUEST_OK;
-			create_client(client_name);
-		}
-	}
-
-	////////////////////////////////////////////////////////////////////////////
-	// UNREGISTER
-	////////////////////////////////////////////////////////////////////////////
-	if (command == string(UNREGISTER_TEXT))
-	{
-		if (is_client_registered(client_name, true))
-		{
-			out_message[REQUEST_STATUS] = REQUEST_OK;
-		}
-		else
-		{
-			// Given client does't exist among registered users.
-			out_message[REQUEST_STATUS] = ERROR_IN_REQUEST;
-			server_log->write_to_log(
-					"ERROR: " + client_name + "\tdoes not exist.\n");
-		}
-	}
-
-	////////////////////////////////////////////////////////////////////////////
-	// CREATE
-	////////////////////////////////////////////////////////////////////////////
-	if (command == string(CREATE_TEXT))
-	{
-		int new_id = create_event(client_name, split_msg);
-
-		// return to client the corresponding string
-		string new_id_str = std::to_string(new_id);
-		new_id_str.copy(out_message, new_id_str.length());
-	}
-
-	////////////////////////////////////////////////////////////////////////////
-	// GET_TOP_5
-	////////////////////////////////////////////////////////////////////////////
-	if(command == string(GET_TOP_5_TEXT))
-	{
-		server_log->write_to_log(
-				client_name + "\trequests the top 5 newest events.\n");
-
-		string return_message = "Top 5 newest events are:\n";
-		string event_representation = EMPTY_STR;
-		int counter = 0;
-
-		pthread_mutex_lock(&events_mutex);
-		// Iterate from the end to
-		for (vector<Event*>::reverse_iterator it = events.rbegin();
-			 it != events.rend(); ++it )
-		{
-			if(counter < FIVE_CLIENTS)
-			{
-				event_representation = to_string((*it)->event_id) + "\t" +\
-									   (*it)->event_title + "\t" +\
-									   (*it)->event_date + "\t" +\
-									   (*it)->event_description + ".\n";
-				return_message += event_representation + (char) EVENT_DELIMITER;
-				counter++;
-			}
-			else
-			{
-				break;
-			}
-		}
-		// Incase the event data structure is empty.
-		if (events.size() == 0)
-			return_message += '\n' + (char) EVENT_DELIMITER;
-		pthread_mutex_unlock(&events_mutex);
-
-		// -1 in order to not include the delimiter in the final representation
-		return_message.copy(out_message, return_message.length() - 1);
-	}
-
-	////////////////////////////////////////////////////////////////////////////
-	// SEND_RSVP
-	////////////////////////////////////////////////////////////////////////////
-	if (command == string(SEND_RSVP_TEXT))
-	{
-		int id_to_RSVP = stoi(split_msg[GET_RSVP_ID + ARG_OFFSET]);
-
-		Client* client_in_list = nullptr;
-
-		bool found_event = false;
-		bool found_in_RSVP = false;
-
-		pthread_mutex_lock(&events_mutex);
-		for(auto const& event: events)
-		{
-			if (event->event_id == id_to_RSVP)
-			{
-				found_event = true;
-
-				// Check if client is already RSVP.
-				for(auto const& client_in_RSVP: event->RSVP_list)
-				{
-					// Check if, for given id's RSVP list, client exists.
-					if (client_in_RSVP->name == client_name)
-					{
-						found_in_RSVP = true;
-						out_message[REQUEST_STATUS] = REQUEST_OK_BUT_PLUS;
-						break;
-					}
-				}
-
-				// Went through all clients and didn't find
-				if (!found_in_RSVP)
-				{
-					client_in_list = retrieve_client_by_name(client_name);
-					event->RSVP_list.push_back(client_in_list);
-					client_in_list->event_id_RSVP = id_to_RSVP;
-
-					out_message[REQUEST_STATUS] = REQUEST_OK;
-
-					break;
-				}
-			}
-		}
-		pthread_mutex_unlock(&events_mutex);
-
-		// Event for given id was not found.
-		if (!found_event)
-		{
-			out_message[REQUEST_STATUS] = ERROR_IN_REQUEST;
-			server_log->write_to_log("ERROR\tparse_command_and_execute\tevent "
-											 "with given id does not exist.\n");
-		}
-		else
-		{
-			server_log->write_to_log(client_name + "\tis RSVP "
-									 "to event with id " +
-									 split_msg[GET_RSVP_ID + \
-									 ARG_OFFSET] + ".\n");
-		}
-	}
-
-	////////////////////////////////////////////////////////////////////////////
-	// GET_RSVPS_LIST
-	////////////////////////////////////////////////////////////////////////////
-	if (command == string(GET_RSVPS_LIST_TEXT))
-	{
-		int id_to_RSVP_list = stoi(split_msg[GET_RSVP_ID + 1]);
-
-		vector<string> client_name_list;
-
-		string ready_name_list = EMPTY_STR;
-
-		bool found_event = false;
-
-		pthread_mutex_lock(&events_mutex);
-		for (auto const &event: events)
-		{
-			if (event->event_id == id_to_RSVP_list)
-			{
-				found_event = true;
-
-				// Check if client is already RSVP.
-				for (auto const &client_in_RSVP: event->RSVP_list)
-				{
-					client_name_list.push_back(client_in_RSVP->name);
-				}
-
-				for (auto const &name: client_name_list)
-					ready_name_list += name + ' ';
-
-				break;
-			}
-
-		}
-		pthread_mutex_unlock(&events_mutex);
-
-		// Event for given id was not found.
-		if (!found_event)
-		{
-			out_message[REQUEST_STATUS] = ERROR_IN_REQUEST;
-			server_log->write_to_log("ERROR\tparse_command_and_execute\tevent "
-											 "with given id does not exist.\n");
-		}
-		else
-		{
-			// -1 in order to not include the delimiter in the final represent'.
-			ready_name_list.copy(out_message, ready_name_list.length() - 1);
-			server_log->write_to_log(
-					client_name + "\trequests the RSVP’s list for event " \
-                    "with id " + split_msg[GET_RSVP_ID + 1] + ".\n");
-		}
-	}
-
-	////////////////////////////////////////////////////////////////////////////
-	// Send back information and clean up
-	////////////////////////////////////////////////////////////////////////////
-	if (write_data(current_connection, out_message,
-				   PROTOCOL_MESSAGE_SIZE) == FAILURE)
-	{
-		server_log->write_to_log(sys_call_error("write"));
-		exit(ERROR);
-	}
-
-	// close that connection
-	close(*current_connection);
-
-	return SUCCESS;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-
-/**
- * This function listens to the stdin and signals to the server to shut down
- * when "exit" is typed.
- */
-void * stdin_thread_func(void * /*args*/)
-{
-    // loop until exit is entered
-    while (!toExit)
-	{
-		// get user input
-		string user_input;
-		getline(cin, user_input);
-
-		if ((strcasecmp(user_input.c_str(), EXIT_TEXT) == EQUAL))
-		{
-            toExit = true;
-        }
-    }
-
-	pthread_exit(SUCCESS);
-}
-
-/**
- * This function performes a single command
- */
-void * command_thread_func(void * args)
-{
-	// get connection from args
-	int* current_conn = (int *) args;
-
-	// reset in_message
-	char in_message[PROTOCOL_MESSAGE_SIZE];
-	memset(in_message, '\0', PROTOCOL_MESSAGE_SIZE);
-
-	// read data from the client
-	if (read_data(current_conn, in_message, \
-	              PROTOCOL_MESSAGE_SIZE) == FAILURE)
-	{
-		free_allocated_memory();
-		exit_write_close(server_log, sys_call_error("read"), ERROR);
-	}
-
-	// parse command and execute
-	if (parse_command_and_execute(current_conn, string(in_message)) == ERROR)
-	{
-		free_allocated_memory();
-
-		delete server_log;
-		exit(ERROR);
-	}
-
-	delete current_conn;
-	pthread_exit(SUCCESS);
-}
-
-/**
- * This function listens to the opened socket, and proccess new requests
- */
-void * clients_thread_func(void * /*args*/)
-{
-	pthread_mutex_lock(&threads_num_mutex);
-	threads_num++;
-	pthread_mutex_unlock(&threads_num_mutex);
-
-	while (true)
-	{
-		// get the first connection request
-		int current_connection = get_ready_connection(server_sock);
-		if (current_connection == FAILURE)
-		{
-			free_allocated_memory();
-			exit_write_close(server_log, \
-				sys_call_error("accept"), ERROR);
-		}
-
-		// if exit was not typed by the server's stdin, process the request
-		if (!toExit)
-		{
-			int * con = new int(current_connection);
-			//*con = current_connection;
-			pthread_t thread;
-
-			// create thread
-			if (pthread_create(&thread, NULL, \
-			                   command_thread_func, con) != SUCCESS)
-			{
-				free_allocated_memory();
-				exit_write_close(server_log, \
-				sys_call_error("pthread_create"), ERROR);
-			}
-
-			pthread_detach(thread);
-		}
-		else
-		{
-			pthread_mutex_lock(&threads_num_mutex);
-			threads_num--;
-			pthread_mutex_unlock(&threads_num_mutex);
-
-			pthread_exit(SUCCESS);
-		}
-	}
-}
-
-//==============================================================================
-//================================= MAIN =======================================
-//==============================================================================
-
-int main(int argc , char *argv[])
-{
-	// Check usage
-	if (argc != SERVER_ARG_NUM)
-	{
-		cout << SERVER_USAGE << endl;
-		exit(SUCCESS);
-	}
-
-	// Create log file
-	server_log = new(nothrow) Log(SERVER_LOG_FILE, server_log_mutex);
-	if (server_log == nullptr)
-	{
-		exit_write_close(server_log, sys_call_error("new"), ERROR);
-	}
-
-	// Open log file
-	if (server_log->open_log_file() == FAILURE)
-	{
-		delete server_log;
-		exit(ERROR);
-	}
-
-	// init sockaddr_in
-	struct sockaddr_in server = init_sockaddr(atoi(argv[SERVER_ARG_PORT]),
-											  INADDR_ANY);
-	// Establish connection
-	server_sock = establish_connection(server);
-	if (server_sock == FAILURE)
-	{
-		delete server_log;
-		exit(ERROR);
-	}
-
-	// Create stdin thread - this tread will listen to the stdin for "ERROR" txt
-	if (pthread_create(&stdin_thread, NULL, stdin_thread_func, NULL) != SUCCESS)
-	{
-		exit_write_close(server_log, \
-		                 sys_call_error("pthread_create"), ERROR);
-	}
-
-	// Create clients thread - this tread will listen to opened sockets
-	if (pthread_create(&clients_thread, NULL, \
-	                   clients_thread_func, NULL) != SUCCESS)
-	{
-		exit_write_close(server_log, \
-		                 sys_call_error("pthread_create") ,ERROR);
-	}
-
-	// wait for exit input from user
-	int ret_join = pthread_join(stdin_thread, nullptr);
-	if (ret_join != SUCCESS)
-	{
-		free_allocated_memory();
-		exit_write_close(server_log, \
-		                 sys_call_error("pthread_join"), ERROR);
-	}
-
-	server_log->write_to_log("EXIT command is typed: server is shutdown.\n");
-
-	while(!toExit && threads_num > 0);
-
-	server_log->close_log_file();
-
-	free_allocated_memory();
-	close(server_sock);
-	delete server_log;
-
-	return SUCCESS;
-}
\ No newline at end of file
+//==============================================================================
+//=============================== INCLUDES  ====================================
+//==============================================================================
+#include <thread_db.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <list>
+#include <set>
+#include <memory>
+#include <atomic>
+#include "Utils.h"
+#include "WorkerPool.h"
+#include "WriteAheadLog.h"
+#include "Snapshot.h"
+#include "Arena.h"
+#include "SearchIndex.h"
+#include "Cursor.h"
+#include "NameTree.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+//==============================================================================
+//=============================== STRUCTS ======================================
+//==============================================================================
+typedef struct
+{
+	string name;
+	// ids of the events the client RSVP'ed to
+	vector<int> RSVP_events;
+} Client;
+
+typedef struct
+{
+	// views into event_line
+	StrRef event_title;
+	StrRef event_date;
+	StrRef event_description;
+	// the event's line as GET_TOP_N lists it (id, fields and ".\n"), a view
+	// into event_texts serialized once, when the event is created or
+	// hydrated
+	StrRef event_line;
+	int event_id;
+	// clients which RSVP'ed, in no particular order
+	vector<Client*> RSVP_list;
+	// position of each client of RSVP_list in it
+	unordered_map<Client*, size_t> RSVP_index;
+	// The names of RSVP_list, by bytes, as GET_RSVPS_LIST lists them. A
+	// writer makes the next version, which shares all but a logarithmic path
+	// with the current one, and publishes it with atomic_store while the
+	// event's shard is locked for writing; readers only atomic_load a version
+	// and list it without the shard's lock.
+	NameTree::Ptr RSVP_names;
+} Event;
+
+// Events waiting to be pushed to a subscriber: the ids from first_id to
+// last_id. A range of more than one id stands for events which were coalesced
+// since the subscriber read them slower than they were created.
+typedef struct
+{
+	int first_id;
+	int last_id;
+} PushRange;
+
+// What the request a worker executes does to the subscription of its
+// connection.
+typedef enum {SUBSCRIPTION_KEPT, SUBSCRIPTION_STARTED, SUBSCRIPTION_ENDED}
+		SubscriptionChange;
+
+// A connection is in one of these states while its requests are read.
+typedef enum {AWAITING_HEADER, AWAITING_PAYLOAD, AWAITING_LEGACY} ConnState;
+
+// A complete request, waiting for a worker to execute it.
+typedef struct
+{
+	string message;
+	FrameHeader header;
+	bool is_legacy;
+	// the request's trace id if it is traced (0 if not), and when it was
+	// received
+	uint64_t trace_id;
+	uint64_t received_ns;
+} Request;
+
+// The reactor owning a connection reads it; workers execute its requests and
+// write their replies. The fields from mutex on are shared, and guarded by it.
+typedef struct
+{
+	int fd;
+	// the epoll instance of the owning reactor
+	int epoll_fd;
+	ConnState state;
+	// header of the request whose payload is awaited
+	FrameHeader header;
+	// only the first request of a connection may be a legacy one
+	bool first_request;
+	// received bytes which were not handled yet
+	string in_buffer;
+
+	pthread_mutex_t mutex;
+	// requests waiting for a worker, executed in order
+	deque<Request> requests;
+	// whether the connection is queued to, or served by, a worker
+	bool scheduled;
+	// close the connection once all the replies were written
+	bool closing;
+	// a write failed, the reactor should close the connection
+	bool broken;
+	// the reactor closed the connection, nothing is written to it anymore
+	bool closed;
+	// stop reading requests while too many wait to be executed or written
+	bool read_paused;
+	// replies which were not written yet, from out_offset on
+	string out_buffer;
+	size_t out_offset;
+	time_t last_active;
+	// replies which wait for their mutations to be committed to the
+	// write-ahead log, and the LSN the last of them waits for
+	int awaiting_commit;
+	uint64_t commit_lsn;
+	// Subscribed to new events (SUBSCRIBE): the header of the SUBSCRIBE
+	// request, which the pushes carry, and the events to push, up to
+	// SUBSCRIBER_QUEUE_SIZE ranges. They are written once the replies before
+	// them were.
+	bool subscribed;
+	FrameHeader push_header;
+	deque<PushRange> pushes;
+	// the reactor holds a reference while the connection is open, a worker
+	// holds one while the connection is scheduled, each reply awaiting
+	// commit holds one, and the subscribers list holds one
+	int refs;
+} Connection;
+
+// The command of a request, and when its reply was built, for timing the
+// sending of the reply.
+typedef struct
+{
+	Opcode opcode;
+	uint64_t ready_ns;
+} ReplyTiming;
+
+// A reply which is written once the write-ahead log is durable up to lsn.
+typedef struct
+{
+	Connection* conn;
+	Request request;
+	string reply;
+	uint64_t lsn;
+	// the last record of the request itself, 0 if it appended none (it
+	// waits for the replies before it)
+	uint64_t record_lsn;
+	ReplyTiming timing;
+} DeferredReply;
+
+// Counters of the server, besides the requests', which the threads keep in
+// metrics.
+typedef enum
+{
+	COUNTER_RSVPS_ADDED,
+	COUNTER_RSVPS_REMOVED,
+	// requests refused since the server was overloaded
+	COUNTER_OVERLOADED,
+	// pushes written to subscribers, and those which were coalesced ranges
+	COUNTER_PUSHES,
+	COUNTER_COALESCED_PUSHES,
+	COUNTERS_NUM
+} ServerCounter;
+
+// Each reactor thread drives the connections registered to its epoll instance.
+typedef struct
+{
+	int epoll_fd;
+	pthread_t thread;
+	// guards connections, which the clients thread adds to
+	pthread_mutex_t connections_mutex;
+	unordered_set<Connection*> connections;
+} Reactor;
+
+//==============================================================================
+//=============================== TYPEDEG ======================================
+//==============================================================================
+// Registered clients, keyed by their name (a view of Client::name), case
+// insensitively.
+typedef unordered_map<StrRef, Client*, CaseInsensitiveHash,
+                      CaseInsensitiveEqual> ClientsMap;
+
+//==============================================================================
+//============================ DATA STRUCTURES =================================
+//==============================================================================
+// The registered clients whose names hash to a shard, and their slab. The
+// shard's lock guards them, and the RSVPs of its clients (their RSVP_events).
+typedef struct alignas(CACHE_LINE_SIZE)
+{
+	ProfiledRWLock lock{CLIENT_SHARDS_LOCK, TRACE_CLIENT_SHARD_SPAN, true};
+	ClientsMap clients;
+	ObjectPool<Client> pool{CLIENT_SLAB_SIZE};
+} ClientShard;
+
+// The lock of the events whose ids map to a shard. It guards their RSVPs
+// (RSVP_list and RSVP_index, and the publishing of RSVP_names); the rest of
+// an event does not change once it is created.
+typedef struct alignas(CACHE_LINE_SIZE)
+{
+	ProfiledRWLock lock{EVENT_SHARDS_LOCK, TRACE_EVENT_SHARD_SPAN, true};
+} EventShard;
+
+ClientShard client_shards[CLIENT_SHARDS];
+EventShard event_shards[EVENT_SHARDS];
+
+// Events by creation order, in chunks of slots which never move. Ids are
+// assigned sequentially (from FIRST_EVENT_ID) while events_mutex is held, so
+// the table is also indexed by id: the event with id i is in slot
+// i - FIRST_EVENT_ID. A new event's slot is set before events_num covers it,
+// so events are looked up without events_mutex. The slots of the loaded
+// snapshot's events are nullptr until find_event first gets them.
+atomic<Event*>* event_chunks[MAX_EVENT_CHUNKS];
+atomic<size_t> events_num(0);
+
+// Events are allocated from a slab, guarded by events_mutex. The lines of the
+// events created or hydrated since the server started are kept in
+// event_texts, guarded by events_mutex too.
+ObjectPool<Event> event_pool(EVENT_SLAB_SIZE);
+StringArena event_texts(EVENT_TEXT_CHUNK_SIZE);
+
+// The events whose date parses, ordered by (date key, id), so that the events
+// of a range of dates are found in logarithmic time. Guarded by
+// date_index_lock, which is taken after any other lock of the store.
+// The events of the loaded snapshot are only indexed by the first query.
+typedef set<pair<uint32_t, int> > DateIndex;
+DateIndex date_index;
+ProfiledRWLock date_index_lock(DATE_INDEX_LOCK, TRACE_DATE_INDEX_SPAN);
+pthread_once_t snapshot_dates_once = PTHREAD_ONCE_INIT;
+
+// The words of the titles and descriptions of the events, which SEARCH looks
+// up. Guarded by search_index_lock, which is taken after any other lock of the
+// store; events are added to it in the order of their ids, while events_mutex
+// is held. The events of the loaded snapshot are only added by the first
+// search.
+SearchIndex search_index;
+ProfiledRWLock search_index_lock(SEARCH_INDEX_LOCK, TRACE_SEARCH_INDEX_SPAN);
+pthread_once_t snapshot_terms_once = PTHREAD_ONCE_INIT;
+
+//==============================================================================
+//================================= GLOBALS ====================================
+//==============================================================================
+// The log file
+Log * server_log;
+
+// Will be used to guard the log file
+ProfiledMutex server_log_mutex(SERVER_LOG_LOCK, TRACE_LOG_MUTEX_SPAN);
+
+// whether a flusher thread writes the log, the records it may queue, and what
+// happens to a record when they are all taken
+bool async_log = false;
+int log_buffer = DEFAULT_LOG_BUFFER;
+LogFullPolicy log_full_policy = LOG_FULL_BLOCK;
+
+// Will be used to guard the creation of events: avaliable_id, the event table's
+// slots and chunks, the event slab and event_texts.
+// Lock order: a client shard, then event shards (by ascending index), then
+// events_mutex, then the write-ahead log's own mutex, date_index_lock or
+// search_index_lock. Only take_snapshot takes more than one client shard, by
+// ascending index too.
+ProfiledMutex events_mutex(EVENTS_LOCK, TRACE_EVENTS_MUTEX_SPAN);
+
+ProfiledMutex threads_num_mutex(THREADS_NUM_LOCK);
+int threads_num = 0;
+
+// this thread listens to the stdin
+pthread_t stdin_thread;
+
+// this thread accepts new connections and hands them to the reactors
+pthread_t clients_thread;
+
+// the reactors which serve the connections
+Reactor* reactors = nullptr;
+int reactors_num = 0;
+
+// the workers which execute the requests
+WorkerPool* worker_pool = nullptr;
+int workers_num = 0;
+int work_queue_capacity = DEFAULT_WORK_QUEUE_CAPACITY;
+
+// the server socket
+int server_sock;
+
+// the next id to assign
+int avaliable_id = FIRST_EVENT_ID;
+
+// the most events GET_TOP_N lists
+int top_n_cap = DEFAULT_TOP_N_CAP;
+
+bool toExit = false;
+
+// whether requests in the legacy fixed size format are still served
+bool accept_legacy = true;
+
+// seconds a client session may stay idle before it is closed
+int idle_timeout = DEFAULT_IDLE_TIMEOUT;
+
+// the backlog of the listening socket
+int pending_connections = MAX_PENDING_CONNECTIONS;
+
+// the directory the store is persisted to, empty if it is not persisted
+string data_dir = EMPTY_STR;
+
+// seconds between two snapshots of the store
+int snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+
+// The mutations of the store since the snapshot. A mutation is appended while
+// the locks of the clients and events it mutates are held, so mutations which
+// touch the same ones are in the order they were made in. nullptr if the store
+// is not persisted.
+WriteAheadLog* wal = nullptr;
+
+// the oldest generation of the log which the snapshot does not cover
+uint64_t oldest_wal_generation = 0;
+
+// The snapshot the store was recovered from, mapped while the server runs, and
+// its clients by their index in it. The clients of an event which was not
+// accessed yet are all still registered, since unregistering a client accesses
+// its events. nullptr if there was none.
+SnapshotReader* loaded_snapshot = nullptr;
+vector<Client*> snapshot_clients;
+
+// this thread indexes the events of the loaded snapshot, if there is one
+pthread_t indexer_thread;
+
+// this thread takes the snapshots
+pthread_t snapshot_thread;
+
+// when the reply to a mutation is sent, relative to its commit to the log
+Durability durability = DURABILITY_NONE;
+int commit_delay = DEFAULT_COMMIT_DELAY;
+
+// The LSN of the last record the request a worker executes appended, 0 if it
+// appended none, and whether a record it appended could not be written.
+thread_local uint64_t request_commit_lsn = 0;
+thread_local bool request_commit_failed = false;
+
+// Replies waiting for the log to be committed (DURABILITY_BATCHED), in the
+// order they were deferred in.
+// Lock order: deferred_replies_mutex before a connection's mutex.
+list<DeferredReply> deferred_replies;
+ProfiledMutex deferred_replies_mutex(DEFERRED_REPLIES_LOCK);
+
+// The connections subscribed to new events, and the id of the newest event
+// pushed to them. The notifier wakes up when events are created, and queues
+// the events created since to every subscriber.
+// Lock order: subscribers_mutex before a connection's mutex.
+vector<Connection*> subscribers;
+int notified_event_id = 0;
+ProfiledMutex subscribers_mutex(SUBSCRIBERS_LOCK);
+pthread_cond_t events_created = PTHREAD_COND_INITIALIZER;
+// read by create_event without the mutex, so that it signals only if needed
+atomic<size_t> subscribers_num(0);
+pthread_t notifier_thread;
+
+// What the request a worker executes does to its connection's subscription.
+thread_local SubscriptionChange request_subscription = SUBSCRIPTION_KEPT;
+
+// Counters and latency histograms of the requests by opcode, and the
+// ServerCounter counters. Each thread records to its own block, read by STATS.
+Metrics* metrics = nullptr;
+
+// The command of the request a worker executed, and when its reply was built,
+// for timing the sending of the reply.
+thread_local Opcode request_opcode = OP_NONE;
+thread_local uint64_t request_executed_ns = 0;
+
+// the RSVPs of the loaded snapshot, which are not added with add_rsvp
+uint64_t snapshot_rsvps_num = 0;
+
+// when the server started
+time_t start_time;
+
+// the file the stats are dumped to every stats_interval seconds, empty if they
+// are not dumped
+string stats_file = EMPTY_STR;
+int stats_interval = DEFAULT_STATS_INTERVAL;
+
+// the file the spans of the traced requests are written to on TRACE and on
+// exit, empty if requests are not traced; one of every trace_sample_every
+// requests is
+string trace_file = EMPTY_STR;
+int trace_sample_every = DEFAULT_TRACE_SAMPLE;
+
+// whether the waits for the locks, and how long they are held, are profiled;
+// the profile is part of the stats, and is written to the log on LOCKS and on
+// exit
+bool lock_profile = false;
+
+// this thread dumps the stats
+pthread_t stats_thread;
+
+//==============================================================================
+//=============================== HELPERS ======================================
+//==============================================================================
+/**
+ * Initialize the (empty) store's metrics. Runs before any other thread.
+ */
+void init_store()
+{
+	metrics = new Metrics(OPCODES_NUM, COUNTERS_NUM);
+	start_time = time(nullptr);
+}
+
+/**
+ * The shard of the clients with a given name (case insensitively).
+ */
+ClientShard& client_shard_of(StrRef client_name)
+{
+	return client_shards[CaseInsensitiveHash()(client_name) &
+	                     (CLIENT_SHARDS - 1)];
+}
+
+/**
+ * The shard of the event with a given id.
+ */
+EventShard& event_shard_of(int event_id)
+{
+	return event_shards[(unsigned) event_id & (EVENT_SHARDS - 1)];
+}
+
+/**
+ * The slot of the event at a given index of the table, whose chunk exists.
+ */
+atomic<Event*>& event_slot(size_t index)
+{
+	return event_chunks[index / EVENT_CHUNK_SIZE][index % EVENT_CHUNK_SIZE];
+}
+
+/**
+ * Grow the event table to num slots, the new ones empty. Returns false if the
+ * table cannot hold them. events_mutex is held (or no other thread runs).
+ */
+bool grow_event_table(size_t num)
+{
+	if (num > (size_t) MAX_EVENT_CHUNKS * EVENT_CHUNK_SIZE)
+	{
+		return false;
+	}
+
+	for (size_t chunk = 0; chunk * EVENT_CHUNK_SIZE < num; chunk++)
+	{
+		if (event_chunks[chunk] == nullptr)
+		{
+			event_chunks[chunk] = new atomic<Event*>[EVENT_CHUNK_SIZE]();
+		}
+	}
+	events_num.store(num, memory_order_release);
+	return true;
+}
+
+/**
+ * Add a new event to the end of the event table, which publishes its id.
+ * Returns false if the table is full. events_mutex is held (or no other
+ * thread runs).
+ */
+bool append_event(Event* event)
+{
+	size_t index = events_num.load(memory_order_relaxed);
+	if (index == (size_t) MAX_EVENT_CHUNKS * EVENT_CHUNK_SIZE)
+	{
+		return false;
+	}
+
+	if (event_chunks[index / EVENT_CHUNK_SIZE] == nullptr)
+	{
+		event_chunks[index / EVENT_CHUNK_SIZE] =
+				new atomic<Event*>[EVENT_CHUNK_SIZE]();
+	}
+	event_slot(index).store(event, memory_order_release);
+	events_num.store(index + 1, memory_order_release);
+	return true;
+}
+
+/**
+ * free allocated memory to all dynamiclly allocated memories.
+ * */
+void free_allocated_memory()
+{
+	for (auto& shard : client_shards)
+	{
+		for(auto& client : shard.clients)
+		{
+			shard.pool.release(client.second);
+		}
+		shard.clients.clear();
+	}
+
+	size_t num = events_num.exchange(0);
+	for (size_t i = 0; i < num; i++)
+	{
+		Event* event = event_slot(i).load();
+		if (event != nullptr)
+		{
+			event_pool.release(event);
+		}
+	}
+	for (auto& chunk : event_chunks)
+	{
+		delete[] chunk;
+		chunk = nullptr;
+	}
+	date_index.clear();
+	search_index = SearchIndex();
+
+	delete loaded_snapshot;
+	loaded_snapshot = nullptr;
+}
+
+/**
+ * This function establishes a connection for a given sockaddr_in
+ */
+int establish_connection(sockaddr_in& connection_info)
+{
+    int client;
+
+    // Create socket
+    if ((client = socket(AF_INET, SOCK_STREAM, 0)) < SUCCESS)
+	{
+        server_log->write_to_log(sys_call_error("socket"));
+        return FAILURE;
+    }
+
+    // Bind `sock` with given addresses
+    if (bind(client, (struct sockaddr *) &connection_info, \
+             sizeof(struct sockaddr_in)) < SUCCESS)
+	{
+        close(client);
+        server_log->write_to_log(sys_call_error("bind"));
+        return FAILURE;
+    }
+
+    // Max # of queued connects
+    if (listen(client, pending_connections) < SUCCESS)
+	{
+        close(client);
+        server_log->write_to_log(sys_call_error("listen"));
+        return FAILURE;
+    }
+
+    // The clients thread accepts connections until none is pending
+    if (fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK) < SUCCESS)
+	{
+        close(client);
+        server_log->write_to_log(sys_call_error("fcntl"));
+        return FAILURE;
+    }
+
+    return client;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Get the first connection request on the queue of pending connections for the
+ * listening socket, as a non blocking socket. FAILURE if there is none.
+ */
+int get_ready_connection(int s)
+{
+    /* socket of connection */
+    int caller;
+    if ((caller = accept4(s, NULL, NULL, SOCK_NONBLOCK)) < SUCCESS)
+	{
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            server_log->write_to_log(sys_call_error("accept"));
+        }
+        return FAILURE;
+    }
+
+    // replies are small, don't delay them
+    int no_delay = 1;
+    setsockopt(caller, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    return caller;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Append an event's fields to its line, as GET_TOP_N lists it (following its
+ * id).
+ */
+void append_event_line(string& line, StrRef title, StrRef date,
+                       StrRef description)
+{
+	line += '\t';
+	line.append(title.data, title.length);
+	line += '\t';
+	line.append(date.data, date.length);
+	line += '\t';
+	line.append(description.data, description.length);
+	line += ".\n";
+}
+
+/**
+ * Serialize the line of an event, whose id is set, to event_texts, and point
+ * its fields into it. events_mutex is held.
+ */
+void set_event_text(Event* event, StrRef title, StrRef date,
+                    StrRef description)
+{
+	string line = to_string(event->event_id);
+	size_t title_offset = line.length() + 1;
+	append_event_line(line, title, date, description);
+
+	char* text = event_texts.allocate(line.length());
+	memcpy(text, line.data(), line.length());
+	event->event_line = make_ref(text, line.length());
+	event->event_title = make_ref(text + title_offset, title.length);
+	event->event_date = make_ref(event->event_title.data + title.length + 1,
+	                             date.length);
+	event->event_description = make_ref(event->event_date.data +
+	                                    date.length + 1, description.length);
+}
+
+/**
+ * Build an event of the loaded snapshot, which was not accessed yet, from its
+ * stored record, unless another thread just did. Its RSVPs do not change
+ * meanwhile, whether its shard is locked or not: a writer hydrates an event
+ * before changing them, and waits for events_mutex to do so.
+ */
+Event* hydrate_event(uint32_t index)
+{
+	events_mutex.lock(__func__);
+	Event* hydrated = event_slot(index).load(memory_order_relaxed);
+	if (hydrated != nullptr)
+	{
+		events_mutex.unlock();
+		return hydrated;
+	}
+
+	const SnapshotEvent& stored = loaded_snapshot->get_event(index);
+	const char* text = loaded_snapshot->get_text(stored.text_offset);
+
+	// the text is copied into the event's line
+	Event* event = event_pool.allocate();
+	event->event_id = FIRST_EVENT_ID + (int) index;
+	StrRef title = make_ref(text, stored.title_length);
+	text += stored.title_length;
+	StrRef date = make_ref(text, stored.date_length);
+	text += stored.date_length;
+	set_event_text(event, title, date,
+	               make_ref(text, stored.description_length));
+
+	// the clients already list the event among their RSVPs
+	const uint32_t* rsvps = loaded_snapshot->get_event_rsvps(stored);
+	vector<StrRef> names;
+	event->RSVP_list.reserve(stored.rsvps_num);
+	names.reserve(stored.rsvps_num);
+	for (uint32_t i = 0; i < stored.rsvps_num; i++)
+	{
+		Client* client = snapshot_clients[rsvps[i]];
+		event->RSVP_index[client] = event->RSVP_list.size();
+		event->RSVP_list.push_back(client);
+		names.push_back(make_ref(client->name));
+	}
+	sort(names.begin(), names.end(), NameLess());
+	event->RSVP_names = NameTree::build(names);
+
+	event_slot(index).store(event, memory_order_release);
+	events_mutex.unlock();
+	return event;
+}
+
+/**
+ * Get the index in the event table of the event with a given id. Returns false
+ * if there is no such event.
+ */
+bool get_event_index(int event_id, size_t& index)
+{
+	if (event_id < FIRST_EVENT_ID ||
+	    (size_t) (event_id - FIRST_EVENT_ID) >=
+	    events_num.load(memory_order_acquire))
+	{
+		return false;
+	}
+
+	index = (size_t) (event_id - FIRST_EVENT_ID);
+	return true;
+}
+
+/**
+ * Get the event with a given id, in constant time and without events_mutex
+ * (unless it is hydrated). nullptr if there is none. The event's shard is
+ * locked, if its RSVPs are used.
+ */
+Event* find_event(int event_id)
+{
+	size_t index;
+	if (!get_event_index(event_id, index))
+	{
+		return nullptr;
+	}
+
+	Event* event = event_slot(index).load(memory_order_acquire);
+	return event != nullptr ? event : hydrate_event((uint32_t) index);
+}
+
+/**
+ * Parse the page size and the continuation token of a paged request; either
+ * is left as it is if its token of the request is empty. Returns false if the
+ * size is not a positive integer, or the token is not one of a cursor of the
+ * given kind.
+ */
+bool parse_page_options(StrRef size_ref, StrRef token, uint8_t kind,
+                        long& page_size, Cursor& cursor, bool& has_cursor)
+{
+	if (size_ref.length > 0 &&
+	    (!ref_to_long(size_ref, page_size) || page_size <= 0))
+	{
+		return false;
+	}
+	has_cursor = token.length > 0;
+	return !has_cursor || (decode_cursor(token.data, token.length, cursor) &&
+	                       cursor.kind == kind);
+}
+
+/**
+ * The reply listing a page of the names of the clients which RSVP'ed to the
+ * event with a given id: up to page_size of them, by name, starting after the
+ * name after (or from the first, if it is empty), and no more than fit in
+ * MAX_RSVPS_PAGE_LENGTH bytes. The names are separated by spaces; if more
+ * follow, a line with the continuation token of the page follows them. A page
+ * is listed from the version of the names published last, without the
+ * event's shard: it seeks the version in logarithmic time and then takes time
+ * in its size, however many clients RSVP'ed. Returns false if there is no
+ * such event.
+ */
+bool rsvps_page_reply(int event_id, const string& after, size_t page_size,
+                      string& reply)
+{
+	Event* event = find_event(event_id);
+	if (event == nullptr)
+	{
+		return false;
+	}
+
+	// no name is empty, so all of them follow an empty one
+	reply.clear();
+	NameTree::Ptr published = atomic_load(&event->RSVP_names);
+	Cursor next;
+	if (published != nullptr &&
+	    published->list_after(make_ref(after), page_size,
+	                          MAX_RSVPS_PAGE_LENGTH, reply, next.name))
+	{
+		next.kind = CURSOR_RSVPS;
+		next.event_id = event_id;
+		next.date_key = 0;
+		reply += "\n" NEXT_PAGE_TEXT " " + encode_cursor(next);
+	}
+	return true;
+}
+
+/**
+ * Get the title, date and description of the event with a given id, without
+ * taking any lock (they never change). Returns false if there is no such
+ * event. An event of the loaded snapshot which was not accessed yet is read
+ * from the snapshot.
+ */
+bool get_event_fields(int event_id, StrRef& title, StrRef& date,
+                      StrRef& description)
+{
+	size_t index;
+	if (!get_event_index(event_id, index))
+	{
+		return false;
+	}
+
+	Event* event = event_slot(index).load(memory_order_acquire);
+	if (event != nullptr)
+	{
+		title = event->event_title;
+		date = event->event_date;
+		description = event->event_description;
+		return true;
+	}
+
+	const SnapshotEvent& stored = loaded_snapshot->get_event((uint32_t) index);
+	const char* text = loaded_snapshot->get_text(stored.text_offset);
+	title = make_ref(text, stored.title_length);
+	text += stored.title_length;
+	date = make_ref(text, stored.date_length);
+	text += stored.date_length;
+	description = make_ref(text, stored.description_length);
+	return true;
+}
+
+/**
+ * Append the line of the event with a given id, as GET_TOP_N lists it,
+ * without taking any lock. The line of an event of the loaded snapshot which
+ * was not accessed yet is formatted from the snapshot. Nothing is appended
+ * if there is no such event.
+ */
+void append_event_text(string& out, int event_id)
+{
+	size_t index;
+	if (!get_event_index(event_id, index))
+	{
+		return;
+	}
+
+	Event* event = event_slot(index).load(memory_order_acquire);
+	if (event != nullptr)
+	{
+		out.append(event->event_line.data, event->event_line.length);
+		return;
+	}
+
+	StrRef title, date, description;
+	get_event_fields(event_id, title, date, description);
+	out += to_string(event_id);
+	append_event_line(out, title, date, description);
+}
+
+/**
+ * RSVP a client to an event, in time logarithmic in its RSVPs (to publish
+ * the next version of its names). Returns false if the client already RSVP'ed
+ * to it. The client's shard and the event's shard are locked for writing.
+ */
+bool add_rsvp(Event* event, Client* client)
+{
+	if (!event->RSVP_index.insert(make_pair(client,
+	                                        event->RSVP_list.size())).second)
+	{
+		return false;
+	}
+
+	event->RSVP_list.push_back(client);
+	client->RSVP_events.push_back(event->event_id);
+	atomic_store(&event->RSVP_names,
+	             NameTree::insert(atomic_load(&event->RSVP_names),
+	                              client->name));
+	metrics->add_to_counter(COUNTER_RSVPS_ADDED, 1);
+	return true;
+}
+
+/**
+ * Cancel the RSVP of a client to an event, in time logarithmic in its RSVPs:
+ * the last client of the list takes its place, and the next version of the
+ * names is published. The event's shard is locked for writing.
+ */
+void remove_rsvp(Event* event, Client* client)
+{
+	unordered_map<Client*, size_t>::iterator it =
+			event->RSVP_index.find(client);
+	if (it == event->RSVP_index.end())
+	{
+		return;
+	}
+
+	Client* last = event->RSVP_list.back();
+	event->RSVP_list[it->second] = last;
+	event->RSVP_index[last] = it->second;
+
+	event->RSVP_list.pop_back();
+	event->RSVP_index.erase(client);
+	atomic_store(&event->RSVP_names,
+	             NameTree::erase(atomic_load(&event->RSVP_names),
+	                             client->name));
+	metrics->add_to_counter(COUNTER_RSVPS_REMOVED, 1);
+}
+
+/**
+ * Get the registered client with a given name (case insensitively), in
+ * constant time and without allocating. nullptr if there is none. The
+ * client's shard is locked.
+ */
+Client* find_client(StrRef client_name)
+{
+	ClientsMap& clients = client_shard_of(client_name).clients;
+	ClientsMap::iterator it = clients.find(client_name);
+	return it == clients.end() ? nullptr : it->second;
+}
+
+/**
+ * The number of registered clients. The shards are locked in turn, so it is
+ * only a snapshot while clients register.
+ */
+size_t registered_clients_num()
+{
+	size_t num = 0;
+	for (auto& shard: client_shards)
+	{
+		shard.lock.read_lock(__func__);
+		num += shard.clients.size();
+		shard.lock.unlock();
+	}
+	return num;
+}
+
+/**
+ * Write a mutation of the registered clients (RECORD_REGISTER or
+ * RECORD_UNREGISTER) to the write-ahead log, if the store is persisted. The
+ * client's shard is locked for writing (and for RECORD_UNREGISTER, the shards
+ * of the events it RSVP'ed to).
+ */
+void log_client_mutation(uint8_t type, const string& client_name)
+{
+	if (wal == nullptr)
+	{
+		return;
+	}
+
+	StoreRecord record;
+	record.type = type;
+	record.name = client_name;
+	if (wal->append(record, request_commit_lsn) == FAILURE)
+	{
+		request_commit_failed = true;
+		server_log->write_to_log(sys_call_error("write"));
+	}
+}
+
+/**
+ * Write a new event to the write-ahead log, if the store is persisted, before
+ * its id is published. events_mutex is held.
+ */
+void log_event_creation(const Event* event)
+{
+	if (wal == nullptr)
+	{
+		return;
+	}
+
+	StoreRecord record;
+	record.type = RECORD_CREATE;
+	record.event_id = (uint32_t) event->event_id;
+	record.title = ref_to_string(event->event_title);
+	record.date = ref_to_string(event->event_date);
+	record.description = ref_to_string(event->event_description);
+	if (wal->append(record, request_commit_lsn) == FAILURE)
+	{
+		request_commit_failed = true;
+		server_log->write_to_log(sys_call_error("write"));
+	}
+}
+
+/**
+ * Write an RSVP to the write-ahead log, if the store is persisted. The
+ * client's shard and the event's shard are locked for writing.
+ */
+void log_rsvp(const Event* event, const Client* client)
+{
+	if (wal == nullptr)
+	{
+		return;
+	}
+
+	StoreRecord record;
+	record.type = RECORD_RSVP;
+	record.event_id = (uint32_t) event->event_id;
+	record.name = client->name;
+	if (wal->append(record, request_commit_lsn) == FAILURE)
+	{
+		request_commit_failed = true;
+		server_log->write_to_log(sys_call_error("write"));
+	}
+}
+
+/**
+ * Add a client to its shard. The shard is locked for writing.
+ */
+Client* insert_client(const string& client_name)
+{
+	ClientShard& shard = client_shard_of(make_ref(client_name));
+	Client* new_client = shard.pool.allocate();
+	new_client->name = client_name;
+
+	// the key refers to the client's own copy of its name
+	shard.clients[make_ref(new_client->name)] = new_client;
+	return new_client;
+}
+
+/**
+ * Remove a client from its shard, and from the events it RSVP'ed to, and free
+ * it. The client's shard, and the shards of the events it RSVP'ed to, are
+ * locked for writing.
+ */
+void erase_client(Client* client)
+{
+	// Remove from RSVP if needed.
+	for (auto const& event_id: client->RSVP_events)
+	{
+		remove_rsvp(find_event(event_id), client);
+	}
+
+	ClientShard& shard = client_shard_of(make_ref(client->name));
+	shard.clients.erase(make_ref(client->name));
+	shard.pool.release(client); // Deallocate resources for client
+}
+
+/**
+ * Lock, for writing and by ascending index, the shards of the events a client
+ * RSVP'ed to. Returns the set of shards, as bits by index.
+ */
+uint64_t lock_rsvp_shards(const Client* client)
+{
+	static_assert(EVENT_SHARDS <= 64, "a shard set is 64 bits");
+
+	uint64_t shards = 0;
+	for (auto const& event_id: client->RSVP_events)
+	{
+		shards |= (uint64_t) 1 << ((unsigned) event_id & (EVENT_SHARDS - 1));
+	}
+	for (int i = 0; i < EVENT_SHARDS; i++)
+	{
+		if (shards & ((uint64_t) 1 << i))
+		{
+			event_shards[i].lock.write_lock(__func__);
+		}
+	}
+	return shards;
+}
+
+/**
+ * Unlock the event shards lock_rsvp_shards locked.
+ */
+void unlock_rsvp_shards(uint64_t shards)
+{
+	for (int i = 0; i < EVENT_SHARDS; i++)
+	{
+		if (shards & ((uint64_t) 1 << i))
+		{
+			event_shards[i].lock.unlock();
+		}
+	}
+}
+
+/**
+ * Given client is deleted, and if neccessary, removed from an event he's
+ * RSVP. The client's shard is locked for writing.
+ */
+void delete_client(Client* client)
+{
+	// The events are locked along with the record, so that no RSVP to them
+	// is logged before it and applied after the removal (or the other way)
+	uint64_t shards = lock_rsvp_shards(client);
+	log_client_mutation(RECORD_UNREGISTER, client->name);
+
+	server_log->write_to_log(
+			client->name + "\twas unregistered successfully.\n");
+
+	erase_client(client);
+	unlock_rsvp_shards(shards);
+}
+
+/**
+ * Checks is client_name is already registered. if to_del is true, client is
+ * also deleted (default is false)
+ */
+bool is_client_registered(StrRef client_name, bool to_del = false)
+{
+	ClientShard& shard = client_shard_of(client_name);
+	if (to_del)
+	{
+		shard.lock.write_lock(__func__);
+	}
+	else
+	{
+		shard.lock.read_lock(__func__);
+	}
+	Client* client = find_client(client_name);
+
+	// delete it if needed
+	if (client != nullptr && to_del)
+	{
+		delete_client(client);
+	}
+	shard.lock.unlock();
+
+	return client != nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initialize resources for a new client, unless a client with the same name
+ * (case insensitively) is already registered. Returns whether the client was
+ * created.
+ */
+bool create_client(StrRef client_name)
+{
+	ClientShard& shard = client_shard_of(client_name);
+	shard.lock.write_lock(__func__);
+	if (find_client(client_name) != nullptr)
+	{
+		shard.lock.unlock();
+		return false;
+	}
+
+	Client* new_client = insert_client(ref_to_string(client_name));
+	log_client_mutation(RECORD_REGISTER, new_client->name);
+	shard.lock.unlock();
+
+	server_log->write_to_log(ref_to_string(client_name) + \
+	                         "\twas registered successfully.\n");
+	return true;
+}
+
+/**
+ * Add an event to date_index, if its date parses.
+ */
+void index_event_date(int event_id, StrRef date)
+{
+	uint32_t date_key;
+	if (!parse_date_key(date, date_key))
+	{
+		return;
+	}
+
+	date_index_lock.write_lock(__func__);
+	date_index.insert(make_pair(date_key, event_id));
+	date_index_lock.unlock();
+}
+
+/**
+ * Add the events of the loaded snapshot to date_index, from the mapped text.
+ * Runs once, on the indexer thread (or the first query of the index, if it
+ * comes before the thread gets to it).
+ */
+void index_snapshot_dates()
+{
+	if (loaded_snapshot == nullptr)
+	{
+		return;
+	}
+
+	// sorted first, the keys are mostly inserted in constant time
+	vector<pair<uint32_t, int> > dated;
+	dated.reserve(loaded_snapshot->get_events_num());
+	for (uint32_t i = 0; i < loaded_snapshot->get_events_num(); i++)
+	{
+		const SnapshotEvent& stored = loaded_snapshot->get_event(i);
+		const char* date = loaded_snapshot->get_text(stored.text_offset) +
+		                   stored.title_length;
+		uint32_t date_key;
+		if (parse_date_key(make_ref(date, stored.date_length), date_key))
+		{
+			dated.push_back(make_pair(date_key, FIRST_EVENT_ID + (int) i));
+		}
+	}
+	sort(dated.begin(), dated.end());
+
+	date_index_lock.write_lock(__func__);
+	date_index.insert(dated.begin(), dated.end());
+	date_index_lock.unlock();
+}
+
+/**
+ * Append the lines of events to a reply, as GET_TOP_N lists them: each one
+ * serialized already, unless its event was not accessed since the snapshot
+ * was loaded.
+ */
+void append_event_lines(string& reply, const vector<int>& event_ids)
+{
+	for (size_t i = 0; i < event_ids.size(); i++)
+	{
+		if (i > 0)
+		{
+			reply += (char) EVENT_DELIMITER;
+		}
+		append_event_text(reply, event_ids[i]);
+	}
+}
+
+/**
+ * The reply listing the top_n newest events (all of them if there are fewer).
+ * It is built from the event table, without any lock, so creating an event
+ * costs the same whatever top_n_cap is.
+ */
+string top_events_reply(size_t top_n)
+{
+	// the events up to the newest one are all set in the table by now
+	size_t num = events_num.load(memory_order_acquire);
+	vector<int> event_ids;
+	event_ids.reserve(min(top_n, num));
+	for (size_t i = 1; i <= num && event_ids.size() < top_n; i++)
+	{
+		event_ids.push_back(FIRST_EVENT_ID + (int) (num - i));
+	}
+
+	string reply = "Top " + to_string(top_n) + " newest events are:\n";
+	append_event_lines(reply, event_ids);
+	return reply;
+}
+
+/**
+ * The terms an event is searched by: the words of its title and description.
+ */
+void get_event_terms(StrRef title, StrRef description, vector<string>& terms)
+{
+	SearchIndex::tokenize(title.data, title.length, terms);
+	SearchIndex::tokenize(description.data, description.length, terms);
+}
+
+/**
+ * Add the events of the loaded snapshot to search_index, from the mapped text.
+ * They are indexed on their own, without the lock, and then put before the
+ * events created since. Runs once, on the indexer thread (or the first
+ * search, if it comes before the thread gets to it).
+ */
+void index_snapshot_terms()
+{
+	if (loaded_snapshot == nullptr)
+	{
+		return;
+	}
+
+	SearchIndex older;
+	vector<string> terms;
+	for (uint32_t i = 0; i < loaded_snapshot->get_events_num(); i++)
+	{
+		const SnapshotEvent& stored = loaded_snapshot->get_event(i);
+		const char* title = loaded_snapshot->get_text(stored.text_offset);
+		const char* description = title + stored.title_length +
+		                          stored.date_length;
+		terms.clear();
+		get_event_terms(make_ref(title, stored.title_length),
+		                make_ref(description, stored.description_length),
+		                terms);
+		older.add(FIRST_EVENT_ID + (int) i, terms);
+	}
+
+	search_index_lock.write_lock(__func__);
+	search_index.prepend(older);
+	search_index_lock.unlock();
+}
+
+/**
+ * Index the events of the loaded snapshot for SEARCH and GET_EVENTS_RANGE in
+ * the background, once the server started, so that no request waits for the
+ * whole snapshot to be indexed on a worker. A query which comes before this is
+ * done waits for the index it reads.
+ */
+void* indexer_thread_func(void*)
+{
+	pthread_once(&snapshot_terms_once, index_snapshot_terms);
+	pthread_once(&snapshot_dates_once, index_snapshot_dates);
+	return nullptr;
+}
+
+/**
+ * The reply listing the newest SEARCH_RESULTS events which have every term of
+ * a query, as GET_TOP_N lists them. Returns false if the query is too broad.
+ */
+bool search_reply(StrRef query, string& reply)
+{
+	vector<string> terms;
+	SearchIndex::parse_query(query.data, query.length, terms);
+
+	pthread_once(&snapshot_terms_once, index_snapshot_terms);
+
+	// the ids are taken under the lock, their fields never change
+	vector<int> event_ids;
+	search_index_lock.read_lock(__func__);
+	int searched = search_index.search(terms, SEARCH_RESULTS, event_ids);
+	search_index_lock.unlock();
+	if (searched == FAILURE)
+	{
+		return false;
+	}
+
+	reply = "Events matching " + ref_to_string(query) + ":\n";
+	append_event_lines(reply, event_ids);
+	return true;
+}
+
+/**
+ * The reply listing a page of up to page_size events by id, from the newest,
+ * starting before the event of a cursor (or from the newest, if there is
+ * none). The events follow a header line, which has the continuation token of
+ * the page if older events are left. Events created meanwhile are not listed
+ * by the later pages.
+ */
+void events_page_reply(size_t page_size, const Cursor* before, string& reply)
+{
+	// ids from FIRST_EVENT_ID to the newest are taken
+	int newest_id = FIRST_EVENT_ID - 1 +
+	                (int) events_num.load(memory_order_acquire);
+	int start_id = before != nullptr ? min(before->event_id - 1, newest_id) :
+	                                   newest_id;
+
+	vector<int> event_ids;
+	for (int event_id = start_id;
+	     event_id >= FIRST_EVENT_ID && event_ids.size() < page_size;
+	     event_id--)
+	{
+		event_ids.push_back(event_id);
+	}
+
+	reply = "Events by id";
+	if (!event_ids.empty() && event_ids.back() > FIRST_EVENT_ID)
+	{
+		Cursor next;
+		next.kind = CURSOR_EVENTS;
+		next.event_id = event_ids.back();
+		next.date_key = 0;
+		reply += ", " NEXT_PAGE_TEXT " " + encode_cursor(next);
+	}
+	reply += ":\n";
+	append_event_lines(reply, event_ids);
+}
+
+/**
+ * The reply listing up to limit events dated from from_key to to_key, by date
+ * and then by id, starting after the event of a cursor (or from the first, if
+ * there is none). The events follow a header line, as GET_TOP_N lists them;
+ * if more events are in the range, the header has the continuation token of
+ * the page.
+ */
+void events_range_reply(StrRef from, uint32_t from_key, StrRef to,
+                        uint32_t to_key, size_t limit, const Cursor* after,
+                        string& reply)
+{
+	// the events after the cursor's, or from the first of the range (no event
+	// has the id 0)
+	pair<uint32_t, int> last(from_key, 0);
+	if (after != nullptr)
+	{
+		last = max(last, make_pair(after->date_key, after->event_id));
+	}
+
+	pthread_once(&snapshot_dates_once, index_snapshot_dates);
+
+	// the ids are taken under the lock, their fields never change
+	vector<int> event_ids;
+	bool has_more = false;
+	date_index_lock.read_lock(__func__);
+	for (DateIndex::const_iterator it = date_index.upper_bound(last);
+	     it != date_index.end() && it->first <= to_key; ++it)
+	{
+		if (event_ids.size() == limit)
+		{
+			has_more = true;
+			break;
+		}
+		event_ids.push_back(it->second);
+	}
+	date_index_lock.unlock();
+
+	reply = "Events from " + ref_to_string(from) + " to " + ref_to_string(to);
+	if (has_more)
+	{
+		Cursor next;
+		next.kind = CURSOR_RANGE;
+		next.event_id = event_ids.back();
+		StrRef title, date, description;
+		get_event_fields(next.event_id, title, date, description);
+		parse_date_key(date, next.date_key);
+		reply += ", " NEXT_PAGE_TEXT " " + encode_cursor(next);
+	}
+	reply += ":\n";
+	append_event_lines(reply, event_ids);
+}
+
+/**
+ * Initialize resources for a new event. Its fields are copied from the request
+ * to event_texts.
+ * return the newly created event's id, or FAILURE if the event table is full.
+ */
+int create_event(StrRef client_name, StrRef title, StrRef date,
+                 StrRef description)
+{
+	// The terms are found before the lock is taken
+	vector<string> terms;
+	get_event_terms(title, description, terms);
+
+	// Get unique id, and store the event at the index matching it
+	events_mutex.lock(__func__);
+	if (events_num.load(memory_order_relaxed) ==
+	    (size_t) MAX_EVENT_CHUNKS * EVENT_CHUNK_SIZE)
+	{
+		events_mutex.unlock();
+		server_log->write_to_log("ERROR\tcreate_event\tthe event table is "
+		                         "full.\n");
+		return FAILURE;
+	}
+	Event* new_event = event_pool.allocate();
+	new_event->event_id = avaliable_id;
+	avaliable_id++;
+	set_event_text(new_event, title, date, description);
+	// the record precedes any RSVP to the event, which needs its id
+	log_event_creation(new_event);
+	append_event(new_event);
+	int event_id = new_event->event_id;
+	search_index_lock.write_lock(__func__);
+	search_index.add(event_id, terms);
+	search_index_lock.unlock();
+	events_mutex.unlock();
+
+	// the notifier pushes the event (it also wakes up every tick)
+	if (subscribers_num.load(memory_order_relaxed) > 0)
+	{
+		pthread_cond_signal(&events_created);
+	}
+
+	index_event_date(event_id, date);
+
+	server_log->write_to_log(ref_to_string(client_name) + "\tevent id " + \
+	                         to_string(event_id) + \
+							 " was assigned to the event with title " + \
+							 ref_to_string(title) + ".\n");
+
+	return event_id;
+}
+
+/**
+ * The number of threads of the process. 0 if it is unknown.
+ */
+int process_threads_num()
+{
+	ifstream status(PROC_STATUS_FILE);
+	string line;
+	while (getline(status, line))
+	{
+		if (line.compare(0, sizeof(THREADS_FIELD) - 1, THREADS_FIELD) == EQUAL)
+		{
+			return atoi(line.c_str() + sizeof(THREADS_FIELD) - 1);
+		}
+	}
+	return 0;
+}
+
+/**
+ * The number of open connections, over all the reactors.
+ */
+size_t open_connections_num()
+{
+	size_t num = 0;
+	for (int i = 0; i < reactors_num; i++)
+	{
+		pthread_mutex_lock(&reactors[i].connections_mutex);
+		num += reactors[i].connections.size();
+		pthread_mutex_unlock(&reactors[i].connections_mutex);
+	}
+	return num;
+}
+
+/**
+ * The stats of the server, as a JSON object: gauges of its state, counters,
+ * and for each command which was requested, the number of requests and of
+ * errors, and the latency histograms of their phases. The metrics are summed
+ * over the threads as they are read, so a request being recorded may be
+ * counted in some of them and not yet in others.
+ */
+string stats_json()
+{
+	time_t now = time(nullptr);
+	string json = "{\"time\":" + to_string(now) + ",\"uptime_seconds\":" +
+	              to_string(now - start_time);
+
+	// an RSVP is added before it is removed, so reading the removals first
+	// counts no RSVP twice
+	uint64_t rsvps_removed = metrics->get_counter(COUNTER_RSVPS_REMOVED);
+	uint64_t rsvps_num = snapshot_rsvps_num +
+	                     metrics->get_counter(COUNTER_RSVPS_ADDED) -
+	                     rsvps_removed;
+	json += ",\"gauges\":{\"connections\":" +
+	        to_string(open_connections_num()) +
+	        ",\"threads\":" + to_string(process_threads_num()) +
+	        ",\"events\":" + to_string(events_num.load()) +
+	        ",\"clients\":" + to_string(registered_clients_num()) +
+	        ",\"rsvps\":" + to_string(rsvps_num) +
+	        ",\"subscribers\":" + to_string(subscribers_num.load()) + "}";
+
+	json += ",\"counters\":{\"overloaded\":" +
+	        to_string(metrics->get_counter(COUNTER_OVERLOADED)) +
+	        ",\"pushes\":" + to_string(metrics->get_counter(COUNTER_PUSHES)) +
+	        ",\"coalesced_pushes\":" +
+	        to_string(metrics->get_counter(COUNTER_COALESCED_PUSHES)) + "}";
+
+	WorkerPoolStats pool = worker_pool->get_stats();
+	json += ",\"worker_pool\":{\"workers\":" + to_string(pool.workers_num) +
+	        ",\"queue_depth\":" + to_string(pool.queue_depth) +
+	        ",\"max_queue_depth\":" + to_string(pool.max_queue_depth) +
+	        ",\"submitted\":" + to_string(pool.submitted) +
+	        ",\"rejected\":" + to_string(pool.rejected) +
+	        ",\"max_wait_ns\":" + to_string(pool.max_wait_ns) + "}";
+
+	if (wal != nullptr)
+	{
+		WalStats commits = wal->get_stats();
+		json += ",\"wal\":{\"commits\":" + to_string(commits.commits) +
+		        ",\"failed_commits\":" + to_string(commits.failed_commits) +
+		        ",\"records\":" + to_string(commits.committed_records) +
+		        ",\"max_batch_records\":" +
+		        to_string(commits.max_batch_records) +
+		        ",\"max_commit_ns\":" + to_string(commits.max_commit_ns) + "}";
+	}
+
+	json += ",\"requests\":{";
+	bool is_first = true;
+	for (int opcode = OP_NONE; opcode < OPCODES_NUM; opcode++)
+	{
+		RequestMetrics request;
+		metrics->get_requests((size_t) opcode, request);
+		uint64_t requests_num = request.phases[PHASE_EXECUTE].get_count();
+		if (requests_num == 0)
+		{
+			continue;
+		}
+
+		json += (is_first ? "\"" : ",\"") +
+		        string(text_from_opcode((Opcode) opcode)) +
+		        "\":{\"count\":" + to_string(requests_num) +
+		        ",\"errors\":" + to_string(request.errors.get()) +
+		        ",\"parse\":" + request.phases[PHASE_PARSE].to_json() +
+		        ",\"execute\":" + request.phases[PHASE_EXECUTE].to_json() +
+		        ",\"send\":" + request.phases[PHASE_SEND].to_json() + "}";
+		is_first = false;
+	}
+	json += "}";
+
+	if (lock_profile)
+	{
+		json += ",\"locks\":" + lock_profile_json();
+	}
+	json += "}";
+	return json;
+}
+
+/**
+ * Parse the event id given by a request's argument. Returns false, and leaves
+ * event_id as it is, if it is not a number which may be an id.
+ */
+bool parse_event_id(StrRef id_arg, int& event_id)
+{
+	long id;
+	if (!ref_to_long(id_arg, id) || id < FIRST_EVENT_ID || id > INT_MAX)
+	{
+		return false;
+	}
+
+	event_id = (int) id;
+	return true;
+}
+
+/**
+ * Record a request to the metrics of its command: it was parsed from start_ns
+ * to parsed_ns, and executed until now. Its reply is an error if the command
+ * is unknown. The worker times the sending of the reply from now on. Both
+ * phases are spans of the request, if it is traced.
+ */
+void record_request(Opcode command, uint64_t start_ns, uint64_t parsed_ns,
+                    const string& reply)
+{
+	request_opcode = command;
+	request_executed_ns = monotonic_ns();
+
+	bool is_error = command == OP_NONE ||
+	                (reply.length() == 1 && reply[0] == ERROR_IN_REQUEST);
+	metrics->record_request(command, parsed_ns - start_ns,
+	                        request_executed_ns - parsed_ns, is_error);
+
+	if (is_tracing.load(memory_order_relaxed))
+	{
+		trace_span(TRACE_PARSE_SPAN, start_ns, parsed_ns);
+		trace_span(text_from_opcode(command), parsed_ns, request_executed_ns);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Parse a command and execute it. The reply to send back is put in
+ * out_message.
+ * The request is parsed in place: its tokens are views into msg_to_parse, and
+ * strings are only made of them when they are stored or logged.
+ */
+int parse_command_and_execute(const string& msg_to_parse, string& out_message)
+{
+	out_message.clear();
+	uint64_t start_ns = monotonic_ns();
+
+	// name, command, and up to three arguments, the last one of which (an
+	// event's description) may contain delimiters
+	StrRef split_msg[MAX_REQUEST_TOKENS];
+	size_t tokens_num = tokenize(make_ref(msg_to_parse), STRING_DELIMITER,
+	                             split_msg, MAX_REQUEST_TOKENS);
+
+	if (tokens_num <= COMMAND_SPLIT_MSG_INDEX_SERVER)
+	{
+		out_message += ERROR_IN_REQUEST;
+		server_log->write_to_log("ERROR\tparse_command_and_execute\t"
+		                         "malformed request.\n");
+		record_request(OP_NONE, start_ns, monotonic_ns(), out_message);
+		return SUCCESS;
+	}
+
+	// extract name and command
+	StrRef client_name = split_msg[CLIENT_NAME_SPLIT_MSG_INDEX];
+	Opcode command = opcode_from_ref(split_msg[COMMAND_SPLIT_MSG_INDEX_SERVER]);
+
+	// the first argument, if any
+	StrRef argument = tokens_num > GET_RSVP_ID + ARG_OFFSET ?
+	                  split_msg[GET_RSVP_ID + ARG_OFFSET] : make_ref(EMPTY_STR);
+	uint64_t parsed_ns = monotonic_ns();
+
+	switch (command)
+	{
+	////////////////////////////////////////////////////////////////////////////
+	// REGISTER
+	////////////////////////////////////////////////////////////////////////////
+	case OP_REGISTER:
+		if (create_client(client_name))
+		{
+			// registered successfully
+			out_message += REQUEST_OK;
+		}
+		else
+		{
+			// client already registered
+			out_message += ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR: " + ref_to_string(client_name) +
+			                         "\tis already exists.\n");
+		}
+		break;
+
+	////////////////////////////////////////////////////////////////////////////
+	// UNREGISTER
+	////////////////////////////////////////////////////////////////////////////
+	case OP_UNREGISTER:
+		if (is_client_registered(client_name, true))
+		{
+			out_message += REQUEST_OK;
+		}
+		else
+		{
+			// Given client does't exist among registered users.
+			out_message += ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR: " + ref_to_string(client_name) +
+			                         "\tdoes not exist.\n");
+		}
+		break;
+
+	////////////////////////////////////////////////////////////////////////////
+	// CREATE
+	////////////////////////////////////////////////////////////////////////////
+	case OP_CREATE:
+	{
+		if (tokens_num <= EVENT_DATE_ARG + ARG_OFFSET)
+		{
+			out_message += ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\t"
+			                         "malformed request.\n");
+			break;
+		}
+
+		// Offset of one since we've sent, in addition, client's name.
+		int new_id = create_event(client_name,
+		                          split_msg[EVENT_TITLE_ARG + ARG_OFFSET],
+		                          split_msg[EVENT_DATE_ARG + ARG_OFFSET],
+		                          tokens_num > DESC_IDX ? split_msg[DESC_IDX] :
+		                                                  make_ref(EMPTY_STR));
+
+		// return to client the corresponding string
+		if (new_id == FAILURE)
+		{
+			out_message = ERROR_IN_REQUEST;
+		}
+		else
+		{
+			out_message = std::to_string(new_id);
+		}
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// GET_TOP_5
+	////////////////////////////////////////////////////////////////////////////
+	case OP_GET_TOP_5:
+		server_log->write_to_log(ref_to_string(client_name) +
+		                         "\trequests the top 5 newest events.\n");
+
+		out_message = top_events_reply(FIVE_CLIENTS);
+		break;
+
+	////////////////////////////////////////////////////////////////////////////
+	// GET_TOP_N
+	////////////////////////////////////////////////////////////////////////////
+	case OP_GET_TOP_N:
+	{
+		// the value is clamped, so a huge N is simply capped below
+		long requested;
+		if (!ref_to_long(argument, requested) || requested <= 0)
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\t" +
+			                         ref_to_string(client_name) +
+			                         " sent an invalid N.\n");
+			break;
+		}
+
+		// up to top_n_cap events are listed
+		size_t top_n = (size_t) min(requested, (long) top_n_cap);
+		server_log->write_to_log(ref_to_string(client_name) + \
+		                         "\trequests the top " + \
+		                         to_string(top_n) + " newest events.\n");
+
+		out_message = top_events_reply(top_n);
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// SEND_RSVP
+	////////////////////////////////////////////////////////////////////////////
+	case OP_SEND_RSVP:
+	{
+		Client* client_in_list = nullptr;
+
+		bool found_event = false;
+		bool found_in_RSVP = false;
+		bool found_client = true;
+
+		// no event has the id 0, which stands for an argument which is not one
+		int event_id = 0;
+		parse_event_id(argument, event_id);
+
+		// the client's shard before the event's, as in delete_client
+		ClientShard& client_shard = client_shard_of(client_name);
+		EventShard& event_shard = event_shard_of(event_id);
+		client_shard.lock.write_lock(__func__);
+		client_in_list = find_client(client_name);
+
+		event_shard.lock.write_lock(__func__);
+		Event* event = find_event(event_id);
+		if (event != nullptr)
+		{
+			found_event = true;
+
+			// e.g. its REGISTER was refused since the server was busy
+			if (client_in_list == nullptr)
+			{
+				found_client = false;
+				out_message = ERROR_IN_REQUEST;
+			}
+			else
+			{
+				// Check if client is already RSVP, or add it.
+				found_in_RSVP = !add_rsvp(event, client_in_list);
+				out_message = found_in_RSVP ? REQUEST_OK_BUT_PLUS : REQUEST_OK;
+				if (!found_in_RSVP)
+				{
+					log_rsvp(event, client_in_list);
+				}
+			}
+		}
+		event_shard.lock.unlock();
+		client_shard.lock.unlock();
+
+		// Event for given id was not found.
+		if (!found_event)
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\tevent "
+											 "with given id does not exist.\n");
+		}
+		else if (!found_client)
+		{
+			server_log->write_to_log("ERROR\tparse_command_and_execute\t" +
+			                         ref_to_string(client_name) +
+			                         " is not registered.\n");
+		}
+		else
+		{
+			server_log->write_to_log(ref_to_string(client_name) + "\tis RSVP "
+									 "to event with id " +
+									 ref_to_string(argument) + ".\n");
+		}
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// GET_RSVPS_LIST
+	////////////////////////////////////////////////////////////////////////////
+	case OP_GET_RSVPS_LIST:
+	{
+		string ready_name_list = EMPTY_STR;
+
+		// no event has the id 0, which stands for an argument which is not one
+		int event_id = 0;
+		parse_event_id(argument, event_id);
+
+		// A page of the names is listed, by name: without a page size, the
+		// first MAX_RSVPS_PAGE of them, which are the whole list unless a
+		// next page line follows them
+		StrRef page_ref = tokens_num > RSVPS_PAGE_ARG + ARG_OFFSET ?
+		                  split_msg[RSVPS_PAGE_ARG + ARG_OFFSET] :
+		                  make_ref(EMPTY_STR);
+		StrRef token = tokens_num > RSVPS_TOKEN_ARG + ARG_OFFSET ?
+		               split_msg[RSVPS_TOKEN_ARG + ARG_OFFSET] :
+		               make_ref(EMPTY_STR);
+		long page_size = MAX_RSVPS_PAGE;
+		Cursor after;
+		bool has_cursor = false;
+		if (!parse_page_options(page_ref, token, CURSOR_RSVPS, page_size,
+		                        after, has_cursor) ||
+		    (has_cursor && after.event_id != event_id))
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\t" +
+			                         ref_to_string(client_name) +
+			                         " sent an invalid page of RSVPs.\n");
+			break;
+		}
+
+		// the names are listed without the event's shard
+		bool found_event =
+				rsvps_page_reply(event_id, after.name,
+				                 (size_t) min(page_size, (long) MAX_RSVPS_PAGE),
+				                 ready_name_list);
+
+		// Event for given id was not found.
+		if (!found_event)
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\tevent "
+											 "with given id does not exist.\n");
+		}
+		else
+		{
+			out_message.swap(ready_name_list);
+			server_log->write_to_log(ref_to_string(client_name) +
+			                         "\trequests the RSVP’s list for event "
+			                         "with id " + ref_to_string(argument) +
+			                         ".\n");
+		}
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// GET_EVENTS_RANGE
+	////////////////////////////////////////////////////////////////////////////
+	case OP_GET_EVENTS_RANGE:
+	{
+		// the limit and the continuation token are in the last token
+		StrRef options[RANGE_TOKEN_ARG - RANGE_LIMIT_ARG + 1] =
+				{make_ref(EMPTY_STR), make_ref(EMPTY_STR)};
+		if (tokens_num > RANGE_LIMIT_ARG + ARG_OFFSET)
+		{
+			tokenize(split_msg[RANGE_LIMIT_ARG + ARG_OFFSET],
+			         STRING_DELIMITER, options,
+			         RANGE_TOKEN_ARG - RANGE_LIMIT_ARG + 1);
+		}
+
+		uint32_t from_key, to_key;
+		long limit = DEFAULT_RANGE_LIMIT;
+		Cursor after;
+		bool has_cursor = false;
+		if (tokens_num <= RANGE_TO_ARG + ARG_OFFSET ||
+		    !parse_date_key(split_msg[RANGE_FROM_ARG + ARG_OFFSET],
+		                    from_key) ||
+		    !parse_date_key(split_msg[RANGE_TO_ARG + ARG_OFFSET], to_key) ||
+		    !parse_page_options(options[0], options[1], CURSOR_RANGE, limit,
+		                        after, has_cursor))
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\t" +
+			                         ref_to_string(client_name) +
+			                         " sent an invalid range of events.\n");
+			break;
+		}
+
+		// the limit is clamped, as GET_TOP_N's N is
+		events_range_reply(split_msg[RANGE_FROM_ARG + ARG_OFFSET], from_key,
+		                   split_msg[RANGE_TO_ARG + ARG_OFFSET], to_key,
+		                   (size_t) min(limit, (long) MAX_RANGE_LIMIT),
+		                   has_cursor ? &after : nullptr, out_message);
+
+		server_log->write_to_log(ref_to_string(client_name) + \
+		                         "\trequests the events from " + \
+		                         ref_to_string(argument) + " to " + \
+		                         ref_to_string(split_msg[RANGE_TO_ARG +
+		                                                 ARG_OFFSET]) + \
+		                         ".\n");
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// GET_EVENTS
+	////////////////////////////////////////////////////////////////////////////
+	case OP_GET_EVENTS:
+	{
+		StrRef page_ref = tokens_num > EVENTS_PAGE_ARG + ARG_OFFSET ?
+		                  split_msg[EVENTS_PAGE_ARG + ARG_OFFSET] :
+		                  make_ref(EMPTY_STR);
+		StrRef token = tokens_num > EVENTS_TOKEN_ARG + ARG_OFFSET ?
+		               split_msg[EVENTS_TOKEN_ARG + ARG_OFFSET] :
+		               make_ref(EMPTY_STR);
+		long page_size = DEFAULT_EVENTS_PAGE;
+		Cursor before;
+		bool has_cursor = false;
+		if (!parse_page_options(page_ref, token, CURSOR_EVENTS, page_size,
+		                        before, has_cursor))
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\t" +
+			                         ref_to_string(client_name) +
+			                         " sent an invalid page of events.\n");
+			break;
+		}
+
+		events_page_reply((size_t) min(page_size, (long) MAX_EVENTS_PAGE),
+		                  has_cursor ? &before : nullptr, out_message);
+		server_log->write_to_log(ref_to_string(client_name) + \
+		                         "\trequests a page of the events.\n");
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// SUBSCRIBE, UNSUBSCRIBE
+	////////////////////////////////////////////////////////////////////////////
+	case OP_SUBSCRIBE:
+	case OP_UNSUBSCRIBE:
+	{
+		// the worker changes the subscription of the connection
+		if (!is_client_registered(client_name, false))
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR: " + ref_to_string(client_name) +
+			                         "\tdoes not exist.\n");
+			break;
+		}
+
+		bool is_subscribe = command == OP_SUBSCRIBE;
+		request_subscription = is_subscribe ? SUBSCRIPTION_STARTED :
+		                                      SUBSCRIPTION_ENDED;
+		out_message = REQUEST_OK;
+		server_log->write_to_log(ref_to_string(client_name) + \
+		                         (is_subscribe ? "\tsubscribes to" :
+		                                         "\tunsubscribes from") + \
+		                         " new events.\n");
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// SEARCH
+	////////////////////////////////////////////////////////////////////////////
+	case OP_SEARCH:
+	{
+		// the query is the rest of the request
+		StrRef query = make_ref(EMPTY_STR);
+		if (tokens_num > GET_RSVP_ID + ARG_OFFSET)
+		{
+			query = make_ref(argument.data, msg_to_parse.data() +
+			                 msg_to_parse.length() - argument.data);
+		}
+
+		if (!search_reply(query, out_message))
+		{
+			out_message = ERROR_IN_REQUEST;
+			server_log->write_to_log("ERROR\tparse_command_and_execute\t" +
+			                         ref_to_string(client_name) +
+			                         " sent a too broad search.\n");
+			break;
+		}
+
+		server_log->write_to_log(ref_to_string(client_name) + \
+		                         "\tsearches for " + ref_to_string(query) + \
+		                         ".\n");
+		break;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// STATS
+	////////////////////////////////////////////////////////////////////////////
+	case OP_STATS:
+		out_message = stats_json();
+		server_log->write_to_log(ref_to_string(client_name) + \
+		                         "\trequests the stats.\n");
+		break;
+
+	default:
+		break;
+	}
+
+	record_request(command, start_ns, parsed_ns, out_message);
+	return SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+//==============================================================================
+//============================== PERSISTENCE ===================================
+//==============================================================================
+// The store is rebuilt on startup from the snapshot, followed by the
+// generations of the write-ahead log it does not cover. A snapshot is written
+// by a child process, forked while all the store's locks are held: it sees the
+// store as it was at that moment, and the log is rotated to a new generation
+// before the locks are released. Requests are only held back for the fork.
+
+/**
+ * Apply a record of a snapshot or of the write-ahead log to the store. arg
+ * points to the last generation the snapshot covers, which a RECORD_SNAPSHOT
+ * record sets. Runs before any other thread, while the store is rebuilt.
+ */
+void apply_record(const StoreRecord& record, void* arg)
+{
+	switch (record.type)
+	{
+	case RECORD_SNAPSHOT:
+		*(uint64_t*) arg = record.generation;
+		break;
+
+	case RECORD_REGISTER:
+		if (find_client(make_ref(record.name)) == nullptr)
+		{
+			insert_client(record.name);
+		}
+		break;
+
+	case RECORD_UNREGISTER:
+	{
+		Client* client = find_client(make_ref(record.name));
+		if (client != nullptr)
+		{
+			erase_client(client);
+		}
+		break;
+	}
+
+	case RECORD_CREATE:
+	{
+		// ids are assigned in order, so a record out of it is a stale one
+		if ((int) record.event_id != avaliable_id ||
+		    events_num.load() == (size_t) MAX_EVENT_CHUNKS * EVENT_CHUNK_SIZE)
+		{
+			break;
+		}
+		Event* new_event = event_pool.allocate();
+		new_event->event_id = avaliable_id;
+		avaliable_id++;
+		set_event_text(new_event, make_ref(record.title), make_ref(record.date),
+		               make_ref(record.description));
+		append_event(new_event);
+		index_event_date(new_event->event_id, new_event->event_date);
+
+		vector<string> terms;
+		get_event_terms(new_event->event_title, new_event->event_description,
+		                terms);
+		search_index.add(new_event->event_id, terms);
+		break;
+	}
+
+	case RECORD_RSVP:
+	{
+		Event* event = find_event((int) record.event_id);
+		Client* client = find_client(make_ref(record.name));
+		if (event != nullptr && client != nullptr)
+		{
+			add_rsvp(event, client);
+		}
+		break;
+	}
+	}
+}
+
+/**
+ * Rebuild the store from a snapshot of an older version, a stream of records.
+ * Runs before any other thread.
+ */
+int load_record_snapshot(const string& path, uint64_t& covered_generation)
+{
+	uint64_t records_num, valid_length;
+	bool is_torn;
+
+	if (read_records(path, apply_record, &covered_generation, records_num,
+	                 valid_length, is_torn) == FAILURE)
+	{
+		server_log->write_to_log(sys_call_error("read_records"));
+		return FAILURE;
+	}
+	if (is_torn)
+	{
+		server_log->write_to_log("ERROR\tload_record_snapshot\tthe snapshot " +
+		                         path + " is corrupt.\n");
+		return FAILURE;
+	}
+	server_log->write_to_log("loaded " + to_string(records_num) + \
+	                         " records of the snapshot, which covers the log "
+	                         "up to generation " + \
+	                         to_string(covered_generation) + ".\n");
+	return SUCCESS;
+}
+
+/**
+ * Map the snapshot, if there is one, and register its clients. Its events are
+ * only built once they are accessed, so loading it does not parse or copy
+ * them. Runs before any other thread.
+ */
+int load_snapshot(uint64_t& covered_generation)
+{
+	uint64_t start_ns = monotonic_ns();
+	string path = WriteAheadLog::snapshot_path(data_dir);
+
+	SnapshotReader* snapshot = new SnapshotReader;
+	if (snapshot->open(path) == FAILURE)
+	{
+		int error = errno;
+		delete snapshot;
+		if (error == ENOENT)
+		{
+			return SUCCESS;
+		}
+		if (error == EINVAL)
+		{
+			return load_record_snapshot(path, covered_generation);
+		}
+
+		errno = error;
+		server_log->write_to_log(error == EBADMSG ?
+		                         "ERROR\tload_snapshot\tthe snapshot " + path +
+		                         " is corrupt.\n" :
+		                         sys_call_error("open"));
+		return FAILURE;
+	}
+
+	snapshot_clients.reserve(snapshot->get_clients_num());
+	for (uint32_t i = 0; i < snapshot->get_clients_num(); i++)
+	{
+		const SnapshotClient& stored = snapshot->get_client(i);
+		Client* client = insert_client(
+				string(snapshot->get_text(stored.name_offset),
+				       stored.name_length));
+
+		const uint32_t* rsvps = snapshot->get_client_rsvps(stored);
+		client->RSVP_events.reserve(stored.rsvps_num);
+		for (uint32_t j = 0; j < stored.rsvps_num; j++)
+		{
+			client->RSVP_events.push_back(FIRST_EVENT_ID + (int) rsvps[j]);
+		}
+		snapshot_rsvps_num += stored.rsvps_num;
+		snapshot_clients.push_back(client);
+	}
+
+	if (!grow_event_table(snapshot->get_events_num()))
+	{
+		delete snapshot;
+		server_log->write_to_log("ERROR\tload_snapshot\tthe snapshot " + path +
+		                         " has more events than the table holds.\n");
+		return FAILURE;
+	}
+	avaliable_id = FIRST_EVENT_ID + (int) events_num.load();
+	covered_generation = snapshot->get_generation();
+	loaded_snapshot = snapshot;
+
+	server_log->write_to_log("loaded the snapshot of " + \
+	                         to_string(registered_clients_num()) + \
+	                         " clients and " + to_string(events_num.load()) + \
+	                         " events, which covers the log up to generation " + \
+	                         to_string(covered_generation) + ", in " + \
+	                         to_string((monotonic_ns() - start_ns) / NS_IN_US) + \
+	                         "us.\n");
+	return SUCCESS;
+}
+
+/**
+ * Rebuild the store from the snapshot and the generations of the write-ahead
+ * log it does not cover, and start a new generation. Runs before any other
+ * thread.
+ */
+int recover_store()
+{
+	uint64_t covered_generation = 0;
+	uint64_t records_num, valid_length;
+	bool is_torn;
+
+	if (load_snapshot(covered_generation) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	string path;
+	uint64_t generation = covered_generation + 1;
+	uint64_t replayed = 0;
+	for (;; generation++)
+	{
+		path = WriteAheadLog::generation_path(data_dir, generation);
+		if (read_records(path, apply_record, &covered_generation, records_num,
+		                 valid_length, is_torn) == FAILURE)
+		{
+			if (errno == ENOENT)
+			{
+				break;
+			}
+			server_log->write_to_log(sys_call_error("read_records"));
+			return FAILURE;
+		}
+		replayed += records_num;
+
+		// e.g. the server crashed in the middle of a write
+		if (is_torn)
+		{
+			server_log->write_to_log("ERROR\trecover_store\t" + path + \
+			                         " is torn after " + \
+			                         to_string(valid_length) + \
+			                         " bytes, the rest is dropped.\n");
+			if (truncate(path.c_str(), (off_t) valid_length) < 0)
+			{
+				server_log->write_to_log(sys_call_error("truncate"));
+				return FAILURE;
+			}
+		}
+	}
+	oldest_wal_generation = covered_generation + 1;
+
+	server_log->write_to_log("replayed " + to_string(replayed) + \
+	                         " records of the log: " + \
+	                         to_string(registered_clients_num()) + \
+	                         " clients and " + to_string(events_num.load()) + \
+	                         " events were recovered.\n");
+
+	if (wal->open(generation) == FAILURE)
+	{
+		server_log->write_to_log(sys_call_error("open"));
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/**
+ * Write the store to the snapshot, as covering the log up to generation.
+ * Runs in the child process of take_snapshot, where the store's mutexes are
+ * held by its parent's threads; nothing which takes a lock (e.g. the server's
+ * log) is used.
+ */
+int write_snapshot(uint64_t generation)
+{
+	// the size of the snapshot, and the index of each client in it
+	unordered_map<const Client*, uint32_t> client_indices;
+	uint64_t rsvps_num = 0;
+	uint64_t heap_size = 0;
+	for (auto const& shard: client_shards)
+	{
+		for (auto const& client: shard.clients)
+		{
+			uint32_t index = (uint32_t) client_indices.size();
+			client_indices[client.second] = index;
+			rsvps_num += client.second->RSVP_events.size();
+			heap_size += client.second->name.length();
+		}
+	}
+	size_t num = events_num.load();
+	for (size_t i = 0; i < num; i++)
+	{
+		Event* event = event_slot(i).load();
+		if (event != nullptr)
+		{
+			heap_size += event->event_title.length +
+			             event->event_date.length +
+			             event->event_description.length;
+			continue;
+		}
+		const SnapshotEvent& stored = loaded_snapshot->get_event((uint32_t) i);
+		heap_size += (uint64_t) stored.title_length + stored.date_length +
+		             stored.description_length;
+	}
+
+	SnapshotWriter writer(data_dir);
+	if (writer.open(generation, (uint32_t) client_indices.size(),
+	                (uint32_t) num, rsvps_num, heap_size) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	// in the order the indices were given in
+	for (auto const& shard: client_shards)
+	{
+		for (auto const& client: shard.clients)
+		{
+			const string& name = client.second->name;
+			const vector<int>& rsvps = client.second->RSVP_events;
+			writer.add_client(name.data(), (uint32_t) name.length(),
+			                  (uint32_t) rsvps.size());
+			for (auto const& event_id: rsvps)
+			{
+				writer.add_client_rsvp((uint32_t) (event_id - FIRST_EVENT_ID));
+			}
+		}
+	}
+
+	for (size_t i = 0; i < num; i++)
+	{
+		Event* event = event_slot(i).load();
+		if (event != nullptr)
+		{
+			writer.add_event(event->event_title.data,
+			                 (uint32_t) event->event_title.length,
+			                 event->event_date.data,
+			                 (uint32_t) event->event_date.length,
+			                 event->event_description.data,
+			                 (uint32_t) event->event_description.length,
+			                 (uint32_t) event->RSVP_list.size());
+			for (auto const& client: event->RSVP_list)
+			{
+				writer.add_event_rsvp(client_indices[client]);
+			}
+			continue;
+		}
+
+		// an event which was not accessed is copied from the loaded snapshot
+		const SnapshotEvent& stored = loaded_snapshot->get_event((uint32_t) i);
+		const char* title = loaded_snapshot->get_text(stored.text_offset);
+		const char* date = title + stored.title_length;
+		const char* description = date + stored.date_length;
+		writer.add_event(title, stored.title_length, date, stored.date_length,
+		                 description, stored.description_length,
+		                 stored.rsvps_num);
+
+		const uint32_t* rsvps = loaded_snapshot->get_event_rsvps(stored);
+		for (uint32_t j = 0; j < stored.rsvps_num; j++)
+		{
+			writer.add_event_rsvp(client_indices[snapshot_clients[rsvps[j]]]);
+		}
+	}
+
+	return writer.commit();
+}
+
+/**
+ * Take a snapshot of the store, and delete the generations of the log it
+ * covers.
+ */
+int take_snapshot()
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// Nothing mutates the store, or is appended to the log, until the child
+	// is forked and the log is rotated
+	for (auto& shard: client_shards)
+	{
+		shard.lock.write_lock(__func__);
+	}
+	for (auto& shard: event_shards)
+	{
+		shard.lock.write_lock(__func__);
+	}
+	events_mutex.lock(__func__);
+	uint64_t generation = wal->get_generation();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		_exit(write_snapshot(generation) == SUCCESS ? EXIT_SUCCESS :
+		                                              EXIT_FAILURE);
+	}
+	int rotated = pid > 0 ? wal->rotate() : FAILURE;
+	events_mutex.unlock();
+	for (auto& shard: event_shards)
+	{
+		shard.lock.unlock();
+	}
+	for (auto& shard: client_shards)
+	{
+		shard.lock.unlock();
+	}
+
+	if (pid < 0)
+	{
+		server_log->write_to_log(sys_call_error("fork"));
+		return FAILURE;
+	}
+	if (rotated == FAILURE)
+	{
+		// the snapshot would cover records appended after it was taken
+		server_log->write_to_log(sys_call_error("rotate"));
+		kill(pid, SIGKILL);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+	{
+	}
+	if (rotated == FAILURE)
+	{
+		return FAILURE;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+	{
+		server_log->write_to_log("ERROR\ttake_snapshot\tthe snapshot of "
+		                         "generation " + to_string(generation) + \
+		                         " failed.\n");
+		return FAILURE;
+	}
+
+	for (; oldest_wal_generation <= generation; oldest_wal_generation++)
+	{
+		unlink(WriteAheadLog::generation_path(data_dir,
+		                                      oldest_wal_generation).c_str());
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + \
+	                  (end.tv_nsec - start.tv_nsec) / 1000000;
+	server_log->write_to_log("a snapshot covering the log up to generation " + \
+	                         to_string(generation) + " was taken in " + \
+	                         to_string(elapsed_ms) + "ms.\n");
+	return SUCCESS;
+}
+
+/**
+ * Take a snapshot every snapshot_interval seconds, or once the current
+ * generation of the log grew to SNAPSHOT_WAL_SIZE, if the store changed.
+ */
+void* snapshot_thread_func(void*)
+{
+	time_t last_snapshot = time(nullptr);
+
+	while (!toExit)
+	{
+		sleep(SNAPSHOT_TICK_SECONDS);
+
+		uint64_t wal_size = wal->get_size();
+		if (wal_size > 0 && (wal_size >= SNAPSHOT_WAL_SIZE ||
+		                     time(nullptr) - last_snapshot >=
+		                     snapshot_interval))
+		{
+			take_snapshot();
+			last_snapshot = time(nullptr);
+		}
+	}
+
+	return nullptr;
+}
+
+//==============================================================================
+//================================ REACTOR =====================================
+//==============================================================================
+// Lock order: a reactor's connections_mutex before a connection's mutex. The
+// stores' mutexes are only taken with neither of them held (but a
+// connection's pushes read events, which takes no lock).
+
+/**
+ * Whether too many requests of a connection wait to be executed or committed,
+ * or too many replies wait to be written. The connection's mutex is held.
+ */
+bool is_backlogged(Connection* conn)
+{
+	return conn->requests.size() + (size_t) conn->awaiting_commit >=
+	       MAX_QUEUED_REQUESTS ||
+	       conn->out_buffer.length() - conn->out_offset > MAX_PENDING_OUTPUT;
+}
+
+/**
+ * Queue a frame, with the opcode and the request id of a header. A payload
+ * longer than a frame takes is replaced by ERROR_IN_REQUEST. The connection's
+ * mutex is held.
+ */
+void queue_frame(Connection* conn, FrameHeader header, uint16_t flags,
+                 string& payload)
+{
+	if (payload.length() > MAX_FRAME_PAYLOAD)
+	{
+		server_log->write_to_log("ERROR\tqueue_frame\ta reply of " +
+		                         to_string(payload.length()) + " bytes is "
+		                         "longer than a frame, an error is sent.\n");
+		payload.assign(1, ERROR_IN_REQUEST);
+	}
+
+	header.flags = flags;
+	header.length = (uint32_t) payload.length();
+
+	unsigned char raw_header[FRAME_HEADER_SIZE];
+	encode_frame_header(header, raw_header);
+	conn->out_buffer.append((char*) raw_header, FRAME_HEADER_SIZE);
+	conn->out_buffer += payload;
+}
+
+/**
+ * Queue the reply of a request, in the format the request was sent with. The
+ * connection's mutex is held.
+ */
+void queue_reply(Connection* conn, const Request& request, string& out_message,
+                 uint16_t flags)
+{
+	if (request.is_legacy)
+	{
+		out_message.resize(PROTOCOL_MESSAGE_SIZE - 1, END_STR);
+		conn->out_buffer += out_message;
+		conn->out_buffer += END_STR;
+		return;
+	}
+
+	queue_frame(conn, request.header, flags, out_message);
+}
+
+/**
+ * Queue the pushes of a subscriber's events, once the replies before them
+ * were written. Returns whether there were any. The connection's mutex is
+ * held.
+ */
+bool queue_pushes(Connection* conn)
+{
+	if (conn->pushes.empty())
+	{
+		return false;
+	}
+
+	conn->out_buffer.clear();
+	conn->out_offset = 0;
+	string push;
+	for (auto const& range: conn->pushes)
+	{
+		if (range.first_id == range.last_id)
+		{
+			push = NEW_EVENT_TEXT;
+			append_event_text(push, range.first_id);
+		}
+		else
+		{
+			push = NEW_EVENTS_TEXT + to_string(range.first_id) + " to " + \
+			       to_string(range.last_id) + COALESCED_TEXT ".\n";
+			metrics->add_to_counter(COUNTER_COALESCED_PUSHES, 1);
+		}
+		queue_frame(conn, conn->push_header, FLAG_PUSH, push);
+	}
+	metrics->add_to_counter(COUNTER_PUSHES, conn->pushes.size());
+	conn->pushes.clear();
+	return true;
+}
+
+/**
+ * Add the events from first_id to last_id to the pushes of a subscriber. When
+ * they do not fit in its queue, the queue is coalesced into a single range,
+ * which takes the events created until the subscriber catches up. The
+ * connection's mutex is held.
+ */
+void add_pushes(Connection* conn, int first_id, int last_id)
+{
+	deque<PushRange>& pushes = conn->pushes;
+	if (!pushes.empty() && pushes.back().first_id < pushes.back().last_id)
+	{
+		pushes.back().last_id = last_id;
+		return;
+	}
+
+	if (pushes.size() + (size_t) (last_id - first_id) < SUBSCRIBER_QUEUE_SIZE)
+	{
+		for (int event_id = first_id; event_id <= last_id; event_id++)
+		{
+			pushes.push_back({event_id, event_id});
+		}
+		return;
+	}
+
+	PushRange coalesced = {pushes.empty() ? first_id : pushes.front().first_id,
+	                       last_id};
+	pushes.clear();
+	pushes.push_back(coalesced);
+}
+
+/**
+ * Refuse a request since the server is overloaded. The connection's mutex is
+ * held.
+ */
+void queue_overload_reply(Connection* conn, const Request& request)
+{
+	string out_message = request.is_legacy ? string(1, ERROR_IN_REQUEST) :
+	                     string(OVERLOADED_TEXT);
+	queue_reply(conn, request, out_message, FLAG_OVERLOADED);
+	metrics->add_to_counter(COUNTER_OVERLOADED, 1);
+
+	server_log->write_to_log("ERROR\tsubmit_request\tserver is overloaded, "
+	                         "request refused.\n");
+}
+
+/**
+ * Write as much of the queued replies as the connection accepts. The rest is
+ * written when the connection becomes writable again. The connection's mutex
+ * is held.
+ */
+int flush_connection(Connection* conn)
+{
+	while (conn->out_offset < conn->out_buffer.length() || queue_pushes(conn))
+	{
+		ssize_t bytes_written = write(conn->fd,
+		                              conn->out_buffer.data() + conn->out_offset,
+		                              conn->out_buffer.length() -
+		                              conn->out_offset);
+		if (bytes_written > 0)
+		{
+			conn->out_offset += (size_t) bytes_written;
+			continue;
+		}
+
+		if (bytes_written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (bytes_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			return SUCCESS;
+		}
+
+		server_log->write_to_log(sys_call_error("write"));
+		return FAILURE;
+	}
+
+	conn->out_buffer.clear();
+	conn->out_offset = 0;
+	return SUCCESS;
+}
+
+/**
+ * Drop a reference to a connection. The last one closes its socket (only then,
+ * so that its descriptor can't be reused while a worker writes to it).
+ */
+void release_connection(Connection* conn)
+{
+	pthread_mutex_lock(&conn->mutex);
+	bool is_last = (--conn->refs == 0);
+	pthread_mutex_unlock(&conn->mutex);
+
+	if (is_last)
+	{
+		close(conn->fd);
+		pthread_mutex_destroy(&conn->mutex);
+		delete conn;
+	}
+}
+
+/**
+ * Make the reactor of a connection serve it again, even if no new data
+ * arrived (e.g. to resume reading, or to close it).
+ */
+void wake_reactor(Connection* conn)
+{
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = conn;
+
+	// modifying an edge triggered descriptor reports its current readiness
+	epoll_ctl(conn->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+/**
+ * Subscribe a connection to new events: the events created from now on are
+ * pushed to it, with the request id of the SUBSCRIBE request.
+ */
+void subscribe(Connection* conn, const Request& request)
+{
+	subscribers_mutex.lock(__func__);
+	pthread_mutex_lock(&conn->mutex);
+	bool is_new = !conn->subscribed && !conn->closed;
+	if (is_new)
+	{
+		conn->subscribed = true;
+		conn->push_header = request.header;
+		conn->refs++;
+	}
+	pthread_mutex_unlock(&conn->mutex);
+
+	if (is_new)
+	{
+		subscribers.push_back(conn);
+		subscribers_num.store(subscribers.size(), memory_order_relaxed);
+	}
+	subscribers_mutex.unlock();
+}
+
+/**
+ * End the subscription of a connection, if it has one. The events which were
+ * not written yet are dropped.
+ */
+void unsubscribe(Connection* conn)
+{
+	subscribers_mutex.lock(__func__);
+	pthread_mutex_lock(&conn->mutex);
+	bool was_subscribed = conn->subscribed;
+	conn->subscribed = false;
+	conn->pushes.clear();
+	pthread_mutex_unlock(&conn->mutex);
+
+	if (was_subscribed)
+	{
+		subscribers.erase(find(subscribers.begin(), subscribers.end(), conn));
+		subscribers_num.store(subscribers.size(), memory_order_relaxed);
+	}
+	subscribers_mutex.unlock();
+
+	if (was_subscribed)
+	{
+		release_connection(conn);
+	}
+}
+
+/**
+ * This function pushes new events to the subscribers: once events were
+ * created, it queues them to every subscriber and writes what each one
+ * accepts without blocking. A subscriber whose socket is full is written to
+ * by its reactor once it is writable again, and meanwhile its queue is
+ * coalesced, so a slow subscriber neither holds back the others nor grows
+ * without bound.
+ */
+void* notifier_thread_func(void*)
+{
+	subscribers_mutex.lock(__func__);
+	notified_event_id = FIRST_EVENT_ID - 1 +
+	                    (int) events_num.load(memory_order_acquire);
+
+	while (!toExit)
+	{
+		int newest_id = FIRST_EVENT_ID - 1 +
+		                (int) events_num.load(memory_order_acquire);
+		if (newest_id == notified_event_id)
+		{
+			timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += REACTOR_TICK_MS * 1000000L;
+			deadline.tv_sec += deadline.tv_nsec / (long) NS_IN_SECOND;
+			deadline.tv_nsec %= (long) NS_IN_SECOND;
+			subscribers_mutex.timed_wait(events_created, deadline,
+			                             __func__);
+			continue;
+		}
+
+		for (auto const& conn: subscribers)
+		{
+			pthread_mutex_lock(&conn->mutex);
+			add_pushes(conn, notified_event_id + 1, newest_id);
+			bool is_broken = !conn->closed && flush_connection(conn) == FAILURE;
+			if (is_broken)
+			{
+				conn->broken = true;
+			}
+			// the reactor closes the connection
+			bool wake = is_broken && !conn->scheduled;
+			pthread_mutex_unlock(&conn->mutex);
+
+			if (wake)
+			{
+				wake_reactor(conn);
+			}
+		}
+		notified_event_id = newest_id;
+	}
+
+	subscribers_mutex.unlock();
+	return nullptr;
+}
+
+/**
+ * Hold back the reply of a request until its mutation is committed to the
+ * write-ahead log (DURABILITY_BATCHED). A reply which follows a held back
+ * reply on the same connection is held back as well, so that replies keep the
+ * order of their requests. Returns whether the reply was held back.
+ */
+bool defer_reply(Connection* conn, const Request& request, string& reply)
+{
+	if (wal == nullptr || durability != DURABILITY_BATCHED)
+	{
+		return false;
+	}
+
+	// the committer reports a commit with deferred_replies_mutex held, so a
+	// reply is either found committed here, or found by the report
+	deferred_replies_mutex.lock(__func__);
+	pthread_mutex_lock(&conn->mutex);
+	bool to_defer = conn->awaiting_commit > 0 ||
+	                request_commit_lsn > wal->get_durable_lsn();
+	if (to_defer)
+	{
+		conn->commit_lsn = max(conn->commit_lsn, request_commit_lsn);
+		conn->awaiting_commit++;
+		conn->refs++;
+		deferred_replies.push_back({conn, request, std::move(reply),
+		                            conn->commit_lsn, request_commit_lsn,
+		                            {request_opcode, request_executed_ns}});
+	}
+	pthread_mutex_unlock(&conn->mutex);
+	deferred_replies_mutex.unlock();
+
+	// a record fails before the durable LSN passes it
+	if (!to_defer && request_commit_lsn != 0 &&
+	    wal->is_failed(request_commit_lsn))
+	{
+		reply = ERROR_IN_REQUEST;
+	}
+	return to_defer;
+}
+
+/**
+ * Called by the committer of the write-ahead log once it is settled up to
+ * durable_lsn: write the replies which waited for it, as errors if their
+ * records failed.
+ */
+void on_wal_commit(uint64_t durable_lsn)
+{
+	vector<Connection*> committed_connections;
+	vector<ReplyTiming> timings;
+
+	deferred_replies_mutex.lock(__func__);
+	auto it = deferred_replies.begin();
+	while (it != deferred_replies.end())
+	{
+		if (it->lsn > durable_lsn)
+		{
+			++it;
+			continue;
+		}
+
+		if (it->record_lsn != 0 && wal->is_failed(it->record_lsn))
+		{
+			it->reply = ERROR_IN_REQUEST;
+		}
+
+		Connection* conn = it->conn;
+		pthread_mutex_lock(&conn->mutex);
+		if (!conn->closed)
+		{
+			queue_reply(conn, it->request, it->reply, NO_FLAGS);
+		}
+		conn->awaiting_commit--;
+		pthread_mutex_unlock(&conn->mutex);
+
+		committed_connections.push_back(conn);
+		timings.push_back(it->timing);
+		it = deferred_replies.erase(it);
+	}
+	deferred_replies_mutex.unlock();
+
+	for (size_t i = 0; i < committed_connections.size(); i++)
+	{
+		Connection* conn = committed_connections[i];
+		pthread_mutex_lock(&conn->mutex);
+		if (!conn->closed && flush_connection(conn) == FAILURE)
+		{
+			conn->broken = true;
+		}
+		metrics->record_send(timings[i].opcode,
+		                     monotonic_ns() - timings[i].ready_ns);
+
+		// as after a worker's batch, the reactor may wait for the replies
+		bool wake = !conn->closed && conn->awaiting_commit == 0 &&
+		            !conn->scheduled &&
+		            ((conn->read_paused && !is_backlogged(conn)) ||
+		             conn->closing || conn->broken);
+		pthread_mutex_unlock(&conn->mutex);
+
+		if (wake)
+		{
+			wake_reactor(conn);
+		}
+		release_connection(conn);
+	}
+}
+
+/**
+ * Execute a batch of a connection's queued requests in order, and write their
+ * replies. Returns true if more requests are queued, and the connection is
+ * still scheduled; otherwise the worker's reference to it is released.
+ */
+bool execute_batch(Connection* conn)
+{
+	string out_message;
+	int executed = 0;
+	// the replies of the batch which are written by the worker
+	ReplyTiming timings[WORKER_BATCH_SIZE];
+	int queued = 0;
+	// the last traced request of the batch, which writing the replies is a
+	// span of
+	uint64_t batch_trace_id = 0;
+
+	pthread_mutex_lock(&conn->mutex);
+	while (!conn->requests.empty() && !conn->closed &&
+	       executed < WORKER_BATCH_SIZE)
+	{
+		Request request = std::move(conn->requests.front());
+		conn->requests.pop_front();
+		pthread_mutex_unlock(&conn->mutex);
+
+		TracedRequest traced(request.trace_id);
+		if (request.trace_id != 0)
+		{
+			trace_async_span(TRACE_QUEUED_SPAN, request.trace_id,
+			                 request.received_ns, monotonic_ns());
+			batch_trace_id = request.trace_id;
+		}
+
+		// parse command and execute
+		request_commit_lsn = 0;
+		request_commit_failed = false;
+		if (parse_command_and_execute(request.message, out_message) == ERROR)
+		{
+			free_allocated_memory();
+
+			delete server_log;
+			exit(ERROR);
+		}
+		executed++;
+
+		// the mutation was applied, but it would not survive a restart
+		if (request_commit_failed)
+		{
+			out_message = ERROR_IN_REQUEST;
+		}
+
+		// only a framed session can be pushed to
+		SubscriptionChange subscription = request_subscription;
+		request_subscription = SUBSCRIPTION_KEPT;
+		if (subscription != SUBSCRIPTION_KEPT && request.is_legacy)
+		{
+			out_message = ERROR_IN_REQUEST;
+			subscription = SUBSCRIPTION_KEPT;
+		}
+
+		bool is_deferred = defer_reply(conn, request, out_message);
+
+		pthread_mutex_lock(&conn->mutex);
+		if (!is_deferred)
+		{
+			queue_reply(conn, request, out_message, NO_FLAGS);
+			timings[queued++] = {request_opcode, request_executed_ns};
+		}
+
+		// the pushes follow the reply
+		if (subscription != SUBSCRIPTION_KEPT)
+		{
+			pthread_mutex_unlock(&conn->mutex);
+			if (subscription == SUBSCRIPTION_STARTED)
+			{
+				subscribe(conn, request);
+			}
+			else
+			{
+				unsubscribe(conn);
+			}
+			pthread_mutex_lock(&conn->mutex);
+		}
+	}
+
+	if (!conn->closed)
+	{
+		TracedRequest traced(batch_trace_id);
+		TraceScope writing(TRACE_SOCKET_WRITE_SPAN);
+		if (flush_connection(conn) == FAILURE)
+		{
+			conn->broken = true;
+		}
+	}
+
+	// the replies of a batch are written together, after its last request
+	uint64_t sent_ns = monotonic_ns();
+	for (int i = 0; i < queued; i++)
+	{
+		metrics->record_send(timings[i].opcode, sent_ns - timings[i].ready_ns);
+	}
+
+	bool has_more = !conn->requests.empty() && !conn->closed;
+	conn->scheduled = has_more;
+	conn->last_active = time(NULL);
+
+	// the reactor waits for the worker to resume reading, or to close
+	bool wake = !conn->closed && !has_more &&
+	            ((conn->read_paused && !is_backlogged(conn)) ||
+	             conn->closing || conn->broken);
+	pthread_mutex_unlock(&conn->mutex);
+
+	if (has_more)
+	{
+		return true;
+	}
+
+	if (wake)
+	{
+		wake_reactor(conn);
+	}
+
+	release_connection(conn);
+	return false;
+}
+
+/**
+ * The task a worker runs for a connection: execute its queued requests a
+ * batch at a time, so that other connections get their turn.
+ */
+void connection_task(void* args)
+{
+	Connection* conn = (Connection*) args;
+	while (execute_batch(conn))
+	{
+		// requeue the connection, unless the queue is full
+		if (worker_pool->try_submit(connection_task, conn))
+		{
+			return;
+		}
+	}
+}
+
+/**
+ * Hand a complete request to the workers. The connection is queued to the
+ * workers unless it already is; a request which can't be queued is refused
+ * with an overload error.
+ */
+void submit_request(Connection* conn, Request& request)
+{
+	pthread_mutex_lock(&conn->mutex);
+	if (conn->requests.size() >= MAX_QUEUED_REQUESTS)
+	{
+		queue_overload_reply(conn, request);
+		pthread_mutex_unlock(&conn->mutex);
+		return;
+	}
+
+	conn->requests.push_back(std::move(request));
+	bool to_schedule = !conn->scheduled;
+	if (to_schedule)
+	{
+		conn->scheduled = true;
+		conn->refs++;
+	}
+	pthread_mutex_unlock(&conn->mutex);
+
+	if (!to_schedule || worker_pool->try_submit(connection_task, conn))
+	{
+		return;
+	}
+
+	// the work queue is full: refuse the requests of the connection
+	pthread_mutex_lock(&conn->mutex);
+	while (!conn->requests.empty())
+	{
+		queue_overload_reply(conn, conn->requests.front());
+		conn->requests.pop_front();
+	}
+	conn->scheduled = false;
+	conn->refs--;
+	pthread_mutex_unlock(&conn->mutex);
+}
+
+/**
+ * Decide whether a request which was just received is traced.
+ */
+void sample_request(Request& request)
+{
+	request.trace_id = trace_sample();
+	request.received_ns = request.trace_id == 0 ? 0 : monotonic_ns();
+}
+
+/**
+ * Hand the requests which were completely received on a connection to the
+ * workers. The connection moves between its states as headers and payloads
+ * arrive.
+ */
+int handle_requests(Connection* conn)
+{
+	size_t handled = 0;
+	Request request;
+
+	while (true)
+	{
+		const char* data = conn->in_buffer.data() + handled;
+		size_t available = conn->in_buffer.length() - handled;
+
+		if (conn->state == AWAITING_HEADER)
+		{
+			if (available < FRAME_HEADER_SIZE)
+			{
+				break;
+			}
+
+			// the first byte of the header tells whether the message is framed
+			conn->header = decode_frame_header((const unsigned char*) data);
+			if (conn->header.magic == FRAME_MAGIC)
+			{
+				if (conn->header.length > MAX_REQUEST_PAYLOAD)
+				{
+					server_log->write_to_log("ERROR\thandle_requests\t"
+					                         "request is too long.\n");
+					return FAILURE;
+				}
+				handled += FRAME_HEADER_SIZE;
+				conn->state = AWAITING_PAYLOAD;
+			}
+			else if (accept_legacy && conn->first_request)
+			{
+				conn->state = AWAITING_LEGACY;
+			}
+			else
+			{
+				server_log->write_to_log("ERROR\thandle_requests\tunexpected "
+				                         "legacy request refused.\n");
+				return FAILURE;
+			}
+			conn->first_request = false;
+		}
+		else if (conn->state == AWAITING_PAYLOAD)
+		{
+			if (available < conn->header.length)
+			{
+				break;
+			}
+
+			request.message.assign(data, conn->header.length);
+			request.header = conn->header;
+			request.is_legacy = false;
+			sample_request(request);
+			handled += conn->header.length;
+			conn->state = AWAITING_HEADER;
+
+			submit_request(conn, request);
+		}
+		else
+		{
+			if (available < PROTOCOL_MESSAGE_SIZE)
+			{
+				break;
+			}
+
+			request.message.assign(data, strnlen(data, PROTOCOL_MESSAGE_SIZE));
+			request.header = conn->header;
+			request.is_legacy = true;
+			sample_request(request);
+			handled += PROTOCOL_MESSAGE_SIZE;
+
+			// a legacy client expects the connection to be closed
+			pthread_mutex_lock(&conn->mutex);
+			conn->closing = true;
+			pthread_mutex_unlock(&conn->mutex);
+
+			submit_request(conn, request);
+			break;
+		}
+	}
+
+	conn->in_buffer.erase(0, handled);
+	return SUCCESS;
+}
+
+/**
+ * Read everything available on a connection, handing requests to the workers
+ * as they complete. Reading pauses while the connection is backlogged.
+ */
+int handle_readable(Connection* conn, char* chunk)
+{
+	while (true)
+	{
+		pthread_mutex_lock(&conn->mutex);
+		bool is_closing = conn->closing;
+		conn->read_paused = !is_closing && is_backlogged(conn);
+		bool is_paused = conn->read_paused;
+		pthread_mutex_unlock(&conn->mutex);
+
+		if (is_closing || is_paused)
+		{
+			break;
+		}
+
+		ssize_t bytes_read = read(conn->fd, chunk, READ_CHUNK_SIZE);
+		if (bytes_read > 0)
+		{
+			conn->in_buffer.append(chunk, (size_t) bytes_read);
+			if (handle_requests(conn) == FAILURE)
+			{
+				return FAILURE;
+			}
+			continue;
+		}
+
+		// the client closed its side, answer what was already received
+		if (bytes_read == 0)
+		{
+			pthread_mutex_lock(&conn->mutex);
+			conn->closing = true;
+			pthread_mutex_unlock(&conn->mutex);
+			break;
+		}
+
+		if (errno == EINTR)
+		{
+			continue;
+		}
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			break;
+		}
+
+		server_log->write_to_log(sys_call_error("read"));
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * Register a new connection to a reactor.
+ */
+void add_connection(Reactor* reactor, int fd)
+{
+	Connection* conn = new Connection;
+	conn->fd = fd;
+	conn->epoll_fd = reactor->epoll_fd;
+	conn->state = AWAITING_HEADER;
+	conn->first_request = true;
+	pthread_mutex_init(&conn->mutex, NULL);
+	conn->scheduled = false;
+	conn->closing = false;
+	conn->broken = false;
+	conn->closed = false;
+	conn->read_paused = false;
+	conn->out_offset = 0;
+	conn->last_active = time(NULL);
+	conn->awaiting_commit = 0;
+	conn->commit_lsn = 0;
+	conn->subscribed = false;
+	conn->refs = 1;
+
+	pthread_mutex_lock(&reactor->connections_mutex);
+	reactor->connections.insert(conn);
+	pthread_mutex_unlock(&reactor->connections_mutex);
+
+	// edge triggered: the reactor reads and writes until it would block
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = conn;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < SUCCESS)
+	{
+		server_log->write_to_log(sys_call_error("epoll_ctl"));
+
+		pthread_mutex_lock(&reactor->connections_mutex);
+		reactor->connections.erase(conn);
+		pthread_mutex_unlock(&reactor->connections_mutex);
+
+		release_connection(conn);
+	}
+}
+
+/**
+ * Close a connection. Its resources are released once no worker uses it.
+ */
+void close_connection(Reactor* reactor, Connection* conn)
+{
+	pthread_mutex_lock(&conn->mutex);
+	conn->closed = true;
+	conn->requests.clear();
+	pthread_mutex_unlock(&conn->mutex);
+
+	unsubscribe(conn);
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+	pthread_mutex_lock(&reactor->connections_mutex);
+	reactor->connections.erase(conn);
+	pthread_mutex_unlock(&reactor->connections_mutex);
+
+	release_connection(conn);
+}
+
+/**
+ * Serve a connection which the reactor reported as ready.
+ */
+void serve_connection(Reactor* reactor, Connection* conn, uint32_t events,
+                      char* chunk)
+{
+	bool is_broken = (events & EPOLLERR) != 0;
+	bool to_continue = false;
+
+	do
+	{
+		is_broken = is_broken || handle_readable(conn, chunk) == FAILURE;
+
+		pthread_mutex_lock(&conn->mutex);
+		is_broken = is_broken || conn->broken ||
+		            flush_connection(conn) == FAILURE;
+		to_continue = conn->read_paused && !is_backlogged(conn);
+		pthread_mutex_unlock(&conn->mutex);
+	}
+	while (!is_broken && to_continue);
+
+	pthread_mutex_lock(&conn->mutex);
+	conn->last_active = time(NULL);
+	bool is_done = conn->closing && !conn->scheduled &&
+	               conn->awaiting_commit == 0 && conn->out_buffer.empty();
+	pthread_mutex_unlock(&conn->mutex);
+
+	if (is_broken || is_done)
+	{
+		close_connection(reactor, conn);
+	}
+}
+
+/**
+ * Close the connections of a reactor which were idle for too long. A
+ * connection whose requests are being executed is not idle, and neither is a
+ * subscriber, which waits for pushes.
+ */
+void close_idle_connections(Reactor* reactor, time_t now)
+{
+	vector<Connection*> idle_connections;
+
+	pthread_mutex_lock(&reactor->connections_mutex);
+	for (auto const& conn: reactor->connections)
+	{
+		pthread_mutex_lock(&conn->mutex);
+		if (!conn->scheduled && conn->awaiting_commit == 0 &&
+		    !conn->subscribed && now - conn->last_active >= idle_timeout)
+		{
+			idle_connections.push_back(conn);
+		}
+		pthread_mutex_unlock(&conn->mutex);
+	}
+	pthread_mutex_unlock(&reactor->connections_mutex);
+
+	for (auto const& conn: idle_connections)
+	{
+		close_connection(reactor, conn);
+	}
+}
+
+/**
+ * This function drives the connections of a single reactor: it waits for
+ * them to become ready, reads their requests and hands them to the workers,
+ * and writes replies, without ever blocking on a single connection.
+ */
+void * reactor_thread_func(void * args)
+{
+	Reactor* reactor = (Reactor*) args;
+	struct epoll_event ready[MAX_EPOLL_EVENTS];
+	vector<char> chunk(READ_CHUNK_SIZE);
+	time_t last_sweep = time(NULL);
+	trace_name_thread(REACTOR_THREAD_NAME);
+
+	threads_num_mutex.lock(__func__);
+	threads_num++;
+	threads_num_mutex.unlock();
+
+	while (!toExit)
+	{
+		int ready_num = epoll_wait(reactor->epoll_fd, ready, MAX_EPOLL_EVENTS,
+		                           REACTOR_TICK_MS);
+		if (ready_num == FAILURE && errno != EINTR)
+		{
+			server_log->write_to_log(sys_call_error("epoll_wait"));
+			break;
+		}
+
+		for (int i = 0; i < ready_num; i++)
+		{
+			serve_connection(reactor, (Connection*) ready[i].data.ptr,
+			                 ready[i].events, chunk.data());
+		}
+
+		time_t now = time(NULL);
+		if (now != last_sweep)
+		{
+			close_idle_connections(reactor, now);
+			last_sweep = now;
+		}
+	}
+
+	threads_num_mutex.lock(__func__);
+	threads_num--;
+	threads_num_mutex.unlock();
+
+	pthread_exit(SUCCESS);
+}
+
+/**
+ * This function listens to the opened socket, and hands every new connection
+ * to a reactor, in turns.
+ */
+void * clients_thread_func(void * /*args*/)
+{
+	trace_name_thread(ACCEPT_THREAD_NAME);
+	threads_num_mutex.lock(__func__);
+	threads_num++;
+	threads_num_mutex.unlock();
+
+	int epoll_fd = epoll_create1(0);
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = nullptr;
+	if (epoll_fd == FAILURE ||
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_sock, &event) < SUCCESS)
+	{
+		free_allocated_memory();
+		exit_write_close(server_log, sys_call_error("epoll_ctl"), ERROR);
+	}
+
+	int next_reactor = 0;
+	while (!toExit)
+	{
+		if (epoll_wait(epoll_fd, &event, 1, REACTOR_TICK_MS) <= 0)
+		{
+			continue;
+		}
+
+		// accept every pending connection; accepting one and handing it to
+		// its reactor is traced as a request is
+		while (true)
+		{
+			TracedRequest traced(trace_sample());
+			TraceScope accepting(TRACE_ACCEPT_SPAN);
+			int current_connection = get_ready_connection(server_sock);
+			if (current_connection == FAILURE)
+			{
+				break;
+			}
+			add_connection(&reactors[next_reactor], current_connection);
+			next_reactor = (next_reactor + 1) % reactors_num;
+		}
+	}
+
+	close(epoll_fd);
+
+	threads_num_mutex.lock(__func__);
+	threads_num--;
+	threads_num_mutex.unlock();
+
+	pthread_exit(SUCCESS);
+}
+
+/**
+ * Create the reactors and their threads.
+ */
+int start_reactors()
+{
+	reactors = new Reactor[reactors_num];
+
+	for (int i = 0; i < reactors_num; i++)
+	{
+		pthread_mutex_init(&reactors[i].connections_mutex, NULL);
+		reactors[i].epoll_fd = epoll_create1(0);
+		if (reactors[i].epoll_fd == FAILURE)
+		{
+			server_log->write_to_log(sys_call_error("epoll_create1"));
+			return FAILURE;
+		}
+
+		if (pthread_create(&reactors[i].thread, NULL, reactor_thread_func,
+		                   &reactors[i]) != SUCCESS)
+		{
+			server_log->write_to_log(sys_call_error("pthread_create"));
+			return FAILURE;
+		}
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * Wait for the reactors to stop, let the workers finish their tasks, and close
+ * the connections left.
+ */
+void stop_reactors()
+{
+	for (int i = 0; i < reactors_num; i++)
+	{
+		pthread_join(reactors[i].thread, nullptr);
+	}
+
+	worker_pool->stop();
+
+	for (int i = 0; i < reactors_num; i++)
+	{
+		vector<Connection*> connections(reactors[i].connections.begin(),
+		                                reactors[i].connections.end());
+		for (auto const& conn: connections)
+		{
+			close_connection(&reactors[i], conn);
+		}
+
+		close(reactors[i].epoll_fd);
+		pthread_mutex_destroy(&reactors[i].connections_mutex);
+	}
+
+	delete[] reactors;
+	reactors = nullptr;
+}
+
+/**
+ * Describe the counters of the worker pool.
+ */
+string worker_pool_stats_text()
+{
+	WorkerPoolStats stats = worker_pool->get_stats();
+	uint64_t average_wait_ns = stats.executed == 0 ? 0 :
+	                           stats.total_wait_ns / stats.executed;
+
+	return "worker pool: workers " + to_string(stats.workers_num) +
+	       ", queue depth " + to_string(stats.queue_depth) + "/" +
+	       to_string(stats.queue_capacity) + " (max " +
+	       to_string(stats.max_queue_depth) + "), submitted " +
+	       to_string(stats.submitted) + ", rejected " +
+	       to_string(stats.rejected) + ", wait avg " +
+	       to_string(average_wait_ns / NS_IN_US) + "us max " +
+	       to_string(stats.max_wait_ns / NS_IN_US) + "us.\n";
+}
+
+/**
+ * Describe the counters of the write-ahead log's commits.
+ */
+string wal_stats_text()
+{
+	WalStats stats = wal->get_stats();
+	uint64_t average_batch = stats.commits == 0 ? 0 :
+	                         stats.committed_records / stats.commits;
+	uint64_t average_commit_ns = stats.commits == 0 ? 0 :
+	                             stats.total_commit_ns / stats.commits;
+
+	return "write-ahead log: commits " + to_string(stats.commits) +
+	       " (failed " + to_string(stats.failed_commits) + "), records " +
+	       to_string(stats.committed_records) + ", batch avg " +
+	       to_string(average_batch) + " max " +
+	       to_string(stats.max_batch_records) + ", commit avg " +
+	       to_string(average_commit_ns / NS_IN_US) + "us max " +
+	       to_string(stats.max_commit_ns / NS_IN_US) + "us.\n";
+}
+
+/**
+ * Write the stats to stats_file. The file is replaced at once, so a reader
+ * never sees a partial dump.
+ */
+int dump_stats()
+{
+	string temp_path = stats_file + STATS_TEMP_SUFFIX;
+	ofstream out(temp_path, ios::trunc);
+	out << stats_json() << endl;
+	out.close();
+
+	if (!out || rename(temp_path.c_str(), stats_file.c_str()) != SUCCESS)
+	{
+		server_log->write_to_log("ERROR\tdump_stats\tcannot write the stats "
+		                         "to " + stats_file + ".\n");
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/**
+ * Write the spans of the traced requests to trace_file, for Perfetto (or
+ * chrome://tracing) to open.
+ */
+int export_trace()
+{
+	if (write_trace(trace_file) == FAILURE)
+	{
+		server_log->write_to_log("ERROR\texport_trace\tcannot write the "
+		                         "trace to " + trace_file + ".\n");
+		return FAILURE;
+	}
+	cout << "trace written to " << trace_file << endl;
+	return SUCCESS;
+}
+
+/**
+ * The stats thread: dump the stats every stats_interval seconds, and once
+ * more when the server exits.
+ */
+void* stats_thread_func(void*)
+{
+	time_t last_dump = time(nullptr);
+
+	while (!toExit)
+	{
+		sleep(STATS_TICK_SECONDS);
+
+		if (time(nullptr) - last_dump >= stats_interval)
+		{
+			dump_stats();
+			last_dump = time(nullptr);
+		}
+	}
+
+	dump_stats();
+	return nullptr;
+}
+
+/**
+ * This function listens to the stdin and signals to the server to shut down
+ * when "exit" is typed.
+ */
+void * stdin_thread_func(void * /*args*/)
+{
+    // loop until exit is entered
+    while (!toExit)
+	{
+		// get user input
+		string user_input;
+		getline(cin, user_input);
+
+		if ((strcasecmp(user_input.c_str(), EXIT_TEXT) == EQUAL))
+		{
+            toExit = true;
+        }
+		else if ((strcasecmp(user_input.c_str(), STATS_TEXT) == EQUAL))
+		{
+			string stats = worker_pool_stats_text();
+			if (wal != nullptr)
+			{
+				stats += wal_stats_text();
+			}
+			cout << stats;
+			server_log->write_to_log(stats);
+		}
+		else if ((strcasecmp(user_input.c_str(), TRACE_TEXT) == EQUAL) &&
+		         !trace_file.empty())
+		{
+			export_trace();
+		}
+		else if ((strcasecmp(user_input.c_str(), LOCKS_TEXT) == EQUAL) &&
+		         lock_profile)
+		{
+			string locks = lock_profile_json() + "\n";
+			cout << locks;
+			server_log->write_to_log(locks);
+		}
+    }
+
+	pthread_exit(SUCCESS);
+}
+
+//==============================================================================
+//================================= MAIN =======================================
+//==============================================================================
+// emBench links the server's functions, without its main
+#ifndef EM_BENCH
+
+int main(int argc , char *argv[])
+{
+	// Check usage
+	if (argc < SERVER_ARG_NUM)
+	{
+		cout << SERVER_USAGE << endl;
+		exit(SUCCESS);
+	}
+
+	// Parse options
+	for (int i = SERVER_FIRST_OPTION_ARG; i < argc; i++)
+	{
+		string key, value;
+		bool valid = parse_option(argv[i], key, value);
+		int number = 0;
+		bool is_number = valid && parse_int_option(value, number);
+
+		if (valid && key == LEGACY_OPTION && (value == "on" || value == "off"))
+		{
+			accept_legacy = (value == "on");
+		}
+		else if (is_number && key == IDLE_TIMEOUT_OPTION && number > 0)
+		{
+			idle_timeout = number;
+		}
+		else if (is_number && key == REACTORS_OPTION && number > 0)
+		{
+			reactors_num = number;
+		}
+		else if (is_number && key == BACKLOG_OPTION && number > 0)
+		{
+			pending_connections = number;
+		}
+		else if (is_number && key == WORKERS_OPTION && number > 0)
+		{
+			workers_num = number;
+		}
+		else if (is_number && key == QUEUE_OPTION && number > 0)
+		{
+			work_queue_capacity = number;
+		}
+		else if (is_number && key == TOP_N_CAP_OPTION && number > 0 &&
+		         number <= MAX_TOP_N_CAP)
+		{
+			top_n_cap = number;
+		}
+		else if (valid && key == DATA_DIR_OPTION && !value.empty())
+		{
+			data_dir = value;
+		}
+		else if (is_number && key == SNAPSHOT_INTERVAL_OPTION && number > 0)
+		{
+			snapshot_interval = number;
+		}
+		else if (valid && key == DURABILITY_OPTION &&
+		         (value == DURABILITY_NONE_TEXT ||
+		          value == DURABILITY_BATCHED_TEXT ||
+		          value == DURABILITY_STRICT_TEXT))
+		{
+			durability = (value == DURABILITY_BATCHED_TEXT) ?
+			             DURABILITY_BATCHED :
+			             (value == DURABILITY_STRICT_TEXT) ? DURABILITY_STRICT :
+			                                                DURABILITY_NONE;
+		}
+		else if (is_number && key == COMMIT_DELAY_OPTION && number >= 0)
+		{
+			commit_delay = number;
+		}
+		else if (valid && key == LOG_OPTION &&
+		         (value == LOG_SYNC || value == LOG_ASYNC))
+		{
+			async_log = (value == LOG_ASYNC);
+		}
+		else if (is_number && key == LOG_BUFFER_OPTION && number > 0)
+		{
+			log_buffer = number;
+		}
+		else if (valid && key == STATS_FILE_OPTION && !value.empty())
+		{
+			stats_file = value;
+		}
+		else if (is_number && key == STATS_INTERVAL_OPTION && number > 0)
+		{
+			stats_interval = number;
+		}
+		else if (valid && key == TRACE_FILE_OPTION && !value.empty())
+		{
+			trace_file = value;
+		}
+		else if (is_number && key == TRACE_SAMPLE_OPTION && number > 0)
+		{
+			trace_sample_every = number;
+		}
+		else if (valid && key == LOCK_PROFILE_OPTION &&
+		         (value == "on" || value == "off"))
+		{
+			lock_profile = (value == "on");
+		}
+		else if (valid && key == LOG_FULL_OPTION &&
+		         (value == LOG_FULL_DROP_TEXT || value == LOG_FULL_BLOCK_TEXT))
+		{
+			log_full_policy = (value == LOG_FULL_DROP_TEXT) ? LOG_FULL_DROP :
+			                                                 LOG_FULL_BLOCK;
+		}
+		else
+		{
+			cout << SERVER_USAGE << endl;
+			exit(SUCCESS);
+		}
+	}
+
+	// By default, a reactor and a worker per core
+	int cores_num = max((int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+	if (reactors_num == 0)
+	{
+		reactors_num = cores_num;
+	}
+	if (workers_num == 0)
+	{
+		workers_num = cores_num;
+	}
+
+	// Create log file
+	server_log = new(nothrow) Log(SERVER_LOG_FILE, server_log_mutex);
+	if (server_log == nullptr)
+	{
+		exit_write_close(server_log, sys_call_error("new"), ERROR);
+	}
+
+	// Open log file
+	if (server_log->open_log_file() == FAILURE)
+	{
+		delete server_log;
+		exit(ERROR);
+	}
+
+	if (async_log && server_log->start_async(log_buffer, log_full_policy) ==
+	                 FAILURE)
+	{
+		exit_write_close(server_log, sys_call_error("start_async"), ERROR);
+	}
+
+	init_store();
+	if (!trace_file.empty())
+	{
+		start_tracing((uint32_t) trace_sample_every);
+	}
+	if (lock_profile)
+	{
+		start_lock_profiling();
+	}
+
+	// Rebuild the store persisted by the previous runs
+	if (!data_dir.empty())
+	{
+		wal = new WriteAheadLog(data_dir, durability, commit_delay,
+		                        on_wal_commit);
+		if (recover_store() == FAILURE)
+		{
+			exit_write_close(server_log, "ERROR\tmain\tcannot recover the "
+			                 "store from " + data_dir + ".\n", ERROR);
+		}
+	}
+
+	// Create indexer thread - this thread will index the loaded snapshot
+	if (loaded_snapshot != nullptr &&
+	    pthread_create(&indexer_thread, NULL, indexer_thread_func,
+	                   NULL) != SUCCESS)
+	{
+		exit_write_close(server_log, \
+		                 sys_call_error("pthread_create") ,ERROR);
+	}
+
+	// a client which goes away must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	// init sockaddr_in
+	struct sockaddr_in server = init_sockaddr(atoi(argv[SERVER_ARG_PORT]),
+											  INADDR_ANY);
+	// Establish connection
+	server_sock = establish_connection(server);
+	if (server_sock == FAILURE)
+	{
+		delete server_log;
+		exit(ERROR);
+	}
+
+	// Create the workers - they will execute the requests
+	worker_pool = new WorkerPool(workers_num, work_queue_capacity);
+	if (worker_pool->start() == FAILURE)
+	{
+		free_allocated_memory();
+		exit_write_close(server_log, sys_call_error("pthread_create"), ERROR);
+	}
+
+	// Create stdin thread - this tread will listen to the stdin for "ERROR" txt
+	// (and STATS, which reads the workers' stats, so it starts after them)
+	if (pthread_create(&stdin_thread, NULL, stdin_thread_func, NULL) != SUCCESS)
+	{
+		exit_write_close(server_log, \
+		                 sys_call_error("pthread_create"), ERROR);
+	}
+
+	// Create the reactors - they will serve the connections
+	if (start_reactors() == FAILURE)
+	{
+		free_allocated_memory();
+		exit_write_close(server_log, "ERROR\tmain\tcannot start the "
+		                 "reactors.\n", ERROR);
+	}
+
+	// Create snapshot thread - this thread will take the snapshots
+	if (wal != nullptr && pthread_create(&snapshot_thread, NULL,
+	                                     snapshot_thread_func, NULL) != SUCCESS)
+	{
+		exit_write_close(server_log, \
+		                 sys_call_error("pthread_create") ,ERROR);
+	}
+
+	// Create notifier thread - this thread will push new events to subscribers
+	if (pthread_create(&notifier_thread, NULL, notifier_thread_func,
+	                   NULL) != SUCCESS)
+	{
+		exit_write_close(server_log, \
+		                 sys_call_error("pthread_create") ,ERROR);
+	}
+
+	// Create stats thread - this thread will dump the stats
+	if (!stats_file.empty() && pthread_create(&stats_thread, NULL,
+	                                          stats_thread_func,
+	                                          NULL) != SUCCESS)
+	{
+		exit_write_close(server_log, \
+		                 sys_call_error("pthread_create") ,ERROR);
+	}
+
+	// Create clients thread - this tread will listen to opened sockets
+	if (pthread_create(&clients_thread, NULL, \
+	                   clients_thread_func, NULL) != SUCCESS)
+	{
+		exit_write_close(server_log, \
+		                 sys_call_error("pthread_create") ,ERROR);
+	}
+
+	// wait for exit input from user
+	int ret_join = pthread_join(stdin_thread, nullptr);
+	if (ret_join != SUCCESS)
+	{
+		free_allocated_memory();
+		exit_write_close(server_log, \
+		                 sys_call_error("pthread_join"), ERROR);
+	}
+
+	server_log->write_to_log("EXIT command is typed: server is shutdown.\n");
+
+	// the clients thread, the notifier, the stats thread and the reactors
+	// stop within a tick
+	pthread_join(clients_thread, nullptr);
+	pthread_join(notifier_thread, nullptr);
+	if (!stats_file.empty())
+	{
+		pthread_join(stats_thread, nullptr);
+	}
+	stop_reactors();
+	server_log->write_to_log(worker_pool_stats_text());
+	delete worker_pool;
+
+	// the snapshot is unmapped once it is indexed
+	if (loaded_snapshot != nullptr)
+	{
+		pthread_join(indexer_thread, nullptr);
+	}
+
+	// the replies still awaiting commit are dropped with their connections
+	if (wal != nullptr)
+	{
+		pthread_join(snapshot_thread, nullptr);
+		server_log->write_to_log(wal_stats_text());
+		delete wal;
+	}
+
+	if (!trace_file.empty())
+	{
+		export_trace();
+	}
+	if (lock_profile)
+	{
+		server_log->write_to_log(lock_profile_json() + "\n");
+	}
+	server_log->close_log_file();
+
+	free_allocated_memory();
+	free_trace_buffers();
+	free_lock_profiles();
+	delete metrics;
+	close(server_sock);
+	delete server_log;
+
+	return SUCCESS;
+}
+
+#endif //EM_BENCH